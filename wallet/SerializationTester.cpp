@@ -303,15 +303,17 @@ void RunCrossPlatformSerializationTests()
     }
 
     CTxInUndo cTxInUndo;
-    cTxInUndo.txout     = cTxOut;
-    cTxInUndo.fCoinBase = 0;
-    cTxInUndo.nHeight   = 0x12345678;
-    cTxInUndo.nVersion  = 0x12345678;
+    cTxInUndo.txout      = cTxOut;
+    cTxInUndo.fCoinBase  = 0;
+    cTxInUndo.nHeight    = 0x12345678;
+    cTxInUndo.nVersion   = 0x12345678;
+    cTxInUndo.fCoinStake = 1;
+    cTxInUndo.nTime      = 0x12345678;
     {
         CDataStream ss(SER_DISK, 0);
         ss << cTxInUndo;
         TEST_EQUALITY(boost::algorithm::hex(ss.str()),
-                      "81A2A1D8708090D0AB7880A2EAC1C689EFC08E210C616263646566", __LINE__);
+                      "81A2A1D8708090D0AB78018090D0AB7880A2EAC1C689EFC08E210C616263646566", __LINE__);
     }
 
     CTxUndo cTxUndo;
@@ -320,7 +322,7 @@ void RunCrossPlatformSerializationTests()
         CDataStream ss(SER_DISK, 0);
         ss << cTxUndo;
         TEST_EQUALITY(boost::algorithm::hex(ss.str()),
-                      "0181A2A1D8708090D0AB7880A2EAC1C689EFC08E210C616263646566", __LINE__);
+                      "0181A2A1D8708090D0AB78018090D0AB7880A2EAC1C689EFC08E210C616263646566", __LINE__);
     }
 
     CMerkleTx cMerkleTx     = cTransaction;
@@ -0,0 +1,206 @@
+#include "addrindex.h"
+
+#include "block.h"
+#include "blockindex.h"
+#include "coins.h"
+#include "main.h"
+#include "net.h"
+#include "ntp1/ntp1transaction.h"
+#include "txdb.h"
+#include "util.h"
+
+boost::atomic<bool> fAddrIndex(false);
+boost::atomic<bool> fAddrIndexSynced(false);
+boost::atomic<int>  nAddrIndexHeight(-1);
+
+namespace {
+// the background build has no undo data, so the spent outputs are read from the transaction index
+bool ConnectBlockAddrIndexBuild(CTxDB& txdb, const CBlock& block, int nHeight)
+{
+    return ConnectBlockAddrIndex(txdb, block, nHeight, nullptr);
+}
+} // namespace
+
+CIndexBuild addrIndexBuild("address index", "addrindex", THREAD_ADDRINDEX, &CTxDB::ReadAddrIndexHeight,
+                           &CTxDB::WriteAddrIndexHeight, &CTxDB::EraseAddrIndex,
+                           &ConnectBlockAddrIndexBuild, fAddrIndex, fAddrIndexSynced, nAddrIndexHeight);
+
+namespace {
+std::vector<CAddrIndexToken> GetOutputTokens(const NTP1Transaction& ntp1tx, unsigned int n)
+{
+    std::vector<CAddrIndexToken> vTokens;
+    if (n >= ntp1tx.getTxOutCount())
+        return vTokens;
+    const NTP1TxOut& ntp1txout = ntp1tx.getTxOut(n);
+    for (unsigned long i = 0; i < ntp1txout.tokenCount(); i++)
+        vTokens.push_back(
+            CAddrIndexToken(ntp1txout.getToken(i).getTokenId(), ntp1txout.getToken(i).getAmount()));
+    return vTokens;
+}
+
+/** Moves an output of an address from its unspent outputs to its history */
+bool IndexSpend(CTxDB& txdb, const CTxIn& txin, const CTxOut& txoutPrev, uint32_t nHeight,
+                const uint256& txid, uint32_t nIn)
+{
+    uint160 scriptHash;
+    if (!GetAddrIndexScriptHash(txoutPrev.scriptPubKey, scriptHash))
+        return true;
+
+    const CAddrIndexUtxoKey utxoKey(scriptHash, txin.prevout.hash, txin.prevout.n);
+    CAddrIndexDelta         delta;
+    delta.nValue = -txoutPrev.nValue;
+    CAddrIndexUtxo utxo;
+    if (txdb.ReadAddrIndexUtxo(utxoKey, utxo)) {
+        delta.nPrevHeight = utxo.nHeight;
+        delta.vTokens     = utxo.vTokens;
+        if (!txdb.EraseAddrIndexUtxo(utxoKey))
+            return error("IndexSpend() : failed to erase the unspent output %s:%u",
+                         txin.prevout.hash.ToString().c_str(), txin.prevout.n);
+    }
+    return txdb.WriteAddrIndexDelta(CAddrIndexKey(scriptHash, nHeight, txid, nIn, true), delta);
+}
+
+/** Moves a spent output of an address from its history back to its unspent outputs */
+bool UnindexSpend(CTxDB& txdb, const CTxIn& txin, const CTxOut& txoutPrev, uint32_t nHeight,
+                  const uint256& txid, uint32_t nIn)
+{
+    uint160 scriptHash;
+    if (!GetAddrIndexScriptHash(txoutPrev.scriptPubKey, scriptHash))
+        return true;
+
+    const CAddrIndexKey key(scriptHash, nHeight, txid, nIn, true);
+    CAddrIndexDelta     delta;
+    if (!txdb.ReadAddrIndexDelta(key, delta))
+        return error("UnindexSpend() : the spend of %s:%u isn't in the address index",
+                     txin.prevout.hash.ToString().c_str(), txin.prevout.n);
+
+    CAddrIndexUtxo utxo;
+    utxo.nValue       = txoutPrev.nValue;
+    utxo.nHeight      = delta.nPrevHeight;
+    utxo.scriptPubKey = txoutPrev.scriptPubKey;
+    utxo.vTokens      = delta.vTokens;
+    return txdb.WriteAddrIndexUtxo(CAddrIndexUtxoKey(scriptHash, txin.prevout.hash, txin.prevout.n),
+                                   utxo) &&
+           txdb.EraseAddrIndexDelta(key);
+}
+} // namespace
+
+uint160 GetAddrIndexScriptHash(const CTxDestination& dest)
+{
+    return Hash160(GetScriptForDestination(dest));
+}
+
+bool GetAddrIndexScriptHash(const CScript& scriptPubKey, uint160& scriptHash)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(scriptPubKey, dest))
+        return false;
+    scriptHash = GetAddrIndexScriptHash(dest);
+    return true;
+}
+
+bool ConnectBlockAddrIndex(CTxDB& txdb, const CBlock& block, int nHeight, const CBlockUndo* pundo)
+{
+    int nIndexHeight = -1;
+    if (!txdb.ReadAddrIndexHeight(nIndexHeight))
+        return error("ConnectBlockAddrIndex() : failed to read the height of the address index");
+    // the background build gets to the block later
+    if (nIndexHeight != nHeight - 1)
+        return true;
+
+    if (pundo && pundo->vtxundo.size() + 1 != block.vtx.size())
+        return error("ConnectBlockAddrIndex() : block %s and its undo data are inconsistent",
+                     block.GetHash().ToString().c_str());
+
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx   = block.vtx[i];
+        const uint256       txid = tx.GetHash();
+
+        if (!tx.IsCoinBase()) {
+            if (pundo && pundo->vtxundo[i - 1].vprevout.size() != tx.vin.size())
+                return error("ConnectBlockAddrIndex() : the undo data of %s is inconsistent",
+                             txid.ToString().c_str());
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                const COutPoint& prevout = tx.vin[j].prevout;
+                CTxOut           txoutPrev;
+                if (pundo) {
+                    txoutPrev = pundo->vtxundo[i - 1].vprevout[j].txout;
+                } else {
+                    CTransaction txPrev;
+                    if (!txdb.ReadDiskTx(prevout.hash, txPrev) || prevout.n >= txPrev.vout.size())
+                        return error("ConnectBlockAddrIndex() : failed to read the input %s:%u",
+                                     prevout.hash.ToString().c_str(), prevout.n);
+                    txoutPrev = txPrev.vout[prevout.n];
+                }
+                if (!IndexSpend(txdb, tx.vin[j], txoutPrev, nHeight, txid, j))
+                    return false;
+            }
+        }
+
+        NTP1Transaction ntp1tx;
+        const bool      fNTP1 = NTP1Transaction::IsTxNTP1(&tx) && txdb.ReadNTP1Tx(txid, ntp1tx);
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            uint160 scriptHash;
+            if (!GetAddrIndexScriptHash(tx.vout[j].scriptPubKey, scriptHash))
+                continue;
+
+            CAddrIndexDelta delta;
+            delta.nValue = tx.vout[j].nValue;
+            if (fNTP1)
+                delta.vTokens = GetOutputTokens(ntp1tx, j);
+            CAddrIndexUtxo utxo;
+            utxo.nValue       = delta.nValue;
+            utxo.nHeight      = nHeight;
+            utxo.scriptPubKey = tx.vout[j].scriptPubKey;
+            utxo.vTokens      = delta.vTokens;
+            if (!txdb.WriteAddrIndexDelta(CAddrIndexKey(scriptHash, nHeight, txid, j, false), delta) ||
+                !txdb.WriteAddrIndexUtxo(CAddrIndexUtxoKey(scriptHash, txid, j), utxo))
+                return error("ConnectBlockAddrIndex() : failed to index the output %s:%u",
+                             txid.ToString().c_str(), j);
+        }
+    }
+    return txdb.WriteAddrIndexHeight(nHeight);
+}
+
+bool DisconnectBlockAddrIndex(CTxDB& txdb, const CBlock& block, int nHeight,
+                              const CBlockUndo& blockundo)
+{
+    int nIndexHeight = -1;
+    if (!txdb.ReadAddrIndexHeight(nIndexHeight))
+        return error("DisconnectBlockAddrIndex() : failed to read the height of the address index");
+    if (nIndexHeight < nHeight)
+        return true;
+    if (nIndexHeight > nHeight)
+        return error("DisconnectBlockAddrIndex() : block %s isn't at the top of the address index",
+                     block.GetHash().ToString().c_str());
+
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return error("DisconnectBlockAddrIndex() : block %s and its undo data are inconsistent",
+                     block.GetHash().ToString().c_str());
+
+    for (int i = block.vtx.size() - 1; i >= 0; i--) {
+        const CTransaction& tx   = block.vtx[i];
+        const uint256       txid = tx.GetHash();
+
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            uint160 scriptHash;
+            if (!GetAddrIndexScriptHash(tx.vout[j].scriptPubKey, scriptHash))
+                continue;
+            if (!txdb.EraseAddrIndexUtxo(CAddrIndexUtxoKey(scriptHash, txid, j)) ||
+                !txdb.EraseAddrIndexDelta(CAddrIndexKey(scriptHash, nHeight, txid, j, false)))
+                return error("DisconnectBlockAddrIndex() : failed to erase the output %s:%u",
+                             txid.ToString().c_str(), j);
+        }
+
+        if (tx.IsCoinBase())
+            continue;
+        const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+        if (txundo.vprevout.size() != tx.vin.size())
+            return error("DisconnectBlockAddrIndex() : the undo data of %s is inconsistent",
+                         txid.ToString().c_str());
+        for (int j = tx.vin.size() - 1; j >= 0; j--)
+            if (!UnindexSpend(txdb, tx.vin[j], txundo.vprevout[j].txout, nHeight, txid, j))
+                return false;
+    }
+    return txdb.WriteAddrIndexHeight(nHeight - 1);
+}
@@ -0,0 +1,165 @@
+#ifndef ADDRINDEX_H
+#define ADDRINDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+
+#include "indexbuild.h"
+#include "ntp1/ntp1script.h"
+#include "script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+class CBlock;
+class CBlockUndo;
+class CTxDB;
+
+/** -addrindex */
+extern boost::atomic<bool> fAddrIndex;
+
+/** Whether the address index has caught up with the main chain, after which it's kept up to date by
+ * ConnectBlock() and DisconnectBlock() */
+extern boost::atomic<bool> fAddrIndexSynced;
+
+/** How far the background build of the address index got: the main chain is indexed up to this
+ * height, or -1 if nothing is */
+extern boost::atomic<int> nAddrIndexHeight;
+
+/** The background build of the address index (see InitIndexBuild()) */
+extern CIndexBuild addrIndexBuild;
+
+/** Serializes a number with its most significant byte first, so that the keys it's in sort by it */
+class CBigEndian32
+{
+    uint32_t& n;
+
+public:
+    explicit CBigEndian32(uint32_t& nIn) : n(nIn) {}
+
+    unsigned int GetSerializeSize(int /*nType*/, int /*nVersion*/) const { return 4; }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int /*nType*/, int /*nVersion*/) const
+    {
+        const unsigned char vch[4] = {static_cast<unsigned char>(n >> 24),
+                                      static_cast<unsigned char>(n >> 16),
+                                      static_cast<unsigned char>(n >> 8), static_cast<unsigned char>(n)};
+        s.write((const char*)vch, sizeof(vch));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int /*nType*/, int /*nVersion*/)
+    {
+        unsigned char vch[4];
+        s.read((char*)vch, sizeof(vch));
+        n = (uint32_t(vch[0]) << 24) | (uint32_t(vch[1]) << 16) | (uint32_t(vch[2]) << 8) | vch[3];
+    }
+};
+
+#define BIGENDIAN32(obj) REF(CBigEndian32(REF(obj)))
+
+/** An amount of an NTP1 token in an output */
+struct CAddrIndexToken
+{
+    std::string tokenId;
+    NTP1Int     nAmount;
+
+    CAddrIndexToken() : nAmount(0) {}
+    CAddrIndexToken(const std::string& tokenIdIn, const NTP1Int& nAmountIn)
+        : tokenId(tokenIdIn), nAmount(nAmountIn)
+    {
+    }
+
+    IMPLEMENT_SERIALIZE(READWRITE(tokenId); READWRITE(nAmount);)
+};
+
+/**
+ * The key of an entry of the history of an address: an output paid to it, or one of its outputs that
+ * was spent, in which case n is the input that spent it. The entries of an address are in the order of
+ * their blocks.
+ */
+struct CAddrIndexKey
+{
+    uint160  scriptHash;
+    uint32_t nHeight;
+    uint256  txid;
+    uint32_t n;
+    bool     fSpend;
+
+    CAddrIndexKey() : nHeight(0), n(0), fSpend(false) {}
+    CAddrIndexKey(const uint160& scriptHashIn, uint32_t nHeightIn, const uint256& txidIn, uint32_t nIn,
+                  bool fSpendIn)
+        : scriptHash(scriptHashIn), nHeight(nHeightIn), txid(txidIn), n(nIn), fSpend(fSpendIn)
+    {
+    }
+
+    IMPLEMENT_SERIALIZE(READWRITE(scriptHash); READWRITE(BIGENDIAN32(nHeight)); READWRITE(txid);
+                        READWRITE(BIGENDIAN32(n)); READWRITE(fSpend);)
+};
+
+/** The amounts of an entry of the history; negative for a spend, which has the height of the output it
+ * spent as well */
+struct CAddrIndexDelta
+{
+    int64_t                      nValue;
+    uint32_t                     nPrevHeight;
+    std::vector<CAddrIndexToken> vTokens;
+
+    CAddrIndexDelta() : nValue(0), nPrevHeight(0) {}
+
+    IMPLEMENT_SERIALIZE(READWRITE(nValue); READWRITE(nPrevHeight); READWRITE(vTokens);)
+};
+
+/** The key of an unspent output of an address */
+struct CAddrIndexUtxoKey
+{
+    uint160  scriptHash;
+    uint256  txid;
+    uint32_t n;
+
+    CAddrIndexUtxoKey() : n(0) {}
+    CAddrIndexUtxoKey(const uint160& scriptHashIn, const uint256& txidIn, uint32_t nIn)
+        : scriptHash(scriptHashIn), txid(txidIn), n(nIn)
+    {
+    }
+
+    IMPLEMENT_SERIALIZE(READWRITE(scriptHash); READWRITE(txid); READWRITE(BIGENDIAN32(n));)
+};
+
+struct CAddrIndexUtxo
+{
+    int64_t                      nValue;
+    uint32_t                     nHeight;
+    CScript                      scriptPubKey;
+    std::vector<CAddrIndexToken> vTokens;
+
+    CAddrIndexUtxo() : nValue(0), nHeight(0) {}
+
+    IMPLEMENT_SERIALIZE(READWRITE(nValue); READWRITE(nHeight); READWRITE(scriptPubKey);
+                        READWRITE(vTokens);)
+};
+
+/** The hash the entries of an address are found with: Hash160 of the standard script that pays to it,
+ * so that pay-to-pubkey outputs are under the address of their key */
+uint160 GetAddrIndexScriptHash(const CTxDestination& dest);
+
+/** The hash of the address an output pays to; false if it doesn't pay to one */
+bool GetAddrIndexScriptHash(const CScript& scriptPubKey, uint160& scriptHash);
+
+/**
+ * Adds the outputs and the spends of a block of the main chain to the address index, and moves its
+ * height to the block's; does nothing unless the index is up to the block before, since the
+ * background build gets to the block otherwise (see ThreadIndexBuild()). The outputs spent are
+ * taken from the undo data of the block, or read from the transaction index if there's none
+ * (pundo == nullptr). The NTP1 transactions of the block have to be written already.
+ */
+bool ConnectBlockAddrIndex(CTxDB& txdb, const CBlock& block, int nHeight, const CBlockUndo* pundo);
+
+/** Takes the block out of the address index, if the index is up to it */
+bool DisconnectBlockAddrIndex(CTxDB& txdb, const CBlock& block, int nHeight,
+                              const CBlockUndo& blockundo);
+
+#endif // ADDRINDEX_H
@@ -9,6 +9,8 @@
 #include <string>
 #include <boost/thread/mutex.hpp>
 #include <map>
+#include <new>
+#include <vector>
 
 #ifdef WIN32
 #ifdef _WIN32_WINNT
@@ -251,6 +253,135 @@ struct zero_after_free_allocator : public std::allocator<T>
     }
 };
 
+/**
+ * Thread-safe pool of large buffers, for use by pooled_allocator.
+ *
+ * Freeing a large buffer usually gives its pages back to the system, so that the next buffer of the
+ * same size has to be mapped and faulted in again. Buffers of serialized blocks and network
+ * messages are allocated and freed all the time with about the same sizes, so instead they're
+ * kept here (up to a total of MAX_IDLE_SIZE bytes) and handed out again. Buffer sizes are rounded up
+ * to the next power of two, so that every buffer fits any request of its size class. Small buffers
+ * are left to the system allocator, which already does this.
+ *
+ * Buffers aren't cleared, neither when they're returned to the pool nor when they're handed out
+ * again, so this must not be used for private data.
+ */
+class BufferPool
+{
+    static const int MIN_CLASS_BITS = 16;
+    static const int MAX_CLASS_BITS = 26;
+    static const int CLASS_COUNT    = MAX_CLASS_BITS - MIN_CLASS_BITS + 1;
+
+public:
+    static const size_t MIN_POOLED_SIZE = size_t(1) << MIN_CLASS_BITS;
+    static const size_t MAX_POOLED_SIZE = size_t(1) << MAX_CLASS_BITS;
+    static const size_t MAX_IDLE_SIZE   = size_t(1) << 26;
+
+    /** Never destroyed, so that buffers can be freed at any time during shutdown */
+    static BufferPool& Instance()
+    {
+        static BufferPool* pool = new BufferPool;
+        return *pool;
+    }
+
+    void* Allocate(size_t size)
+    {
+        if (size < MIN_POOLED_SIZE || size > MAX_POOLED_SIZE)
+            return ::operator new(size);
+        const int nClass = SizeClass(size);
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            std::vector<void*>& vFree = vFreeBuffers[nClass];
+            if (!vFree.empty()) {
+                void* p = vFree.back();
+                vFree.pop_back();
+                nIdleSize -= ClassSize(nClass);
+                return p;
+            }
+        }
+        return ::operator new(ClassSize(nClass));
+    }
+
+    void Free(void* p, size_t size)
+    {
+        if (p == NULL)
+            return;
+        if (size < MIN_POOLED_SIZE || size > MAX_POOLED_SIZE) {
+            ::operator delete(p);
+            return;
+        }
+        const int nClass = SizeClass(size);
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            if (nIdleSize + ClassSize(nClass) <= MAX_IDLE_SIZE) {
+                vFreeBuffers[nClass].push_back(p);
+                nIdleSize += ClassSize(nClass);
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+
+    /** Total size of the buffers waiting to be reused */
+    size_t GetIdleSize()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return nIdleSize;
+    }
+
+private:
+    boost::mutex       mutex;
+    std::vector<void*> vFreeBuffers[CLASS_COUNT];
+    size_t             nIdleSize;
+
+    BufferPool() : nIdleSize(0) {}
+
+    static int SizeClass(size_t size)
+    {
+        int nClass = 0;
+        while (ClassSize(nClass) < size)
+            nClass++;
+        return nClass;
+    }
+
+    static size_t ClassSize(int nClass) { return size_t(1) << (MIN_CLASS_BITS + nClass); }
+};
+
+//
+// Allocator that reuses large buffers through BufferPool. Contents are neither
+// cleared nor locked, so this is only for public data.
+//
+template<typename T>
+struct pooled_allocator : public std::allocator<T>
+{
+    // MSVC8 default copy constructor is broken
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type  difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+    pooled_allocator() throw() {}
+    pooled_allocator(const pooled_allocator& a) throw() : base(a) {}
+    template <typename U>
+    pooled_allocator(const pooled_allocator<U>& a) throw() : base(a) {}
+    ~pooled_allocator() throw() {}
+    template<typename _Other> struct rebind
+    { typedef pooled_allocator<_Other> other; };
+
+    T* allocate(std::size_t n, const void* /*hint*/ = 0)
+    {
+        return static_cast<T*>(BufferPool::Instance().Allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        BufferPool::Instance().Free(p, sizeof(T) * n);
+    }
+};
+
 // This is exactly like std::string, but with a custom allocator.
 typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > SecureString;
 
@@ -137,8 +137,9 @@ vector<unsigned char> ParseHexO(const Object& o, string strKey)
 
 string CRPCTable::help(string strCommand) const
 {
-    string          strRet;
-    set<rpcfn_type> setDone;
+    string                strRet;
+    set<rpcfn_type>       setDone;
+    set<rpcstreamfn_type> setDoneStreamed;
     for (map<string, const CRPCCommand*>::const_iterator mi = mapCommands.begin();
          mi != mapCommands.end(); ++mi) {
         const CRPCCommand* pcmd      = mi->second;
@@ -149,10 +150,16 @@ string CRPCTable::help(string strCommand) const
         if (strCommand != "" && strMethod != strCommand)
             continue;
         try {
-            Array      params;
-            rpcfn_type pfn = pcmd->actor;
-            if (setDone.insert(pfn).second)
-                (*pfn)(params, true);
+            Array params;
+            if (pcmd->streamActor) {
+                CRPCValueWriter writer;
+                if (setDoneStreamed.insert(pcmd->streamActor).second)
+                    (*pcmd->streamActor)(params, true, writer);
+            } else {
+                rpcfn_type pfn = pcmd->actor;
+                if (setDone.insert(pfn).second)
+                    (*pfn)(params, true);
+            }
         } catch (std::exception& e) {
             // Help text is returned in an exception
             string strHelp = string(e.what());
@@ -198,8 +205,8 @@ Value stop(const Array& params, bool fHelp)
 
 // clang-format off
 static const CRPCCommand vRPCCommands[] =
-{ //  name                         function                    safemd  unlocked
-  //  ------------------------     -----------------------     ------  --------
+{ //  name                         function                    safemd  unlocked  streamed function
+  //  ------------------------     -----------------------     ------  --------  -----------------
     { "help",                      &help,                      true,   true },
     { "stop",                      &stop,                      true,   true },
     { "getbestblockhash",          &getbestblockhash,          true,   false },
@@ -207,6 +214,7 @@ static const CRPCCommand vRPCCommands[] =
     { "getconnectioncount",        &getconnectioncount,        true,   false },
     { "getpeerinfo",               &getpeerinfo,               true,   false },
     { "getdifficulty",             &getdifficulty,             true,   false },
+    { "getblockchaininfo",         &getblockchaininfo,         true,   false },
     { "getinfo",                   &getinfo,                   true,   false },
     { "getsubsidy",                &getsubsidy,                true,   false },
     { "getmininginfo",             &getmininginfo,             true,   false },
@@ -239,12 +247,12 @@ static const CRPCCommand vRPCCommands[] =
     { "sendmany",                  &sendmany,                  false,  false },
     { "addmultisigaddress",        &addmultisigaddress,        false,  false },
     { "addredeemscript",           &addredeemscript,           false,  false },
-    { "getrawmempool",             &getrawmempool,             true,   false },
-    { "getblock",                  &getblock,                  false,  false },
-    { "getblockbynumber",          &getblockbynumber,          false,  false },
+    { "getrawmempool",             NULL,                       true,   true,   &getrawmempool },
+    { "getblock",                  NULL,                       false,  true,   &getblock },
+    { "getblockbynumber",          NULL,                       false,  true,   &getblockbynumber },
     { "getblockhash",              &getblockhash,              false,  false },
     { "gettransaction",            &gettransaction,            false,  false },
-    { "listtransactions",          &listtransactions,          false,  false },
+    { "listtransactions",          NULL,                       false,  true,   &listtransactions },
     { "listaddressgroupings",      &listaddressgroupings,      false,  false },
     { "signmessage",               &signmessage,               false,  false },
     { "verifymessage",             &verifymessage,             false,  false },
@@ -254,12 +262,12 @@ static const CRPCCommand vRPCCommands[] =
     { "settxfee",                  &settxfee,                  false,  false },
     { "getblocktemplate",          &getblocktemplate,          true,   false },
     { "submitblock",               &submitblock,               false,  false },
-    { "listsinceblock",            &listsinceblock,            false,  false },
+    { "listsinceblock",            NULL,                       false,  true,   &listsinceblock },
     { "dumpprivkey",               &dumpprivkey,               false,  false },
     { "dumpwallet",                &dumpwallet,                true,   false },
-    { "importwallet",              &importwallet,              false,  false },
-    { "importprivkey",             &importprivkey,             false,  false },
-    { "listunspent",               &listunspent,               false,  false },
+    { "importwallet",              &importwallet,              false,  true },
+    { "importprivkey",             &importprivkey,             false,  true },
+    { "listunspent",               NULL,                       false,  true,   &listunspent },
     { "getrawtransaction",         &getrawtransaction,         false,  false },
     { "createrawtransaction",      &createrawtransaction,      false,  false },
     { "createrawntp1transaction",  &createrawntp1transaction,  false,  false },
@@ -268,6 +276,13 @@ static const CRPCCommand vRPCCommands[] =
     { "signrawtransaction",        &signrawtransaction,        false,  false },
     { "sendrawtransaction",        &sendrawtransaction,        false,  false },
     { "getcheckpoint",             &getcheckpoint,             true,   false },
+    { "getdbinfo",                 &getdbinfo,                 true,   false },
+    { "getaddressutxos",           &getaddressutxos,           false,  false },
+    { "getaddresshistory",         &getaddresshistory,         false,  false },
+    { "getaddressbalance",         &getaddressbalance,         false,  false },
+    { "gettokeninfo",              &gettokeninfo,              false,  false },
+    { "gettokenholders",           &gettokenholders,           false,  false },
+    { "gettokentransfers",         &gettokentransfers,         false,  false },
     { "reservebalance",            &reservebalance,            false,  true},
     { "checkwallet",               &checkwallet,               false,  true},
     { "repairwallet",              &repairwallet,              false,  true},
@@ -379,6 +394,27 @@ static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
                      strMsg.size(), FormatFullVersion().c_str(), strMsg.c_str());
 }
 
+/** Header of a reply whose body is sent with chunked transfer encoding (see HTTPChunk()) */
+static string HTTPReplyHeaderChunked(int nStatus, bool keepalive)
+{
+    return strprintf("HTTP/1.1 %d %s\r\n"
+                     "Date: %s\r\n"
+                     "Connection: %s\r\n"
+                     "Transfer-Encoding: chunked\r\n"
+                     "Content-Type: application/json\r\n"
+                     "Server: neblio-json-rpc/%s\r\n"
+                     "\r\n",
+                     nStatus, nStatus == HTTP_OK ? "OK" : "Internal Server Error", rfc1123Time().c_str(),
+                     keepalive ? "keep-alive" : "close", FormatFullVersion().c_str());
+}
+
+static string HTTPChunk(const string& strData)
+{
+    return strprintf("%" PRIszx "\r\n", strData.size()) + strData + "\r\n";
+}
+
+static const string HTTP_LAST_CHUNK = "0\r\n\r\n";
+
 int ReadHTTPStatus(std::basic_istream<char>& stream, int& proto)
 {
     string str;
@@ -417,7 +453,41 @@ int ReadHTTPHeader(std::basic_istream<char>& stream, map<string, string>& mapHea
     return nLen;
 }
 
-int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet)
+static bool ReadHTTPChunkedBody(std::basic_istream<char>& stream, string& strMessageRet)
+{
+    while (true) {
+        string strSize;
+        std::getline(stream, strSize);
+        if (!stream)
+            return false;
+        // chunk extensions are allowed after the size and are ignored
+        strSize = strSize.substr(0, strSize.find_first_of(";\r"));
+        boost::trim(strSize);
+        if (strSize.empty() || strSize.size() > 8 ||
+            strSize.find_first_not_of("0123456789abcdefABCDEF") != string::npos)
+            return false;
+        const uint64_t nChunkSize = strtoull(strSize.c_str(), NULL, 16);
+        if (nChunkSize == 0)
+            break;
+        if (nChunkSize > MAX_SIZE - strMessageRet.size())
+            return false;
+        const std::size_t nOldSize = strMessageRet.size();
+        strMessageRet.resize(nOldSize + nChunkSize);
+        stream.read(&strMessageRet[nOldSize], nChunkSize);
+        // every chunk is terminated by CRLF
+        string strTerminator;
+        std::getline(stream, strTerminator);
+        if (!stream)
+            return false;
+    }
+    // skip the trailer, which ends with an empty line
+    map<string, string> mapTrailer;
+    ReadHTTPHeader(stream, mapTrailer);
+    return true;
+}
+
+int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet,
+             int* pnProtoRet = NULL)
 {
     mapHeadersRet.clear();
     strMessageRet = "";
@@ -425,6 +495,8 @@ int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRe
     // Read status
     int nProto  = 0;
     int nStatus = ReadHTTPStatus(stream, nProto);
+    if (pnProtoRet)
+        *pnProtoRet = nProto;
 
     // Read header
     int nLen = ReadHTTPHeader(stream, mapHeadersRet);
@@ -432,7 +504,10 @@ int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRe
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0) {
+    if (boost::algorithm::icontains(mapHeadersRet["transfer-encoding"], "chunked")) {
+        if (!ReadHTTPChunkedBody(stream, strMessageRet))
+            return HTTP_INTERNAL_SERVER_ERROR;
+    } else if (nLen > 0) {
         vector<char> vch(nLen);
         stream.read(&vch[0], nLen);
         strMessageRet = string(vch.begin(), vch.end());
@@ -950,6 +1025,48 @@ static string JSONRPCExecBatch(const Array& vReq)
     return write_string(Value(ret), false) + "\n";
 }
 
+/**
+ * Executes a singleton request and sends the reply with chunked transfer encoding while the result
+ * is being produced, so that large results never have to be held in memory as a whole.
+ * If the call fails before anything is sent, the error is thrown so that a regular error reply can
+ * be sent. If it fails midway, the partial result is terminated and the error is reported next to
+ * it. Returns false if the connection cannot be reused afterwards.
+ */
+static bool StreamJSONRPCReply(std::iostream& stream, const JSONRequest& jreq, bool fKeepAlive)
+{
+    bool           fHeaderSent = false;
+    CRPCTextWriter writer([&](const string& strData) {
+        if (!fHeaderSent) {
+            stream << HTTPReplyHeaderChunked(HTTP_OK, fKeepAlive);
+            fHeaderSent = true;
+        }
+        stream << HTTPChunk(strData) << std::flush;
+    });
+
+    // same layout as JSONRPCReply()
+    writer.BeginObject();
+    writer.WriteKey("result");
+    Value error = Value::null;
+    try {
+        tableRPC.executeStreamed(jreq.strMethod, jreq.params, writer);
+    } catch (Object& objError) {
+        if (!fHeaderSent)
+            throw;
+        printf("ThreadRPCServer method=%s failed after sending %" PRIu64 " bytes\n",
+               jreq.strMethod.c_str(), writer.GetBytesFlushed());
+        writer.CloseScopes(1);
+        error = objError;
+    }
+    writer.WritePair("error", error);
+    writer.WritePair("id", jreq.id);
+    writer.EndObject();
+    writer.WriteRaw("\n");
+    writer.Flush();
+    stream << HTTP_LAST_CHUNK << std::flush;
+
+    return error.type() == null_type && fKeepAlive;
+}
+
 static CCriticalSection cs_THREAD_RPCHANDLER;
 
 void ThreadRPCServer3(void* parg)
@@ -977,7 +1094,8 @@ void ThreadRPCServer3(void* parg)
         map<string, string> mapHeaders;
         string              strRequest;
 
-        ReadHTTP(conn->stream(), mapHeaders, strRequest);
+        int nProto = 0;
+        ReadHTTP(conn->stream(), mapHeaders, strRequest, &nProto);
 
         // Check authorization
         if (mapHeaders.count("authorization") == 0) {
@@ -1014,6 +1132,13 @@ void ThreadRPCServer3(void* parg)
             if (valRequest.type() == obj_type) {
                 jreq.parse(valRequest);
 
+                // chunked transfer encoding requires HTTP/1.1
+                const CRPCCommand* pcmd = tableRPC[jreq.strMethod];
+                if (pcmd && pcmd->streamActor && nProto >= 1) {
+                    fRun = StreamJSONRPCReply(conn->stream(), jreq, fRun);
+                    continue;
+                }
+
                 Value result = tableRPC.execute(jreq.strMethod, jreq.params);
 
                 // Send reply
@@ -1042,11 +1167,10 @@ void ThreadRPCServer3(void* parg)
     }
 }
 
-json_spirit::Value CRPCTable::execute(const std::string&        strMethod,
-                                      const json_spirit::Array& params) const
+static const CRPCCommand* FindCommandForExecution(const CRPCTable& table, const std::string& strMethod)
 {
     // Find method
-    const CRPCCommand* pcmd = tableRPC[strMethod];
+    const CRPCCommand* pcmd = table[strMethod];
     if (!pcmd)
         throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
 
@@ -1055,6 +1179,43 @@ json_spirit::Value CRPCTable::execute(const std::string&        strMethod,
     if (strWarning != "" && !GetBoolArg("-disablesafemode") && !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    return pcmd;
+}
+
+static void ExecuteStreamActor(const CRPCCommand* pcmd, const json_spirit::Array& params,
+                               CRPCStreamWriter& writer)
+{
+    try {
+        if (pcmd->unlocked)
+            pcmd->streamActor(params, false, writer);
+        else {
+            // the streamed calls take the locks themselves for each batch (see RPC_STREAM_BATCH_SIZE);
+            // one that doesn't is only written to the client once the locks are released, so that a
+            // slow client can't hold up the node; it's kept as text until then
+            writer.HoldOutput(true);
+            {
+                LOCK2(cs_main, pwalletMain->cs_wallet);
+                pcmd->streamActor(params, false, writer);
+            }
+            writer.HoldOutput(false);
+        }
+    } catch (std::exception& e) {
+        writer.HoldOutput(false);
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+}
+
+json_spirit::Value CRPCTable::execute(const std::string&        strMethod,
+                                      const json_spirit::Array& params) const
+{
+    const CRPCCommand* pcmd = FindCommandForExecution(*this, strMethod);
+
+    if (pcmd->streamActor) {
+        CRPCValueWriter writer;
+        ExecuteStreamActor(pcmd, params, writer);
+        return writer.GetValue();
+    }
+
     try {
         // Execute
         Value result;
@@ -1072,6 +1233,17 @@ json_spirit::Value CRPCTable::execute(const std::string&        strMethod,
     }
 }
 
+void CRPCTable::executeStreamed(const std::string& strMethod, const json_spirit::Array& params,
+                                CRPCStreamWriter& writer) const
+{
+    const CRPCCommand* pcmd = FindCommandForExecution(*this, strMethod);
+
+    if (pcmd->streamActor)
+        ExecuteStreamActor(pcmd, params, writer);
+    else
+        writer.WriteValue(execute(strMethod, params));
+}
+
 std::vector<string> CRPCTable::listCommands() const
 {
     std::vector<std::string>                          commandList;
@@ -1288,6 +1460,24 @@ Array RPCConvertValues(const std::string& strMethod, const std::vector<std::stri
         ConvertTo<Array>(params[2], true);
     if (strMethod == "keypoolrefill" && n > 0)
         ConvertTo<int64_t>(params[0]);
+    if (strMethod == "exportblockchain" && n > 2)
+        ConvertTo<bool>(params[2]);
+    if (strMethod == "getaddressutxos" && n > 1)
+        ConvertTo<int64_t>(params[1]);
+    if (strMethod == "getaddressutxos" && n > 2)
+        ConvertTo<int64_t>(params[2]);
+    if (strMethod == "getaddresshistory" && n > 1)
+        ConvertTo<int64_t>(params[1]);
+    if (strMethod == "getaddresshistory" && n > 2)
+        ConvertTo<int64_t>(params[2]);
+    if (strMethod == "gettokenholders" && n > 1)
+        ConvertTo<int64_t>(params[1]);
+    if (strMethod == "gettokenholders" && n > 2)
+        ConvertTo<int64_t>(params[2]);
+    if (strMethod == "gettokentransfers" && n > 1)
+        ConvertTo<int64_t>(params[1]);
+    if (strMethod == "gettokentransfers" && n > 2)
+        ConvertTo<int64_t>(params[2]);
 
     return params;
 }
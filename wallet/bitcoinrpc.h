@@ -17,6 +17,7 @@ class CBlockIndex;
 #include "json/json_spirit_writer_template.h"
 
 #include "checkpoints.h"
+#include "rpcstreamwriter.h"
 #include "util.h"
 
 #include "ntp1/ntp1sendtokensonerecipientdata.h"
@@ -97,13 +98,23 @@ void RPCTypeCheck(const json_spirit::Object&                            o,
 
 typedef json_spirit::Value (*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
 
+/** RPC call that pushes its (potentially huge) result into a writer instead of returning it */
+typedef void (*rpcstreamfn_type)(const json_spirit::Array& params, bool fHelp,
+                                 CRPCStreamWriter& writer);
+
+/** How many entries a streamed RPC call assembles at a time under cs_main (and cs_wallet); the calls
+ * take the locks themselves and release them before the entries are written, so that a slow client
+ * can't hold up the node */
+static const unsigned int RPC_STREAM_BATCH_SIZE = 100;
+
 class CRPCCommand
 {
 public:
-    std::string name;
-    rpcfn_type  actor;
-    bool        okSafeMode;
-    bool        unlocked;
+    std::string      name;
+    rpcfn_type       actor;
+    bool             okSafeMode;
+    bool             unlocked;
+    rpcstreamfn_type streamActor; // if set, actor is NULL and the result is streamed to the client
 };
 
 /**
@@ -128,6 +139,18 @@ public:
      */
     json_spirit::Value execute(const std::string& method, const json_spirit::Array& params) const;
 
+    /**
+     * Execute a method, writing its result into the given writer. Methods that support streaming
+     * write their result incrementally; for the others, the result is written once it's complete.
+     * @param method   Method to execute
+     * @param params   Array of arguments (JSON objects)
+     * @param writer   Destination of the result
+     * @throws an exception (json_spirit::Value) when an error happens. Part of the result may
+     * have been written by then.
+     */
+    void executeStreamed(const std::string& method, const json_spirit::Array& params,
+                         CRPCStreamWriter& writer) const;
+
     /**
      * Returns a list of registered commands
      * @returns List of registered commands.
@@ -197,10 +220,10 @@ extern json_spirit::Value addmultisigaddress(const json_spirit::Array& params, b
 extern json_spirit::Value addredeemscript(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listreceivedbyaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listreceivedbyaccount(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value listtransactions(const json_spirit::Array& params, bool fHelp);
+extern void listtransactions(const json_spirit::Array& params, bool fHelp, CRPCStreamWriter& writer);
 extern json_spirit::Value listaddressgroupings(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listaccounts(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value listsinceblock(const json_spirit::Array& params, bool fHelp);
+extern void listsinceblock(const json_spirit::Array& params, bool fHelp, CRPCStreamWriter& writer);
 extern json_spirit::Value gettransaction(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value backupwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value keypoolrefill(const json_spirit::Array& params, bool fHelp);
@@ -220,7 +243,7 @@ extern json_spirit::Value getnewpubkey(const json_spirit::Array& params, bool fH
 
 extern json_spirit::Value getrawtransaction(const json_spirit::Array& params,
                                             bool                      fHelp); // in rcprawtransaction.cpp
-extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
+extern void listunspent(const json_spirit::Array& params, bool fHelp, CRPCStreamWriter& writer);
 extern json_spirit::Value createrawtransaction(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createrawntp1transaction(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value decoderawtransaction(const json_spirit::Array& params, bool fHelp);
@@ -233,12 +256,20 @@ extern json_spirit::Value getbestblockhash(const json_spirit::Array& params,
 extern json_spirit::Value getblockcount(const json_spirit::Array& params,
                                         bool                      fHelp); // in rpcblockchain.cpp
 extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getblockchaininfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern void getrawmempool(const json_spirit::Array& params, bool fHelp, CRPCStreamWriter& writer);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value getblockbynumber(const json_spirit::Array& params, bool fHelp);
+extern void getblock(const json_spirit::Array& params, bool fHelp, CRPCStreamWriter& writer);
+extern void getblockbynumber(const json_spirit::Array& params, bool fHelp, CRPCStreamWriter& writer);
 extern json_spirit::Value getcheckpoint(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getdbinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressutxos(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddresshistory(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressbalance(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value gettokeninfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value gettokenholders(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value gettokentransfers(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value exportblockchain(const json_spirit::Array& params, bool fHelp);
 
 std::vector<NTP1SendTokensOneRecipientData>
@@ -1,14 +1,20 @@
 #include "block.h"
 
 #include "NetworkForks.h"
+#include "addrindex.h"
+#include "blockencodings.h"
 #include "blockindex.h"
 #include "checkpoints.h"
+#include "coins.h"
+#include "headerchain.h"
 #include "kernel.h"
 #include "main.h"
+#include "tokenindex.h"
 #include "txmempool.h"
 #include "util.h"
 #include <boost/algorithm/string.hpp>
 #include <boost/foreach.hpp>
+#include <limits>
 
 void CBlock::print() const
 {
@@ -120,14 +126,18 @@ void CBlock::SetNull()
     vtx.clear();
     vchBlockSig.clear();
     vMerkleTree.clear();
-    nDoS = 0;
+    nDoS       = 0;
+    hashCached = 0;
+    fChecked   = false;
 }
 
 uint256 CBlock::GetPoWHash() const { return scrypt_blockhash(CVOIDBEGIN(nVersion)); }
 
 int64_t CBlock::GetBlockTime() const { return (int64_t)nTime; }
 
-uint256 CBlock::GetHash() const { return GetPoWHash(); }
+uint256 CBlock::GetHash() const { return hashCached != 0 ? hashCached : GetPoWHash(); }
+
+void CBlock::CacheHash() const { hashCached = GetPoWHash(); }
 
 bool CBlock::IsNull() const { return (nBits == 0); }
 
@@ -136,13 +146,43 @@ void CBlock::UpdateTime(const CBlockIndex* /*pindexPrev*/)
     nTime = std::max(GetBlockTime(), GetAdjustedTime());
 }
 
-bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndexSmartPtr& pindex)
+bool CBlock::ReadUndo(CTxDB& txdb, CBlockUndo& blockundo) const
+{
+    if (!txdb.ReadBlockUndo(GetHash(), blockundo)) {
+        // blocks connected by older versions have no undo data
+        blockundo.vtxundo.clear();
+        for (unsigned int i = 1; i < vtx.size(); i++) {
+            blockundo.vtxundo.push_back(CTxUndo());
+            if (!vtx[i].ReadUndoFromDisk(txdb, blockundo.vtxundo.back()))
+                return error("ReadUndo() : no undo data for block %s", GetHash().ToString().c_str());
+        }
+    }
+    if (blockundo.vtxundo.size() + 1 != vtx.size())
+        return error("ReadUndo() : block %s and its undo data are inconsistent",
+                     GetHash().ToString().c_str());
+    return true;
+}
+
+bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndexSmartPtr& pindex, CCoinsViewCache& view)
 {
+    CBlockUndo blockundo;
+    if (!ReadUndo(txdb, blockundo))
+        return false;
+
     // Disconnect in reverse order
+    const CTxUndo txundoCoinBase;
     for (int i = vtx.size() - 1; i >= 0; i--)
-        if (!vtx[i].DisconnectInputs(txdb))
+        if (!vtx[i].DisconnectInputs(txdb, view, i > 0 ? blockundo.vtxundo[i - 1] : txundoCoinBase))
             return false;
 
+    if (!txdb.EraseBlockUndo(GetHash()))
+        return error("DisconnectBlock() : EraseBlockUndo failed");
+
+    if (fAddrIndex && !DisconnectBlockAddrIndex(txdb, *this, pindex->nHeight, blockundo))
+        return error("DisconnectBlock() : failed to take the block out of the address index");
+    if (fTokenIndex && !DisconnectBlockTokenIndex(txdb, *this, pindex->nHeight))
+        return error("DisconnectBlock() : failed to take the block out of the token index");
+
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
     if (pindex->pprev) {
@@ -195,294 +235,86 @@ CBlock::CommonAncestorSuccessorBlocks CBlock::GetBlocksUpToCommonAncestorInMainC
     return res;
 }
 
-/**
- * @brief CBlock::GetAlternateChainTxsUpToCommonAncestor
- * @return
- * This function will get all the blocks from the main chain up to the common ancestor with this block;
- * then, it'll unspend all the transactions in these blocks and return them in the map. This is necessary
- * to solve the problem of stake attack described in VerifyInputsUnspent()
- */
-CBlock::ChainReplaceTxs CBlock::GetAlternateChainTxsUpToCommonAncestor(CTxDB& txdb) const
-{
-    CommonAncestorSuccessorBlocks commonAncestory = GetBlocksUpToCommonAncestorInMainChain();
-    std::vector<CBlock>           forkChainBlocks; // to be reconnected
-    forkChainBlocks.reserve(commonAncestory.inFork.size() + 1);
-
-    // get all txs in the fork leading to this transaction (in order to test spending them later)
-    for (const uint256& bh : commonAncestory.inFork) {
-        CBlock blk;
-        //        std::cout << "In fork block hash: " << bh.ToString() << std::endl;
-        if (!txdb.ReadBlock(bh, blk, true)) {
-            throw std::runtime_error("In fork chain search, block " + bh.ToString() +
-                                     " was not found in the database");
-        }
-        forkChainBlocks.push_back(blk);
-    }
-
-    ChainReplaceTxs result;
-    result.commonAncestorBlockIndex = commonAncestory.commonAncestor;
-
-    // since the fork can spend transactions from itself, we need to put them in such a way they're
-    // reachable in O(1)
-    std::unordered_map<uint256, CTransaction> forkTxs;
-
-    // unspend/disconnect all inputs that are in the fork
-    // we also need to unspent this block, so we add it and pop it later
-    forkChainBlocks.push_back(*this);
-    for (const CBlock& blk : forkChainBlocks) {
-        for (const CTransaction& tx : blk.vtx) {
-            forkTxs[tx.GetHash()] = tx;
-        }
-
-        for (const CTransaction& tx : blk.vtx) {
-            if (tx.IsCoinBase()) {
-                continue;
-            }
-            const std::vector<CTxIn>& vin = tx.vin;
-            for (unsigned int inIdx = 0; inIdx < vin.size(); inIdx++) {
-                const CTxIn& txin          = vin[inIdx];
-                uint256      outputTxHash  = txin.prevout.hash;
-                unsigned     outputNumInTx = txin.prevout.n;
-
-                auto     idxIt = result.modifiedOutputsTxs.find(outputTxHash);
-                CTxIndex txindex;
-                if (idxIt == result.modifiedOutputsTxs.cend()) {
-                    // Get prev txindex from disk
-                    if (!txdb.ReadTxIndex(outputTxHash, txindex)) {
-                        // the only place left is on the fork itself: the block is spending a tx on the
-                        // fork
-                        auto forkTxIt = forkTxs.find(outputTxHash);
-                        if (forkTxIt != forkTxs.cend()) {
-                            // we don't unspend transaction on the fork, because they're already unspent
-                            // since they're not main chain
-                            continue;
-                        } else {
-                            throw std::runtime_error(
-                                std::string(__PRETTY_FUNCTION__) +
-                                ": ReadTxIndex failed for transaction " + outputTxHash.ToString() +
-                                " and the transaction was not found in the fork itself (1)");
-                        }
-                    }
-
-                } else {
-                    txindex = idxIt->second;
-                }
-
-                // check range
-                if (outputNumInTx >= txindex.vSpent.size()) {
-                    throw std::runtime_error(std::string(__PRETTY_FUNCTION__) +
-                                             ": prevout.n out of range for transaction " +
-                                             outputTxHash.ToString() + " and output " +
-                                             std::to_string(outputNumInTx) + " (1)");
-                }
-
-                if (txindex.vSpent[outputNumInTx].IsNull()) {
-                    // it's already unspent
-                    continue;
-                }
-
-                uint256 spenderBlockHash = txindex.vSpent[outputNumInTx].nBlockPos;
-                auto    blockIt          = mapBlockIndex.find(spenderBlockHash);
-                if (blockIt == mapBlockIndex.cend()) {
-                    throw std::runtime_error(
-                        std::string(__PRETTY_FUNCTION__) + ": The input of transaction " +
-                        tx.GetHash().ToString() + " whose index " + std::to_string(outputNumInTx) +
-                        " and hash " + outputTxHash.ToString() + "is found to be in block " +
-                        spenderBlockHash.ToString() +
-                        " but that block is not found in the block index. This should never happen.");
-                }
-
-                // this should be true anyway, because ReadTxIndex has only blocks with spent
-                // transactions from the main chain, but we double check for consistency
-                if (!blockIt->second->IsInMainChain()) {
-                    throw std::runtime_error(
-                        std::string(__PRETTY_FUNCTION__) + ": The input of transaction " +
-                        tx.GetHash().ToString() + " whose index " + std::to_string(outputNumInTx) +
-                        " and hash " + outputTxHash.ToString() + "is found to be in block " +
-                        spenderBlockHash.ToString() +
-                        " but while that block was found, it's not in the main chain");
-                }
-
-                // make sure that the spending transaction is in the main chain above the common ancestor
-                if (blockIt->second->nHeight > commonAncestory.commonAncestor->nHeight) {
-                    // unspend, which is equivalent to disconnecting the blockchain (without updating
-                    // the database)
-                    txindex.vSpent[outputNumInTx].SetNull();
-
-                    // this way, all main-chain spent transactions are in this map, while marked
-                    // unspent
-                    result.modifiedOutputsTxs[outputTxHash] = txindex;
-                }
-            }
-        }
-    }
-    // now that this block's inputs are unspent in the fork, we pop it
-    forkChainBlocks.pop_back();
-
-    // at this point, all transactions from the fork that are spent in the main chain are now unspent
-
-    //    std::cout << "Start reconnecting txs" << std::endl;
-    // respend the transactions on the fork (to test whether this block is valid at this chain)
-    for (const CBlock& blk : forkChainBlocks) {
-        for (const CTransaction& tx : blk.vtx) {
-            if (tx.IsCoinBase()) {
-                continue;
-            }
-            // std::cout << "Reconnecting inputs in: " << tx.GetHash().ToString() << std::endl;
-            const std::vector<CTxIn>& vin = tx.vin;
-            for (unsigned int inIdx = 0; inIdx < vin.size(); inIdx++) {
-                const CTxIn& txin          = vin[inIdx];
-                uint256      outputTxHash  = txin.prevout.hash;
-                unsigned     outputNumInTx = txin.prevout.n;
-
-                auto     idxIt = result.modifiedOutputsTxs.find(outputTxHash);
-                CTxIndex txindex;
-                if (idxIt == result.modifiedOutputsTxs.cend()) {
-                    // Get prev txindex from disk
-                    if (!txdb.ReadTxIndex(outputTxHash, txindex)) {
-                        // the only place left is on the fork itself: the block is spending a tx on the
-                        // fork
-                        auto forkTxIt = forkTxs.find(outputTxHash);
-                        if (forkTxIt != forkTxs.cend()) {
-                            const CTransaction& txInFork = forkTxIt->second;
-                            txindex = CTxIndex(CDiskTxPos(blk.GetHash(), 42), txInFork.vout.size());
-                        } else {
-                            throw std::runtime_error(
-                                std::string(__PRETTY_FUNCTION__) +
-                                ": ReadTxIndex failed for transaction " + outputTxHash.ToString() +
-                                " and the transaction was not found in the fork itself (2)");
-                        }
-                    }
-                } else {
-                    txindex = idxIt->second;
-                }
-
-                // check range
-                if (outputNumInTx >= txindex.vSpent.size()) {
-                    throw std::runtime_error(
-                        std::string(__PRETTY_FUNCTION__) + ": prevout.n out of range for transaction " +
-                        outputTxHash.ToString() + " and output " + std::to_string(outputNumInTx));
-                }
-
-                // spend the output (without updating the database)
-                txindex.vSpent[outputNumInTx] = CreateFakeSpentTxPos(txindex.pos.nBlockPos);
-
-                result.modifiedOutputsTxs[outputTxHash] = txindex;
-            }
-            // since we're respending the transactions, we should store them in modified list because
-            // they can be spent in subsequent blocks
-            auto idxIt = result.modifiedOutputsTxs.find(tx.GetHash());
-            if (idxIt == result.modifiedOutputsTxs.cend()) {
-                result.modifiedOutputsTxs[tx.GetHash()] =
-                    CTxIndex(CDiskTxPos(this->GetHash(), 3), tx.vout.size());
-            }
-        }
-    }
-    //    std::cout << "End reconnecting txs" << std::endl;
-    return result;
-}
-
 bool CBlock::VerifyInputsUnspent(CTxDB& txdb) const
 {
     // this function solves the problem in
     // https://medium.com/@dsl_uiuc/fake-stake-attacks-on-chain-based-proof-of-stake-cryptocurrencies-b8b05723f806
     // this function doesn't modify the database or the block being analyzed
 
-    // in order to do this, we reverse/disconnect transactions up to the common ancestor (without
-    // modifying the database), then we replay the new chain up the this block, finally we check whether
-    // this block is valid in the chain constructed from common ancestor to this
-
-    // queued transactions are the inputs that we already found (even from this block). The map stores
-    // whether transactions are spent already. This solves the problem of spending an output in the same
-    // block where it's created
-    ChainReplaceTxs alternateChainTxs;
-
+    // the inputs have to be unspent on the chain of this block, which isn't necessarily the main
+    // chain. The coins of the main chain are taken back to the common ancestor with the undo data of
+    // the blocks above it, the blocks of the fork leading to this block are applied, and then the
+    // transactions of this block are, in order, so that outputs spent in the same block where they're
+    // created are found as well. For a block on top of the main chain, nothing is read but the coins.
+    CommonAncestorSuccessorBlocks commonAncestry;
     try {
-        alternateChainTxs = GetAlternateChainTxsUpToCommonAncestor(txdb);
+        commonAncestry = GetBlocksUpToCommonAncestorInMainChain();
     } catch (std::exception& ex) {
         return error("Failed to verify unspent inputs for block %s; error: %s",
                      this->GetHash().ToString().c_str(), ex.what());
     }
 
-    std::unordered_map<uint256, CTxIndex>& queuedTxs = alternateChainTxs.modifiedOutputsTxs;
+    CCoinsViewCache view(*pcoinsTip, true);
+    const CTxUndo   txundoCoinBase;
+
+    for (CBlockIndexSmartPtr pindex = boost::atomic_load(&pindexBest);
+         pindex != commonAncestry.commonAncestor; pindex = boost::atomic_load(&pindex->pprev)) {
+        if (!pindex->pprev)
+            return error("VerifyInputsUnspent() : the common ancestor of block %s is not below the "
+                         "best block",
+                         this->GetHash().ToString().c_str());
+        CBlock     block;
+        CBlockUndo blockundo;
+        if (!block.ReadFromDisk(pindex.get(), txdb) || !block.ReadUndo(txdb, blockundo))
+            return error("VerifyInputsUnspent() : failed to read main chain block %s",
+                         pindex->GetBlockHash().ToString().c_str());
+        for (int i = block.vtx.size() - 1; i >= 0; i--)
+            if (!block.vtx[i].UndoCoins(view, i > 0 ? blockundo.vtxundo[i - 1] : txundoCoinBase))
+                return error("VerifyInputsUnspent() : failed to undo main chain block %s",
+                             pindex->GetBlockHash().ToString().c_str());
+    }
 
-    for (const CTransaction& tx : vtx) {
-        {
-            // if an output in the transaction is spent in the same block, it should also be found in the
-            // queued transactions list in order for the tests below to work because it's not in the
-            // blockchain yet
-            auto it = queuedTxs.find(tx.GetHash());
-            if (it == queuedTxs.cend()) {
-                // unspent tx (all vSpent are null)
-                CTxIndex txindex(CDiskTxPos(this->GetHash(), 2), tx.vout.size());
-                queuedTxs[tx.GetHash()] = txindex;
-            }
-        }
+    for (const uint256& bh : commonAncestry.inFork) {
+        CBlock block;
+        if (!txdb.ReadBlock(bh, block, true))
+            return error("VerifyInputsUnspent() : fork block %s was not found in the database",
+                         bh.ToString().c_str());
+        for (const CTransaction& tx : block.vtx)
+            if (!tx.HaveInputs(view) || !tx.UpdateCoins(view, 0))
+                return error("VerifyInputsUnspent() : tx %s in fork block %s spends missing or spent "
+                             "outputs",
+                             tx.GetHash().ToString().c_str(), bh.ToString().c_str());
+    }
 
+    for (const CTransaction& tx : vtx) {
+        // loop over inputs of this transaction, and check whether the outputs are already spent;
         // coinbase don't have any inputs
-        if (tx.IsCoinBase()) {
-            continue;
-        }
-
-        // loop over inputs of this transaction, and check whether the outputs are already spent
         const std::vector<CTxIn>& vin = tx.vin;
-        for (unsigned int inIdx = 0; inIdx < vin.size(); inIdx++) {
-            uint256  outputTxHash  = vin[inIdx].prevout.hash;
-            unsigned outputNumInTx = vin[inIdx].prevout.n;
-            CTxIndex txindex;
-            auto     it                = queuedTxs.find(vin[inIdx].prevout.hash);
-            bool     inputFoundInQueue = (it != queuedTxs.cend());
-            if (inputFoundInQueue) {
-                if (outputNumInTx >= it->second.vSpent.size()) {
-                    return error("Output number %u in tx %s which is an input to tx %s "
-                                 "has an invalid input index in block %s (1)",
-                                 outputNumInTx, outputTxHash.ToString().c_str(),
-                                 tx.GetHash().ToString().c_str(), this->GetHash().ToString().c_str());
-                }
-
-                if (it->second.vSpent[outputNumInTx].IsNull()) {
-                    // tx is not spent yet, so we mark it as spent
-                    it->second.vSpent[outputNumInTx] = CreateFakeSpentTxPos(this->GetHash());
-                } else {
-                    return error("Output number %u in tx %s which is an input to tx %s is attempting to "
-                                 "double-spend in the same block %s",
-                                 outputNumInTx, outputTxHash.ToString().c_str(),
-                                 tx.GetHash().ToString().c_str(), this->GetHash().ToString().c_str());
-                }
-            } else if (txdb.ReadTxIndex(outputTxHash, txindex)) {
-                if (outputNumInTx >= txindex.vSpent.size()) {
-                    return error("Output number %u in tx %s which is an input to tx %s "
-                                 "has an invalid input index in block %s (2)",
-                                 outputNumInTx, outputTxHash.ToString().c_str(),
-                                 tx.GetHash().ToString().c_str(), this->GetHash().ToString().c_str());
-                }
-
-                queuedTxs[outputTxHash] = txindex;
-                if (txindex.vSpent[outputNumInTx].IsNull()) {
-                    queuedTxs.find(outputTxHash)->second.vSpent[outputNumInTx] =
-                        CreateFakeSpentTxPos(this->GetHash());
-                } else {
-                    return error(
-                        "Output number %u in tx %s which is an input to tx %s is being "
-                        "spent it in block %s +++++ it was already spent in block %s, this is a "
-                        "double-spend attempt",
-                        outputNumInTx, outputTxHash.ToString().c_str(), tx.GetHash().ToString().c_str(),
-                        this->GetHash().ToString().c_str(),
-                        txindex.vSpent[outputNumInTx].nBlockPos.ToString().c_str());
-                }
-            } else {
+        for (unsigned int inIdx = 0; inIdx < vin.size() && !tx.IsCoinBase(); inIdx++) {
+            const uint256& outputTxHash  = vin[inIdx].prevout.hash;
+            unsigned       outputNumInTx = vin[inIdx].prevout.n;
+            if (!view.HaveCoins(outputTxHash))
                 return error("Output number %u in tx %s which is an input to tx %s and is being "
                              "attempted to spend it in block %s. it's an invalid tx",
                              outputNumInTx, outputTxHash.ToString().c_str(),
-                             tx.GetHash().ToString().c_str(),
-                             vin[inIdx].prevout.hash.ToString().c_str());
-            }
+                             tx.GetHash().ToString().c_str(), this->GetHash().ToString().c_str());
+            if (!view.GetCoins(outputTxHash).IsAvailable(outputNumInTx))
+                return error("Output number %u in tx %s which is an input to tx %s is being spent in "
+                             "block %s, but it's already spent or out of range on the chain of the "
+                             "block, this is a double-spend attempt",
+                             outputNumInTx, outputTxHash.ToString().c_str(),
+                             tx.GetHash().ToString().c_str(), this->GetHash().ToString().c_str());
         }
+
+        // the outputs of this transaction can be spent by the ones after it in the block
+        if (!tx.UpdateCoins(view, 0))
+            return error("VerifyInputsUnspent() : UpdateCoins failed for tx %s in block %s",
+                         tx.GetHash().ToString().c_str(), this->GetHash().ToString().c_str());
     }
     return true;
 }
 
-bool CBlock::CheckBIP30Attack(CTxDB& txdb, const uint256& hashTx)
+bool CBlock::CheckBIP30Attack(CCoinsViewCache& view, const uint256& hashTx)
 {
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
@@ -497,16 +329,11 @@ bool CBlock::CheckBIP30Attack(CTxDB& txdb, const uint256& hashTx)
     // except the two in the chain that violate it. This prevents exploiting the issue against nodes
     // in their initial block download.
 
-    CTxIndex txindexOld;
-    if (txdb.ReadTxIndex(hashTx, txindexOld)) {
-        for (CDiskTxPos& pos : txindexOld.vSpent)
-            if (pos.IsNull())
-                return false;
-    }
-    return true;
+    return !view.HaveCoins(hashTx) || view.GetCoins(hashTx).IsPruned();
 }
 
-bool CBlock::ConnectBlock(CTxDB& txdb, const CBlockIndexSmartPtr& pindex, bool fJustCheck)
+bool CBlock::ConnectBlock(CTxDB& txdb, const CBlockIndexSmartPtr& pindex, CCoinsViewCache& view,
+                          bool fJustCheck)
 {
     // Check it again in case a previous version let a bad block in, but skip BlockSig checking
     if (!CheckBlock(!fJustCheck, !fJustCheck, false))
@@ -527,6 +354,7 @@ bool CBlock::ConnectBlock(CTxDB& txdb, const CBlockIndexSmartPtr& pindex, bool f
     // block. This is necessary for verifying outputs that are being spent in the same blocks
 
     std::map<uint256, CTxIndex> mapQueuedChanges;
+    CBlockUndo                  blockundo;
     int64_t                     nFees        = 0;
     int64_t                     nValueIn     = 0;
     int64_t                     nValueOut    = 0;
@@ -545,7 +373,7 @@ bool CBlock::ConnectBlock(CTxDB& txdb, const CBlockIndexSmartPtr& pindex, bool f
 
         std::vector<std::pair<CTransaction, NTP1Transaction>> inputsWithNTP1;
 
-        if (!CheckBIP30Attack(txdb, hashTx)) {
+        if (!CheckBIP30Attack(view, hashTx)) {
             return error(
                 "Block %s was rejected as it seems that an attempt of BIP30 attack was attempted\n",
                 this->GetHash().ToString().c_str());
@@ -559,23 +387,24 @@ bool CBlock::ConnectBlock(CTxDB& txdb, const CBlockIndexSmartPtr& pindex, bool f
         if (!fJustCheck)
             nTxPos += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
 
-        MapPrevTx mapInputs;
         if (tx.IsCoinBase())
             nValueOut += tx.GetValueOut();
         else {
-            bool fInvalid;
-            if (!tx.FetchInputs(txdb, mapQueuedChanges, true, false, mapInputs, fInvalid))
-                return false;
+            // the outputs being spent come from the coins view, which has the ones of the
+            // transactions before this one in the block as well
+            if (!tx.HaveInputs(view))
+                return DoS(100, error("ConnectBlock() : %s inputs missing or spent",
+                                      hashTx.ToString().c_str()));
 
             // Add in sigops done by pay-to-script-hash inputs;
             // this is to prevent a "rogue miner" from creating
             // an incredibly-expensive-to-validate block.
-            nSigOps += tx.GetP2SHSigOpCount(mapInputs);
+            nSigOps += tx.GetP2SHSigOpCount(view);
             if (nSigOps > MAX_BLOCK_SIGOPS) {
                 return DoS(100, error("ConnectBlock() : too many sigops"));
             }
 
-            int64_t nTxValueIn  = tx.GetValueIn(mapInputs);
+            int64_t nTxValueIn  = tx.GetValueIn(view);
             int64_t nTxValueOut = tx.GetValueOut();
             nValueIn += nTxValueIn;
             nValueOut += nTxValueOut;
@@ -621,11 +450,20 @@ bool CBlock::ConnectBlock(CTxDB& txdb, const CBlockIndexSmartPtr& pindex, bool f
                 }
             }
 
-            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false)) {
+            if (!tx.ConnectInputs(view, pindex, true, false)) {
+                return false;
+            }
+            if (!tx.MarkSpentInTxIndex(txdb, mapQueuedChanges, posThisTx)) {
                 return false;
             }
         }
 
+        CTxUndo txundo;
+        if (!tx.UpdateCoins(view, txundo, pindex->nHeight))
+            return error("ConnectBlock() : UpdateCoins failed for %s", hashTx.ToString().c_str());
+        if (!tx.IsCoinBase())
+            blockundo.vtxundo.push_back(txundo);
+
         mapQueuedChanges[hashTx]          = CTxIndex(posThisTx, tx.vout.size());
         mapQueuedNTP1Inputs[tx.GetHash()] = inputsWithNTP1;
     }
@@ -662,6 +500,9 @@ bool CBlock::ConnectBlock(CTxDB& txdb, const CBlockIndexSmartPtr& pindex, bool f
     if (fJustCheck)
         return true;
 
+    if (!txdb.WriteBlockUndo(GetHash(), blockundo))
+        return error("ConnectBlock() : WriteBlockUndo failed");
+
     // Write queued txindex changes
     for (std::map<uint256, CTxIndex>::iterator mi = mapQueuedChanges.begin();
          mi != mapQueuedChanges.end(); ++mi) {
@@ -687,6 +528,12 @@ bool CBlock::ConnectBlock(CTxDB& txdb, const CBlockIndexSmartPtr& pindex, bool f
         }
     }
 
+    // the tokens of the outputs are taken from the NTP1 transactions written above
+    if (fAddrIndex && !ConnectBlockAddrIndex(txdb, *this, pindex->nHeight, &blockundo))
+        return error("ConnectBlock() : failed to add the block to the address index");
+    if (fTokenIndex && !ConnectBlockTokenIndex(txdb, *this, pindex->nHeight))
+        return error("ConnectBlock() : failed to add the block to the token index");
+
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
     if (pindex->pprev) {
@@ -710,7 +557,8 @@ bool CBlock::SetBestChainInner(CTxDB& txdb, const CBlockIndexSmartPtr& pindexNew
     uint256 hash = GetHash();
 
     // Adding to current best branch
-    if (!ConnectBlock(txdb, pindexNew) || !txdb.WriteHashBestChain(hash)) {
+    CCoinsViewCache view(*pcoinsTip, true);
+    if (!ConnectBlock(txdb, pindexNew, view) || !txdb.WriteHashBestChain(hash)) {
         if (createDbTransaction) {
             txdb.TxnAbort();
         }
@@ -720,6 +568,11 @@ bool CBlock::SetBestChainInner(CTxDB& txdb, const CBlockIndexSmartPtr& pindexNew
     if (createDbTransaction && !txdb.TxnCommit())
         return error("SetBestChain() : TxnCommit failed");
 
+    // the unspent outputs are kept in memory until FlushCoinsCache() writes them
+    view.SetBestBlock(pindexNew.get());
+    if (!view.Flush())
+        return error("SetBestChain() : failed to update the coins cache");
+
     // Add to current best branch
     pindexNew->pprev->pnext = pindexNew;
 
@@ -742,6 +595,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, const CBlockIndexSmartPtr& pindexNew,
         txdb.WriteHashBestChain(hash);
         if (createDbTransaction && !txdb.TxnCommit())
             return error("SetBestChain() : TxnCommit failed");
+        pcoinsTip->SetBestBlock(pindexNew.get());
         pindexGenesisBlock = pindexNew;
     } else if (hashPrevBlock == hashBestChain) {
         if (!SetBestChainInner(txdb, pindexNew, createDbTransaction))
@@ -959,13 +813,15 @@ bool CBlock::Reorganize(CTxDB& txdb, CBlockIndexSmartPtr& pindexNew, const bool
     printf("REORGANIZE: Connect %" PRIszu " blocks; %s..%s\n", vConnect.size(),
            pfork->GetBlockHash().ToString().c_str(), pindexNew->GetBlockHash().ToString().c_str());
 
+    CCoinsViewCache view(*pcoinsTip, true);
+
     // Disconnect shorter branch
     std::list<CTransaction> vResurrect;
     for (CBlockIndexSmartPtr& pindex : vDisconnect) {
         CBlock block;
         if (!block.ReadFromDisk(pindex.get()))
             return error("Reorganize() : ReadFromDisk for disconnect failed");
-        if (!block.DisconnectBlock(txdb, pindex))
+        if (!block.DisconnectBlock(txdb, pindex, view))
             return error("Reorganize() : DisconnectBlock %s failed",
                          pindex->GetBlockHash().ToString().c_str());
 
@@ -985,7 +841,7 @@ bool CBlock::Reorganize(CTxDB& txdb, CBlockIndexSmartPtr& pindexNew, const bool
         CBlock              block;
         if (!block.ReadFromDisk(pindex.get(), txdb))
             return error("Reorganize() : ReadFromDisk for connect failed");
-        if (!block.ConnectBlock(txdb, pindex)) {
+        if (!block.ConnectBlock(txdb, pindex, view)) {
             // Invalid block
             return error("Reorganize() : ConnectBlock %s failed",
                          pindex->GetBlockHash().ToString().c_str());
@@ -1002,6 +858,10 @@ bool CBlock::Reorganize(CTxDB& txdb, CBlockIndexSmartPtr& pindexNew, const bool
     if (createDbTransaction && !txdb.TxnCommit())
         return error("Reorganize() : TxnCommit failed");
 
+    view.SetBestBlock(pindexNew.get());
+    if (!view.Flush())
+        return error("Reorganize() : failed to update the coins cache");
+
     // Disconnect shorter branch
     for (CBlockIndexSmartPtr& pindex : vDisconnect)
         if (pindex->pprev)
@@ -1097,6 +957,7 @@ bool CBlock::AddToBlockIndex(uint256 nBlockPos, const uint256& hashProof, CTxDB&
     if (pindexNew->IsProofOfStake())
         setStakeSeen.insert(std::make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
     pindexNew->phashBlock = &((*mi).first);
+    HeaderIndexBlockStored(pindexNew);
 
     // Write to disk block index
     if (createDbTransaction && !txdb.TxnBegin())
@@ -1130,12 +991,20 @@ bool CBlock::AddToBlockIndex(uint256 nBlockPos, const uint256& hashProof, CTxDB&
 }
 
 bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) const
+{
+    // already done by the importer
+    if (fChecked)
+        return true;
+    return CheckBlock(fCheckPOW, fCheckMerkleRoot, fCheckSig, MaxBlockSize());
+}
+
+bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig,
+                        unsigned int nSizeLimit) const
 {
     // These are checks that are independent of context
     // that can be verified before saving an orphan block.
 
     // Size limits
-    unsigned int nSizeLimit = MaxBlockSize();
     if (vtx.empty() || vtx.size() > nSizeLimit ||
         ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION) > nSizeLimit)
         return DoS(100, error("CheckBlock() : size limits failed"));
@@ -1184,7 +1053,7 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
 
     // Check transactions
     for (const CTransaction& tx : vtx) {
-        if (!tx.CheckTransaction())
+        if (!tx.CheckTransaction(nSizeLimit))
             return DoS(tx.nDoS, error("CheckBlock() : CheckTransaction failed"));
 
         // ppcoin: check transaction timestamp
@@ -1326,15 +1195,28 @@ bool CBlock::AcceptBlock()
     uint256 nBlockPos = hash;
     if (!WriteToDisk(nBlockPos, hashProof))
         return error("AcceptBlock() : WriteToDisk failed");
+    // the coins cache keeps what couldn't be written, and it's tried again with the next block
+    if (!FlushCoinsCache())
+        printf("AcceptBlock() : failed to write the coins cache to the database\n");
 
     // Relay inventory, but don't relay old inventory during initial block download
     int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
     if (hashBestChain == hash) {
+        const CInv inv(MSG_BLOCK, hash);
         LOCK(cs_vNodes);
-        for (CNode* pnode : vNodes)
-            if (nBestHeight >
+        for (CNode* pnode : vNodes) {
+            if (nBestHeight <=
                 (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                pnode->PushInventory(CInv(MSG_BLOCK, hash));
+                continue;
+            // the peers that take compact blocks get the block right away instead of asking for it,
+            // with short IDs salted for each of them
+            if (!pnode->fCompactBlocks)
+                pnode->PushInventory(inv);
+            else if (pnode->SetInventoryKnown(inv))
+                pnode->PushMessage("cmpctblock",
+                                   CBlockHeaderAndShortTxIDs(
+                                       *this, GetRand(std::numeric_limits<uint64_t>::max())));
+        }
     }
 
     // ppcoin: check pending sync-checkpoint
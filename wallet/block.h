@@ -10,6 +10,7 @@
 #include <vector>
 
 class CBlockIndex;
+class CCoinsViewCache;
 class CTxDB;
 class CWallet;
 
@@ -44,6 +45,11 @@ public:
     // memory only
     mutable std::vector<uint256> vMerkleTree;
 
+    // memory only: the importer hashes and checks blocks on worker threads before they're processed,
+    // so that none of that is done again while holding cs_main. See CacheHash() and CheckBlock().
+    mutable uint256 hashCached;
+    mutable bool    fChecked;
+
     // Denial-of-service detection:
     mutable int nDoS;
     bool        DoS(int nDoSIn, bool fIn) const
@@ -55,6 +61,10 @@ public:
     CBlock() { SetNull(); }
 
     IMPLEMENT_SERIALIZE(
+        if (fRead) {
+            hashCached = 0;
+            fChecked   = false;
+        }
         READWRITE(this->nVersion); nVersion = this->nVersion; READWRITE(hashPrevBlock);
         READWRITE(hashMerkleRoot); READWRITE(nTime); READWRITE(nBits); READWRITE(nNonce);
 
@@ -77,6 +87,10 @@ public:
 
     uint256 GetPoWHash() const;
 
+    /** Computes the hash once for all the following calls to GetHash(). The block must not be
+     * modified afterwards. */
+    void CacheHash() const;
+
     int64_t GetBlockTime() const;
 
     void UpdateTime(const CBlockIndex* pindexPrev);
@@ -110,15 +124,7 @@ public:
 
     void print() const;
 
-    static bool CheckBIP30Attack(CTxDB& txdb, const uint256& hashTx);
-
-    struct ChainReplaceTxs
-    {
-        // transactions that are being spent in the above ones
-        std::unordered_map<uint256, CTxIndex> modifiedOutputsTxs;
-        // the common ancestor block between the new fork of the new block and the main chain
-        CBlockIndexSmartPtr commonAncestorBlockIndex;
-    };
+    static bool CheckBIP30Attack(CCoinsViewCache& view, const uint256& hashTx);
 
     struct CommonAncestorSuccessorBlocks
     {
@@ -130,10 +136,14 @@ public:
     };
 
     CommonAncestorSuccessorBlocks GetBlocksUpToCommonAncestorInMainChain() const;
-    ChainReplaceTxs               GetAlternateChainTxsUpToCommonAncestor(CTxDB& txdb) const;
 
-    bool DisconnectBlock(CTxDB& txdb, CBlockIndexSmartPtr& pindex);
-    bool ConnectBlock(CTxDB& txdb, const CBlockIndexSmartPtr& pindex, bool fJustCheck = false);
+    /** Reads the undo data written when this block was connected, or puts it together from the
+        transactions it spends if it was connected before undo data was written */
+    bool ReadUndo(CTxDB& txdb, CBlockUndo& blockundo) const;
+
+    bool DisconnectBlock(CTxDB& txdb, CBlockIndexSmartPtr& pindex, CCoinsViewCache& view);
+    bool ConnectBlock(CTxDB& txdb, const CBlockIndexSmartPtr& pindex, CCoinsViewCache& view,
+                      bool fJustCheck = false);
     bool VerifyInputsUnspent(CTxDB& txdb) const;
     bool VerifyBlock(CTxDB& txdb);
     bool ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions = true);
@@ -144,6 +154,10 @@ public:
                          CBlockIndexSmartPtr* newBlockIdxPtr      = nullptr,
                          const bool           createDbTransaction = true);
     bool CheckBlock(bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true) const;
+    /** CheckBlock() with the size limit given, for threads that don't hold cs_main, which MaxBlockSize()
+     * needs */
+    bool CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig,
+                    unsigned int nSizeLimit) const;
     bool AcceptBlock();
     bool GetCoinAge(uint64_t& nCoinAge) const; // ppcoin: calculate total coin age spent in block
     bool SignBlock(CWallet& keystore, int64_t nFees);
@@ -0,0 +1,129 @@
+#include "blockencodings.h"
+
+#include <unordered_map>
+
+#include "globals.h"
+#include "hash.h"
+#include "txmempool.h"
+#include "util.h"
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, uint64_t nNonceIn)
+    : header(block.GetBlockHeader()), nNonce(nNonceIn)
+{
+    header.vchBlockSig = block.vchBlockSig;
+    SetShortIDKeys();
+
+    // the coinbase, and the coinstake of a proof-of-stake block, can't be in the peer's memory pool
+    const unsigned int nPrefilled = block.IsProofOfStake() ? 2 : 1;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        if (i < nPrefilled)
+            vPrefilledTxs.push_back(CPrefilledTransaction(i, block.vtx[i]));
+        else
+            vShortTxIDs.push_back(GetShortID(block.vtx[i].GetHash()));
+    }
+}
+
+void CBlockHeaderAndShortTxIDs::SetShortIDKeys() const
+{
+    header.CacheHash();
+    const uint256 hashBlock = header.GetHash();
+    const uint256 hashKeys  = Hash(BEGIN(hashBlock), END(hashBlock), BEGIN(nNonce), END(nNonce));
+    memcpy(&nShortIDKey0, hashKeys.begin(), 8);
+    memcpy(&nShortIDKey1, hashKeys.begin() + 8, 8);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txid) const
+{
+    return SipHashUint256(nShortIDKey0, nShortIDKey1, txid) & 0xffffffffffffULL;
+}
+
+CompactBlockStatus CPartialBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock,
+                                           const CTxMemPool&                pool)
+{
+    // no transaction is smaller than 10 bytes
+    if (cmpctblock.header.IsNull() || cmpctblock.BlockTxCount() == 0 ||
+        cmpctblock.BlockTxCount() > MAX_BLOCK_SIZE / 10)
+        return COMPACTBLOCK_INVALID;
+
+    header = cmpctblock.header;
+    vtx.assign(cmpctblock.BlockTxCount(), CTransaction());
+    vHave.assign(cmpctblock.BlockTxCount(), false);
+
+    // the prefilled transactions are in the order of the block, and the short IDs fill the gaps
+    for (unsigned int i = 0; i < cmpctblock.vPrefilledTxs.size(); i++) {
+        const CPrefilledTransaction& prefilled = cmpctblock.vPrefilledTxs[i];
+        if (prefilled.nIndex >= vtx.size() ||
+            (i > 0 && prefilled.nIndex <= cmpctblock.vPrefilledTxs[i - 1].nIndex))
+            return COMPACTBLOCK_INVALID;
+        vtx[prefilled.nIndex]   = prefilled.tx;
+        vHave[prefilled.nIndex] = true;
+    }
+
+    std::unordered_map<uint64_t, uint32_t> mapShortIDs; // to the index in the block
+    mapShortIDs.reserve(cmpctblock.vShortTxIDs.size());
+    uint32_t nIndex = 0;
+    for (uint64_t nShortID : cmpctblock.vShortTxIDs) {
+        while (vHave[nIndex])
+            nIndex++;
+        // the sender's short IDs collided; the block has to be asked for whole
+        if (!mapShortIDs.insert(std::make_pair(nShortID, nIndex)).second)
+            return COMPACTBLOCK_FAILED;
+        nIndex++;
+    }
+
+    std::vector<bool> vCollided(vtx.size(), false);
+    {
+        LOCK(pool.cs);
+        for (const std::pair<const uint256, CTransaction>& entry : pool.mapTx) {
+            const std::unordered_map<uint64_t, uint32_t>::const_iterator it =
+                mapShortIDs.find(cmpctblock.GetShortID(entry.first));
+            if (it == mapShortIDs.end() || vCollided[it->second])
+                continue;
+            if (vHave[it->second]) {
+                // two transactions of the pool have the ID, and it's asked for instead
+                vHave[it->second]     = false;
+                vCollided[it->second] = true;
+                vtx[it->second]       = CTransaction();
+                continue;
+            }
+            vtx[it->second]   = entry.second;
+            vHave[it->second] = true;
+        }
+    }
+    return COMPACTBLOCK_OK;
+}
+
+std::vector<uint32_t> CPartialBlock::GetMissing() const
+{
+    std::vector<uint32_t> vMissing;
+    for (uint32_t i = 0; i < vHave.size(); i++)
+        if (!vHave[i])
+            vMissing.push_back(i);
+    return vMissing;
+}
+
+CompactBlockStatus CPartialBlock::FillBlock(CBlock&                          block,
+                                            const std::vector<CTransaction>& vMissingTxs) const
+{
+    block     = header;
+    block.vtx = vtx;
+    size_t nMissing = 0;
+    for (size_t i = 0; i < vHave.size(); i++) {
+        if (vHave[i])
+            continue;
+        if (nMissing >= vMissingTxs.size())
+            return COMPACTBLOCK_INVALID;
+        block.vtx[i] = vMissingTxs[nMissing++];
+    }
+    if (nMissing != vMissingTxs.size())
+        return COMPACTBLOCK_INVALID;
+
+    // a transaction of the pool that has the short ID of one of the block's makes the wrong block
+    if (block.BuildMerkleTree() != block.hashMerkleRoot) {
+        printf("CPartialBlock::FillBlock() : the transactions of compact block %s don't match its "
+               "merkle root\n",
+               header.GetHash().ToString().c_str());
+        return COMPACTBLOCK_FAILED;
+    }
+    return COMPACTBLOCK_OK;
+}
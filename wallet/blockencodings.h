@@ -0,0 +1,156 @@
+#ifndef BLOCKENCODINGS_H
+#define BLOCKENCODINGS_H
+
+#include <cstdint>
+#include <vector>
+
+#include "block.h"
+#include "serialize.h"
+#include "transaction.h"
+#include "uint256.h"
+
+class CTxMemPool;
+
+/** The version of compact block relay this node speaks, which it sends at the end of its version
+ * message when it sets NODE_COMPACT_BLOCKS */
+static const uint64_t COMPACT_BLOCKS_VERSION = 1;
+
+/** A peer that's asked for the transactions of a block deeper than this gets the whole block */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+
+/** Serializes short transaction IDs as their 6 bytes, least significant first */
+class CShortTxIDs
+{
+    std::vector<uint64_t>& v;
+
+public:
+    explicit CShortTxIDs(std::vector<uint64_t>& vIn) : v(vIn) {}
+
+    unsigned int GetSerializeSize(int /*nType*/, int /*nVersion*/) const
+    {
+        return ::GetSizeOfCompactSize(v.size()) + v.size() * 6;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int /*nType*/, int /*nVersion*/) const
+    {
+        WriteCompactSize(s, v.size());
+        for (uint64_t nShortID : v) {
+            unsigned char vch[6];
+            for (int i = 0; i < 6; i++)
+                vch[i] = static_cast<unsigned char>(nShortID >> (8 * i));
+            s.write((const char*)vch, sizeof(vch));
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int /*nType*/, int /*nVersion*/)
+    {
+        const uint64_t nSize = ReadCompactSize(s);
+        v.clear();
+        // the vector grows as the data is actually there, in case the size is a lie
+        for (uint64_t n = 0; n < nSize; n++) {
+            unsigned char vch[6];
+            s.read((char*)vch, sizeof(vch));
+            uint64_t nShortID = 0;
+            for (int i = 0; i < 6; i++)
+                nShortID |= uint64_t(vch[i]) << (8 * i);
+            v.push_back(nShortID);
+        }
+    }
+};
+
+#define SHORTTXIDS(obj) REF(CShortTxIDs(REF(obj)))
+
+/** A transaction of a compact block that's sent whole, since the peer can't have it already */
+struct CPrefilledTransaction
+{
+    uint32_t     nIndex; // in the block
+    CTransaction tx;
+
+    CPrefilledTransaction() : nIndex(0) {}
+    CPrefilledTransaction(uint32_t nIndexIn, const CTransaction& txIn) : nIndex(nIndexIn), tx(txIn) {}
+
+    IMPLEMENT_SERIALIZE(READWRITE(VARINT(nIndex)); READWRITE(tx);)
+};
+
+/**
+ * A block as it's relayed to the peers that take compact blocks ("cmpctblock"): its header and its
+ * signature, the coinbase and the coinstake, and a 6-byte ID of every other transaction, which the peer
+ * finds in its memory pool. The IDs are SipHash-2-4 of the transaction hashes, keyed with the block and
+ * a nonce that's drawn for every peer, so that nobody can make transactions whose IDs collide for all of
+ * them.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+    mutable uint64_t nShortIDKey0;
+    mutable uint64_t nShortIDKey1;
+
+    void SetShortIDKeys() const;
+
+public:
+    CBlock                             header; // no transactions, but the signature of the block
+    uint64_t                           nNonce;
+    std::vector<uint64_t>              vShortTxIDs;
+    std::vector<CPrefilledTransaction> vPrefilledTxs;
+
+    CBlockHeaderAndShortTxIDs() : nShortIDKey0(0), nShortIDKey1(0), nNonce(0) {}
+    CBlockHeaderAndShortTxIDs(const CBlock& block, uint64_t nNonceIn);
+
+    uint64_t GetShortID(const uint256& txid) const;
+
+    size_t BlockTxCount() const { return vShortTxIDs.size() + vPrefilledTxs.size(); }
+
+    IMPLEMENT_SERIALIZE(READWRITE(header); READWRITE(nNonce); READWRITE(SHORTTXIDS(vShortTxIDs));
+                        READWRITE(vPrefilledTxs); if (fRead) SetShortIDKeys();)
+};
+
+/** The transactions of a block that a peer couldn't find from its compact block ("getblocktxn") */
+struct CBlockTransactionsRequest
+{
+    uint256               hashBlock;
+    std::vector<uint32_t> vIndexes;
+
+    IMPLEMENT_SERIALIZE(READWRITE(hashBlock); READWRITE(vIndexes);)
+};
+
+/** The answer to CBlockTransactionsRequest, in the order of the request ("blocktxn") */
+struct CBlockTransactions
+{
+    uint256                   hashBlock;
+    std::vector<CTransaction> vtx;
+
+    IMPLEMENT_SERIALIZE(READWRITE(hashBlock); READWRITE(vtx);)
+};
+
+enum CompactBlockStatus
+{
+    COMPACTBLOCK_OK,
+    // what the peer sent is malformed
+    COMPACTBLOCK_INVALID,
+    // the block couldn't be put together, most likely because short IDs collided; it's asked for whole
+    COMPACTBLOCK_FAILED,
+};
+
+/** A block that's being put together from its compact block and the memory pool */
+class CPartialBlock
+{
+    CBlock                    header;
+    std::vector<CTransaction> vtx;
+    std::vector<bool>         vHave;
+
+public:
+    /** Takes the prefilled transactions, and the ones of the memory pool that have the short IDs of the
+     * block; a short ID that two transactions of the pool have is left missing */
+    CompactBlockStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool);
+
+    uint256 GetBlockHash() const { return header.GetHash(); }
+
+    /** The indexes of the transactions that have to be asked for, in ascending order */
+    std::vector<uint32_t> GetMissing() const;
+
+    /** Puts the block together with the missing transactions, in the order of GetMissing() */
+    CompactBlockStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vMissingTxs) const;
+};
+
+#endif // BLOCKENCODINGS_H
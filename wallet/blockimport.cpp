@@ -0,0 +1,251 @@
+#include "blockimport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/thread.hpp>
+
+#include "block.h"
+#include "blockprune.h"
+#include "bootstrap.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+namespace {
+// blocks are prepared one batch ahead of the batch being processed
+const size_t IMPORT_BATCH_BLOCKS = 1000;
+const size_t IMPORT_BATCH_BYTES  = 64 * 1024 * 1024;
+
+struct CImportBlock
+{
+    CExternalBlockPos       pos;
+    std::unique_ptr<CBlock> pblock; // null if it couldn't be deserialized
+};
+
+std::vector<CImportBlock> CollectImportBatch(const std::vector<CExternalBlockPos>& vPositions,
+                                             size_t&                               nNext)
+{
+    std::vector<CImportBlock> vBatch;
+    size_t                    nBytes = 0;
+    while (nNext < vPositions.size() && vBatch.size() < IMPORT_BATCH_BLOCKS &&
+           nBytes < IMPORT_BATCH_BYTES) {
+        CImportBlock ib;
+        ib.pos = vPositions[nNext++];
+        nBytes += ib.pos.nSize;
+        vBatch.push_back(std::move(ib));
+    }
+    return vBatch;
+}
+
+/** The size limit of the blocks at the height of the chain, which the import workers check against */
+unsigned int GetImportSizeLimit()
+{
+    LOCK(cs_main);
+    return MaxBlockSize();
+}
+
+/** Deserializes and checks the blocks of a batch; the workers don't hold cs_main, so the size limit of
+ * the blocks, which depends on the forks that are active, is taken before they start */
+void PrepareImportBatch(std::vector<CImportBlock>& vBatch, const char* pchFile, unsigned int nThreads,
+                        unsigned int nSizeLimit)
+{
+    std::atomic<size_t> nNext(0);
+    auto                worker = [&]() {
+        size_t i;
+        while ((i = nNext++) < vBatch.size() && !fShutdown) {
+            CImportBlock& ib = vBatch[i];
+            try {
+                CDataStream ss(pchFile + ib.pos.nOffset, pchFile + ib.pos.nOffset + ib.pos.nSize,
+                               SER_DISK, CLIENT_VERSION);
+                std::unique_ptr<CBlock> pblock(new CBlock);
+                ss >> *pblock;
+                pblock->CacheHash();
+                // a block that fails here is checked again when it's processed, since the size
+                // limit depends on the height of the chain at that point
+                pblock->fChecked = pblock->CheckBlock(true, true, true, nSizeLimit);
+                ib.pblock        = std::move(pblock);
+            } catch (std::exception& e) {
+                printf("LoadExternalBlockFile() : failed to deserialize the block at file pos %u: "
+                       "%s\n",
+                       (unsigned int)ib.pos.nOffset, e.what());
+            }
+        }
+    };
+
+    boost::thread_group threads;
+    for (unsigned int i = 1; i < nThreads; i++)
+        threads.create_thread(worker);
+    worker();
+    threads.join_all();
+}
+} // namespace
+
+std::vector<CExternalBlockPos> FindExternalBlocks(const char* pch, size_t nLen, unsigned int nSizeLimit)
+{
+    static const size_t HEADER_SIZE = sizeof(pchMessageStart) + sizeof(uint32_t);
+
+    std::vector<CExternalBlockPos> vPositions;
+    size_t                         nPos = 0;
+    while (nPos + HEADER_SIZE <= nLen) {
+        const void* pFound = memchr(pch + nPos, pchMessageStart[0], nLen - HEADER_SIZE + 1 - nPos);
+        if (!pFound)
+            break;
+        nPos = static_cast<const char*>(pFound) - pch;
+        if (memcmp(pch + nPos, pchMessageStart, sizeof(pchMessageStart)) != 0) {
+            nPos++;
+            continue;
+        }
+        uint32_t nSize;
+        memcpy(&nSize, pch + nPos + sizeof(pchMessageStart), sizeof(nSize));
+        if (nSize == 0 || nSize > nSizeLimit || nSize > nLen - nPos - HEADER_SIZE) {
+            nPos++;
+            continue;
+        }
+        vPositions.push_back(CExternalBlockPos{nPos + HEADER_SIZE, nSize});
+        nPos += HEADER_SIZE + nSize;
+    }
+    return vPositions;
+}
+
+namespace {
+/** Imports the blocks of a plain block file, or of a decompressed chunk of a compressed one */
+int ImportExternalBlocks(const char* pch, size_t nLen, unsigned int nThreads)
+{
+    int64_t nStart = GetTimeMillis();
+
+    // the limit of the chain at the height being imported is checked when the blocks are processed
+    const std::vector<CExternalBlockPos> vPositions =
+        FindExternalBlocks(pch, nLen, std::max(MAX_BLOCK_SIZE, OLD_MAX_BLOCK_SIZE));
+    LogPrint(LOG_IMPORT, "Found %u blocks in %" PRId64 "ms\n", (unsigned int)vPositions.size(),
+             GetTimeMillis() - nStart);
+
+    int                       nLoaded = 0;
+    size_t                    nNext   = 0;
+    std::vector<CImportBlock> vBatch  = CollectImportBatch(vPositions, nNext);
+    PrepareImportBatch(vBatch, pch, nThreads, GetImportSizeLimit());
+    while (!vBatch.empty() && !fRequestShutdown && !fShutdown) {
+        // prepare the next batch while this one is being processed; the limit only grows with the chain,
+        // so the one of the chain before the batch is never too large for its blocks
+        std::vector<CImportBlock> vNextBatch = CollectImportBatch(vPositions, nNext);
+        const unsigned int        nSizeLimit = GetImportSizeLimit();
+        boost::thread             prefetcher(
+            [&]() { PrepareImportBatch(vNextBatch, pch, nThreads, nSizeLimit); });
+
+        // the blocks are written to the database in batches, and cs_main is held until a batch is
+        // committed
+        size_t i = 0;
+        while (i < vBatch.size() && !fRequestShutdown && !fShutdown) {
+            LOCK(cs_main);
+            CTxDBBatchScope dbBatch;
+            do {
+                CImportBlock& ib = vBatch[i++];
+                if (!ib.pblock)
+                    continue;
+                LogPrint(LOG_IMPORT, "Processing block at file pos: %u\n", (unsigned int)ib.pos.nOffset);
+                try {
+                    if (ProcessBlock(NULL, ib.pblock.get()))
+                        nLoaded++;
+                } catch (std::exception& e) {
+                    printf("LoadExternalBlockFile() : error while processing the block at file pos %u: "
+                           "%s\n",
+                           (unsigned int)ib.pos.nOffset, e.what());
+                }
+                ib.pblock.reset();
+            } while (i < vBatch.size() && !dbBatch.IsDue() && !fRequestShutdown && !fShutdown);
+        }
+        // the batches are committed by now, so the old blocks can be pruned
+        PruneBlocksIfNeeded();
+
+        prefetcher.join();
+        vBatch.swap(vNextBatch);
+    }
+    return nLoaded;
+}
+
+/**
+ * Imports the chunks of a compressed bootstrap file in order, decompressing the next chunk while
+ * the blocks of the current one are processed. The chunks at the start of the file whose last block
+ * is known already are skipped, so an interrupted import continues where it stopped.
+ */
+int ImportCompressedBootstrap(const char* pch, size_t nLen, unsigned int nThreads)
+{
+    std::vector<CBootstrapChunk> vChunks;
+    if (!ReadBootstrapIndex(pch, nLen, vChunks))
+        return 0;
+
+    // The blocks of the file are numbered from the genesis block, so the first chunk that isn't known
+    // is normally the one with the block after the best one. The chunks before it are checked against
+    // the block index, since the file may be of another chain from some point on.
+    size_t nFirstChunk = 0;
+    {
+        LOCK(cs_main);
+        const int nChunk = FindBootstrapChunk(vChunks, nBestHeight + 1);
+        nFirstChunk      = nChunk < 0 ? vChunks.size() : nChunk;
+        while (nFirstChunk > 0 && !mapBlockIndex.count(vChunks[nFirstChunk - 1].hashLastBlock))
+            nFirstChunk--;
+    }
+    if (nFirstChunk > 0) {
+        printf("Skipping %u chunks (%u blocks) of the bootstrap file that are known already\n",
+               (unsigned int)nFirstChunk,
+               vChunks[nFirstChunk - 1].nFirstBlock + vChunks[nFirstChunk - 1].nBlocks);
+    }
+
+    auto decompress = [&](size_t nChunk, std::string& strRecords) {
+        try {
+            strRecords = DecompressBootstrapChunk(pch, vChunks[nChunk]);
+        } catch (std::exception& e) {
+            printf("LoadExternalBlockFile() : failed to decompress the chunk at file pos %" PRIu64
+                   ": %s\n",
+                   vChunks[nChunk].nOffset, e.what());
+            strRecords.clear();
+        }
+    };
+
+    int         nLoaded = 0;
+    std::string strRecords;
+    if (nFirstChunk < vChunks.size())
+        decompress(nFirstChunk, strRecords);
+    for (size_t i = nFirstChunk; i < vChunks.size() && !fRequestShutdown && !fShutdown; i++) {
+        std::string   strNextRecords;
+        boost::thread prefetcher([&]() {
+            if (i + 1 < vChunks.size())
+                decompress(i + 1, strNextRecords);
+        });
+        nLoaded += ImportExternalBlocks(strRecords.data(), strRecords.size(), nThreads);
+        prefetcher.join();
+        strRecords.swap(strNextRecords);
+    }
+    return nLoaded;
+}
+} // namespace
+
+bool LoadExternalBlockFile(const boost::filesystem::path& path)
+{
+    int64_t nStart = GetTimeMillis();
+
+    boost::iostreams::mapped_file_source file;
+    try {
+        file.open(path.string());
+    } catch (std::exception& e) {
+        printf("LoadExternalBlockFile() : failed to map %s: %s\n", path.string().c_str(), e.what());
+        return false;
+    }
+    if (!file.is_open())
+        return false;
+
+    const unsigned int nThreads = std::max(1u, boost::thread::hardware_concurrency());
+
+    int nLoaded;
+    if (IsCompressedBootstrap(file.data(), file.size()))
+        nLoaded = ImportCompressedBootstrap(file.data(), file.size(), nThreads);
+    else
+        nLoaded = ImportExternalBlocks(file.data(), file.size(), nThreads);
+
+    printf("Loaded %i blocks from external file %s in %" PRId64 "ms\n", nLoaded,
+           path.string().c_str(), GetTimeMillis() - nStart);
+    return nLoaded > 0;
+}
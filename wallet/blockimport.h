@@ -0,0 +1,33 @@
+#ifndef BLOCKIMPORT_H
+#define BLOCKIMPORT_H
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** Where a block is in a block file (bootstrap.dat or a blk000?.dat file given with -loadblock) */
+struct CExternalBlockPos
+{
+    size_t       nOffset; // of the serialized block, after the message start and the size
+    unsigned int nSize;
+};
+
+/**
+ * Finds the blocks of a block file, which are stored one after the other, each preceded by the
+ * message start and its size. Whatever can't be the start of a block is skipped, looking for the
+ * next message start; sizes that are zero, above nSizeLimit or past the end of the file are taken
+ * to be garbage.
+ */
+std::vector<CExternalBlockPos> FindExternalBlocks(const char* pch, size_t nLen, unsigned int nSizeLimit);
+
+/**
+ * Imports the blocks of a block file. The file is memory mapped and its blocks located first;
+ * then batches of blocks are deserialized, hashed and put through the checks that don't depend on
+ * the chain on worker threads, while the previous batch is being processed.
+ * Compressed bootstrap files (see bootstrap.h) are imported chunk by chunk the same way.
+ * Returns whether any block was imported.
+ */
+bool LoadExternalBlockFile(const boost::filesystem::path& path);
+
+#endif // BLOCKIMPORT_H
@@ -16,6 +16,7 @@ CBlockIndex::CBlockIndex()
     nMint                  = 0;
     nMoneySupply           = 0;
     nFlags                 = 0;
+    nStatus                = BLOCK_VALID_TRANSACTIONS;
     nStakeModifier         = 0;
     nStakeModifierChecksum = 0;
     hashProof              = 0;
@@ -40,6 +41,7 @@ CBlockIndex::CBlockIndex(uint256 nBlockPosIn, CBlock& block)
     nMint                  = 0;
     nMoneySupply           = 0;
     nFlags                 = 0;
+    nStatus                = BLOCK_VALID_TRANSACTIONS;
     nStakeModifier         = 0;
     nStakeModifierChecksum = 0;
     hashProof              = 0;
@@ -35,6 +35,19 @@ public:
         BLOCK_STAKE_MODIFIER = (1 << 2), // regenerated stake modifier
     };
 
+    unsigned int nStatus; // how much of the block is known to be valid, and whether it's still stored;
+                          // in-memory only
+    enum
+    {
+        // only the header is known, which was checked by AcceptBlockHeader() (see headerchain.h)
+        BLOCK_VALID_HEADER = 1,
+        // the block is stored, after CBlock::AcceptBlock() checked it whole
+        BLOCK_VALID_TRANSACTIONS = 2,
+        BLOCK_VALID_MASK         = 3,
+        // the block was pruned, and only its header is left (see PruneBlocks() and LoadPrunedBlocks())
+        BLOCK_PRUNED = 8,
+    };
+
     uint64_t     nStakeModifier;         // hash modifier for proof-of-stake
     unsigned int nStakeModifierChecksum; // checksum of index; in-memeory only
 
@@ -65,6 +78,8 @@ public:
 
     bool IsInMainChain() const;
 
+    bool IsHeaderOnly() const { return (nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS; }
+
     bool CheckIndex() const { return true; }
 
     int64_t GetPastTimeLimit() const { return GetMedianTimePast(); }
@@ -0,0 +1,321 @@
+#include "blockprune.h"
+
+#include <algorithm>
+#include <limits>
+#include <set>
+
+#include "addrindex.h"
+#include "block.h"
+#include "blockindex.h"
+#include "coins.h"
+#include "main.h"
+#include "ntp1/ntp1transaction.h"
+#include "tokenindex.h"
+#include "txdb.h"
+#include "txindex.h"
+#include "util.h"
+
+boost::atomic<uint64_t> nPruneTarget(0);
+boost::atomic<int>      nPruneHeight(0);
+
+namespace {
+// the blocks erased from the database in one transaction
+const int PRUNE_BATCH_BLOCKS = 500;
+
+bool IsSpendable(const CTxOut& txout)
+{
+    return !txout.IsEmpty() && !(!txout.scriptPubKey.empty() && txout.scriptPubKey[0] == OP_RETURN);
+}
+
+/** Whether a transaction of a block that's pruned may still be read (see PruneBlocks()) */
+bool IsTxNeeded(const CTransaction& tx, const CTxIndex& txindex, int nLastPrunable)
+{
+    bool fNeeded = NTP1Transaction::IsTxNTP1(&tx);
+    for (unsigned int i = 0; !fNeeded && i < txindex.vSpent.size() && i < tx.vout.size(); i++) {
+        if (!IsSpendable(tx.vout[i]))
+            continue;
+        const CDiskTxPos& posSpent = txindex.vSpent[i];
+        if (posSpent.IsNull()) {
+            fNeeded = true;
+            continue;
+        }
+        BlockIndexMapType::const_iterator mi = mapBlockIndex.find(posSpent.nBlockPos);
+        fNeeded = mi == mapBlockIndex.end() || mi->second->nHeight > nLastPrunable;
+    }
+    return fNeeded;
+}
+
+/** Keeps the transactions of a block that's pruned that may still be read; and drops the ones that
+ * were kept for the block spending them, since it's pruned now as well */
+bool KeepNeededTxs(CTxDB& txdb, const CBlock& block, const uint256& hashBlock, int nLastPrunable)
+{
+    std::set<uint256> setPrevTxs;
+    for (const CTransaction& tx : block.vtx) {
+        // a transaction that isn't indexed at this block isn't in the main chain here
+        CTxIndex txindex;
+        if (!txdb.ReadTxIndex(tx.GetHash(), txindex) || txindex.pos.nBlockPos != hashBlock)
+            continue;
+        if (!tx.IsCoinBase())
+            for (const CTxIn& txin : tx.vin)
+                setPrevTxs.insert(txin.prevout.hash);
+
+        if (IsTxNeeded(tx, txindex, nLastPrunable) && !txdb.WritePrunedTx(txindex.pos, tx))
+            return error("KeepNeededTxs() : failed to keep transaction %s",
+                         tx.GetHash().ToString().c_str());
+    }
+
+    for (const uint256& hashPrev : setPrevTxs) {
+        CTxIndex     txindex;
+        CTransaction txPrev;
+        if (!txdb.ReadTxIndex(hashPrev, txindex) || !txdb.ReadPrunedTx(txindex.pos, txPrev) ||
+            IsTxNeeded(txPrev, txindex, nLastPrunable))
+            continue;
+        if (!txdb.ErasePrunedTx(txindex.pos))
+            return error("KeepNeededTxs() : failed to drop transaction %s", hashPrev.ToString().c_str());
+    }
+    return true;
+}
+
+/** The height of the block up to which the coins are written, or -1 if they're missing or not on the
+ * main chain; the blocks after it are read again on startup if the coins in memory are lost (see
+ * CTxDB::LoadCoins()) */
+int GetCoinsWrittenHeight(CTxDB& txdb)
+{
+    uint256 hashCoinsBest;
+    if (!txdb.ReadCoinsBestBlock(hashCoinsBest))
+        return -1;
+    BlockIndexMapType::const_iterator mi = mapBlockIndex.find(hashCoinsBest);
+    if (mi == mapBlockIndex.end() || !mi->second->IsInMainChain())
+        return -1;
+    return mi->second->nHeight;
+}
+
+bool PruneBlockFiles(CTxDB& txdb, uint64_t nTarget, int nLastPrunable)
+{
+    const std::map<uint32_t, uint64_t> mapFileSizes = glob_blockStore->GetFileSizes();
+    uint64_t                           nTotal       = 0;
+    for (const std::pair<const uint32_t, uint64_t>& entry : mapFileSizes)
+        nTotal += entry.second;
+    if (nTotal <= nTarget)
+        return true;
+
+    // the blocks of each file and the highest of them; the blocks were migrated from the database in
+    // the order of their hashes, so a file isn't necessarily below the ones after it
+    std::vector<std::pair<uint256, CBlockFilePos>> vPositions;
+    if (!txdb.ReadBlockFilePositions(vPositions))
+        return false;
+    std::map<uint32_t, int>                  mapFileMaxHeights;
+    std::map<uint32_t, std::vector<uint256>> mapFileBlocks;
+    for (const std::pair<uint256, CBlockFilePos>& entry : vPositions) {
+        mapFileBlocks[entry.second.nFile].push_back(entry.first);
+        int& nMaxHeight = mapFileMaxHeights.emplace(entry.second.nFile, 0).first->second;
+        // a block that isn't in the index can't be read through it anyway
+        BlockIndexMapType::const_iterator mi = mapBlockIndex.find(entry.first);
+        if (mi != mapBlockIndex.end())
+            nMaxHeight = std::max(nMaxHeight, mi->second->nHeight);
+    }
+
+    for (uint32_t nFile : SelectBlockFilesToPrune(mapFileSizes, mapFileMaxHeights, nTarget,
+                                                  nLastPrunable)) {
+        const int nHeight = std::max<int>(nPruneHeight, mapFileMaxHeights[nFile]);
+        if (!txdb.TxnBegin())
+            return error("PruneBlockFiles() : TxnBegin failed");
+        for (const uint256& hash : mapFileBlocks[nFile]) {
+            CBlock block;
+            if (mapBlockIndex.count(hash) &&
+                (!txdb.ReadBlock(hash, block) || !KeepNeededTxs(txdb, block, hash, nLastPrunable))) {
+                txdb.TxnAbort();
+                return error("PruneBlockFiles() : failed to keep the transactions of block %s",
+                             hash.ToString().c_str());
+            }
+            if (!txdb.EraseBlock(hash)) {
+                txdb.TxnAbort();
+                return error("PruneBlockFiles() : failed to erase block %s", hash.ToString().c_str());
+            }
+        }
+        if (!txdb.WritePruneHeight(nHeight)) {
+            txdb.TxnAbort();
+            return error("PruneBlockFiles() : failed to write the prune height");
+        }
+        if (!txdb.TxnCommit())
+            return error("PruneBlockFiles() : TxnCommit failed");
+        nPruneHeight = nHeight;
+        for (const uint256& hash : mapFileBlocks[nFile]) {
+            BlockIndexMapType::const_iterator mi = mapBlockIndex.find(hash);
+            if (mi != mapBlockIndex.end())
+                mi->second->nStatus |= CBlockIndex::BLOCK_PRUNED;
+        }
+
+        // nothing refers to the file anymore; if it can't be removed, it's only left behind
+        glob_blockStore->RemoveFile(nFile);
+        printf("Pruned block file %u with %u blocks, up to height %d\n", nFile,
+               (unsigned int)mapFileBlocks[nFile].size(), mapFileMaxHeights[nFile]);
+    }
+    return true;
+}
+
+bool PruneBlocksInDb(CTxDB& txdb, uint64_t nTarget, int nLastPrunable)
+{
+    uint64_t nSize = 0;
+    if (!txdb.GetBlocksDbSize(nSize))
+        return false;
+    if (nSize <= nTarget)
+        return true;
+
+    // the first block that isn't pruned yet
+    CBlockIndexSmartPtr pindex = boost::atomic_load(&pindexBest);
+    while (pindex && pindex->nHeight > nPruneHeight + 1)
+        pindex = pindex->pprev;
+
+    while (pindex && pindex->nHeight <= nLastPrunable && nSize > nTarget) {
+        if (fShutdown || fRequestShutdown)
+            return true;
+        if (!txdb.TxnBegin())
+            return error("PruneBlocksInDb() : TxnBegin failed");
+        int                              nHeight = nPruneHeight;
+        std::vector<CBlockIndexSmartPtr> vPruned;
+        for (int i = 0; i < PRUNE_BATCH_BLOCKS && pindex && pindex->nHeight <= nLastPrunable &&
+                        nSize > nTarget;
+             i++, pindex = pindex->pnext) {
+            // the size of the block in the database is about that of the serialized block
+            CBlock block;
+            if (txdb.ReadBlock(pindex->blockKeyInDB, block)) {
+                nSize -= std::min<uint64_t>(nSize, ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION));
+                if (!KeepNeededTxs(txdb, block, pindex->blockKeyInDB, nLastPrunable) ||
+                    !txdb.EraseBlock(pindex->blockKeyInDB)) {
+                    txdb.TxnAbort();
+                    return error("PruneBlocksInDb() : failed to prune block %s",
+                                 pindex->GetBlockHash().ToString().c_str());
+                }
+            }
+            nHeight = pindex->nHeight;
+            vPruned.push_back(pindex);
+        }
+        if (!txdb.WritePruneHeight(nHeight)) {
+            txdb.TxnAbort();
+            return error("PruneBlocksInDb() : failed to write the prune height");
+        }
+        if (!txdb.TxnCommit())
+            return error("PruneBlocksInDb() : TxnCommit failed");
+        nPruneHeight = nHeight;
+        for (const CBlockIndexSmartPtr& pindexPruned : vPruned)
+            pindexPruned->nStatus |= CBlockIndex::BLOCK_PRUNED;
+        printf("Pruned the blocks up to height %d\n", nHeight);
+    }
+    return true;
+}
+} // namespace
+
+bool IsBlockPruned(const CBlockIndex* pindex) { return pindex->nStatus & CBlockIndex::BLOCK_PRUNED; }
+
+bool LoadPrunedBlocks(CTxDB& txdb)
+{
+    const int nHeight = nPruneHeight;
+    if (nHeight == 0)
+        return true;
+
+    if (!glob_blockStore) {
+        // the blocks are erased from the database along the main chain, from the first one on
+        CBlockIndexSmartPtr pindex = boost::atomic_load(&pindexBest);
+        for (; pindex; pindex = pindex->pprev)
+            if (pindex->nHeight <= nHeight)
+                pindex->nStatus |= CBlockIndex::BLOCK_PRUNED;
+        return true;
+    }
+
+    // the positions of a file's blocks are erased with it; they're read in the order of the hashes
+    std::vector<std::pair<uint256, CBlockFilePos>> vPositions;
+    if (!txdb.ReadBlockFilePositions(vPositions))
+        return false;
+    std::vector<uint256> vStored;
+    vStored.reserve(vPositions.size());
+    for (const std::pair<uint256, CBlockFilePos>& entry : vPositions)
+        vStored.push_back(entry.first);
+    std::sort(vStored.begin(), vStored.end());
+
+    unsigned int nPruned = 0;
+    for (const std::pair<const uint256, CBlockIndexSmartPtr>& item : mapBlockIndex) {
+        if (item.second->nHeight <= nHeight &&
+            !std::binary_search(vStored.begin(), vStored.end(), item.first)) {
+            item.second->nStatus |= CBlockIndex::BLOCK_PRUNED;
+            nPruned++;
+        }
+    }
+    printf("LoadPrunedBlocks() : %u blocks up to height %d are pruned\n", nPruned, nHeight);
+    return true;
+}
+
+std::vector<uint32_t> SelectBlockFilesToPrune(const std::map<uint32_t, uint64_t>& mapFileSizes,
+                                              const std::map<uint32_t, int>& mapFileMaxHeights,
+                                              uint64_t nTarget, int nLastPrunable)
+{
+    std::vector<uint32_t> vFiles;
+    if (mapFileSizes.empty())
+        return vFiles;
+
+    uint64_t nTotal = 0;
+    for (const std::pair<const uint32_t, uint64_t>& entry : mapFileSizes)
+        nTotal += entry.second;
+
+    const uint32_t nLastFile = mapFileSizes.rbegin()->first;
+    for (const std::pair<const uint32_t, uint64_t>& entry : mapFileSizes) {
+        if (nTotal <= nTarget || entry.first == nLastFile)
+            break;
+        std::map<uint32_t, int>::const_iterator it = mapFileMaxHeights.find(entry.first);
+        if (it != mapFileMaxHeights.end() && it->second > nLastPrunable)
+            continue;
+        vFiles.push_back(entry.first);
+        nTotal -= entry.second;
+    }
+    return vFiles;
+}
+
+bool PruneBlocks(CTxDB& txdb)
+{
+    AssertLockHeld(cs_main);
+
+    const uint64_t      nTarget       = nPruneTarget;
+    CBlockIndexSmartPtr pindexBestPtr = boost::atomic_load(&pindexBest);
+    if (nTarget == 0 || !pindexBestPtr)
+        return true;
+    int nLastPrunable = pindexBestPtr->nHeight - MIN_BLOCKS_TO_KEEP;
+    // the background builds of the indexes still read the blocks they didn't get to
+    if (fAddrIndex && !fAddrIndexSynced)
+        nLastPrunable = std::min<int>(nLastPrunable, nAddrIndexHeight);
+    if (fTokenIndex && !fTokenIndexSynced)
+        nLastPrunable = std::min<int>(nLastPrunable, nTokenIndexHeight);
+    if (nLastPrunable <= 0)
+        return true;
+
+    // the coins are written before the blocks after them are pruned, rather than when the cache is
+    // full, since they couldn't be brought up to date on startup otherwise
+    if (pcoinsTip && GetCoinsWrittenHeight(txdb) < nLastPrunable) {
+        if (!FlushCoinsCache(true))
+            return error("PruneBlocks() : failed to write the coins");
+        nLastPrunable = std::min(nLastPrunable, GetCoinsWrittenHeight(txdb));
+        if (nLastPrunable <= 0)
+            return true;
+    }
+
+    if (glob_blockStore)
+        return PruneBlockFiles(txdb, nTarget, nLastPrunable);
+    if (nLastPrunable <= nPruneHeight)
+        return true;
+    return PruneBlocksInDb(txdb, nTarget, nLastPrunable);
+}
+
+void PruneBlocksIfNeeded()
+{
+    static int nLastCheckHeight = 0; // guarded by cs_main
+
+    if (nPruneTarget == 0 || CTxDBBatchScope::IsActive())
+        return;
+    LOCK(cs_main);
+    if (nBestHeight < nLastCheckHeight + PRUNE_CHECK_INTERVAL)
+        return;
+    nLastCheckHeight = nBestHeight;
+
+    CTxDB txdb;
+    if (!PruneBlocks(txdb))
+        printf("PruneBlocksIfNeeded() : pruning the blocks failed\n");
+}
@@ -0,0 +1,70 @@
+#ifndef BLOCKPRUNE_H
+#define BLOCKPRUNE_H
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <boost/atomic.hpp>
+
+class CBlockIndex;
+class CTxDB;
+
+/** The blocks below the best one that are never pruned, so that reorganizations still find the blocks
+ * and undo data they need; about a day of blocks */
+static const int MIN_BLOCKS_TO_KEEP = 2880;
+
+/** The smallest -prune target, in MB */
+static const uint64_t MIN_PRUNE_TARGET_MB = 550;
+
+/** How many blocks the best one moves between two checks of whether there's something to prune */
+static const int PRUNE_CHECK_INTERVAL = 100;
+
+/** -prune in bytes, or 0 if the blocks aren't pruned */
+extern boost::atomic<uint64_t> nPruneTarget;
+
+/** The height of the highest block that was pruned, now or in an earlier run; 0 if no block was pruned
+ * ever. The blocks below it aren't necessarily pruned, since the block files don't follow the heights
+ * (see IsBlockPruned()). */
+extern boost::atomic<int> nPruneHeight;
+
+/** Whether the block was pruned, in which case only its header is left */
+bool IsBlockPruned(const CBlockIndex* pindex);
+
+/** Marks the blocks of the block index that were pruned in an earlier run (see
+ * CBlockIndex::BLOCK_PRUNED): those whose position in the block files is gone, or with the blocks in the
+ * database, those of the main chain up to nPruneHeight */
+bool LoadPrunedBlocks(CTxDB& txdb);
+
+/**
+ * Picks the block files to remove to bring the blocks down to nTarget bytes, oldest file first. The
+ * last file is appended to, and the files with a block above nLastPrunable are still needed, so
+ * they're never picked.
+ */
+std::vector<uint32_t> SelectBlockFilesToPrune(const std::map<uint32_t, uint64_t>& mapFileSizes,
+                                              const std::map<uint32_t, int>& mapFileMaxHeights,
+                                              uint64_t nTarget, int nLastPrunable);
+
+/**
+ * Deletes the oldest blocks of the main chain while the blocks take more than nPruneTarget, keeping
+ * the last MIN_BLOCKS_TO_KEEP of them. With -flatblockfiles, whole block files are removed; otherwise,
+ * the blocks are erased from the database one by one, and LMDB reuses their pages.
+ *
+ * Before a block goes, its transactions that may still be read are kept on their own (see
+ * CTxDB::WritePrunedTx()): those with outputs that are unspent, or were spent in a block that isn't
+ * pruned yet and could be disconnected, since they're the inputs of the transactions being validated
+ * and staked; and the NTP1 ones, since tokens are resolved through their inputs and their issuances.
+ * The ones that were kept for a block spending them are dropped when that block is pruned. Headers are
+ * read from the block index (see CTxDB::ReadBlock()). The coins are written first if they lag behind
+ * the blocks to prune, since the blocks after them are read again on startup.
+ *
+ * cs_main has to be held, and there can't be a batch on the thread (see CTxDBBatchScope), since files
+ * are only removed once the erasure of their blocks is committed.
+ */
+bool PruneBlocks(CTxDB& txdb);
+
+/** Prunes the blocks every PRUNE_CHECK_INTERVAL blocks, if -prune is set; does nothing while there's a
+ * batch on the thread, so it's called again once the batch is committed */
+void PruneBlocksIfNeeded();
+
+#endif // BLOCKPRUNE_H
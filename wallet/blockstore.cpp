@@ -0,0 +1,260 @@
+#include "blockstore.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "protocol.h"
+#include "util.h"
+
+namespace {
+uint32_t GetChecksum(const char* pch, size_t nLen)
+{
+    boost::crc_32_type crc;
+    crc.process_bytes(pch, nLen);
+    return crc.checksum();
+}
+} // namespace
+
+const uint32_t CBlockStore::DEFAULT_MAX_FILE_SIZE;
+const uint32_t CBlockStore::RECORD_HEADER_SIZE;
+
+CBlockStore::CBlockStore(const boost::filesystem::path& dirIn, uint32_t nMaxFileSizeIn)
+    : dir(dirIn), nMaxFileSize(nMaxFileSizeIn), fileAppend(nullptr), nAppendFile(0), nAppendSize(0),
+      fDirty(false)
+{
+    boost::filesystem::create_directories(dir);
+
+    // appending continues in the last file; the first ones may have been pruned
+    for (boost::filesystem::directory_iterator it(dir); it != boost::filesystem::directory_iterator();
+         ++it) {
+        unsigned int nFile;
+        char         chEnd;
+        if (sscanf(it->path().filename().string().c_str(), "blk%u.da%c", &nFile, &chEnd) == 2 &&
+            chEnd == 't' && nFile > nAppendFile)
+            nAppendFile = nFile;
+    }
+    if (!OpenAppendFile(nAppendFile))
+        throw std::runtime_error("Failed to open the block file " +
+                                 GetFilePath(nAppendFile).string());
+}
+
+CBlockStore::~CBlockStore()
+{
+    Flush();
+    if (fileAppend)
+        fclose(fileAppend);
+}
+
+boost::filesystem::path CBlockStore::GetFilePath(uint32_t nFile) const
+{
+    return dir / strprintf("blk%05u.dat", nFile);
+}
+
+bool CBlockStore::OpenAppendFile(uint32_t nFile)
+{
+    FILE* file = fopen(GetFilePath(nFile).string().c_str(), "ab");
+    if (!file)
+        return error("CBlockStore::OpenAppendFile() : failed to open %s",
+                     GetFilePath(nFile).string().c_str());
+    if (fseek(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        return error("CBlockStore::OpenAppendFile() : failed to seek in %s",
+                     GetFilePath(nFile).string().c_str());
+    }
+    long nSize = ftell(file);
+    if (nSize < 0) {
+        fclose(file);
+        return error("CBlockStore::OpenAppendFile() : failed to get the size of %s",
+                     GetFilePath(nFile).string().c_str());
+    }
+    if (fileAppend) {
+        // the file being left is synced now, so that Flush() only has the new one to sync
+        if (fDirty)
+            FileCommit(fileAppend);
+        fclose(fileAppend);
+    }
+    fileAppend  = file;
+    nAppendFile = nFile;
+    nAppendSize = static_cast<uint32_t>(nSize);
+    return true;
+}
+
+bool CBlockStore::Append(const char* pch, uint32_t nSize, CBlockFilePos& posRet)
+{
+    LOCK(cs);
+
+    if (!fileAppend && !OpenAppendFile(nAppendFile))
+        return false;
+    if (nAppendSize > 0 && nAppendSize + RECORD_HEADER_SIZE + nSize > nMaxFileSize &&
+        !OpenAppendFile(nAppendFile + 1))
+        return false;
+
+    char header[RECORD_HEADER_SIZE];
+    const uint32_t nChecksum = GetChecksum(pch, nSize);
+    memcpy(header, pchMessageStart, sizeof(pchMessageStart));
+    memcpy(header + 4, &nSize, sizeof(nSize));
+    memcpy(header + 8, &nChecksum, sizeof(nChecksum));
+
+    // readers use files of their own, so whatever is appended has to leave the buffer right away
+    fDirty = true;
+    if (fwrite(header, 1, sizeof(header), fileAppend) != sizeof(header) ||
+        fwrite(pch, 1, nSize, fileAppend) != nSize || fflush(fileAppend) != 0) {
+        error("CBlockStore::Append() : failed to write to %s",
+              GetFilePath(nAppendFile).string().c_str());
+        DiscardPartialRecord();
+        return false;
+    }
+
+    posRet = CBlockFilePos(nAppendFile, nAppendSize + RECORD_HEADER_SIZE, nSize);
+    nAppendSize += RECORD_HEADER_SIZE + nSize;
+    return true;
+}
+
+void CBlockStore::DiscardPartialRecord()
+{
+    // Whatever part of the record got written is cut off again, and the file is opened anew, which
+    // takes nAppendSize from the size it has then; if it can't be cut off, the next record just goes
+    // after it. Nothing refers to the part, and reads of it would fail the checks of the record.
+    fclose(fileAppend);
+    fileAppend = nullptr;
+    boost::system::error_code ec;
+    boost::filesystem::resize_file(GetFilePath(nAppendFile), nAppendSize, ec);
+    if (ec)
+        printf("CBlockStore::DiscardPartialRecord() : failed to truncate %s: %s\n",
+               GetFilePath(nAppendFile).string().c_str(), ec.message().c_str());
+    // if it can't be opened, the next Append() tries again
+    OpenAppendFile(nAppendFile);
+}
+
+bool CBlockStore::Flush()
+{
+    LOCK(cs);
+    if (!fDirty || !fileAppend)
+        return true;
+    if (fflush(fileAppend) != 0)
+        return error("CBlockStore::Flush() : failed to flush %s",
+                     GetFilePath(nAppendFile).string().c_str());
+    FileCommit(fileAppend);
+    fDirty = false;
+    return true;
+}
+
+std::shared_ptr<FILE> CBlockStore::GetReadFile(uint32_t nFile)
+{
+    AssertLockHeld(cs);
+    std::map<uint32_t, std::shared_ptr<FILE>>::const_iterator it = mapReadFiles.find(nFile);
+    if (it != mapReadFiles.end())
+        return it->second;
+    FILE* file = fopen(GetFilePath(nFile).string().c_str(), "rb");
+    if (!file)
+        return nullptr;
+    std::shared_ptr<FILE> filePtr(file, [](FILE* f) { fclose(f); });
+    mapReadFiles[nFile] = filePtr;
+    return filePtr;
+}
+
+bool CBlockStore::ReadAt(uint32_t nFile, uint32_t nPos, char* pch, size_t nLen)
+{
+#ifdef WIN32
+    // without pread, the seek and the read have to happen together
+    LOCK(cs);
+    std::shared_ptr<FILE> file = GetReadFile(nFile);
+    if (!file || fseek(file.get(), nPos, SEEK_SET) != 0)
+        return false;
+    return fread(pch, 1, nLen, file.get()) == nLen;
+#else
+    std::shared_ptr<FILE> file;
+    {
+        LOCK(cs);
+        file = GetReadFile(nFile);
+    }
+    if (!file)
+        return false;
+    const int fd    = fileno(file.get());
+    size_t    nRead = 0;
+    while (nRead < nLen) {
+        ssize_t n = pread(fd, pch + nRead, nLen - nRead, static_cast<off_t>(nPos) + nRead);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        nRead += n;
+    }
+    return true;
+#endif
+}
+
+bool CBlockStore::Read(const CBlockFilePos& pos, std::vector<char>& vchRet)
+{
+    if (pos.nPos < RECORD_HEADER_SIZE)
+        return error("CBlockStore::Read() : invalid position %u in file %u", pos.nPos, pos.nFile);
+
+    char header[RECORD_HEADER_SIZE];
+    if (!ReadAt(pos.nFile, pos.nPos - RECORD_HEADER_SIZE, header, sizeof(header)))
+        return error("CBlockStore::Read() : failed to read the record at %u in file %u", pos.nPos,
+                     pos.nFile);
+    uint32_t nSize, nChecksum;
+    memcpy(&nSize, header + 4, sizeof(nSize));
+    memcpy(&nChecksum, header + 8, sizeof(nChecksum));
+    if (memcmp(header, pchMessageStart, sizeof(pchMessageStart)) != 0 || nSize != pos.nSize)
+        return error("CBlockStore::Read() : the record at %u in file %u has an invalid header",
+                     pos.nPos, pos.nFile);
+
+    vchRet.resize(nSize);
+    if (nSize > 0 && !ReadAt(pos.nFile, pos.nPos, &vchRet[0], nSize))
+        return error("CBlockStore::Read() : failed to read the record at %u in file %u", pos.nPos,
+                     pos.nFile);
+    if (GetChecksum(vchRet.data(), vchRet.size()) != nChecksum)
+        return error("CBlockStore::Read() : checksum mismatch in the record at %u in file %u",
+                     pos.nPos, pos.nFile);
+    return true;
+}
+
+bool CBlockStore::ReadPart(const CBlockFilePos& pos, uint32_t nOffset, uint32_t nLen,
+                           std::vector<char>& vchRet)
+{
+    if (nOffset > pos.nSize)
+        return error("CBlockStore::ReadPart() : offset %u is past the end of the block at %u in file "
+                     "%u",
+                     nOffset, pos.nPos, pos.nFile);
+    vchRet.resize(std::min(nLen, pos.nSize - nOffset));
+    if (!vchRet.empty() && !ReadAt(pos.nFile, pos.nPos + nOffset, &vchRet[0], vchRet.size()))
+        return error("CBlockStore::ReadPart() : failed to read the record at %u in file %u",
+                     pos.nPos, pos.nFile);
+    return true;
+}
+
+std::map<uint32_t, uint64_t> CBlockStore::GetFileSizes()
+{
+    LOCK(cs);
+    std::map<uint32_t, uint64_t> mapSizes;
+    boost::system::error_code    ec;
+    for (uint32_t nFile = 0; nFile <= nAppendFile; nFile++) {
+        const uint64_t nSize = boost::filesystem::file_size(GetFilePath(nFile), ec);
+        if (!ec)
+            mapSizes[nFile] = nSize;
+    }
+    return mapSizes;
+}
+
+bool CBlockStore::RemoveFile(uint32_t nFile)
+{
+    LOCK(cs);
+    if (nFile >= nAppendFile)
+        return error("CBlockStore::RemoveFile() : file %u is still appended to", nFile);
+    // the file is closed once the reads that have it open are done
+    mapReadFiles.erase(nFile);
+    boost::system::error_code ec;
+    boost::filesystem::remove(GetFilePath(nFile), ec);
+    if (ec)
+        return error("CBlockStore::RemoveFile() : failed to remove %s: %s",
+                     GetFilePath(nFile).string().c_str(), ec.message().c_str());
+    return true;
+}
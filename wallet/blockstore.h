@@ -0,0 +1,94 @@
+#ifndef BLOCKSTORE_H
+#define BLOCKSTORE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "serialize.h"
+#include "sync.h"
+
+/** Where a block is in the files of a CBlockStore */
+struct CBlockFilePos
+{
+    uint32_t nFile;
+    uint32_t nPos;  // of the serialized block, after the header of its record
+    uint32_t nSize; // of the serialized block
+
+    CBlockFilePos() : nFile(0), nPos(0), nSize(0) {}
+    CBlockFilePos(uint32_t nFileIn, uint32_t nPosIn, uint32_t nSizeIn)
+        : nFile(nFileIn), nPos(nPosIn), nSize(nSizeIn)
+    {
+    }
+
+    IMPLEMENT_SERIALIZE(READWRITE(nFile); READWRITE(nPos); READWRITE(nSize);)
+};
+
+/**
+ * Append-only storage of serialized blocks, in files of up to nMaxFileSize bytes named blk00000.dat,
+ * blk00001.dat, ... in a directory of their own. Each block is a record of the message start, the
+ * size of the block, its CRC32 and the block itself, so that a record that was only partly written
+ * when the node stopped is told apart when it's read. Records are never changed once appended; the
+ * database keeps where the record of each block is (see CTxDB::WriteBlock()).
+ *
+ * Reads don't take the lock where there's pread(), so that blocks can be read from many threads
+ * while another one appends. Whole files can be removed when their blocks are pruned (-prune).
+ */
+class CBlockStore
+{
+public:
+    static const uint32_t DEFAULT_MAX_FILE_SIZE = 128 * 1024 * 1024;
+    static const uint32_t RECORD_HEADER_SIZE    = 12;
+
+    explicit CBlockStore(const boost::filesystem::path& dirIn,
+                         uint32_t                       nMaxFileSizeIn = DEFAULT_MAX_FILE_SIZE);
+    ~CBlockStore();
+
+    CBlockStore(const CBlockStore&) = delete;
+    CBlockStore& operator=(const CBlockStore&) = delete;
+
+    /** Appends a serialized block to the last file, or to a new one if it doesn't fit */
+    bool Append(const char* pch, uint32_t nSize, CBlockFilePos& posRet);
+
+    /** Reads a whole block, and checks it against the checksum of its record */
+    bool Read(const CBlockFilePos& pos, std::vector<char>& vchRet);
+
+    /** Reads up to nLen bytes at nOffset into a block, without the checksum (e.g. a transaction) */
+    bool ReadPart(const CBlockFilePos& pos, uint32_t nOffset, uint32_t nLen, std::vector<char>& vchRet);
+
+    /** Syncs what was appended since the last call to disk; the positions of the blocks shouldn't be
+     * committed to the database before that */
+    bool Flush();
+
+    /** The size of every file there is, by its number */
+    std::map<uint32_t, uint64_t> GetFileSizes();
+
+    /** Removes a file other than the one being appended to; reads that are going on finish first */
+    bool RemoveFile(uint32_t nFile);
+
+    const boost::filesystem::path& GetDir() const { return dir; }
+
+private:
+    const boost::filesystem::path dir;
+    const uint32_t                nMaxFileSize;
+
+    CCriticalSection          cs;
+    FILE*                     fileAppend; // the last file, opened for appending
+    uint32_t                  nAppendFile;
+    uint32_t                  nAppendSize;
+    bool                      fDirty;       // appended to since the last Flush()
+    // kept open until the store is closed or the file is removed
+    std::map<uint32_t, std::shared_ptr<FILE>> mapReadFiles;
+
+    boost::filesystem::path GetFilePath(uint32_t nFile) const;
+    bool                    OpenAppendFile(uint32_t nFile);
+    void                    DiscardPartialRecord(); // after a failed append
+    std::shared_ptr<FILE>   GetReadFile(uint32_t nFile);
+    bool                    ReadAt(uint32_t nFile, uint32_t nPos, char* pch, size_t nLen);
+};
+
+#endif // BLOCKSTORE_H
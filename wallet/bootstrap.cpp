@@ -0,0 +1,260 @@
+#include "bootstrap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/thread.hpp>
+
+#include "block.h"
+#include "blockindex.h"
+#include "hash.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+namespace {
+// blocks are read (and compressed) one batch ahead of the batch being written
+const size_t EXPORT_BATCH_BLOCKS = 2000;
+
+struct CExportChunk
+{
+    std::string strData; // the records, compressed if the file is
+    uint32_t    nSize   = 0;
+    uint32_t    nBlocks = 0;
+    uint256     hashLastBlock;
+};
+
+struct CExportBatch
+{
+    size_t                    nBlocks = 0;
+    std::vector<CExportChunk> vChunks;
+    CBlockIndexSmartPtr       pindexFailed; // a block that couldn't be read
+};
+
+template <typename Worker>
+void RunExportWorkers(Worker worker, unsigned int nThreads)
+{
+    boost::thread_group threads;
+    for (unsigned int i = 1; i < nThreads; i++)
+        threads.create_thread(worker);
+    worker();
+    threads.join_all();
+}
+
+CExportBatch PrepareExportBatch(const std::vector<CBlockIndexSmartPtr>& vBlocks, size_t nFirst,
+                                bool fCompress, unsigned int nThreads, std::atomic<bool>& stopped)
+{
+    CExportBatch batch;
+    if (nFirst >= vBlocks.size())
+        return batch;
+    batch.nBlocks = std::min(EXPORT_BATCH_BLOCKS, vBlocks.size() - nFirst);
+
+    // every block starts with pchMessageStart and its size
+    std::vector<std::string> vRecords(batch.nBlocks);
+    std::atomic<size_t>      nNext(0);
+    RunExportWorkers(
+        [&]() {
+            CTxDB  txdb("r");
+            size_t i;
+            while ((i = nNext++) < batch.nBlocks && !stopped.load() && !fShutdown) {
+                CBlock block;
+                if (!block.ReadFromDisk(vBlocks[nFirst + i]->blockKeyInDB, txdb, true))
+                    continue;
+                CDataStream  ss(SER_DISK, CLIENT_VERSION);
+                unsigned int nSize = block.GetSerializeSize(SER_DISK, CLIENT_VERSION);
+                ss << FLATDATA(pchMessageStart) << nSize << block;
+                vRecords[i].assign(ss.begin(), ss.end());
+            }
+        },
+        nThreads);
+    if (stopped.load() || fShutdown)
+        return batch;
+
+    for (size_t i = 0; i < batch.nBlocks; i++) {
+        if (vRecords[i].empty()) {
+            batch.pindexFailed = vBlocks[nFirst + i];
+            return batch;
+        }
+        if (batch.vChunks.empty() || (fCompress && batch.vChunks.back().nSize >= BOOTSTRAP_CHUNK_SIZE))
+            batch.vChunks.push_back(CExportChunk());
+        CExportChunk& chunk = batch.vChunks.back();
+        chunk.strData.append(vRecords[i]);
+        chunk.nSize += vRecords[i].size();
+        chunk.nBlocks++;
+        chunk.hashLastBlock = vBlocks[nFirst + i]->GetBlockHash();
+        std::string().swap(vRecords[i]);
+    }
+
+    if (fCompress) {
+        nNext = 0;
+        RunExportWorkers(
+            [&]() {
+                size_t i;
+                while ((i = nNext++) < batch.vChunks.size())
+                    batch.vChunks[i].strData = ZlibCompress(batch.vChunks[i].strData);
+            },
+            nThreads);
+    }
+    return batch;
+}
+} // namespace
+
+bool IsCompressedBootstrap(const char* pch, size_t nLen)
+{
+    return nLen >= sizeof(BOOTSTRAP_MAGIC) && memcmp(pch, BOOTSTRAP_MAGIC, sizeof(BOOTSTRAP_MAGIC)) == 0;
+}
+
+bool ReadBootstrapIndex(const char* pch, size_t nLen, std::vector<CBootstrapChunk>& vChunks)
+{
+    vChunks.clear();
+    if (!IsCompressedBootstrap(pch, nLen) || nLen < BOOTSTRAP_HEADER_SIZE + BOOTSTRAP_TRAILER_SIZE)
+        return error("ReadBootstrapIndex() : not a compressed bootstrap file");
+
+    uint32_t nVersion;
+    memcpy(&nVersion, pch + sizeof(BOOTSTRAP_MAGIC), sizeof(nVersion));
+    if (nVersion > BOOTSTRAP_VERSION)
+        return error("ReadBootstrapIndex() : unsupported version %u", nVersion);
+
+    const char* pchTrailer = pch + nLen - BOOTSTRAP_TRAILER_SIZE;
+    if (memcmp(pchTrailer + sizeof(uint64_t), BOOTSTRAP_MAGIC, sizeof(BOOTSTRAP_MAGIC)) != 0)
+        return error("ReadBootstrapIndex() : the file is truncated");
+    uint64_t nIndexOffset;
+    memcpy(&nIndexOffset, pchTrailer, sizeof(nIndexOffset));
+    if (nIndexOffset < BOOTSTRAP_HEADER_SIZE ||
+        nIndexOffset > nLen - BOOTSTRAP_TRAILER_SIZE ||
+        nLen - BOOTSTRAP_TRAILER_SIZE - nIndexOffset < sizeof(uint256))
+        return error("ReadBootstrapIndex() : invalid index position");
+
+    const char* pchIndex    = pch + nIndexOffset;
+    const char* pchChecksum = pchTrailer - sizeof(uint256);
+    try {
+        CDataStream ss(pchIndex, pchChecksum, SER_DISK, CLIENT_VERSION);
+        ss >> vChunks;
+        if (!ss.empty())
+            return error("ReadBootstrapIndex() : invalid index size");
+    } catch (std::exception& e) {
+        vChunks.clear();
+        return error("ReadBootstrapIndex() : failed to read the index: %s", e.what());
+    }
+    uint256 hashIndex;
+    memcpy(&hashIndex, pchChecksum, sizeof(hashIndex));
+    if (Hash(pchIndex, pchChecksum) != hashIndex) {
+        vChunks.clear();
+        return error("ReadBootstrapIndex() : index checksum mismatch");
+    }
+
+    uint32_t nBlocks = 0;
+    for (const CBootstrapChunk& chunk : vChunks) {
+        if (chunk.nOffset < BOOTSTRAP_HEADER_SIZE || chunk.nCompressedSize == 0 ||
+            chunk.nOffset > nIndexOffset || chunk.nCompressedSize > nIndexOffset - chunk.nOffset ||
+            chunk.nSize > BOOTSTRAP_MAX_CHUNK_SIZE || chunk.nFirstBlock != nBlocks) {
+            vChunks.clear();
+            return error("ReadBootstrapIndex() : invalid chunk at file pos %" PRIu64, chunk.nOffset);
+        }
+        nBlocks += chunk.nBlocks;
+    }
+    return true;
+}
+
+std::string DecompressBootstrapChunk(const char* pch, const CBootstrapChunk& chunk)
+{
+    std::string strRecords =
+        ZlibDecompress(std::string(pch + chunk.nOffset, chunk.nCompressedSize), chunk.nSize);
+    if (strRecords.size() != chunk.nSize)
+        throw std::runtime_error("The size of the chunk at file pos " + std::to_string(chunk.nOffset) +
+                                 " doesn't match the index");
+    return strRecords;
+}
+
+int FindBootstrapChunk(const std::vector<CBootstrapChunk>& vChunks, uint32_t nBlock)
+{
+    auto it = std::upper_bound(
+        vChunks.begin(), vChunks.end(), nBlock,
+        [](uint32_t n, const CBootstrapChunk& chunk) { return n < chunk.nFirstBlock; });
+    if (it == vChunks.begin())
+        return -1;
+    --it;
+    if (nBlock >= it->nFirstBlock + it->nBlocks)
+        return -1;
+    return static_cast<int>(it - vChunks.begin());
+}
+
+void ExportBootstrapBlocks(const std::string& filename, const std::vector<CBlockIndexSmartPtr>& vBlocks,
+                           bool fCompress, std::atomic<bool>& stopped, std::atomic<double>& progress)
+{
+    std::ofstream outFile(filename.c_str(), std::ios::binary);
+    if (!outFile.good()) {
+        throw std::runtime_error("Failed to open file for writing. Make sure you have sufficient "
+                                 "permissions and diskspace.");
+    }
+
+    uint64_t nFilePos = 0;
+    if (fCompress) {
+        CDataStream ssHeader(SER_DISK, CLIENT_VERSION);
+        ssHeader << FLATDATA(BOOTSTRAP_MAGIC) << BOOTSTRAP_VERSION;
+        outFile.write(&ssHeader[0], ssHeader.size());
+        nFilePos += ssHeader.size();
+    }
+
+    const unsigned int nThreads = std::max(1u, boost::thread::hardware_concurrency());
+
+    std::vector<CBootstrapChunk> vIndex;
+    size_t                       nWritten = 0;
+    CExportBatch                 batch    = PrepareExportBatch(vBlocks, 0, fCompress, nThreads, stopped);
+    while (batch.nBlocks > 0 && !batch.pindexFailed && !stopped.load() && !fShutdown) {
+        // read the next batch while this one is being written
+        const size_t nNextFirst = nWritten + batch.nBlocks;
+        CExportBatch nextBatch;
+        boost::thread prefetcher([&]() {
+            nextBatch = PrepareExportBatch(vBlocks, nNextFirst, fCompress, nThreads, stopped);
+        });
+
+        for (const CExportChunk& chunk : batch.vChunks) {
+            outFile.write(chunk.strData.data(), chunk.strData.size());
+            CBootstrapChunk entry;
+            entry.nOffset         = nFilePos;
+            entry.nCompressedSize = chunk.strData.size();
+            entry.nSize           = chunk.nSize;
+            entry.nFirstBlock     = vIndex.empty() ? 0 : vIndex.back().nFirstBlock + vIndex.back().nBlocks;
+            entry.nBlocks         = chunk.nBlocks;
+            entry.hashLastBlock   = chunk.hashLastBlock;
+            vIndex.push_back(entry);
+            nFilePos += chunk.strData.size();
+        }
+        const bool fWriteFailed = !outFile.good();
+        if (fWriteFailed)
+            stopped.store(true);
+
+        prefetcher.join();
+        if (fWriteFailed) {
+            throw std::runtime_error("An error was raised while writing the file. Make sure you "
+                                     "have sufficient permissions and diskspace.");
+        }
+        nWritten += batch.nBlocks;
+        progress.store(static_cast<double>(nWritten) / static_cast<double>(vBlocks.size()),
+                       std::memory_order_relaxed);
+        batch = std::move(nextBatch);
+    }
+    if (batch.pindexFailed) {
+        throw std::runtime_error("Failed to read block " +
+                                 batch.pindexFailed->GetBlockHash().ToString() + " from the database.");
+    }
+    if (stopped.load() || fShutdown) {
+        throw std::runtime_error("Operation was stopped.");
+    }
+
+    if (fCompress) {
+        CDataStream ssIndex(SER_DISK, CLIENT_VERSION);
+        ssIndex << vIndex;
+        uint256 hashIndex = Hash(ssIndex.begin(), ssIndex.end());
+        ssIndex << hashIndex << nFilePos << FLATDATA(BOOTSTRAP_MAGIC);
+        outFile.write(&ssIndex[0], ssIndex.size());
+    }
+    outFile.flush();
+    if (!outFile.good()) {
+        throw std::runtime_error("An error was raised while writing the file. Make sure you "
+                                 "have sufficient permissions and diskspace.");
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef BOOTSTRAP_H
+#define BOOTSTRAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "globals.h"
+#include "serialize.h"
+#include "uint256.h"
+
+/**
+ * Compressed bootstrap files
+ *
+ * A plain bootstrap.dat has the blocks one after the other, each preceded by the message start and
+ * its size. A compressed one has the same records, cut into chunks of about BOOTSTRAP_CHUNK_SIZE
+ * bytes at block boundaries and compressed with zlib one by one:
+ *
+ *   magic (8 bytes), version (4 bytes)
+ *   the compressed chunks
+ *   the index: the chunks (CBootstrapChunk), and the hash of the serialized chunks
+ *   the position of the index (8 bytes), magic (8 bytes)
+ *
+ * The magic can't be the start of a plain file, which is how the importer tells them apart. Since
+ * the index is found from the end of the file, the chunks can be decompressed independently and in
+ * parallel, and the chunks whose blocks are known already can be skipped without reading them.
+ */
+static const char     BOOTSTRAP_MAGIC[8]        = {'N', 'E', 'B', 'L', 'B', 'S', 'Z', 'C'};
+static const uint32_t BOOTSTRAP_VERSION         = 1;
+static const size_t   BOOTSTRAP_HEADER_SIZE     = sizeof(BOOTSTRAP_MAGIC) + sizeof(uint32_t);
+static const size_t   BOOTSTRAP_TRAILER_SIZE    = sizeof(uint64_t) + sizeof(BOOTSTRAP_MAGIC);
+static const size_t   BOOTSTRAP_CHUNK_SIZE      = 4 * 1024 * 1024;
+static const uint32_t BOOTSTRAP_MAX_CHUNK_SIZE  = 256 * 1024 * 1024;
+
+/** A chunk of a compressed bootstrap file, as it's listed in the index */
+class CBootstrapChunk
+{
+public:
+    uint64_t nOffset;         // of the compressed data in the file
+    uint32_t nCompressedSize;
+    uint32_t nSize;           // of the records once decompressed
+    uint32_t nFirstBlock;     // how many blocks come before the chunk
+    uint32_t nBlocks;
+    uint256  hashLastBlock;
+
+    CBootstrapChunk() { SetNull(); }
+
+    void SetNull()
+    {
+        nOffset         = 0;
+        nCompressedSize = 0;
+        nSize           = 0;
+        nFirstBlock     = 0;
+        nBlocks         = 0;
+        hashLastBlock   = 0;
+    }
+
+    IMPLEMENT_SERIALIZE(READWRITE(nOffset); READWRITE(nCompressedSize); READWRITE(nSize);
+                        READWRITE(nFirstBlock); READWRITE(nBlocks); READWRITE(hashLastBlock);)
+};
+
+/** Whether the file starts like a compressed bootstrap file */
+bool IsCompressedBootstrap(const char* pch, size_t nLen);
+
+/** Reads the index of a compressed bootstrap file, checking that it agrees with the file. */
+bool ReadBootstrapIndex(const char* pch, size_t nLen, std::vector<CBootstrapChunk>& vChunks);
+
+/** The records of a chunk of a compressed bootstrap file; throws if the chunk is corrupted. */
+std::string DecompressBootstrapChunk(const char* pch, const CBootstrapChunk& chunk);
+
+/** The chunk that has the block with the given number, or -1 if there are fewer blocks */
+int FindBootstrapChunk(const std::vector<CBootstrapChunk>& vChunks, uint32_t nBlock);
+
+/**
+ * Writes the blocks to a bootstrap file in the given order, compressed or not. Batches of blocks
+ * are read from the database (and compressed) on worker threads while the previous batch is
+ * being written. Throws std::runtime_error if the export fails or is stopped.
+ */
+void ExportBootstrapBlocks(const std::string& filename, const std::vector<CBlockIndexSmartPtr>& vBlocks,
+                           bool fCompress, std::atomic<bool>& stopped, std::atomic<double>& progress);
+
+#endif // BOOTSTRAP_H
@@ -0,0 +1,226 @@
+#include "coins.h"
+
+#include "blockindex.h"
+#include "globals.h"
+#include "txdb.h"
+#include "util.h"
+
+CCoinsViewCache* pcoinsTip      = NULL;
+unsigned int     nCoinCacheSize = 5000;
+
+// Amount compression:
+// * If the amount is 0, output 0
+// * first, divide the amount (in base units) by the largest power of 10 possible; call the exponent e (e
+// is max 9)
+// * if e<9, the last digit of the resulting number cannot be 0; store it as d, and drop it (divide by
+// 10)
+//   * call the result n
+//   * output 1 + 10*(9*n + d - 1) + e
+// * if e==9, we only know the resulting number is not zero, so output 1 + 10*(n - 1) + 9
+// (this is decodable, as d is in [1-9] and e is in [0-9])
+
+uint64_t CTxOutCompressor::CompressAmount(uint64_t n)
+{
+    if (n == 0)
+        return 0;
+    int e = 0;
+    while (((n % 10) == 0) && e < 9) {
+        n /= 10;
+        e++;
+    }
+    if (e < 9) {
+        int d = (n % 10);
+        assert(d >= 1 && d <= 9);
+        n /= 10;
+        return 1 + (n * 9 + d - 1) * 10 + e;
+    } else {
+        return 1 + (n - 1) * 10 + 9;
+    }
+}
+
+uint64_t CTxOutCompressor::DecompressAmount(uint64_t x)
+{
+    // x = 0  OR  x = 1+10*(9*n + d - 1) + e  OR  x = 1+10*(n - 1) + 9
+    if (x == 0)
+        return 0;
+    x--;
+    // x = 10*(9*n + d - 1) + e
+    int e = x % 10;
+    x /= 10;
+    uint64_t n = 0;
+    if (e < 9) {
+        // x = 9*n + d - 1
+        int d = (x % 9) + 1;
+        x /= 9;
+        // x = n
+        n = x * 10 + d;
+    } else {
+        n = x + 1;
+    }
+    while (e) {
+        n *= 10;
+        e--;
+    }
+    return n;
+}
+
+bool         CCoinsView::GetCoins(uint256 /*txid*/, CCoins& /*coins*/) { return false; }
+bool         CCoinsView::SetCoins(uint256 /*txid*/, const CCoins& /*coins*/) { return false; }
+bool         CCoinsView::HaveCoins(uint256 /*txid*/) { return false; }
+CBlockIndex* CCoinsView::GetBestBlock() { return NULL; }
+bool         CCoinsView::SetBestBlock(CBlockIndex* /*pindex*/) { return false; }
+bool         CCoinsView::BatchWrite(const std::map<uint256, CCoins>& /*mapCoins*/,
+                                    CBlockIndex* /*pindex*/)
+{
+    return false;
+}
+bool CCoinsView::GetStats(CCoinsStats& /*stats*/) { return false; }
+
+CCoinsViewBacked::CCoinsViewBacked(CCoinsView& viewIn) : base(&viewIn) {}
+bool CCoinsViewBacked::GetCoins(uint256 txid, CCoins& coins) { return base->GetCoins(txid, coins); }
+bool CCoinsViewBacked::SetCoins(uint256 txid, const CCoins& coins) { return base->SetCoins(txid, coins); }
+bool CCoinsViewBacked::HaveCoins(uint256 txid) { return base->HaveCoins(txid); }
+CBlockIndex* CCoinsViewBacked::GetBestBlock() { return base->GetBestBlock(); }
+bool         CCoinsViewBacked::SetBestBlock(CBlockIndex* pindex) { return base->SetBestBlock(pindex); }
+void         CCoinsViewBacked::SetBackend(CCoinsView& viewIn) { base = &viewIn; }
+bool CCoinsViewBacked::BatchWrite(const std::map<uint256, CCoins>& mapCoins, CBlockIndex* pindex)
+{
+    return base->BatchWrite(mapCoins, pindex);
+}
+bool CCoinsViewBacked::GetStats(CCoinsStats& stats) { return base->GetStats(stats); }
+
+CCoinsViewCache::CCoinsViewCache(CCoinsView& baseIn, bool /*fDummy*/)
+    : CCoinsViewBacked(baseIn), pindexTip(NULL)
+{
+}
+
+bool CCoinsViewCache::GetCoins(uint256 txid, CCoins& coins)
+{
+    std::map<uint256, CCoins>::iterator it = cacheCoins.find(txid);
+    if (it != cacheCoins.end()) {
+        coins = it->second;
+        return true;
+    }
+    if (base->GetCoins(txid, coins)) {
+        cacheCoins[txid] = coins;
+        return true;
+    }
+    return false;
+}
+
+std::map<uint256, CCoins>::iterator CCoinsViewCache::FetchCoins(uint256 txid)
+{
+    std::map<uint256, CCoins>::iterator it = cacheCoins.lower_bound(txid);
+    if (it != cacheCoins.end() && it->first == txid)
+        return it;
+    CCoins tmp;
+    if (!base->GetCoins(txid, tmp))
+        return cacheCoins.end();
+    std::map<uint256, CCoins>::iterator ret =
+        cacheCoins.insert(it, std::make_pair(txid, CCoins()));
+    tmp.swap(ret->second);
+    return ret;
+}
+
+CCoins& CCoinsViewCache::GetCoins(uint256 txid)
+{
+    std::map<uint256, CCoins>::iterator it = FetchCoins(txid);
+    assert(it != cacheCoins.end());
+    return it->second;
+}
+
+bool CCoinsViewCache::SetCoins(uint256 txid, const CCoins& coins)
+{
+    cacheCoins[txid] = coins;
+    return true;
+}
+
+bool CCoinsViewCache::HaveCoins(uint256 txid) { return FetchCoins(txid) != cacheCoins.end(); }
+
+CBlockIndex* CCoinsViewCache::GetBestBlock()
+{
+    if (pindexTip == NULL)
+        pindexTip = base->GetBestBlock();
+    return pindexTip;
+}
+
+bool CCoinsViewCache::SetBestBlock(CBlockIndex* pindex)
+{
+    pindexTip = pindex;
+    return true;
+}
+
+bool CCoinsViewCache::BatchWrite(const std::map<uint256, CCoins>& mapCoins, CBlockIndex* pindex)
+{
+    for (std::map<uint256, CCoins>::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
+        cacheCoins[it->first] = it->second;
+    pindexTip = pindex;
+    return true;
+}
+
+bool CCoinsViewCache::Flush()
+{
+    bool fOk = base->BatchWrite(cacheCoins, GetBestBlock());
+    if (fOk)
+        cacheCoins.clear();
+    return fOk;
+}
+
+unsigned int CCoinsViewCache::GetCacheSize() { return cacheCoins.size(); }
+
+bool CCoinsViewDB::GetCoins(uint256 txid, CCoins& coins) { return CTxDB("r").ReadCoins(txid, coins); }
+
+bool CCoinsViewDB::SetCoins(uint256 txid, const CCoins& coins)
+{
+    CTxDB txdb;
+    if (coins.IsPruned())
+        return !txdb.HaveCoins(txid) || txdb.EraseCoins(txid);
+    return txdb.WriteCoins(txid, coins);
+}
+
+bool CCoinsViewDB::HaveCoins(uint256 txid) { return CTxDB("r").HaveCoins(txid); }
+
+CBlockIndex* CCoinsViewDB::GetBestBlock()
+{
+    uint256 hashBestBlock;
+    if (!CTxDB("r").ReadCoinsBestBlock(hashBestBlock))
+        return NULL;
+    BlockIndexMapType::const_iterator it = mapBlockIndex.find(hashBestBlock);
+    if (it == mapBlockIndex.end())
+        return NULL;
+    return it->second.get();
+}
+
+bool CCoinsViewDB::SetBestBlock(CBlockIndex* pindex)
+{
+    return CTxDB().WriteCoinsBestBlock(pindex->GetBlockHash());
+}
+
+bool CCoinsViewDB::BatchWrite(const std::map<uint256, CCoins>& mapCoins, CBlockIndex* pindex)
+{
+    LogPrint(LOG_DB, "Committing %u changed transactions to the coin database...\n",
+             (unsigned int)mapCoins.size());
+
+    CTxDB txdb;
+    if (!txdb.TxnBegin(mapCoins.size() * 1000))
+        return error("CCoinsViewDB::BatchWrite() : TxnBegin failed");
+    for (std::map<uint256, CCoins>::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        bool fOk;
+        if (it->second.IsPruned())
+            fOk = !txdb.HaveCoins(it->first) || txdb.EraseCoins(it->first);
+        else
+            fOk = txdb.WriteCoins(it->first, it->second);
+        if (!fOk) {
+            txdb.TxnAbort();
+            return error("CCoinsViewDB::BatchWrite() : failed to write the coins of %s",
+                         it->first.ToString().c_str());
+        }
+    }
+    if (pindex && !txdb.WriteCoinsBestBlock(pindex->GetBlockHash())) {
+        txdb.TxnAbort();
+        return error("CCoinsViewDB::BatchWrite() : failed to write the best block");
+    }
+    if (!txdb.TxnCommit())
+        return error("CCoinsViewDB::BatchWrite() : TxnCommit failed");
+    return true;
+}
@@ -0,0 +1,525 @@
+#ifndef COINS_H
+#define COINS_H
+
+#include <map>
+
+#include <boost/foreach.hpp>
+
+#include "outpoint.h"
+#include "script.h"
+#include "serialize.h"
+#include "transaction.h"
+#include "txout.h"
+#include "uint256.h"
+
+class CBlockIndex;
+
+/** wrapper for CTxOut that provides a more compact serialization */
+class CTxOutCompressor
+{
+private:
+    CTxOut& txout;
+
+public:
+    static uint64_t CompressAmount(uint64_t nAmount);
+    static uint64_t DecompressAmount(uint64_t nAmount);
+
+    CTxOutCompressor(CTxOut& txoutIn) : txout(txoutIn) {}
+
+    IMPLEMENT_SERIALIZE(({
+                            if (!fRead) {
+                                uint64_t nVal = CompressAmount(txout.nValue);
+                                READWRITE(VARINT(nVal));
+                            } else {
+                                uint64_t nVal = 0;
+                                READWRITE(VARINT(nVal));
+                                txout.nValue = DecompressAmount(nVal);
+                            }
+                            CScriptCompressor cscript(REF(txout.scriptPubKey));
+                            READWRITE(cscript);
+                        });)
+};
+
+/** Undo information for a CTxIn
+ *
+ *  Contains the prevout's CTxOut being spent, and if this was the
+ *  last output of the affected transaction, its metadata as well
+ *  (coinbase or not, height, transaction version)
+ */
+class CTxInUndo
+{
+public:
+    CTxOut       txout;      // the txout data before being spent
+    bool         fCoinBase;  // if the outpoint was the last unspent: whether it belonged to a coinbase
+    unsigned int nHeight;    // if the outpoint was the last unspent: its height
+    int          nVersion;   // if the outpoint was the last unspent: its version
+    bool         fCoinStake; // if the outpoint was the last unspent: whether it belonged to a coinstake
+    unsigned int nTime;      // if the outpoint was the last unspent: the time of its transaction
+
+    CTxInUndo() : txout(), fCoinBase(false), nHeight(0), nVersion(0), fCoinStake(false), nTime(0) {}
+    CTxInUndo(const CTxOut& txoutIn, bool fCoinBaseIn = false, unsigned int nHeightIn = 0,
+              int nVersionIn = 0, bool fCoinStakeIn = false, unsigned int nTimeIn = 0)
+        : txout(txoutIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), nVersion(nVersionIn),
+          fCoinStake(fCoinStakeIn), nTime(nTimeIn)
+    {
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        unsigned int nSize =
+            ::GetSerializeSize(VARINT(nHeight * 2 + (fCoinBase ? 1 : 0)), nType, nVersion);
+        if (nHeight > 0) {
+            nSize += ::GetSerializeSize(VARINT(this->nVersion), nType, nVersion);
+            nSize += ::GetSerializeSize(VARINT(fCoinStake ? 1u : 0u), nType, nVersion);
+            nSize += ::GetSerializeSize(VARINT(nTime), nType, nVersion);
+        }
+        return nSize + ::GetSerializeSize(CTxOutCompressor(REF(txout)), nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, VARINT(nHeight * 2 + (fCoinBase ? 1 : 0)), nType, nVersion);
+        if (nHeight > 0) {
+            ::Serialize(s, VARINT(this->nVersion), nType, nVersion);
+            ::Serialize(s, VARINT(fCoinStake ? 1u : 0u), nType, nVersion);
+            ::Serialize(s, VARINT(nTime), nType, nVersion);
+        }
+        ::Serialize(s, CTxOutCompressor(REF(txout)), nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned int nCode = 0;
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        nHeight   = nCode / 2;
+        fCoinBase = nCode & 1;
+        if (nHeight > 0) {
+            ::Unserialize(s, VARINT(this->nVersion), nType, nVersion);
+            unsigned int nFlag = 0;
+            ::Unserialize(s, VARINT(nFlag), nType, nVersion);
+            fCoinStake = nFlag & 1;
+            ::Unserialize(s, VARINT(nTime), nType, nVersion);
+        }
+        ::Unserialize(s, REF(CTxOutCompressor(REF(txout))), nType, nVersion);
+    }
+};
+
+/** Undo information for a CTransaction: the outputs spent by its inputs, in the same order */
+class CTxUndo
+{
+public:
+    std::vector<CTxInUndo> vprevout;
+
+    IMPLEMENT_SERIALIZE(READWRITE(vprevout);)
+};
+
+/**
+ * Undo information for a CBlock: what connecting it took out of the unspent outputs, which is
+ * written along with the block when it's connected, so that it can be disconnected again without
+ * reading the transactions it spends
+ */
+class CBlockUndo
+{
+public:
+    std::vector<CTxUndo> vtxundo; // for all but the coinbase
+
+    IMPLEMENT_SERIALIZE(READWRITE(vtxundo);)
+};
+
+/** pruned version of CTransaction: only retains metadata and unspent transaction outputs
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode)
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - VARINT(nHeight)
+ * - VARINT(nFlag): 1 if the transaction is a coinstake
+ * - VARINT(nTime): the timestamp of the transaction
+ *
+ * The nCode value consists of:
+ * - bit 1: IsCoinBase()
+ * - bit 2: vout[0] is not spent
+ * - bit 4: vout[1] is not spent
+ * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
+ *   - In case both bit 2 and bit 4 are unset, they encode N-1, as there must be at
+ *     least one non-spent output).
+ *
+ * Example: 0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e
+ *          <><><--------------------------------------------><---->
+ *          |  \                  |                             /
+ *    version   code             vout[1]                  height
+ *
+ *    - version = 1
+ *    - code = 4 (vout[1] is not spent, and 0 non-zero bytes of bitvector follow)
+ *    - unspentness bitvector: as 0 non-zero bytes follow, it has length 0
+ *    - vout[1]: 835800816115944e077fe7c803cfa57f29b36bf87c1d35
+ *               * 8358: compact amount representation for 60000000000 (600 BTC)
+ *               * 00: special txout type pay-to-pubkey-hash
+ *               * 816115944e077fe7c803cfa57f29b36bf87c1d35: address uint160
+ *    - height = 203998
+ *
+ *
+ * Example:
+ * 0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b
+ *          <><><--><--------------------------------------------------><----------------------------------------------><---->
+ *         /  \   \                     |                                                           | /
+ *  version  code  unspentness       vout[4]                                                     vout[16]
+ * height
+ *
+ *  - version = 1
+ *  - code = 9 (coinbase, neither vout[0] or vout[1] are unspent,
+ *                2 (1, +1 because both bit 2 and bit 4 are unset) non-zero bitvector bytes follow)
+ *  - unspentness bitvector: bits 2 (0x04) and 14 (0x4000) are set, so vout[2+2] and vout[14+2] are
+ * unspent
+ *  - vout[4]: 86ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4ee
+ *             * 86ef97d579: compact amount representation for 234925952 (2.35 BTC)
+ *             * 00: special txout type pay-to-pubkey-hash
+ *             * 61b01caab50f1b8e9c50a5057eb43c2d9563a4ee: address uint160
+ *  - vout[16]: bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4
+ *              * bbd123: compact amount representation for 110397 (0.001 BTC)
+ *              * 00: special txout type pay-to-pubkey-hash
+ *              * 8c988f1a4a4de2161e0f50aac7f17e7f9555caa4: address uint160
+ *  - height = 120891
+ */
+class CCoins
+{
+public:
+    // whether transaction is a coinbase
+    bool fCoinBase;
+
+    // unspent transaction outputs; spent outputs are .IsNull(); spent outputs at the end of the array
+    // are dropped
+    std::vector<CTxOut> vout;
+
+    // at which height this transaction was included in the active blockchain
+    int nHeight;
+
+    // version of the CTransaction; accesses to this value should probably check for nHeight as well,
+    // as new tx version will probably only be introduced at certain heights
+    int nVersion;
+
+    // whether transaction is a coinstake (ppcoin)
+    bool fCoinStake;
+
+    // timestamp of the transaction, which the inputs that spend it can't precede (ppcoin)
+    unsigned int nTime;
+
+    // construct a CCoins from a CTransaction, at a given height
+    CCoins(const CTransaction& tx, int nHeightIn)
+        : fCoinBase(tx.IsCoinBase()), vout(tx.vout), nHeight(nHeightIn), nVersion(tx.nVersion),
+          fCoinStake(tx.IsCoinStake()), nTime(tx.nTime)
+    {
+    }
+
+    // empty constructor
+    CCoins() : fCoinBase(false), vout(0), nHeight(0), nVersion(0), fCoinStake(false), nTime(0) {}
+
+    // remove spent outputs at the end of vout
+    void Cleanup()
+    {
+        while (vout.size() > 0 && vout.back().IsNull())
+            vout.pop_back();
+    }
+
+    void swap(CCoins& to)
+    {
+        std::swap(to.fCoinBase, fCoinBase);
+        to.vout.swap(vout);
+        std::swap(to.nHeight, nHeight);
+        std::swap(to.nVersion, nVersion);
+        std::swap(to.fCoinStake, fCoinStake);
+        std::swap(to.nTime, nTime);
+    }
+
+    // equality test
+    friend bool operator==(const CCoins& a, const CCoins& b)
+    {
+        return a.fCoinBase == b.fCoinBase && a.nHeight == b.nHeight && a.nVersion == b.nVersion &&
+               a.fCoinStake == b.fCoinStake && a.nTime == b.nTime && a.vout == b.vout;
+    }
+    friend bool operator!=(const CCoins& a, const CCoins& b) { return !(a == b); }
+
+    // calculate number of bytes for the bitmask, and its number of non-zero bytes
+    // each bit in the bitmask represents the availability of one output, but the
+    // availabilities of the first two outputs are encoded separately
+    void CalcMaskSize(unsigned int& nBytes, unsigned int& nNonzeroBytes) const
+    {
+        unsigned int nLastUsedByte = 0;
+        for (unsigned int b = 0; 2 + b * 8 < vout.size(); b++) {
+            bool fZero = true;
+            for (unsigned int i = 0; i < 8 && 2 + b * 8 + i < vout.size(); i++) {
+                if (!vout[2 + b * 8 + i].IsNull()) {
+                    fZero = false;
+                    continue;
+                }
+            }
+            if (!fZero) {
+                nLastUsedByte = b + 1;
+                nNonzeroBytes++;
+            }
+        }
+        nBytes += nLastUsedByte;
+    }
+
+    bool IsCoinBase() const { return fCoinBase; }
+
+    bool IsCoinStake() const { return fCoinStake; }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        unsigned int nSize     = 0;
+        unsigned int nMaskSize = 0, nMaskCode = 0;
+        CalcMaskSize(nMaskSize, nMaskCode);
+        bool fFirst  = vout.size() > 0 && !vout[0].IsNull();
+        bool fSecond = vout.size() > 1 && !vout[1].IsNull();
+        assert(fFirst || fSecond || nMaskCode);
+        unsigned int nCode = 8 * (nMaskCode - (fFirst || fSecond ? 0 : 1)) + (fCoinBase ? 1 : 0) +
+                             (fFirst ? 2 : 0) + (fSecond ? 4 : 0);
+        // version
+        nSize += ::GetSerializeSize(VARINT(this->nVersion), nType, nVersion);
+        // size of header code
+        nSize += ::GetSerializeSize(VARINT(nCode), nType, nVersion);
+        // spentness bitmask
+        nSize += nMaskSize;
+        // txouts themself
+        for (unsigned int i = 0; i < vout.size(); i++)
+            if (!vout[i].IsNull())
+                nSize += ::GetSerializeSize(CTxOutCompressor(REF(vout[i])), nType, nVersion);
+        // height
+        nSize += ::GetSerializeSize(VARINT(nHeight), nType, nVersion);
+        // coinstake flag and time
+        nSize += ::GetSerializeSize(VARINT(fCoinStake ? 1u : 0u), nType, nVersion);
+        nSize += ::GetSerializeSize(VARINT(nTime), nType, nVersion);
+        return nSize;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        unsigned int nMaskSize = 0, nMaskCode = 0;
+        CalcMaskSize(nMaskSize, nMaskCode);
+        bool fFirst  = vout.size() > 0 && !vout[0].IsNull();
+        bool fSecond = vout.size() > 1 && !vout[1].IsNull();
+        assert(fFirst || fSecond || nMaskCode);
+        unsigned int nCode = 8 * (nMaskCode - (fFirst || fSecond ? 0 : 1)) + (fCoinBase ? 1 : 0) +
+                             (fFirst ? 2 : 0) + (fSecond ? 4 : 0);
+        // version
+        ::Serialize(s, VARINT(this->nVersion), nType, nVersion);
+        // header code
+        ::Serialize(s, VARINT(nCode), nType, nVersion);
+        // spentness bitmask
+        for (unsigned int b = 0; b < nMaskSize; b++) {
+            unsigned char chAvail = 0;
+            for (unsigned int i = 0; i < 8 && 2 + b * 8 + i < vout.size(); i++)
+                if (!vout[2 + b * 8 + i].IsNull())
+                    chAvail |= (1 << i);
+            ::Serialize(s, chAvail, nType, nVersion);
+        }
+        // txouts themself
+        for (unsigned int i = 0; i < vout.size(); i++) {
+            if (!vout[i].IsNull())
+                ::Serialize(s, CTxOutCompressor(REF(vout[i])), nType, nVersion);
+        }
+        // coinbase height
+        ::Serialize(s, VARINT(nHeight), nType, nVersion);
+        // coinstake flag and time
+        ::Serialize(s, VARINT(fCoinStake ? 1u : 0u), nType, nVersion);
+        ::Serialize(s, VARINT(nTime), nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned int nCode = 0;
+        // version
+        ::Unserialize(s, VARINT(this->nVersion), nType, nVersion);
+        // header code
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0]              = nCode & 2;
+        vAvail[1]              = nCode & 4;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+        // coinstake flag and time
+        unsigned int nFlag = 0;
+        ::Unserialize(s, VARINT(nFlag), nType, nVersion);
+        fCoinStake = nFlag & 1;
+        ::Unserialize(s, VARINT(nTime), nType, nVersion);
+        Cleanup();
+    }
+
+    // mark an outpoint spent, and construct undo information
+    bool Spend(const COutPoint& out, CTxInUndo& undo)
+    {
+        if (out.n >= vout.size())
+            return false;
+        if (vout[out.n].IsNull())
+            return false;
+        undo = CTxInUndo(vout[out.n]);
+        vout[out.n].SetNull();
+        Cleanup();
+        if (vout.size() == 0) {
+            undo.nHeight    = nHeight;
+            undo.fCoinBase  = fCoinBase;
+            undo.nVersion   = this->nVersion;
+            undo.fCoinStake = fCoinStake;
+            undo.nTime      = nTime;
+        }
+        return true;
+    }
+
+    // mark a vout spent
+    bool Spend(int nPos)
+    {
+        CTxInUndo undo;
+        COutPoint out(0, nPos);
+        return Spend(out, undo);
+    }
+
+    // check whether a particular output is still available
+    bool IsAvailable(unsigned int nPos) const { return (nPos < vout.size() && !vout[nPos].IsNull()); }
+
+    // check whether the entire CCoins is spent
+    // note that only !IsPruned() CCoins can be serialized
+    bool IsPruned() const
+    {
+        BOOST_FOREACH (const CTxOut& out, vout)
+            if (!out.IsNull())
+                return false;
+        return true;
+    }
+};
+
+struct CCoinsStats
+{
+    int      nHeight;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0) {}
+};
+
+/** Abstract view on the open txout dataset. */
+class CCoinsView
+{
+public:
+    // Retrieve the CCoins (unspent transaction outputs) for a given txid
+    virtual bool GetCoins(uint256 txid, CCoins& coins);
+
+    // Modify the CCoins for a given txid
+    virtual bool SetCoins(uint256 txid, const CCoins& coins);
+
+    // Just check whether we have data for a given txid.
+    // This may (but cannot always) return true for fully spent transactions
+    virtual bool HaveCoins(uint256 txid);
+
+    // Retrieve the block index whose state this CCoinsView currently represents
+    virtual CBlockIndex* GetBestBlock();
+
+    // Modify the currently active block index
+    virtual bool SetBestBlock(CBlockIndex* pindex);
+
+    // Do a bulk modification (multiple SetCoins + one SetBestBlock)
+    virtual bool BatchWrite(const std::map<uint256, CCoins>& mapCoins, CBlockIndex* pindex);
+
+    // Calculate statistics about the unspent transaction output set
+    virtual bool GetStats(CCoinsStats& stats);
+
+    // As we use CCoinsViews polymorphically, have a virtual destructor
+    virtual ~CCoinsView() {}
+};
+
+/** CCoinsView backed by another CCoinsView */
+class CCoinsViewBacked : public CCoinsView
+{
+protected:
+    CCoinsView* base;
+
+public:
+    CCoinsViewBacked(CCoinsView& viewIn);
+    bool         GetCoins(uint256 txid, CCoins& coins);
+    bool         SetCoins(uint256 txid, const CCoins& coins);
+    bool         HaveCoins(uint256 txid);
+    CBlockIndex* GetBestBlock();
+    bool         SetBestBlock(CBlockIndex* pindex);
+    void         SetBackend(CCoinsView& viewIn);
+    bool         BatchWrite(const std::map<uint256, CCoins>& mapCoins, CBlockIndex* pindex);
+    bool         GetStats(CCoinsStats& stats);
+};
+
+/** CCoinsView that adds a memory cache for transactions to another CCoinsView */
+class CCoinsViewCache : public CCoinsViewBacked
+{
+protected:
+    CBlockIndex*              pindexTip;
+    std::map<uint256, CCoins> cacheCoins;
+
+public:
+    CCoinsViewCache(CCoinsView& baseIn, bool fDummy = false);
+
+    // Standard CCoinsView methods
+    bool         GetCoins(uint256 txid, CCoins& coins);
+    bool         SetCoins(uint256 txid, const CCoins& coins);
+    bool         HaveCoins(uint256 txid);
+    CBlockIndex* GetBestBlock();
+    bool         SetBestBlock(CBlockIndex* pindex);
+    bool         BatchWrite(const std::map<uint256, CCoins>& mapCoins, CBlockIndex* pindex);
+
+    // Return a modifiable reference to a CCoins. Check HaveCoins first.
+    // Many methods explicitly require a CCoinsViewCache because of this method, to reduce
+    // copying.
+    CCoins& GetCoins(uint256 txid);
+
+    // Push the modifications applied to this cache to its base.
+    // Failure to call this method before destruction will cause the changes to be forgotten.
+    bool Flush();
+
+    // Calculate the size of the cache (in number of transactions)
+    unsigned int GetCacheSize();
+
+private:
+    std::map<uint256, CCoins>::iterator FetchCoins(uint256 txid);
+};
+
+/** CCoinsView backed by the CoinsDb table of the blockchain database */
+class CCoinsViewDB : public CCoinsView
+{
+public:
+    bool         GetCoins(uint256 txid, CCoins& coins);
+    bool         SetCoins(uint256 txid, const CCoins& coins);
+    bool         HaveCoins(uint256 txid);
+    CBlockIndex* GetBestBlock();
+    bool         SetBestBlock(CBlockIndex* pindex);
+    bool         BatchWrite(const std::map<uint256, CCoins>& mapCoins, CBlockIndex* pindex);
+};
+
+/** Global variable that points to the active CCoinsView (protected by cs_main) */
+extern CCoinsViewCache* pcoinsTip;
+
+/** How many transactions pcoinsTip holds before it's written to the database (from -dbcache) */
+extern unsigned int nCoinCacheSize;
+
+#endif // COINS_H
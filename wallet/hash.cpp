@@ -1,7 +1,11 @@
 #include "hash.h"
 
+#include <cassert>
+
 inline uint32_t ROTL32(uint32_t x, int8_t r) { return (x << r) | (x >> (32 - r)); }
 
+inline uint64_t ROTL64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash)
 {
     // The following is MurmurHash3 (x86_32), see
@@ -85,3 +89,102 @@ void* KDF_SHA512(const void* in, size_t inlen, void* out, size_t* outlen)
     return nullptr;
 #endif
 }
+
+#define SIPROUND                                                                                        \
+    do {                                                                                                \
+        v0 += v1;                                                                                       \
+        v1 = ROTL64(v1, 13);                                                                            \
+        v1 ^= v0;                                                                                       \
+        v0 = ROTL64(v0, 32);                                                                            \
+        v2 += v3;                                                                                       \
+        v3 = ROTL64(v3, 16);                                                                            \
+        v3 ^= v2;                                                                                       \
+        v0 += v3;                                                                                       \
+        v3 = ROTL64(v3, 21);                                                                            \
+        v3 ^= v0;                                                                                       \
+        v2 += v1;                                                                                       \
+        v1 = ROTL64(v1, 17);                                                                            \
+        v1 ^= v2;                                                                                       \
+        v2 = ROTL64(v2, 32);                                                                            \
+    } while (0)
+
+CSipHasher::CSipHasher(uint64_t k0, uint64_t k1)
+{
+    v[0]  = 0x736f6d6570736575ULL ^ k0;
+    v[1]  = 0x646f72616e646f6dULL ^ k1;
+    v[2]  = 0x6c7967656e657261ULL ^ k0;
+    v[3]  = 0x7465646279746573ULL ^ k1;
+    count = 0;
+    tmp   = 0;
+}
+
+CSipHasher& CSipHasher::Write(uint64_t data)
+{
+    uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+
+    assert(count % 8 == 0);
+
+    v3 ^= data;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= data;
+
+    v[0] = v0;
+    v[1] = v1;
+    v[2] = v2;
+    v[3] = v3;
+
+    count += 8;
+    return *this;
+}
+
+CSipHasher& CSipHasher::Write(const unsigned char* data, size_t size)
+{
+    uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+    uint64_t t = tmp;
+    int      c = count;
+
+    while (size--) {
+        t |= ((uint64_t)(*(data++))) << (8 * (c % 8));
+        c++;
+        if ((c & 7) == 0) {
+            v3 ^= t;
+            SIPROUND;
+            SIPROUND;
+            v0 ^= t;
+            t = 0;
+        }
+    }
+
+    v[0]  = v0;
+    v[1]  = v1;
+    v[2]  = v2;
+    v[3]  = v3;
+    count = c;
+    tmp   = t;
+
+    return *this;
+}
+
+uint64_t CSipHasher::Finalize() const
+{
+    uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+
+    uint64_t t = tmp | (((uint64_t)count) << 56);
+
+    v3 ^= t;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= t;
+    v2 ^= 0xFF;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val)
+{
+    return CSipHasher(k0, k1).Write(val.begin(), 32).Finalize();
+}
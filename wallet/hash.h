@@ -121,6 +121,25 @@ inline uint160 Hash160(const std::vector<unsigned char>& vch)
 
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+/** SipHash-2-4, a fast keyed hash; the short transaction IDs of compact blocks are made with it, so that
+ * they can't be made to collide without knowing the key */
+class CSipHasher
+{
+    uint64_t      v[4];
+    uint64_t      tmp;
+    unsigned char count; // the number of bytes written, modulo 256
+
+public:
+    CSipHasher(uint64_t k0, uint64_t k1);
+    /** Hashes a number as its 8 bytes, least significant first; only after a multiple of 8 bytes */
+    CSipHasher& Write(uint64_t data);
+    CSipHasher& Write(const unsigned char* data, size_t size);
+    uint64_t    Finalize() const;
+};
+
+/** The SipHash-2-4 of a 256-bit hash, as its 32 bytes */
+uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
+
 template <typename CTXType, int (*InitFunc)(CTXType*), int (*UpdateFunc)(CTXType*, const void*, size_t),
           int (*FinalFunc)(unsigned char*, CTXType*), unsigned DigestSize>
 class HashCalculator
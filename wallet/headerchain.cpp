@@ -0,0 +1,321 @@
+#include "headerchain.h"
+
+#include <algorithm>
+#include <boost/make_shared.hpp>
+#include <map>
+#include <set>
+
+#include "NetworkForks.h"
+#include "block.h"
+#include "blockindex.h"
+#include "checkpoints.h"
+#include "main.h"
+#include "util.h"
+
+BlockIndexMapType   mapHeaderIndex;
+CBlockIndexSmartPtr pindexBestHeader;
+
+// the header-only entries by the block they follow, so that they're moved over to it once it's stored
+static std::multimap<uint256, CBlockIndexSmartPtr> mapHeaderIndexByPrev;
+
+/** A header-only entry, which keeps its hash itself, since it may outlive its place in mapHeaderIndex as
+ * the parent of other entries or in the download queue of a peer */
+class CHeaderIndex : public CBlockIndex
+{
+public:
+    uint256              hashBlock;
+    std::vector<int64_t> vPeers; // that sent the header; it's dropped once they're all gone
+};
+
+// every entry of mapHeaderIndex is a CHeaderIndex
+static CHeaderIndex& GetHeaderEntry(const CBlockIndexSmartPtr& pindex)
+{
+    return static_cast<CHeaderIndex&>(*pindex);
+}
+
+static void AddHeaderPeer(const CBlockIndexSmartPtr& pindex, int64_t nPeerId)
+{
+    std::vector<int64_t>& vPeers = GetHeaderEntry(pindex).vPeers;
+    if (std::find(vPeers.begin(), vPeers.end(), nPeerId) == vPeers.end())
+        vPeers.push_back(nPeerId);
+}
+
+CBlockIndexSmartPtr GetBestHeader()
+{
+    CBlockIndexSmartPtr pindexBestBlock = boost::atomic_load(&pindexBest);
+    CBlockIndexSmartPtr pindexHeader    = boost::atomic_load(&pindexBestHeader);
+    if (pindexHeader && (!pindexBestBlock || pindexHeader->nChainTrust > pindexBestBlock->nChainTrust))
+        return pindexHeader;
+    return pindexBestBlock;
+}
+
+CBlockIndexSmartPtr LookupHeaderIndex(const uint256& hash)
+{
+    BlockIndexMapType::iterator mi = mapBlockIndex.find(hash);
+    if (mi != mapBlockIndex.end())
+        return boost::atomic_load(&mi->second);
+    mi = mapHeaderIndex.find(hash);
+    if (mi != mapHeaderIndex.end())
+        return mi->second;
+    return CBlockIndexSmartPtr();
+}
+
+// The target rules change at the forks, which are told apart by the height of the best block. The
+// target of a header is only checked if the block after the best one has the rules of the header's
+// height; the others are checked once their blocks come.
+static bool IsTargetCheckable(int nHeight)
+{
+    return GetNetForks().getForkAtBlockNumber(nHeight - 1) ==
+           GetNetForks().getForkAtBlockNumber(nBestHeight);
+}
+
+static void EraseHeaderIndexByPrev(const CBlockIndexSmartPtr& pindex)
+{
+    CBlockIndexSmartPtr pindexPrev = boost::atomic_load(&pindex->pprev);
+    if (!pindexPrev)
+        return;
+    typedef std::multimap<uint256, CBlockIndexSmartPtr>::iterator Iterator;
+    std::pair<Iterator, Iterator> range = mapHeaderIndexByPrev.equal_range(pindexPrev->GetBlockHash());
+    for (Iterator it = range.first; it != range.second; ++it) {
+        if (it->second == pindex) {
+            mapHeaderIndexByPrev.erase(it);
+            return;
+        }
+    }
+}
+
+// the entries and the ones after them are taken out of the header index; gives how many there were
+static unsigned int EraseHeaderBranches(std::vector<CBlockIndexSmartPtr> vErase)
+{
+    typedef std::multimap<uint256, CBlockIndexSmartPtr>::iterator Iterator;
+    unsigned int                                                 nErased = 0;
+    while (!vErase.empty()) {
+        const CBlockIndexSmartPtr pindex = vErase.back();
+        vErase.pop_back();
+        const uint256 hash = pindex->GetBlockHash();
+        if (mapHeaderIndex.erase(hash) == 0)
+            continue;
+        EraseHeaderIndexByPrev(pindex);
+        nErased++;
+        std::pair<Iterator, Iterator> range = mapHeaderIndexByPrev.equal_range(hash);
+        for (Iterator it = range.first; it != range.second; ++it)
+            vErase.push_back(it->second);
+    }
+    return nErased;
+}
+
+static void ResetBestHeader()
+{
+    CBlockIndexSmartPtr pindexNewBest;
+    for (const std::pair<const uint256, CBlockIndexSmartPtr>& item : mapHeaderIndex)
+        if (!pindexNewBest || item.second->nChainTrust > pindexNewBest->nChainTrust)
+            pindexNewBest = item.second;
+    boost::atomic_store(&pindexBestHeader, pindexNewBest);
+}
+
+bool AcceptBlockHeader(const CBlock& header, CBlockIndexSmartPtr& pindexOut, int64_t nPeerId)
+{
+    AssertLockHeld(cs_main);
+
+    const uint256 hash = header.GetHash();
+    pindexOut          = LookupHeaderIndex(hash);
+    if (pindexOut) {
+        if (pindexOut->IsHeaderOnly() && mapHeaderIndex.count(hash))
+            AddHeaderPeer(pindexOut, nPeerId);
+        return true;
+    }
+
+    if (header.nVersion > CBlock::CURRENT_VERSION)
+        return header.DoS(100, error("AcceptBlockHeader() : reject unknown block version %d",
+                                     header.nVersion));
+
+    CBlockIndexSmartPtr pindexPrev = LookupHeaderIndex(header.hashPrevBlock);
+    if (!pindexPrev)
+        return error("AcceptBlockHeader() : the header before %s isn't known", hash.ToString().c_str());
+    const int nHeight = pindexPrev->nHeight + 1;
+
+    // the same as CBlock::AcceptBlock() checks against the checkpoints
+    const int64_t nLastCheckpointHeight = Checkpoints::GetLastCheckpointBlockHeight();
+    if (nBestHeight > nLastCheckpointHeight + 1 && nHeight < nLastCheckpointHeight)
+        return header.DoS(25, error("AcceptBlockHeader() : header %s forks before the last checkpoint",
+                                    hash.ToString().c_str()));
+    if (!Checkpoints::CheckHardened(nHeight, hash))
+        return header.DoS(
+            100, error("AcceptBlockHeader() : rejected by hardened checkpoint lock-in at %d", nHeight));
+
+    if (header.GetBlockTime() > FutureDrift(GetAdjustedTime()))
+        return error("AcceptBlockHeader() : header %s has its timestamp too far in the future",
+                     hash.ToString().c_str());
+    if (header.GetBlockTime() <= pindexPrev->GetPastTimeLimit() ||
+        FutureDrift(header.GetBlockTime()) < pindexPrev->GetBlockTime())
+        return error("AcceptBlockHeader() : header %s has its timestamp too early",
+                     hash.ToString().c_str());
+
+    // A header doesn't tell whether its block is proof-of-stake, but all the blocks after LAST_POW_BLOCK
+    // are. The few before it are left to AcceptBlock().
+    const bool fProofOfStake = nHeight > LAST_POW_BLOCK;
+    if (fProofOfStake && IsTargetCheckable(nHeight) &&
+        header.nBits != GetNextTargetRequired(pindexPrev.get(), true))
+        return header.DoS(100, error("AcceptBlockHeader() : header %s has an incorrect proof-of-stake "
+                                     "target",
+                                     hash.ToString().c_str()));
+
+    boost::shared_ptr<CHeaderIndex> pindexNew = boost::make_shared<CHeaderIndex>();
+    pindexNew->hashBlock      = hash;
+    pindexNew->phashBlock     = &pindexNew->hashBlock;
+    pindexNew->pprev          = pindexPrev;
+    pindexNew->nHeight        = nHeight;
+    pindexNew->nVersion       = header.nVersion;
+    pindexNew->hashMerkleRoot = header.hashMerkleRoot;
+    pindexNew->nTime          = header.nTime;
+    pindexNew->nBits          = header.nBits;
+    pindexNew->nNonce         = header.nNonce;
+    pindexNew->nStatus        = CBlockIndex::BLOCK_VALID_HEADER;
+    if (fProofOfStake)
+        pindexNew->SetProofOfStake();
+    pindexNew->nChainTrust = pindexPrev->nChainTrust + pindexNew->GetBlockTrust();
+    pindexNew->vPeers.push_back(nPeerId);
+
+    // when it's full, the branches with less trust than the new header make room for it
+    if (mapHeaderIndex.size() >= MAX_HEADER_INDEX_SIZE && PruneHeaderIndex() == 0 &&
+        EvictHeaderBranches(MAX_HEADER_INDEX_SIZE - MAX_HEADERS_RESULTS, pindexNew) == 0)
+        return error("AcceptBlockHeader() : %" PRIszu " headers with more trust are known ahead of the "
+                     "blocks already",
+                     mapHeaderIndex.size());
+
+    pindexOut = pindexNew;
+    mapHeaderIndex.insert(std::make_pair(hash, pindexOut));
+    mapHeaderIndexByPrev.insert(std::make_pair(header.hashPrevBlock, pindexOut));
+
+    if (pindexOut->nChainTrust > GetBestHeader()->nChainTrust)
+        boost::atomic_store(&pindexBestHeader, pindexOut);
+    return true;
+}
+
+void HeaderIndexBlockStored(const CBlockIndexSmartPtr& pindexStored)
+{
+    const uint256 hash = pindexStored->GetBlockHash();
+
+    BlockIndexMapType::iterator mi = mapHeaderIndex.find(hash);
+    if (mi != mapHeaderIndex.end()) {
+        EraseHeaderIndexByPrev(mi->second);
+        mapHeaderIndex.erase(mi);
+    }
+
+    // the headers after it follow the stored block from now on
+    typedef std::multimap<uint256, CBlockIndexSmartPtr>::iterator Iterator;
+    std::pair<Iterator, Iterator> range = mapHeaderIndexByPrev.equal_range(hash);
+    for (Iterator it = range.first; it != range.second; ++it)
+        boost::atomic_store(&it->second->pprev, pindexStored);
+    mapHeaderIndexByPrev.erase(range.first, range.second);
+
+    CBlockIndexSmartPtr pindexHeader = boost::atomic_load(&pindexBestHeader);
+    if (pindexHeader && pindexHeader->GetBlockHash() == hash)
+        boost::atomic_store(&pindexBestHeader, CBlockIndexSmartPtr());
+}
+
+unsigned int PruneHeaderIndex()
+{
+    CBlockIndexSmartPtr pindexBestBlock = boost::atomic_load(&pindexBest);
+    if (!pindexBestBlock)
+        return 0;
+
+    // the entries up to a header with more trust than the best block are kept, and the branches
+    // that fork off them, or off a stored block, without getting past the best block are on forks
+    // that lost
+    std::set<CBlockIndex*> setKeep;
+    for (const std::pair<const uint256, CBlockIndexSmartPtr>& item : mapHeaderIndex) {
+        if (item.second->nChainTrust <= pindexBestBlock->nChainTrust)
+            continue;
+        CBlockIndexSmartPtr pindex = item.second;
+        while (pindex && mapHeaderIndex.count(pindex->GetBlockHash()) &&
+               setKeep.insert(pindex.get()).second)
+            pindex = boost::atomic_load(&pindex->pprev);
+    }
+    std::vector<CBlockIndexSmartPtr> vErase;
+    for (const std::pair<const uint256, CBlockIndexSmartPtr>& item : mapHeaderIndex) {
+        if (setKeep.count(item.second.get()))
+            continue;
+        CBlockIndexSmartPtr pindexPrev = boost::atomic_load(&item.second->pprev);
+        if (!pindexPrev || !mapHeaderIndex.count(pindexPrev->GetBlockHash()) ||
+            setKeep.count(pindexPrev.get()))
+            vErase.push_back(item.second);
+    }
+
+    const unsigned int nPruned = EraseHeaderBranches(vErase);
+    if (nPruned > 0) {
+        ResetBestHeader();
+        printf("PruneHeaderIndex() : dropped %u headers of forks that the best block got past\n",
+               nPruned);
+    }
+    return nPruned;
+}
+
+unsigned int DropPeerHeaders(int64_t nPeerId)
+{
+    std::vector<CBlockIndexSmartPtr> vErase;
+    for (const std::pair<const uint256, CBlockIndexSmartPtr>& item : mapHeaderIndex) {
+        std::vector<int64_t>& vPeers = GetHeaderEntry(item.second).vPeers;
+        vPeers.erase(std::remove(vPeers.begin(), vPeers.end(), nPeerId), vPeers.end());
+        if (vPeers.empty())
+            vErase.push_back(item.second);
+    }
+    const unsigned int nDropped = EraseHeaderBranches(vErase);
+    if (nDropped > 0) {
+        ResetBestHeader();
+        printf("DropPeerHeaders() : dropped %u headers that only peer %" PRId64 " sent\n", nDropped,
+               nPeerId);
+    }
+    return nDropped;
+}
+
+unsigned int EvictHeaderBranches(size_t nMaxSize, const CBlockIndexSmartPtr& pindexNew)
+{
+    // the headers that pindexNew follows are kept, wherever the other branches fork off them
+    std::set<CBlockIndex*> setNewBranch;
+    for (CBlockIndexSmartPtr pindex = boost::atomic_load(&pindexNew->pprev);
+         pindex && mapHeaderIndex.count(pindex->GetBlockHash());
+         pindex = boost::atomic_load(&pindex->pprev))
+        setNewBranch.insert(pindex.get());
+
+    // the ends of the branches, the ones with the least trust first
+    std::vector<CBlockIndexSmartPtr> vTips;
+    for (const std::pair<const uint256, CBlockIndexSmartPtr>& item : mapHeaderIndex)
+        if (mapHeaderIndexByPrev.count(item.first) == 0)
+            vTips.push_back(item.second);
+    std::sort(vTips.begin(), vTips.end(),
+              [](const CBlockIndexSmartPtr& a, const CBlockIndexSmartPtr& b) {
+                  return a->nChainTrust < b->nChainTrust;
+              });
+
+    // a branch goes back to where it forks off another one, or to a stored block
+    unsigned int nEvicted = 0;
+    for (const CBlockIndexSmartPtr& pindexTip : vTips) {
+        if (mapHeaderIndex.size() <= nMaxSize || pindexTip->nChainTrust >= pindexNew->nChainTrust)
+            break;
+        CBlockIndexSmartPtr pindex = pindexTip;
+        while (pindex && mapHeaderIndex.count(pindex->GetBlockHash()) &&
+               mapHeaderIndexByPrev.count(pindex->GetBlockHash()) == 0 &&
+               setNewBranch.count(pindex.get()) == 0) {
+            CBlockIndexSmartPtr pindexPrev = boost::atomic_load(&pindex->pprev);
+            EraseHeaderIndexByPrev(pindex);
+            mapHeaderIndex.erase(pindex->GetBlockHash());
+            nEvicted++;
+            pindex = pindexPrev;
+        }
+    }
+    if (nEvicted > 0) {
+        ResetBestHeader();
+        printf("EvictHeaderBranches() : evicted %u headers of the branches with the least trust\n",
+               nEvicted);
+    }
+    return nEvicted;
+}
+
+int GetLastStoredHeight(const CBlockIndexSmartPtr& pindexHeader)
+{
+    CBlockIndexSmartPtr pindex = pindexHeader;
+    while (pindex && !mapBlockIndex.count(pindex->GetBlockHash()))
+        pindex = boost::atomic_load(&pindex->pprev);
+    return pindex ? pindex->nHeight : -1;
+}
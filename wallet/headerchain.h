@@ -0,0 +1,72 @@
+#ifndef HEADERCHAIN_H
+#define HEADERCHAIN_H
+
+#include "globals.h"
+#include "uint256.h"
+
+class CBlock;
+
+/** How many headers a "headers" message has at most; a full one means that the peer has more */
+static const unsigned int MAX_HEADERS_RESULTS = 2000;
+
+/** How many headers are known ahead of the stored blocks at most; the header sync waits for the blocks
+ * to come once there are that many, and goes on once half of them did */
+static const unsigned int MAX_HEADER_INDEX_SIZE = 100000;
+
+/** How far past the best block the blocks of the best header chain are asked for */
+static const int BLOCK_DOWNLOAD_WINDOW = 128;
+
+/** How long, in seconds, none of the blocks of the headers that a peer sent can come before the peer is
+ * taken for stalling, and its headers are dropped */
+static const int64_t HEADERS_STALL_TIMEOUT = 5 * 60;
+
+/**
+ * The headers that are known and checked, but whose blocks aren't stored yet; their entries are
+ * header-only (see CBlockIndex::IsHeaderOnly()), and follow either each other or a block of
+ * mapBlockIndex. AddToBlockIndex() takes an entry out once its block is stored. The entries are kept in
+ * memory only, so the header sync starts over from the best block after a restart. An entry belongs to
+ * the peers that sent its header, and is dropped once they all disconnected or stalled (see
+ * DropPeerHeaders()), so that a peer can't keep headers there whose blocks never come.
+ */
+extern BlockIndexMapType mapHeaderIndex;
+
+/** The header with the most chain trust, if it's header-only; see GetBestHeader() */
+extern CBlockIndexSmartPtr pindexBestHeader;
+
+/** The end of the chain of headers with the most trust, which is the best block unless headers are known
+ * past it */
+CBlockIndexSmartPtr GetBestHeader();
+
+/** The entry of a block whose header is known, whether its block is stored or not */
+CBlockIndexSmartPtr LookupHeaderIndex(const uint256& hash);
+
+/**
+ * Checks what can be checked of a block from its header alone (its target, its time and the checkpoints)
+ * and adds a header-only entry for it to mapHeaderIndex, which belongs to the peer nPeerId (see
+ * CNode::nId). The header has to follow a known one. Gives the entry of a header that's known already,
+ * which then belongs to the peer as well. A header that's invalid gets header.nDoS set, like
+ * CBlock::AcceptBlock() does.
+ */
+bool AcceptBlockHeader(const CBlock& header, CBlockIndexSmartPtr& pindexOut, int64_t nPeerId);
+
+/** Replaces the header-only entry of a block that's now stored with the block's (see
+ * AddToBlockIndex()), so that the headers after it follow the stored block */
+void HeaderIndexBlockStored(const CBlockIndexSmartPtr& pindexStored);
+
+/** Drops the branches of header-only entries that don't get past the best block in trust, which are on
+ * forks that lost, so that the header sync can go on; returns how many were dropped */
+unsigned int PruneHeaderIndex();
+
+/** Drops the header-only entries that no other peer than nPeerId sent, and the ones after them, once the
+ * peer is disconnected or stalls; returns how many were dropped */
+unsigned int DropPeerHeaders(int64_t nPeerId);
+
+/** Evicts the branches of header-only entries with less trust than pindexNew, the ones with the least
+ * trust first, until there are no more than nMaxSize entries; the headers that pindexNew follows are
+ * kept. Returns how many were evicted. */
+unsigned int EvictHeaderBranches(size_t nMaxSize, const CBlockIndexSmartPtr& pindexNew);
+
+/** The height of the last block of the header chain up to pindexHeader that's stored */
+int GetLastStoredHeight(const CBlockIndexSmartPtr& pindexHeader);
+
+#endif // HEADERCHAIN_H
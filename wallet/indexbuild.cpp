@@ -0,0 +1,177 @@
+#include "indexbuild.h"
+
+#include "block.h"
+#include "blockindex.h"
+#include "blockprune.h"
+#include "main.h"
+#include "net.h"
+#include "txdb.h"
+#include "ui_interface.h"
+#include "util.h"
+
+namespace {
+/** Indexes the next INDEX_BUILD_BLOCKS blocks; returns false once the build is done or failed */
+bool BuildIndexStep(CIndexBuild& index, CBlockIndexSmartPtr& pindexNext, int64_t nStart)
+{
+    AssertLockHeld(cs_main);
+    CTxDB txdb;
+    int   nHeight = -1;
+    if (!(txdb.*index.ReadHeight)(nHeight)) {
+        printf("ThreadIndexBuild() : failed to read the height of the %s\n", index.pszName);
+        return false;
+    }
+    if (nHeight == INDEX_HEIGHT_REBUILD) {
+        // an index that doesn't match the chain again after it was built again won't ever
+        if (index.fRebuilt) {
+            printf("ThreadIndexBuild() : the %s doesn't match the chain after it was built again; it's "
+                   "off until it's dropped\n",
+                   index.pszName);
+            index.fEnabled = false;
+            return false;
+        }
+        printf("Building the %s again\n", index.pszName);
+        index.fRebuilt = true;
+        if (!(txdb.*index.Erase)()) {
+            printf("ThreadIndexBuild() : failed to drop the %s\n", index.pszName);
+            return false;
+        }
+        pindexNext.reset();
+        return true;
+    }
+    if (nHeight >= nBestHeight) {
+        index.nHeight = nHeight;
+        index.fSynced = true;
+        printf("Built the %s up to height %d in %" PRId64 "ms\n", index.pszName, nHeight,
+               GetTimeMillis() - nStart);
+        return false;
+    }
+
+    if (!pindexNext || pindexNext->nHeight != nHeight + 1 || !pindexNext->IsInMainChain()) {
+        pindexNext = boost::atomic_load(&pindexBest);
+        while (pindexNext && pindexNext->nHeight > nHeight + 1)
+            pindexNext = pindexNext->pprev;
+    }
+
+    if (!txdb.TxnBegin()) {
+        printf("ThreadIndexBuild() : TxnBegin failed\n");
+        return false;
+    }
+    bool fOk = true;
+    for (int i = 0; i < INDEX_BUILD_BLOCKS && pindexNext; i++) {
+        CBlock block;
+        fOk = txdb.ReadBlock(pindexNext->blockKeyInDB, block) &&
+              index.ConnectBlock(txdb, block, pindexNext->nHeight) &&
+              (txdb.*index.ReadHeight)(nHeight);
+        // a block that the index didn't match marked it to be built again
+        if (!fOk || nHeight != pindexNext->nHeight)
+            break;
+        pindexNext = pindexNext->pnext;
+    }
+    if (!fOk) {
+        txdb.TxnAbort();
+        printf("ThreadIndexBuild() : failed to add the block at height %d to the %s\n", nHeight + 1,
+               index.pszName);
+        return false;
+    }
+    if (!txdb.TxnCommit()) {
+        printf("ThreadIndexBuild() : TxnCommit failed\n");
+        return false;
+    }
+    if (nHeight < 0)
+        return true;
+    if (nHeight / 10000 != index.nHeight / 10000)
+        printf("Built the %s up to height %d\n", index.pszName, nHeight);
+    index.nHeight = nHeight;
+    return true;
+}
+} // namespace
+
+bool InitIndexBuild(CTxDB& txdb, CIndexBuild& index, std::string& strError)
+{
+    int nHeight = -1;
+    if (!(txdb.*index.ReadHeight)(nHeight)) {
+        strError = strprintf(_("Failed to read the height of the %s"), index.pszName);
+        return false;
+    }
+
+    // an index that's ahead of the chain doesn't belong to it, and one that was found not to match
+    // the chain is built again
+    if (nHeight == INDEX_HEIGHT_REBUILD ||
+        (nHeight >= 0 && (!index.fEnabled || nHeight > nBestHeight))) {
+        printf("Dropping the %s, which is indexed up to height %d\n", index.pszName, nHeight);
+        if (!(txdb.*index.Erase)()) {
+            strError = strprintf(_("Failed to drop the %s"), index.pszName);
+            return false;
+        }
+        nHeight = -1;
+    }
+    if (!index.fEnabled)
+        return true;
+
+    if (nPruneHeight > 0 && nHeight < nPruneHeight) {
+        strError = strprintf(_("The %s (-%s) can't be built, since the blocks it needs were pruned "
+                               "(-prune)"),
+                             index.pszName, index.pszOption);
+        return false;
+    }
+    index.nHeight = nHeight;
+    index.fSynced = nHeight == nBestHeight;
+    printf("The %s is indexed up to height %d\n", index.pszName, nHeight);
+    return true;
+}
+
+void StartIndexBuild(CIndexBuild& index)
+{
+    AssertLockHeld(cs_main);
+    if (index.fRunning)
+        return;
+    index.fRunning = true;
+    if (!NewThread(ThreadIndexBuild, &index)) {
+        printf("Error: NewThread(ThreadIndexBuild) failed for the %s\n", index.pszName);
+        index.fRunning = false;
+    }
+}
+
+void ThreadIndexBuild(void* parg)
+{
+    CIndexBuild& index = *static_cast<CIndexBuild*>(parg);
+    RenameThread(strprintf("neblio-%s", index.pszOption).c_str());
+    vnThreadsRunning[index.nThread]++;
+
+    const int64_t       nStart = GetTimeMillis();
+    CBlockIndexSmartPtr pindexNext; // the next block to index, as long as it's in the main chain
+    bool                fRunning = true;
+    while (!fShutdown && fRunning) {
+        {
+            LOCK(cs_main);
+            fRunning = BuildIndexStep(index, pindexNext, nStart);
+            // the build is started again by StartIndexBuild() once it stopped here
+            if (!fRunning)
+                index.fRunning = false;
+        }
+        // the blocks that arrive in the meantime get a chance to be processed
+        MilliSleep(1);
+    }
+
+    vnThreadsRunning[index.nThread]--;
+}
+
+bool MarkIndexForRebuild(CTxDB& txdb, CIndexBuild& index, const CBlock& block, int nHeight)
+{
+    AssertLockHeld(cs_main);
+    printf("The %s doesn't match block %s at height %d\n", index.pszName,
+           block.GetHash().ToString().c_str(), nHeight);
+    index.fSynced = false;
+    index.nHeight = -1;
+    if (nPruneHeight > 0) {
+        printf("The %s can't be built again, since blocks were pruned (-prune); it's off until it's "
+               "dropped\n",
+               index.pszName);
+        index.fEnabled = false;
+    }
+    if (!(txdb.*index.WriteHeight)(INDEX_HEIGHT_REBUILD))
+        return error("MarkIndexForRebuild() : failed to write the height of the %s", index.pszName);
+    if (index.fEnabled)
+        StartIndexBuild(index);
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef INDEXBUILD_H
+#define INDEXBUILD_H
+
+#include <string>
+
+#include <boost/atomic.hpp>
+
+class CBlock;
+class CTxDB;
+
+/** How many blocks the background build of an index indexes while it holds cs_main */
+static const int INDEX_BUILD_BLOCKS = 100;
+
+/** The height that's written for an index once it's found not to match the chain, until the background
+ * build drops it and builds it again (see MarkIndexForRebuild()) */
+static const int INDEX_HEIGHT_REBUILD = -2;
+
+/**
+ * An index of the main chain that's optional (like -addrindex and -tokenindex). It's built in the
+ * background up to the best block by ThreadIndexBuild(), INDEX_BUILD_BLOCKS at a time, and kept up to
+ * date by ConnectBlock() and DisconnectBlock() once it caught up. The index says how its height is read
+ * and written, how a block is added to it, and how it's dropped.
+ */
+struct CIndexBuild
+{
+    typedef bool (CTxDB::*ReadHeightFunc)(int& nHeight);
+    typedef bool (CTxDB::*WriteHeightFunc)(int nHeight);
+    typedef bool (CTxDB::*EraseFunc)();
+    /** Adds a block of the main chain to the index, if the index is up to the block before */
+    typedef bool (*ConnectBlockFunc)(CTxDB& txdb, const CBlock& block, int nHeight);
+
+    const char*      pszName;   // for the log, e.g. "token index"
+    const char*      pszOption; // the option without the dash, which names the thread as well
+    int              nThread;   // see vnThreadsRunning
+    ReadHeightFunc   ReadHeight;
+    WriteHeightFunc  WriteHeight;
+    EraseFunc        Erase;
+    ConnectBlockFunc ConnectBlock;
+
+    /** Whether the option is set; the index is turned off when it can't be built again */
+    boost::atomic<bool>& fEnabled;
+    /** Whether the index has caught up with the main chain */
+    boost::atomic<bool>& fSynced;
+    /** How far the background build got: the main chain is indexed up to this height, or -1 if nothing
+     * is */
+    boost::atomic<int>& nHeight;
+
+    // whether ThreadIndexBuild() runs, and whether it built the index again already; guarded by
+    // cs_main
+    bool fRunning;
+    bool fRebuilt;
+
+    CIndexBuild(const char* pszNameIn, const char* pszOptionIn, int nThreadIn,
+                ReadHeightFunc ReadHeightIn, WriteHeightFunc WriteHeightIn, EraseFunc EraseIn,
+                ConnectBlockFunc ConnectBlockIn, boost::atomic<bool>& fEnabledIn,
+                boost::atomic<bool>& fSyncedIn, boost::atomic<int>& nHeightIn)
+        : pszName(pszNameIn), pszOption(pszOptionIn), nThread(nThreadIn), ReadHeight(ReadHeightIn),
+          WriteHeight(WriteHeightIn), Erase(EraseIn), ConnectBlock(ConnectBlockIn), fEnabled(fEnabledIn),
+          fSynced(fSyncedIn), nHeight(nHeightIn), fRunning(false), fRebuilt(false)
+    {
+    }
+};
+
+/**
+ * Checks an index against its option when the block index is loaded: the index is dropped if the
+ * option isn't set anymore, since the blocks connected without it wouldn't be in it, or if it was
+ * marked to be built again; and it can't be built past blocks that were pruned.
+ */
+bool InitIndexBuild(CTxDB& txdb, CIndexBuild& index, std::string& strError);
+
+/** Starts ThreadIndexBuild() for the index, unless it runs already */
+void StartIndexBuild(CIndexBuild& index);
+
+/** Builds the index (a CIndexBuild) up to the best block in the background */
+void ThreadIndexBuild(void* parg);
+
+/** Marks an index that doesn't match the block at nHeight to be built again in the background, so that
+ * the block is connected nevertheless; the index is turned off if that can't be done since blocks were
+ * pruned */
+bool MarkIndexForRebuild(CTxDB& txdb, CIndexBuild& index, const CBlock& block, int nHeight);
+
+#endif // INDEXBUILD_H
@@ -3,6 +3,9 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 #include "bitcoinrpc.h"
+#include "addrindex.h"
+#include "blockprune.h"
+#include "tokenindex.h"
 #include "txdb.h"
 #include "walletdb.h"
 #ifdef NEBLIO_REST
@@ -110,6 +113,7 @@ void Shutdown(void* /*parg*/)
         //        CTxDB().Close();
         FlushDBWalletTransient(false);
         StopNode();
+        FlushCoinsCache(true);
         FlushDBWalletTransient(true);
         boost::filesystem::remove(GetPidFile());
         UnregisterWallet(pwalletMain);
@@ -123,6 +127,7 @@ void Shutdown(void* /*parg*/)
         NewThread(ExitTimeout, NULL);
         MilliSleep(50);
         printf("neblio exited\n\n");
+        CDebugLogWriter::Instance().Stop();
         fExit = true;
 #ifndef QT_GUI
         // ensure non-UI client gets exited here, but let Bitcoin-Qt reach 'return 0;' in bitcoin.cpp
@@ -251,7 +256,7 @@ std::string HelpMessage()
         "  -pid=<file>            " + _("Specify pid file (default: nebliod.pid)") + "\n" +
         "  -datadir=<dir>         " + _("Specify data directory") + "\n" +
         "  -wallet=<dir>          " + _("Specify wallet file (within data directory)") + "\n" +
-        "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n" +
+        "  -dbcache=<n>           " + _("Set database cache size in megabytes, which is also how much memory the unspent transaction outputs can use before they're written (default: 25)") + "\n" +
         "  -maxorphanblocks=<n>   " + _("Keep at most <n> unconnectable blocks in memory (default: 750)") + "\n" +
         "  -maxorphantx=<n>       " + _("Keep at most <n> unconnectable transactions in memory (default: 100)") + "\n" +
         "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n" +
@@ -271,6 +276,7 @@ std::string HelpMessage()
         "  -listen                " + _("Accept connections from outside (default: 1 if no -proxy or -connect)") + "\n" +
         "  -bind=<addr>           " + _("Bind to given address. Use [host]:port notation for IPv6") + "\n" +
         "  -dnsseed               " + _("Find peers using DNS lookup (default: 1)") + "\n" +
+        "  -compactblocks         " + _("Relay new blocks to the peers that support it as compact blocks, which they put together from the transactions they have (default: 1)") + "\n" +
         "  -staking               " + _("Stake your coins to support network and gain reward (default: 1)") + "\n" +
         "  -synctime              " + _("Sync time with other nodes. Disable if time on your system is precise e.g. syncing with NTP (default: 1)") + "\n" +
         "  -cppolicy              " + _("Sync checkpoints policy (default: strict)") + "\n" +
@@ -296,6 +302,7 @@ std::string HelpMessage()
 #endif
         "  -testnet               " + _("Use the test network") + "\n" +
         "  -debug                 " + _("Output extra debugging information. Implies all other -debug* options") + "\n" +
+        "  -debug=<category>      " + _("Output debugging information of a category only (net, db, import, wallet, rpc, ntp1); can be given more than once") + "\n" +
         "  -debugnet              " + _("Output extra network debugging information") + "\n" +
         "  -logtimestamps         " + _("Prepend debug output with timestamp") + "\n" +
         "  -shrinkdebugfile       " + _("Shrink debug.log file on client startup (default: 1 when no -debug)") + "\n" +
@@ -317,9 +324,16 @@ std::string HelpMessage()
         "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100)") + "\n" +
         "  -rescan                " + _("Rescan the block chain for missing wallet transactions") + "\n" +
         "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n" +
+        "  -deferwalletchecks     " + _("Check wallet transactions and keys in the background after loading the wallet, instead of while loading it") + "\n" +
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 2500, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n" +
         "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n" +
+        "  -dbbatchsize=<n>       " + _("During the initial download and imports, write the blocks to the database in batches of up to <n> MB (default: 32, 0 = every block on its own)") + "\n" +
+        "  -flatblockfiles        " + _("Store the blocks in append-only block files instead of the database; blocks already in the database are moved on startup, and they stay in the files from then on (default: 0)") + "\n" +
+        "  -prune=<n>             " + _("Delete the oldest blocks once the blocks take more than <n> MB, keeping the transactions that are still needed; the node then doesn't serve the old blocks, and rescans can't go back that far (default: 0 = keep every block, at least 550)") + "\n" +
+        "  -addrindex             " + _("Maintain an index of the outputs and the history of every address, for getaddressutxos, getaddresshistory and getaddressbalance; it's built in the background if the chain is there already (default: 0)") + "\n" +
+        "  -tokenindex            " + _("Maintain an index of the supply, the holders and the transactions of every NTP1 token, for gettokeninfo, gettokenholders and gettokentransfers; it's built in the background if the chain is there already (default: 0)") + "\n" +
+        "  -dbbatchsync=<n>       " + _("How the database is synced to disk while writing batches: 2 = every batch, 1 = every batch but its metadata, 0 = every minute (a system crash may corrupt the database) (default: 2)") + "\n" +
 
         "\n" + _("Block creation options:") + "\n" +
         "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n" +
@@ -468,6 +482,12 @@ bool AppInit2()
     else
         fDebugNet = GetBoolArg("-debugnet");
 
+    std::vector<std::string> vDebugCategories;
+    mapMultiArgs.get("-debug", vDebugCategories);
+    bool fDebugCategoriesKnown = SetLogCategories(vDebugCategories);
+    if (fDebugNet)
+        nLogCategories |= LOG_NET;
+
 #if !defined(WIN32) && !defined(QT_GUI)
     fDaemon = GetBoolArg("-daemon");
 #else
@@ -562,6 +582,8 @@ bool AppInit2()
 
     if (GetBoolArg("-shrinkdebugfile", !fDebug))
         ShrinkDebugFile();
+    // threads don't survive fork(), so debug.log is only written in the background from here on
+    CDebugLogWriter::Instance().Start();
     printf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     printf("neblio version %s (%s)\n", FormatFullVersion().c_str(), CLIENT_DATE.c_str());
     printf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
@@ -569,6 +591,8 @@ bool AppInit2()
         printf("Startup time: %s\n", DateTimeStrFormat("%x %H:%M:%S", GetTime()).c_str());
     printf("Default data directory %s\n", GetDefaultDataDir().string().c_str());
     printf("Used data directory %s\n", strDataDir.c_str());
+    if (!fDebugCategoriesKnown)
+        printf("Unknown category given with -debug; known categories are net, db, import, wallet, rpc and ntp1\n");
     std::ostringstream strErrors;
 
     if (fDaemon)
@@ -740,6 +764,19 @@ bool AppInit2()
 
     // ********************************************************* Step 7: load blockchain
 
+    CTxDBBatchScope::nMaxBytes  = std::max<int64_t>(0, GetArg("-dbbatchsize", 32)) * ONE_MB;
+    CTxDBBatchScope::nSyncLevel = std::min<int64_t>(std::max<int64_t>(GetArg("-dbbatchsync", 2), 0), 2);
+    const int64_t nPruneMB = GetArg("-prune", 0);
+    if (nPruneMB < 0)
+        return InitError(_("-prune can't be negative"));
+    if (nPruneMB > 0 && nPruneMB < (int64_t)MIN_PRUNE_TARGET_MB)
+        return InitError(strprintf(_("-prune has to be at least %u MB"), (unsigned)MIN_PRUNE_TARGET_MB));
+    nPruneTarget = nPruneMB * ONE_MB;
+    fAddrIndex   = GetBoolArg("-addrindex", false);
+    fTokenIndex  = GetBoolArg("-tokenindex", false);
+    // an unspent transaction in memory takes about 300 bytes
+    nCoinCacheSize = std::max<int64_t>(1, GetArg("-dbcache", 25)) * ONE_MB / 300;
+
     if (!bitdb.Open(GetDataDir())) {
         string msg = strprintf(_("Error initializing database environment %s!"
                                  " To recover, BACKUP THAT DIRECTORY, then remove"
@@ -814,6 +851,23 @@ bool AppInit2()
     }
     printf(" block index %15" PRId64 "ms\n", GetTimeMillis() - nStart);
 
+    // a node that prunes its blocks, or did before, can't serve the old ones
+    if (nPruneTarget > 0 || nPruneHeight > 0) {
+        nLocalServices = (nLocalServices.load() & ~(uint64_t)NODE_NETWORK) | NODE_NETWORK_LIMITED;
+        printf("Pruning the blocks to %" PRIu64 " MB; they're pruned up to height %d\n",
+               nPruneTarget / ONE_MB, nPruneHeight.load());
+    }
+    if (GetBoolArg("-compactblocks", true))
+        nLocalServices = nLocalServices.load() | NODE_COMPACT_BLOCKS;
+
+    {
+        CTxDB       txdb;
+        std::string strIndexError;
+        if (!InitIndexBuild(txdb, addrIndexBuild, strIndexError) ||
+            !InitIndexBuild(txdb, tokenIndexBuild, strIndexError))
+            return InitError(strIndexError);
+    }
+
     if (GetBoolArg("-printblockindex") || GetBoolArg("-printblocktree")) {
         PrintBlockTree();
         return false;
@@ -910,6 +964,9 @@ bool AppInit2()
 
     RegisterWallet(pwalletMain);
 
+    if (nLoadWalletRet == DB_LOAD_OK && GetBoolArg("-deferwalletchecks"))
+        NewThread(ThreadCheckWalletRecords, new std::shared_ptr<CWallet>(pwalletMain));
+
     CBlockIndexSmartPtr pindexRescan = pindexBest;
     if (GetBoolArg("-rescan") ||
         SC_CheckOperationOnRestartScheduleThenDeleteIt(SC_SCHEDULE_ON_RESTART_OPNAME__RESCAN))
@@ -917,11 +974,20 @@ bool AppInit2()
     else {
         CWalletDB     walletdb(strWalletFileName);
         CBlockLocator locator;
-        if (walletdb.ReadBestBlock(locator))
+        if (walletdb.ReadRescanProgress(locator)) {
+            // a rescan was interrupted, continue it
+            pindexRescan = locator.GetBlockIndex();
+            printf("Resuming interrupted rescan from block %i\n",
+                   pindexRescan ? pindexRescan->nHeight : 0);
+        } else if (walletdb.ReadBestBlock(locator))
             pindexRescan = locator.GetBlockIndex();
     }
     if (pindexBest != pindexRescan && pindexBest && pindexRescan &&
         pindexBest->nHeight > pindexRescan->nHeight) {
+        if (IsBlockPruned(pindexRescan.get()))
+            return InitError(_("Rescanning the wallet needs blocks that were pruned (-prune); the "
+                               "blocks have to be downloaded again for that, by removing the database "
+                               "directory."));
         uiInterface.InitMessage(_("Rescanning..."));
         printf("Rescanning last %i blocks (from block %i)...\n",
                pindexBest->nHeight - pindexRescan->nHeight, pindexRescan->nHeight);
@@ -932,6 +998,18 @@ bool AppInit2()
 
     // ********************************************************* Step 9: import blocks
 
+    // the database map is resized ahead of time from now on, while nothing is using it
+    if (!NewThread(ThreadLMDBMaintenance, NULL))
+        printf("Error: NewThread(ThreadLMDBMaintenance) failed\n");
+
+    // the blocks that are there already are added to the indexes while new ones arrive
+    {
+        LOCK(cs_main);
+        for (CIndexBuild* pindexBuild : {&addrIndexBuild, &tokenIndexBuild})
+            if (pindexBuild->fEnabled && !pindexBuild->fSynced)
+                StartIndexBuild(*pindexBuild);
+    }
+
     std::vector<boost::filesystem::path>* vPath = new std::vector<boost::filesystem::path>();
     std::vector<std::string>              loadBlockVals;
     bool loadBlockExists = mapMultiArgs.get("-loadblock", loadBlockVals);
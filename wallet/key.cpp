@@ -12,6 +12,48 @@
 #include "crypto_highlevel.h"
 #include "key.h"
 
+namespace {
+// The secp256k1 group is built only once, with the multiples of the generator precomputed, and all
+// keys share it: copying a group into an EC_KEY only takes a reference to the precomputed table.
+// Building the group from the curve parameters for every key was a large part of the cost of
+// checking a signature.
+class CSecp256k1Group
+{
+    EC_GROUP* group;
+
+public:
+    CSecp256k1Group()
+    {
+        group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+        if (group && !EC_GROUP_precompute_mult(group, NULL)) {
+            EC_GROUP_free(group);
+            group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+        }
+    }
+    ~CSecp256k1Group() { EC_GROUP_free(group); }
+
+    CSecp256k1Group(const CSecp256k1Group&) = delete;
+    CSecp256k1Group& operator=(const CSecp256k1Group&) = delete;
+
+    const EC_GROUP* get() const { return group; }
+};
+} // namespace
+
+// Same as EC_KEY_new_by_curve_name(NID_secp256k1), but uses the shared group
+static EC_KEY* EC_KEY_new_secp256k1()
+{
+    static const CSecp256k1Group secp256k1Group;
+
+    if (!secp256k1Group.get())
+        return NULL;
+    EC_KEY* eckey = EC_KEY_new();
+    if (eckey && !EC_KEY_set_group(eckey, secp256k1Group.get())) {
+        EC_KEY_free(eckey);
+        return NULL;
+    }
+    return eckey;
+}
+
 // Generate a private key from just the secret parameter
 int EC_KEY_regenerate_key(EC_KEY* eckey, BIGNUM* priv_key)
 {
@@ -240,9 +282,9 @@ void CKey::Reset()
     fCompressedPubKey = false;
     if (pkey != NULL)
         EC_KEY_free(pkey);
-    pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
+    pkey = EC_KEY_new_secp256k1();
     if (pkey == NULL)
-        throw key_error("CKey::CKey() : EC_KEY_new_by_curve_name failed");
+        throw key_error("CKey::CKey() : EC_KEY_new_secp256k1 failed");
     fSet = false;
 }
 
@@ -321,7 +363,7 @@ bool CKey::CheckSignatureElement(const unsigned char* vch, int len, bool half)
 CKey::EcKeyPtr CKey::GetLowLevelPublicKey() const
 {
     std::vector<unsigned char> pubkey_raw  = this->GetPubKey().Raw();
-    EC_KEY*                    pkey_rawPtr = EC_KEY_new_by_curve_name(NID_secp256k1);
+    EC_KEY*                    pkey_rawPtr = EC_KEY_new_secp256k1();
     const unsigned char*       pbegin      = &pubkey_raw[0];
     pkey_rawPtr                            = o2i_ECPublicKey(&pkey_rawPtr, &pbegin, pubkey_raw.size());
     if (!pkey_rawPtr) {
@@ -333,7 +375,7 @@ CKey::EcKeyPtr CKey::GetLowLevelPublicKey() const
 CKey::EcKeyPtr CKey::GetLowLevelPrivateKey() const
 {
     CPrivKey             privekey_raw = this->GetPrivKey();
-    EC_KEY*              pkey_rawPtr  = EC_KEY_new_by_curve_name(NID_secp256k1);
+    EC_KEY*              pkey_rawPtr  = EC_KEY_new_secp256k1();
     const unsigned char* pbegin       = &privekey_raw[0];
     if (d2i_ECPrivateKey(&pkey_rawPtr, &pbegin, privekey_raw.size())) {
         if (!EC_KEY_check_key(pkey_rawPtr)) {
@@ -404,14 +446,14 @@ void CKey::MakeNewKey(bool fCompressed)
     fSet = true;
 }
 
-bool CKey::SetPrivKey(const CPrivKey& vchPrivKey)
+bool CKey::SetPrivKey(const CPrivKey& vchPrivKey, bool fSkipCheck)
 {
     const unsigned char* pbegin = &vchPrivKey[0];
     if (d2i_ECPrivateKey(&pkey, &pbegin, vchPrivKey.size())) {
         // In testing, d2i_ECPrivateKey can return true
         // but fill in pkey with a key that fails
         // EC_KEY_check_key, so:
-        if (EC_KEY_check_key(pkey)) {
+        if (fSkipCheck || EC_KEY_check_key(pkey)) {
             fSet = true;
             return true;
         }
@@ -428,9 +470,9 @@ bool CKey::SetPrivKey(const CPrivKey& vchPrivKey)
 bool CKey::SetSecret(const CSecret& vchSecret, bool fCompressed)
 {
     EC_KEY_free(pkey);
-    pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
+    pkey = EC_KEY_new_secp256k1();
     if (pkey == NULL)
-        throw key_error("CKey::SetSecret() : EC_KEY_new_by_curve_name failed");
+        throw key_error("CKey::SetSecret() : EC_KEY_new_secp256k1 failed");
     if (vchSecret.size() != 32)
         throw key_error("CKey::SetSecret() : secret must be 32 bytes");
     BIGNUM* bn = BN_bin2bn(&vchSecret[0], 32, BN_new());
@@ -618,7 +660,7 @@ bool CKey::SetCompactSignature(uint256 hash, const std::vector<unsigned char>& v
     ECDSA_SIG_set0(sig, ecsig_r, ecsig_s);
 #endif
     EC_KEY_free(pkey);
-    pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
+    pkey = EC_KEY_new_secp256k1();
     if (nV >= 31) {
         SetCompressedPubKey();
         nV -= 4;
@@ -655,8 +697,9 @@ bool CKey::Verify(uint256 hash, const std::vector<unsigned char>& vchSigParam)
     if (vchSig.empty())
         return false;
 
-    // New versions of OpenSSL will reject non-canonical DER signatures. de/re-serialize first.
-    unsigned char*       norm_der = NULL;
+    // New versions of OpenSSL will reject non-canonical DER signatures, so the signature is parsed
+    // here and the parsed values are verified directly. ECDSA_verify() would serialize them again
+    // only to parse them back.
     ECDSA_SIG*           norm_sig = ECDSA_SIG_new();
     const unsigned char* sigptr   = &vchSig[0];
     assert(norm_sig);
@@ -670,14 +713,10 @@ bool CKey::Verify(uint256 hash, const std::vector<unsigned char>& vchSigParam)
         ECDSA_SIG_free(norm_sig);
         return false;
     }
-    int derlen = i2d_ECDSA_SIG(norm_sig, &norm_der);
-    ECDSA_SIG_free(norm_sig);
-    if (derlen <= 0)
-        return false;
 
     // -1 = error, 0 = bad sig, 1 = good
-    bool ret = ECDSA_verify(0, (unsigned char*)&hash, sizeof(hash), norm_der, derlen, pkey) == 1;
-    OPENSSL_free(norm_der);
+    bool ret = ECDSA_do_verify((unsigned char*)&hash, sizeof(hash), norm_sig, pkey) == 1;
+    ECDSA_SIG_free(norm_sig);
     return ret;
 }
 
@@ -696,9 +735,19 @@ bool CKey::IsValid()
     return GetPubKey() == key2.GetPubKey();
 }
 
+bool CSignatureVerifier::Verify(const CPubKey& pubkey, const uint256& hash,
+                                const std::vector<unsigned char>& vchSig)
+{
+    if (!fValidKey || pubkey != pubkeySet) {
+        fValidKey = !pubkey.Raw().empty() && key.SetPubKey(pubkey);
+        pubkeySet = pubkey;
+    }
+    return fValidKey && key.Verify(hash, vchSig);
+}
+
 bool ECC_InitSanityCheck()
 {
-    EC_KEY* pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
+    EC_KEY* pkey = EC_KEY_new_secp256k1();
     if (pkey == NULL)
         return false;
     EC_KEY_free(pkey);
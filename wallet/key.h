@@ -118,7 +118,8 @@ public:
     bool IsCompressed() const;
 
     void     MakeNewKey(bool fCompressed);
-    bool     SetPrivKey(const CPrivKey& vchPrivKey);
+    // fSkipCheck skips verifying that the private and public keys match, which is expensive
+    bool     SetPrivKey(const CPrivKey& vchPrivKey, bool fSkipCheck = false);
     bool     SetSecret(const CSecret& vchSecret, bool fCompressed = false);
     CSecret  GetSecret(bool& fCompressed) const;
     CPrivKey GetPrivKey() const;
@@ -167,6 +168,24 @@ public:
     GenerateSharedSecretFromThisPrivateKey(const CKey& publicKey) const;
 };
 
+/**
+ * Verifies signatures with one key, whose public key is only parsed again when it changes, so that the
+ * signatures of one public key that are checked one after the other share it. Gives the same results as
+ * CKey::SetPubKey() and CKey::Verify() on a new key.
+ */
+class CSignatureVerifier
+{
+public:
+    CSignatureVerifier() : fValidKey(false) {}
+
+    bool Verify(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig);
+
+private:
+    CKey    key;
+    CPubKey pubkeySet; // that's set in key, if it's valid
+    bool    fValidKey;
+};
+
 /** Check that required EC support is available at runtime */
 bool ECC_InitSanityCheck(void);
 
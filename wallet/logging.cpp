@@ -0,0 +1,311 @@
+#include "logging.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <tuple>
+
+#include "util.h"
+
+std::atomic<uint32_t> nLogCategories{LOG_NONE};
+
+static const std::pair<const char*, uint32_t> LOG_CATEGORY_NAMES[] = {
+    {"net", LOG_NET},       {"db", LOG_DB},   {"import", LOG_IMPORT},
+    {"wallet", LOG_WALLET}, {"rpc", LOG_RPC}, {"ntp1", LOG_NTP1},
+};
+
+bool SetLogCategories(const std::vector<std::string>& vCategories)
+{
+    bool     fAllKnown   = true;
+    uint32_t nCategories = LOG_NONE;
+    for (const std::string& strCategory : vCategories) {
+        if (strCategory.empty() || strCategory == "1") {
+            nCategories = LOG_ALL;
+            continue;
+        }
+        if (strCategory == "0")
+            continue;
+        bool fKnown = false;
+        for (const std::pair<const char*, uint32_t>& category : LOG_CATEGORY_NAMES) {
+            if (strCategory == category.first) {
+                nCategories |= category.second;
+                fKnown = true;
+            }
+        }
+        fAllKnown = fAllKnown && fKnown;
+    }
+    nLogCategories = nCategories;
+    return fAllKnown;
+}
+
+/**
+ * Ring buffer with a single producer (the thread it belongs to) and a single consumer (whoever holds
+ * cs_file). Every message is stored with its sequence number and its length; positions only grow,
+ * and wrap around the buffer when they're used.
+ */
+class CDebugLogWriter::CThreadBuffer
+{
+public:
+    typedef std::tuple<uint64_t, size_t, size_t> Message; // sequence, offset, length
+
+    static const size_t HEADER_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+
+private:
+    std::vector<char>     vch;
+    std::atomic<uint64_t> nWritePos{0};
+    std::atomic<uint64_t> nReadPos{0};
+
+    void CopyIn(uint64_t nPos, const void* pch, size_t nLen)
+    {
+        const size_t nStart = nPos & (vch.size() - 1);
+        const size_t nFirst = std::min(nLen, vch.size() - nStart);
+        memcpy(&vch[nStart], pch, nFirst);
+        memcpy(&vch[0], static_cast<const char*>(pch) + nFirst, nLen - nFirst);
+    }
+
+    void CopyOut(uint64_t nPos, void* pch, size_t nLen) const
+    {
+        const size_t nStart = nPos & (vch.size() - 1);
+        const size_t nFirst = std::min(nLen, vch.size() - nStart);
+        memcpy(pch, &vch[nStart], nFirst);
+        memcpy(static_cast<char*>(pch) + nFirst, &vch[0], nLen - nFirst);
+    }
+
+public:
+    std::atomic<uint64_t> nDropped{0};
+    std::atomic<bool>     fThreadExited{false};
+
+    explicit CThreadBuffer(size_t nSize) : vch(nSize) {}
+
+    size_t GetSize() const { return vch.size(); }
+    size_t GetUsed() const { return nWritePos.load() - nReadPos.load(); }
+
+    bool Push(uint64_t nSequence, const char* pch, uint32_t nLen)
+    {
+        const uint64_t nWrite = nWritePos.load(std::memory_order_relaxed);
+        const uint64_t nRead  = nReadPos.load(std::memory_order_acquire);
+        if (vch.size() - (nWrite - nRead) < HEADER_SIZE + nLen)
+            return false;
+        CopyIn(nWrite, &nSequence, sizeof(nSequence));
+        CopyIn(nWrite + sizeof(nSequence), &nLen, sizeof(nLen));
+        CopyIn(nWrite + HEADER_SIZE, pch, nLen);
+        nWritePos.store(nWrite + HEADER_SIZE + nLen, std::memory_order_release);
+        return true;
+    }
+
+    /** Moves the messages to str, and where they are to vMessages */
+    void Drain(std::string& str, std::vector<Message>& vMessages)
+    {
+        const uint64_t nWrite = nWritePos.load(std::memory_order_acquire);
+        uint64_t       nRead  = nReadPos.load(std::memory_order_relaxed);
+        while (nRead < nWrite) {
+            uint64_t nSequence;
+            uint32_t nLen;
+            CopyOut(nRead, &nSequence, sizeof(nSequence));
+            CopyOut(nRead + sizeof(nSequence), &nLen, sizeof(nLen));
+            const size_t nOffset = str.size();
+            str.resize(nOffset + nLen);
+            CopyOut(nRead + HEADER_SIZE, &str[nOffset], nLen);
+            vMessages.push_back(Message(nSequence, nOffset, nLen));
+            nRead += HEADER_SIZE + nLen;
+        }
+        nReadPos.store(nRead, std::memory_order_release);
+    }
+};
+
+CDebugLogWriter::CThreadState::~CThreadState()
+{
+    // the buffer is forgotten once the writer has emptied it
+    if (pbuffer)
+        pbuffer->fThreadExited = true;
+}
+
+CDebugLogWriter::CDebugLogWriter(const boost::filesystem::path& pathIn, size_t nThreadBufferSizeIn)
+    : path(pathIn), nThreadBufferSize(nThreadBufferSizeIn)
+{
+}
+
+CDebugLogWriter::~CDebugLogWriter()
+{
+    Stop();
+    if (fileout)
+        fclose(fileout);
+}
+
+CDebugLogWriter& CDebugLogWriter::Instance()
+{
+    // This may be called by global destructors during shutdown. Since the order of destruction of
+    // static/global objects is undefined, the writer is allocated on the heap and never destroyed.
+    static CDebugLogWriter* pwriter = []() {
+        CDebugLogWriter* p = new CDebugLogWriter(GetDataDir() / "debug.log");
+        atexit([]() { Instance().Stop(); });
+        return p;
+    }();
+    return *pwriter;
+}
+
+CDebugLogWriter::CThreadState& CDebugLogWriter::GetThreadState()
+{
+    CThreadState* state = threadState.get();
+    if (!state) {
+        state = new CThreadState;
+        threadState.reset(state);
+    }
+    return *state;
+}
+
+int CDebugLogWriter::VPrint(const char* pszFormat, va_list ap)
+{
+    CThreadState& state = GetThreadState();
+
+    std::string& strLine = state.strLine;
+    strLine.clear();
+    if (fLogTimestamps && state.fStartedNewLine) {
+        // formatting the time is expensive, and it only changes every second
+        const int64_t nTime = GetTime();
+        if (nTime != state.nTimestampTime || state.strTimestamp.empty()) {
+            state.strTimestamp   = DateTimeStrFormat("%x %H:%M:%S", nTime) + " ";
+            state.nTimestampTime = nTime;
+        }
+        strLine = state.strTimestamp;
+    }
+    const size_t nFormatLen = strlen(pszFormat);
+    state.fStartedNewLine   = nFormatLen > 0 && pszFormat[nFormatLen - 1] == '\n';
+
+    if (state.vchFormat.size() < 1024)
+        state.vchFormat.resize(1024);
+    va_list apCopy;
+    va_copy(apCopy, ap);
+    int ret = vsnprintf(&state.vchFormat[0], state.vchFormat.size(), pszFormat, ap);
+    if (ret >= 0 && static_cast<size_t>(ret) >= state.vchFormat.size()) {
+        state.vchFormat.resize(ret + 1);
+        ret = vsnprintf(&state.vchFormat[0], state.vchFormat.size(), pszFormat, apCopy);
+    }
+    va_end(apCopy);
+    if (ret < 0)
+        return ret;
+    strLine.append(&state.vchFormat[0], ret);
+
+    if (fRunning && strLine.size() <= nThreadBufferSize / 2) {
+        if (!state.pbuffer) {
+            state.pbuffer = std::make_shared<CThreadBuffer>(nThreadBufferSize);
+            boost::lock_guard<boost::mutex> lock(cs_buffers);
+            vBuffers.push_back(state.pbuffer);
+        }
+        CThreadBuffer& buffer = *state.pbuffer;
+        if (!buffer.Push(nNextSequence++, strLine.data(), strLine.size())) {
+            buffer.nDropped++;
+            nDropped++;
+        }
+        if (buffer.GetUsed() > buffer.GetSize() / 2)
+            condWriter.notify_one();
+        // Stop() may have emptied the buffers already
+        if (!fRunning)
+            Flush();
+        return ret;
+    }
+
+    // what this thread logged before has to be written first
+    if (state.pbuffer)
+        Flush();
+    boost::lock_guard<boost::mutex> lock(cs_file);
+    WriteToFile(strLine.data(), strLine.size());
+    if (fileout)
+        fflush(fileout);
+    return ret;
+}
+
+void CDebugLogWriter::WriteToFile(const char* pch, size_t nLen)
+{
+    if (!fileout) {
+        fileout = fopen(path.string().c_str(), "a");
+        if (!fileout)
+            return;
+        setvbuf(fileout, NULL, _IOFBF, 1 << 16);
+    }
+    if (fReopen.exchange(false)) {
+        fflush(fileout);
+        if (freopen(path.string().c_str(), "a", fileout) == NULL) {
+            fileout = NULL;
+            return;
+        }
+        setvbuf(fileout, NULL, _IOFBF, 1 << 16);
+    }
+    fwrite(pch, 1, nLen, fileout);
+}
+
+void CDebugLogWriter::Flush()
+{
+    std::vector<std::shared_ptr<CThreadBuffer>> vBuffersCopy;
+    {
+        boost::lock_guard<boost::mutex> lock(cs_buffers);
+        vBuffersCopy = vBuffers;
+    }
+
+    boost::lock_guard<boost::mutex> lock(cs_file);
+
+    uint64_t                              nDroppedNow = 0;
+    std::string                           str;
+    std::vector<CThreadBuffer::Message> vMessages;
+    for (const std::shared_ptr<CThreadBuffer>& pbuffer : vBuffersCopy) {
+        nDroppedNow += pbuffer->nDropped.exchange(0);
+        pbuffer->Drain(str, vMessages);
+    }
+    if (vMessages.empty() && nDroppedNow == 0)
+        return;
+
+    std::sort(vMessages.begin(), vMessages.end());
+    if (nDroppedNow > 0) {
+        std::string strDropped =
+            strprintf("*** %" PRIu64 " debug messages were dropped ***\n", nDroppedNow);
+        WriteToFile(strDropped.data(), strDropped.size());
+    }
+    for (const CThreadBuffer::Message& msg : vMessages)
+        WriteToFile(&str[std::get<1>(msg)], std::get<2>(msg));
+    if (fileout)
+        fflush(fileout);
+
+    boost::lock_guard<boost::mutex> lockBuffers(cs_buffers);
+    vBuffers.erase(std::remove_if(vBuffers.begin(), vBuffers.end(),
+                                  [](const std::shared_ptr<CThreadBuffer>& pbuffer) {
+                                      return pbuffer->fThreadExited && pbuffer->GetUsed() == 0;
+                                  }),
+                   vBuffers.end());
+}
+
+void CDebugLogWriter::ThreadWrite()
+{
+    RenameThread("neblio-log");
+
+    boost::unique_lock<boost::mutex> lock(cs_writer);
+    while (!fStopRequested) {
+        condWriter.wait_for(lock, boost::chrono::milliseconds(WRITE_INTERVAL_MS));
+        lock.unlock();
+        Flush();
+        lock.lock();
+    }
+}
+
+void CDebugLogWriter::Start()
+{
+    boost::lock_guard<boost::mutex> lock(cs_writer);
+    if (fRunning)
+        return;
+    fStopRequested = false;
+    writerThread   = boost::thread(&CDebugLogWriter::ThreadWrite, this);
+    fRunning       = true;
+}
+
+void CDebugLogWriter::Stop()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(cs_writer);
+        if (!fRunning)
+            return;
+        fStopRequested = true;
+    }
+    condWriter.notify_all();
+    writerThread.join();
+    fRunning = false;
+    Flush();
+}
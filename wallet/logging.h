@@ -0,0 +1,127 @@
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/thread.hpp>
+
+/** Categories of debug messages that are only logged when enabled with -debug=<category> */
+enum LogCategory : uint32_t
+{
+    LOG_NONE   = 0,
+    LOG_NET    = 1 << 0,
+    LOG_DB     = 1 << 1,
+    LOG_IMPORT = 1 << 2,
+    LOG_WALLET = 1 << 3,
+    LOG_RPC    = 1 << 4,
+    LOG_NTP1   = 1 << 5,
+    LOG_ALL    = ~(uint32_t)0
+};
+
+extern std::atomic<uint32_t> nLogCategories;
+
+/** Whether messages of the category are logged; see LogPrint() */
+inline bool LogAcceptCategory(uint32_t category)
+{
+    return (nLogCategories.load(std::memory_order_relaxed) & category) != 0;
+}
+
+/** Enables the categories given with -debug; -debug without a category enables all of them.
+ * Returns false if a category is unknown. */
+bool SetLogCategories(const std::vector<std::string>& vCategories);
+
+/**
+ * Writes debug.log on a background thread.
+ *
+ * Every thread that logs has a ring buffer of its own, which only that thread writes to and only the
+ * writer reads from, so logging a message doesn't take a lock or wait for the disk. Every
+ * WRITE_INTERVAL_MS, or as soon as a buffer is half full, the writer collects the messages of all the
+ * threads, puts them back in the order they were logged in and writes them all at once.
+ * A thread that logs faster than that fills its buffer; its messages are then dropped and counted
+ * instead of slowing it down, and the count is written to the log.
+ *
+ * Until Start() is called, and after Stop(), messages are written to the file right away. That's
+ * the case before the daemon forks, during shutdown, and in tools that never start the writer.
+ */
+class CDebugLogWriter
+{
+public:
+    static const size_t       THREAD_BUFFER_SIZE = 1 << 18; // must be a power of two
+    static const unsigned int WRITE_INTERVAL_MS  = 100;
+
+private:
+    class CThreadBuffer;
+
+    struct CThreadState
+    {
+        std::shared_ptr<CThreadBuffer> pbuffer;
+        bool                           fStartedNewLine = true;
+        int64_t                        nTimestampTime  = 0;
+        std::string                    strTimestamp;
+        std::string                    strLine;
+        std::vector<char>              vchFormat;
+
+        ~CThreadState();
+    };
+
+    const boost::filesystem::path path;
+    const size_t                  nThreadBufferSize;
+
+    boost::mutex cs_file; // the file, and reading from the buffers
+    FILE*        fileout = nullptr;
+
+    boost::mutex                                cs_buffers;
+    std::vector<std::shared_ptr<CThreadBuffer>> vBuffers;
+    boost::thread_specific_ptr<CThreadState>    threadState;
+
+    boost::mutex              cs_writer;
+    boost::condition_variable condWriter;
+    bool                      fStopRequested = false;
+    boost::thread             writerThread;
+
+    std::atomic<bool>     fRunning{false};
+    std::atomic<bool>     fReopen{false};
+    std::atomic<uint64_t> nNextSequence{0};
+    std::atomic<uint64_t> nDropped{0};
+
+    CThreadState& GetThreadState();
+    void          WriteToFile(const char* pch, size_t nLen);
+    void          ThreadWrite();
+
+public:
+    explicit CDebugLogWriter(const boost::filesystem::path& pathIn,
+                             size_t nThreadBufferSizeIn = THREAD_BUFFER_SIZE);
+    ~CDebugLogWriter();
+
+    CDebugLogWriter(const CDebugLogWriter&) = delete;
+    CDebugLogWriter& operator=(const CDebugLogWriter&) = delete;
+
+    /** The writer of debug.log in the data directory */
+    static CDebugLogWriter& Instance();
+
+    /** Formats a message like vprintf() and logs it. Returns the length of the message. */
+    int VPrint(const char* pszFormat, va_list ap);
+
+    /** Starts writing on the background thread */
+    void Start();
+
+    /** Writes what's left and goes back to writing right away */
+    void Stop();
+
+    /** Writes everything that was logged so far */
+    void Flush();
+
+    /** The file is opened again before the next write, e.g. after it was rotated */
+    void Reopen() { fReopen = true; }
+
+    /** How many messages were dropped because a buffer was full */
+    uint64_t GetDroppedCount() const { return nDropped; }
+};
+
+#endif // LOGGING_H
@@ -6,9 +6,14 @@
 #include "main.h"
 #include "alert.h"
 #include "block.h"
+#include "blockencodings.h"
+#include "blockimport.h"
+#include "blockprune.h"
+#include "bootstrap.h"
 #include "checkpoints.h"
 #include "db.h"
 #include "disktxpos.h"
+#include "headerchain.h"
 #include "init.h"
 #include "kernel.h"
 #include "merkletx.h"
@@ -27,7 +32,6 @@
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
-#include <boost/range/adaptor/reversed.hpp>
 #include <boost/regex.hpp>
 
 #include "NetworkForks.h"
@@ -961,16 +965,6 @@ bool IsInitialBlockDownload()
     return __IsInitialBlockDownload_internal();
 }
 
-CDiskTxPos CreateFakeSpentTxPos(const uint256& blockhash)
-{
-    /// this creates a fake tx position that helps in marking an output as spent
-    CDiskTxPos fakeTxPos;
-    fakeTxPos.nBlockPos = blockhash;
-    fakeTxPos.nTxPos    = 1; // invalid position just to mark the tx as spent temporarily
-    assert(!fakeTxPos.IsNull());
-    return fakeTxPos;
-}
-
 bool RecoverNTP1TxInDatabase(const CTransaction& tx, CTxDB& txdb, bool recoveryProtection,
                              unsigned recurseDepth)
 {
@@ -1345,6 +1339,8 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
     if (pfrom && !CSyncCheckpoint::strMasterPrivKey.empty())
         Checkpoints::SendSyncCheckpoint(Checkpoints::AutoSelectSyncCheckpoint());
 
+    PruneBlocksIfNeeded();
+
     return true;
 }
 
@@ -1563,6 +1559,9 @@ bool LoadBlockIndex(bool fAllowNew)
     // Load block index
     //
     CTxDB txdb("cr+");
+    static CCoinsViewDB coinsdbview;
+    delete pcoinsTip;
+    pcoinsTip = new CCoinsViewCache(coinsdbview);
     if (!txdb.LoadBlockIndex())
         return false;
 
@@ -1652,6 +1651,18 @@ bool LoadBlockIndex(bool fAllowNew)
     return true;
 }
 
+bool FlushCoinsCache(bool fForce)
+{
+    LOCK(cs_main);
+    if (!pcoinsTip)
+        return true;
+    // the cache is only written when it's full; the blocks after the written ones are replayed on
+    // startup if it's lost (see CTxDB::LoadCoins())
+    if (!fForce && pcoinsTip->GetCacheSize() <= nCoinCacheSize)
+        return true;
+    return pcoinsTip->Flush();
+}
+
 void PrintBlockTree()
 {
     AssertLockHeld(cs_main);
@@ -1715,72 +1726,6 @@ void PrintBlockTree()
     }
 }
 
-bool LoadExternalBlockFile(FILE* fileIn)
-{
-    int64_t nStart = GetTimeMillis();
-
-    int nLoaded = 0;
-    {
-        try {
-            CAutoFile    blkdat(fileIn, SER_DISK, CLIENT_VERSION);
-            unsigned int nPos = 0;
-            while (nPos != (unsigned int)-1 && blkdat.good() && !fRequestShutdown && !fShutdown) {
-                unsigned char pchData[65536];
-                do {
-                    fseek(blkdat, nPos, SEEK_SET);
-                    int nRead = fread(pchData, 1, sizeof(pchData), blkdat);
-                    if (nRead <= 8) {
-                        nPos = (unsigned int)-1;
-                        break;
-                    }
-                    void* nFind =
-                        memchr(pchData, pchMessageStart[0], nRead + 1 - sizeof(pchMessageStart));
-                    if (nFind) {
-                        if (memcmp(nFind, pchMessageStart, sizeof(pchMessageStart)) == 0) {
-                            nPos += ((unsigned char*)nFind - pchData) + sizeof(pchMessageStart);
-                            break;
-                        }
-                        nPos += ((unsigned char*)nFind - pchData) + 1;
-                    } else
-                        nPos += sizeof(pchData) - sizeof(pchMessageStart) + 1;
-                } while (!fRequestShutdown && !fShutdown);
-                if (nPos == (unsigned int)-1)
-                    break;
-                unsigned int nSizeLimit = MaxBlockSize();
-
-                fseek(blkdat, nPos, SEEK_SET);
-
-                unsigned int nSize;
-                blkdat >> nSize;
-
-                static const int fileStartFrom = 0;
-                if (nPos < fileStartFrom) {
-                    nPos += 4 + nSize;
-                    printf("Skipping block at file pos: %u\n", nPos);
-                    continue;
-                }
-
-                if (nSize > 0 && nSize <= nSizeLimit) {
-                    CBlock block;
-                    blkdat >> block;
-                    printf("\nReading block at file pos: %u\n", nPos);
-
-                    LOCK(cs_main);
-
-                    if (ProcessBlock(NULL, &block)) {
-                        nLoaded++;
-                        nPos += 4 + nSize;
-                    }
-                }
-            }
-        } catch (std::exception& e) {
-            printf("%s() : Deserialize or I/O error caught during load\n", __PRETTY_FUNCTION__);
-        }
-    }
-    printf("Loaded %i blocks from external file in %" PRId64 "ms\n", nLoaded, GetTimeMillis() - nStart);
-    return nLoaded > 0;
-}
-
 struct CImportingNow
 {
     CImportingNow()
@@ -1808,23 +1753,17 @@ void ThreadImport(void* data)
 
     // -loadblock=
     // uiInterface.InitMessage(_("Starting block import..."));
-    for (boost::filesystem::path& path : *vFiles) {
-        FILE* file = fopen(path.string().c_str(), "rb");
-        if (file)
-            LoadExternalBlockFile(file);
-    }
+    for (boost::filesystem::path& path : *vFiles)
+        LoadExternalBlockFile(path);
 
     // hardcoded $DATADIR/bootstrap.dat
     filesystem::path pathBootstrap = GetDataDir() / "bootstrap.dat";
     if (filesystem::exists(pathBootstrap)) {
         // uiInterface.InitMessage(_("Importing bootstrap blockchain data file."));
 
-        FILE* file = fopen(pathBootstrap.string().c_str(), "rb");
-        if (file) {
-            filesystem::path pathBootstrapOld = GetDataDir() / "bootstrap.dat.old";
-            LoadExternalBlockFile(file);
-            RenameOver(pathBootstrap, pathBootstrapOld);
-        }
+        filesystem::path pathBootstrapOld = GetDataDir() / "bootstrap.dat.old";
+        LoadExternalBlockFile(pathBootstrap);
+        RenameOver(pathBootstrap, pathBootstrapOld);
     }
 
     delete vFiles;
@@ -1905,6 +1844,211 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
     return true;
 }
 
+// "block" messages of the blocks that were sent to peers most recently. A new block is asked for by
+// every peer it's announced to, and this way it's read and serialized only once for all of them.
+static const unsigned int                             MAX_RECENT_BLOCK_MESSAGES = 4;
+static std::deque<std::pair<uint256, CSharedMessage>> vRecentBlockMessages;
+static CCriticalSection                               cs_vRecentBlockMessages;
+
+static CSharedMessage GetBlockMessage(const CBlockIndex* pindex)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    {
+        LOCK(cs_vRecentBlockMessages);
+        for (const std::pair<uint256, CSharedMessage>& item : vRecentBlockMessages)
+            if (item.first == hash)
+                return item.second;
+    }
+
+    CBlock     block;
+    const bool fRead = block.ReadFromDisk(pindex);
+    CSharedMessage pmsg = MakeSharedMessage("block", block);
+    if (fRead) {
+        LOCK(cs_vRecentBlockMessages);
+        vRecentBlockMessages.push_back(std::make_pair(hash, pmsg));
+        if (vRecentBlockMessages.size() > MAX_RECENT_BLOCK_MESSAGES)
+            vRecentBlockMessages.pop_front();
+    }
+    return pmsg;
+}
+
+/** Asks the peer for the next blocks of its header chain, up to BLOCK_DOWNLOAD_WINDOW blocks past the
+ * best block, and for more headers once the header index has room for them again */
+static void RequestHeaderChainBlocks(CNode* pfrom)
+{
+    if (fImporting)
+        return;
+    while (!pfrom->vBlocksToDownload.empty()) {
+        const CBlockIndexSmartPtr pindex = pfrom->vBlocksToDownload.front();
+        if (pindex->nHeight > nBestHeight + BLOCK_DOWNLOAD_WINDOW)
+            break;
+        pfrom->vBlocksToDownload.pop_front();
+        const uint256 hash = pindex->GetBlockHash();
+        if (!mapBlockIndex.count(hash) && !mapOrphanBlocks.count(hash))
+            pfrom->AskFor(CInv(MSG_BLOCK, hash));
+    }
+
+    if (pfrom->fHeadersSyncPaused && mapHeaderIndex.size() < MAX_HEADER_INDEX_SIZE / 2) {
+        pfrom->fHeadersSyncPaused = false;
+        pfrom->PushGetHeaders(pfrom->pindexBestKnownHeader.get());
+    }
+}
+
+/** Drops the headers of a peer whose header chain gets no further for HEADERS_STALL_TIMEOUT, since the
+ * peer doesn't have their blocks or doesn't send them, and disconnects it */
+static void CheckHeadersStall(CNode* pto)
+{
+    CBlockIndexSmartPtr pindexHeader;
+    if (pto->pindexBestKnownHeader)
+        pindexHeader = LookupHeaderIndex(pto->pindexBestKnownHeader->GetBlockHash());
+    if (!pindexHeader || !pindexHeader->IsHeaderOnly()) {
+        pto->nHeadersStallTime = 0;
+        return;
+    }
+
+    const int64_t nNow = GetTime();
+    if (pto->nHeadersStallTime != 0 && nNow - pto->nHeadersStallTime < HEADERS_STALL_TIMEOUT)
+        return;
+    const int nStoredHeight = GetLastStoredHeight(pindexHeader);
+    if (pto->nHeadersStallTime == 0 || nStoredHeight > pto->nHeadersStallHeight) {
+        pto->nHeadersStallTime   = nNow;
+        pto->nHeadersStallHeight = nStoredHeight;
+        return;
+    }
+
+    printf("CheckHeadersStall() : none of the blocks after %d of the headers of peer %s came, "
+           "disconnecting\n",
+           nStoredHeight, pto->addrName.c_str());
+    DropPeerHeaders(pto->nId);
+    pto->vBlocksToDownload.clear();
+    pto->pindexBestKnownHeader.reset();
+    pto->nSyncedHeaders    = -1;
+    pto->nHeadersStallTime = 0;
+    pto->fDisconnect       = true;
+}
+
+/** Adds the headers that a peer sent to the header index, and asks for the blocks of the peer's header
+ * chain; more headers are asked for if the message was full */
+static bool ProcessHeaders(CNode* pfrom, const std::vector<CBlock>& vHeaders)
+{
+    if (vHeaders.size() > MAX_HEADERS_RESULTS) {
+        pfrom->Misbehaving(20);
+        return error("ProcessHeaders() : %" PRIszu " headers in a message", vHeaders.size());
+    }
+
+    CBlockIndexSmartPtr pindexLast;
+    bool                fAccepted = true;
+    for (const CBlock& header : vHeaders) {
+        if (pindexLast && header.hashPrevBlock != pindexLast->GetBlockHash()) {
+            pfrom->Misbehaving(20);
+            return error("ProcessHeaders() : the headers that peer %s sent aren't a chain",
+                         pfrom->addrName.c_str());
+        }
+        CBlockIndexSmartPtr pindex;
+        if (!AcceptBlockHeader(header, pindex, pfrom->nId)) {
+            // a peer that sends an invalid header is on a fork that can't become the main chain
+            if (header.nDoS)
+                pfrom->Misbehaving(header.nDoS);
+            fAccepted = false;
+            break;
+        }
+        pindexLast = pindex;
+        // a pruned node serves the latest blocks only, which come as they're relayed
+        if (pindex->IsHeaderOnly() && (pfrom->nServices & NODE_NETWORK))
+            pfrom->vBlocksToDownload.push_back(pindex);
+    }
+    if (!pindexLast)
+        return true;
+
+    if (!pfrom->pindexBestKnownHeader ||
+        pindexLast->nChainTrust > pfrom->pindexBestKnownHeader->nChainTrust) {
+        pfrom->pindexBestKnownHeader = pindexLast;
+        pfrom->nSyncedHeaders        = pindexLast->nHeight;
+    }
+    LogPrint(LOG_NET, "headers up to %d %s from peer %s, best header %d\n", pindexLast->nHeight,
+             pindexLast->GetBlockHash().ToString().c_str(), pfrom->addrName.c_str(),
+             GetBestHeader()->nHeight);
+
+    // a full message means that the peer has more
+    if (mapHeaderIndex.size() >= MAX_HEADER_INDEX_SIZE)
+        pfrom->fHeadersSyncPaused = true;
+    else if (fAccepted && vHeaders.size() == MAX_HEADERS_RESULTS)
+        pfrom->PushGetHeaders(pindexLast.get());
+    RequestHeaderChainBlocks(pfrom);
+    return true;
+}
+
+/** Processes a block that a peer sent, whole or put together from its compact block */
+static void ProcessReceivedBlock(CNode* pfrom, CBlock& block)
+{
+    CInv inv(MSG_BLOCK, block.GetHash());
+    pfrom->AddInventoryKnown(inv);
+
+    if (ProcessBlock(pfrom, &block))
+        mapAlreadyAskedFor.erase(inv);
+    if (block.nDoS)
+        pfrom->Misbehaving(block.nDoS);
+    RequestHeaderChainBlocks(pfrom);
+}
+
+/** Puts a block together from its compact block and the memory pool, and asks the peer for the
+ * transactions that aren't there; the block is asked for whole if that fails */
+static bool ProcessCompactBlock(CNode* pfrom, const CBlockHeaderAndShortTxIDs& cmpctblock)
+{
+    const uint256 hashBlock = cmpctblock.header.GetHash();
+    CInv          inv(MSG_BLOCK, hashBlock);
+    pfrom->AddInventoryKnown(inv);
+
+    CTxDB txdb("r");
+    if (AlreadyHave(txdb, inv))
+        return true;
+    // a block that doesn't connect to the chain is asked for whole, which gets its parents the way it's
+    // done for orphans
+    if (!mapBlockIndex.count(cmpctblock.header.hashPrevBlock)) {
+        pfrom->AskFor(inv);
+        return true;
+    }
+    // the header is checked before the mempool is searched and the missing transactions are asked for,
+    // so that a compact block with an invalid header costs neither
+    CBlockIndexSmartPtr pindex;
+    if (!AcceptBlockHeader(cmpctblock.header, pindex, pfrom->nId)) {
+        if (cmpctblock.header.nDoS)
+            pfrom->Misbehaving(cmpctblock.header.nDoS);
+        return error("ProcessCompactBlock() : compact block %s has an invalid header",
+                     hashBlock.ToString().c_str());
+    }
+
+    std::shared_ptr<CPartialBlock> pPartialBlock(new CPartialBlock);
+    const CompactBlockStatus       status = pPartialBlock->InitData(cmpctblock, mempool);
+    if (status == COMPACTBLOCK_INVALID) {
+        pfrom->Misbehaving(100);
+        return error("ProcessCompactBlock() : compact block %s is malformed",
+                     hashBlock.ToString().c_str());
+    }
+    if (status == COMPACTBLOCK_FAILED) {
+        pfrom->AskFor(inv);
+        return true;
+    }
+
+    CBlockTransactionsRequest req;
+    req.hashBlock = hashBlock;
+    req.vIndexes  = pPartialBlock->GetMissing();
+    if (req.vIndexes.empty()) {
+        CBlock block;
+        if (pPartialBlock->FillBlock(block, std::vector<CTransaction>()) == COMPACTBLOCK_OK)
+            ProcessReceivedBlock(pfrom, block);
+        else
+            pfrom->AskFor(inv);
+        return true;
+    }
+
+    LogPrint(LOG_NET, "asking for %" PRIszu " of the %" PRIszu " transactions of compact block %s\n",
+             req.vIndexes.size(), cmpctblock.BlockTxCount(), hashBlock.ToString().c_str());
+    pfrom->pPartialBlock = pPartialBlock;
+    pfrom->PushMessage("getblocktxn", req);
+    return true;
+}
+
 // The message start string is designed to be unlikely to occur in normal data.
 // The characters are rarely used upper ASCII, not valid as UTF-8, and produce
 // a large 4-byte int at any alignment.
@@ -1956,6 +2100,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             vRecv >> pfrom->fRelayTxes; // set to true after we get the first filter* message
         else
             pfrom->fRelayTxes = true;
+        uint64_t nCompactBlocksVersion = 0;
+        if (!vRecv.empty())
+            vRecv >> nCompactBlocksVersion;
+        pfrom->fCompactBlocks = (nLocalServices & NODE_COMPACT_BLOCKS) &&
+                                (pfrom->nServices & NODE_COMPACT_BLOCKS) &&
+                                nCompactBlocksVersion == COMPACT_BLOCKS_VERSION;
 
         if (pfrom->fInbound && addrMe.IsRoutable()) {
             pfrom->addrLocal = addrMe;
@@ -2009,14 +2159,25 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             }
         }
 
-        // Ask the first connected node for block updates
-        static int nAskedForBlocks = 0;
+        // Ask the first connected node for block updates, and another one once no peer that sent
+        // headers is left
+        static int nAskedForBlocks  = 0;
+        bool       fHeadersSyncPeer = false;
+        {
+            LOCK(cs_vNodes);
+            for (CNode* pnode : vNodes)
+                if (pnode != pfrom && !pnode->fDisconnect && pnode->nSyncedHeaders >= 0)
+                    fHeadersSyncPeer = true;
+        }
         if (!pfrom->fClient && !pfrom->fOneShot && !fImporting &&
             (pfrom->nStartingHeight > (nBestHeight - 144)) &&
             (pfrom->nVersion < NOBLKS_VERSION_START || pfrom->nVersion >= NOBLKS_VERSION_END) &&
-            (nAskedForBlocks < 1 || vNodes.size() <= 1)) {
+            (nAskedForBlocks < 1 || vNodes.size() <= 1 || !fHeadersSyncPeer)) {
             nAskedForBlocks++;
-            pfrom->PushGetBlocks(pindexBest.get(), uint256(0));
+            // The blocks are downloaded along the headers of the peer (see ProcessHeaders()). The
+            // headers are asked for from the best block on, so that the peer sends the ones that are
+            // known already as well, and their blocks are asked for from it, whoever sent them first.
+            pfrom->PushGetHeaders(boost::atomic_load(&pindexBest).get());
         }
 
         // Relay alerts
@@ -2188,13 +2349,17 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
                 // Send block from disk
                 BlockIndexMapType::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end()) {
-                    CBlock block;
-                    block.ReadFromDisk(boost::atomic_load(&mi->second).get());
+                if (mi != mapBlockIndex.end() && IsBlockPruned(mi->second.get())) {
+                    LogPrint(LOG_NET, "getdata for pruned block %s ignored\n",
+                             inv.hash.ToString().c_str());
+                } else if (mi != mapBlockIndex.end()) {
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                        pfrom->PushSharedMessage(
+                            GetBlockMessage(boost::atomic_load(&mi->second).get()));
                     else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        block.ReadFromDisk(boost::atomic_load(&mi->second).get());
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -2229,14 +2394,17 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                 }
             } else if (inv.IsKnownType()) {
                 // Send stream from relay memory
-                bool pushed = false;
+                CSharedMessage pmsg;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
-                    if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
-                        pushed = true;
-                    }
+                    map<CInv, CSharedMessage>::iterator mi = mapRelay.find(inv);
+                    if (mi != mapRelay.end())
+                        pmsg = mi->second;
+                }
+                bool pushed = false;
+                if (pmsg) {
+                    pfrom->PushSharedMessage(pmsg);
+                    pushed = true;
                 }
                 if (!pushed && inv.type == MSG_TX) {
                     CTransaction tx;
@@ -2266,12 +2434,17 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (pindex)
             pindex = boost::atomic_load(&pindex->pnext);
         int nLimit = 500;
-        printf("getblocks %d to %s limit %d\n", (pindex ? pindex->nHeight : -1),
-               hashStop.ToString().c_str(), nLimit);
+        LogPrint(LOG_NET, "getblocks %d to %s limit %d\n", (pindex ? pindex->nHeight : -1),
+                 hashStop.ToString().c_str(), nLimit);
         for (; pindex; pindex = pindex->pnext) {
+            if (IsBlockPruned(pindex.get())) {
+                LogPrint(LOG_NET, "  getblocks stopping at pruned block %d %s\n", pindex->nHeight,
+                         pindex->GetBlockHash().ToString().c_str());
+                break;
+            }
             if (pindex->GetBlockHash() == hashStop) {
-                printf("  getblocks stopping at %d %s\n", pindex->nHeight,
-                       pindex->GetBlockHash().ToString().c_str());
+                LogPrint(LOG_NET, "  getblocks stopping at %d %s\n", pindex->nHeight,
+                         pindex->GetBlockHash().ToString().c_str());
                 unsigned int nSMA = StakeMinAge();
                 // ppcoin: tell downloading node about the latest block if it's
                 // without risk being rejected due to stake connection check
@@ -2284,8 +2457,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             if (--nLimit <= 0) {
                 // When this block is requested, we'll send an inv that'll make them
                 // getblocks the next batch of inventory.
-                printf("  getblocks stopping at limit %d %s\n", pindex->nHeight,
-                       pindex->GetBlockHash().ToString().c_str());
+                LogPrint(LOG_NET, "  getblocks stopping at limit %d %s\n", pindex->nHeight,
+                         pindex->GetBlockHash().ToString().c_str());
                 pfrom->hashContinue = pindex->GetBlockHash();
                 break;
             }
@@ -2314,7 +2487,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             BlockIndexMapType::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
-            CBlockIndexSmartPtr pindex = boost::atomic_load(&mi->second);
+            pindex = boost::atomic_load(&mi->second);
         } else {
             // Find the last block the caller has in the main chain
             pindex = locator.GetBlockIndex();
@@ -2323,7 +2496,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         }
 
         vector<CBlock> vHeaders;
-        int            nLimit = 2000;
+        int            nLimit = MAX_HEADERS_RESULTS;
         printf("getheaders %d to %s\n", (pindex ? pindex->nHeight : -1), hashStop.ToString().c_str());
         for (; pindex; pindex = pindex->pnext) {
             vHeaders.push_back(pindex->GetBlockHeader());
@@ -2333,6 +2506,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         pfrom->PushMessage("headers", vHeaders);
     }
 
+    else if (strCommand == "headers") {
+        vector<CBlock> vHeaders;
+        vRecv >> vHeaders;
+
+        return ProcessHeaders(pfrom, vHeaders);
+    }
+
     else if (strCommand == "tx") {
         vector<uint256> vWorkQueue;
         vector<uint256> vEraseQueue;
@@ -2393,17 +2573,77 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     else if (strCommand == "block") {
         CBlock block;
         vRecv >> block;
-        uint256 hashBlock = block.GetHash();
 
-        printf("received block %s\n", hashBlock.ToString().c_str());
+        printf("received block %s\n", block.GetHash().ToString().c_str());
 
-        CInv inv(MSG_BLOCK, hashBlock);
-        pfrom->AddInventoryKnown(inv);
+        ProcessReceivedBlock(pfrom, block);
+    }
 
-        if (ProcessBlock(pfrom, &block))
-            mapAlreadyAskedFor.erase(inv);
-        if (block.nDoS)
-            pfrom->Misbehaving(block.nDoS);
+    else if (strCommand == "cmpctblock") {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        printf("received compact block %s\n", cmpctblock.header.GetHash().ToString().c_str());
+
+        return ProcessCompactBlock(pfrom, cmpctblock);
+    }
+
+    else if (strCommand == "getblocktxn") {
+        CBlockTransactionsRequest req;
+        vRecv >> req;
+
+        BlockIndexMapType::iterator mi = mapBlockIndex.find(req.hashBlock);
+        CBlockIndexSmartPtr         pindex =
+            mi != mapBlockIndex.end() ? boost::atomic_load(&mi->second) : CBlockIndexSmartPtr();
+        if (!pindex || IsBlockPruned(pindex.get())) {
+            LogPrint(LOG_NET, "getblocktxn for unknown or pruned block %s ignored\n",
+                     req.hashBlock.ToString().c_str());
+        } else if (pindex->nHeight < nBestHeight - MAX_BLOCKTXN_DEPTH) {
+            // a block that old wasn't relayed as a compact block lately
+            pfrom->PushSharedMessage(GetBlockMessage(pindex.get()));
+        } else {
+            CBlock block;
+            if (!block.ReadFromDisk(pindex.get()))
+                return error("ProcessMessage() : failed to read block %s for getblocktxn",
+                             req.hashBlock.ToString().c_str());
+            CBlockTransactions resp;
+            resp.hashBlock = req.hashBlock;
+            for (uint32_t nIndex : req.vIndexes) {
+                if (nIndex >= block.vtx.size()) {
+                    pfrom->Misbehaving(100);
+                    return error("ProcessMessage() : getblocktxn for transaction %u of block %s, which "
+                                 "has %" PRIszu,
+                                 nIndex, req.hashBlock.ToString().c_str(), block.vtx.size());
+                }
+                resp.vtx.push_back(block.vtx[nIndex]);
+            }
+            pfrom->PushMessage("blocktxn", resp);
+        }
+    }
+
+    else if (strCommand == "blocktxn") {
+        CBlockTransactions resp;
+        vRecv >> resp;
+
+        std::shared_ptr<CPartialBlock> pPartialBlock = pfrom->pPartialBlock;
+        if (!pPartialBlock || pPartialBlock->GetBlockHash() != resp.hashBlock) {
+            LogPrint(LOG_NET, "blocktxn for block %s that wasn't asked for ignored\n",
+                     resp.hashBlock.ToString().c_str());
+        } else {
+            pfrom->pPartialBlock.reset();
+            CBlock                   block;
+            const CompactBlockStatus status = pPartialBlock->FillBlock(block, resp.vtx);
+            if (status == COMPACTBLOCK_INVALID) {
+                pfrom->Misbehaving(100);
+                return error("ProcessMessage() : blocktxn of block %s has %" PRIszu
+                             " transactions, which isn't what was asked for",
+                             resp.hashBlock.ToString().c_str(), resp.vtx.size());
+            }
+            if (status == COMPACTBLOCK_OK)
+                ProcessReceivedBlock(pfrom, block);
+            else
+                pfrom->AskFor(CInv(MSG_BLOCK, resp.hashBlock));
+        }
     }
 
     else if (strCommand == "getaddr") {
@@ -2587,6 +2827,21 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
+    // During the initial download, the blocks of consecutive "block" messages are written to the
+    // database in batches, which are only committed when cs_main is released (see CTxDBBatchScope).
+    // The batch is committed before any other message, so that neither cs_main nor the write
+    // transaction is held for the messages that don't need them.
+    std::unique_ptr<CCriticalBlock>  lockBatch;
+    std::unique_ptr<CTxDBBatchScope> dbBatch;
+    // the blocks can only be pruned once the batch is committed
+    const auto endBatch = [&]() {
+        if (!dbBatch)
+            return;
+        dbBatch.reset();
+        lockBatch.reset();
+        PruneBlocksIfNeeded();
+    };
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -2637,6 +2892,13 @@ bool ProcessMessages(CNode* pfrom)
             continue;
         }
 
+        if (strCommand != "block")
+            endBatch();
+        else if (!dbBatch && CTxDBBatchScope::nMaxBytes > 0 && IsInitialBlockDownload()) {
+            lockBatch.reset(new CCriticalBlock(cs_main, "cs_main", __FILE__, __LINE__));
+            dbBatch.reset(new CTxDBBatchScope);
+        }
+
         // Process message
         bool fRet = false;
         try {
@@ -2673,6 +2935,8 @@ bool ProcessMessages(CNode* pfrom)
     if (!pfrom->fDisconnect)
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
 
+    endBatch();
+
     return fOk;
 }
 
@@ -2791,6 +3055,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
 
+        // the header sync goes on as the best block moves up, or as the header index gets room again
+        CheckHeadersStall(pto);
+        RequestHeaderChainBlocks(pto);
+
         //
         // Message: getdata
         //
@@ -2913,62 +3181,6 @@ unsigned int StakeMinAge()
     }
 }
 
-// Amount compression:
-// * If the amount is 0, output 0
-// * first, divide the amount (in base units) by the largest power of 10 possible; call the exponent e (e
-// is max 9)
-// * if e<9, the last digit of the resulting number cannot be 0; store it as d, and drop it (divide by
-// 10)
-//   * call the result n
-//   * output 1 + 10*(9*n + d - 1) + e
-// * if e==9, we only know the resulting number is not zero, so output 1 + 10*(n - 1) + 9
-// (this is decodable, as d is in [1-9] and e is in [0-9])
-
-uint64_t CTxOutCompressor::CompressAmount(uint64_t n)
-{
-    if (n == 0)
-        return 0;
-    int e = 0;
-    while (((n % 10) == 0) && e < 9) {
-        n /= 10;
-        e++;
-    }
-    if (e < 9) {
-        int d = (n % 10);
-        assert(d >= 1 && d <= 9);
-        n /= 10;
-        return 1 + (n * 9 + d - 1) * 10 + e;
-    } else {
-        return 1 + (n - 1) * 10 + 9;
-    }
-}
-
-uint64_t CTxOutCompressor::DecompressAmount(uint64_t x)
-{
-    // x = 0  OR  x = 1+10*(9*n + d - 1) + e  OR  x = 1+10*(n - 1) + 9
-    if (x == 0)
-        return 0;
-    x--;
-    // x = 10*(9*n + d - 1) + e
-    int e = x % 10;
-    x /= 10;
-    uint64_t n = 0;
-    if (e < 9) {
-        // x = 9*n + d - 1
-        int d = (x % 9) + 1;
-        x /= 9;
-        // x = n
-        n = x * 10 + d;
-    } else {
-        n = x + 1;
-    }
-    while (e) {
-        n *= 10;
-        e--;
-    }
-    return n;
-}
-
 bool IsTxInMainChain(const uint256& txHash)
 {
     CTransaction tx;
@@ -3008,19 +3220,20 @@ int64_t GetTxBlockHeight(const uint256& txHash)
 }
 
 void ExportBootstrapBlockchain(const string& filename, std::atomic<bool>& stopped,
-                               std::atomic<double>& progress, boost::promise<void>& result)
+                               std::atomic<double>& progress, boost::promise<void>& result,
+                               bool fCompress)
 {
     RenameThread("Export-blockchain");
     try {
         progress.store(0, std::memory_order_relaxed);
 
-        std::vector<CBlockIndex*> chainBlocksIndices;
+        std::vector<CBlockIndexSmartPtr> chainBlocksIndices;
 
         {
-            CBlockIndex* pblockindex = boost::atomic_load(&mapBlockIndex[hashBestChain]).get();
+            CBlockIndexSmartPtr pblockindex = boost::atomic_load(&mapBlockIndex[hashBestChain]);
             chainBlocksIndices.push_back(pblockindex);
             while (pblockindex->nHeight > 0 && !stopped.load() && !fShutdown) {
-                pblockindex = boost::atomic_load(&pblockindex->pprev).get();
+                pblockindex = boost::atomic_load(&pblockindex->pprev);
                 chainBlocksIndices.push_back(pblockindex);
             }
         }
@@ -3029,44 +3242,9 @@ void ExportBootstrapBlockchain(const string& filename, std::atomic<bool>& stoppe
             throw std::runtime_error("Operation was stopped.");
         }
 
-        std::ofstream outFile(filename.c_str(), ios::binary);
-        if (!outFile.good()) {
-            throw std::runtime_error("Failed to open file for writing. Make sure you have sufficient "
-                                     "permissions and diskspace.");
-        }
-
-        size_t threadsholdSize = 1 << 24; // 4 MB
+        std::reverse(chainBlocksIndices.begin(), chainBlocksIndices.end());
+        ExportBootstrapBlocks(filename, chainBlocksIndices, fCompress, stopped, progress);
 
-        CDataStream  serializedBlocks(SER_DISK, CLIENT_VERSION);
-        size_t       written = 0;
-        const size_t total   = chainBlocksIndices.size();
-        for (CBlockIndex* blockIndex : boost::adaptors::reverse(chainBlocksIndices)) {
-            progress.store(static_cast<double>(written) / static_cast<double>(total),
-                           std::memory_order_relaxed);
-            if (stopped.load() || fShutdown) {
-                throw std::runtime_error("Operation was stopped.");
-            }
-            CBlock block;
-            block.ReadFromDisk(blockIndex, true);
-
-            // every block starts with pchMessageStart
-            unsigned int nSize = block.GetSerializeSize(SER_DISK, CLIENT_VERSION);
-            serializedBlocks << FLATDATA(pchMessageStart) << nSize;
-            serializedBlocks << block;
-            if (serializedBlocks.size() > threadsholdSize) {
-                outFile.write(serializedBlocks.str().c_str(), serializedBlocks.size());
-                serializedBlocks.clear();
-            }
-            written++;
-        }
-        if (serializedBlocks.size() > 0) {
-            outFile.write(serializedBlocks.str().c_str(), serializedBlocks.size());
-            serializedBlocks.clear();
-            if (!outFile.good()) {
-                throw std::runtime_error("An error was raised while writing the file. Make sure you "
-                                         "have sufficient permissions and diskspace.");
-            }
-        }
         progress.store(1, std::memory_order_seq_cst);
         result.set_value();
     } catch (std::exception& ex) {
@@ -3168,7 +3346,7 @@ std::deque<uint256> TraverseBlockIndexGraph(const BlockIndexGraphType&        gr
 
 void ExportBootstrapBlockchainWithOrphans(const string& filename, std::atomic<bool>& stopped,
                                           std::atomic<double>& progress, boost::promise<void>& result,
-                                          GraphTraverseType traverseType)
+                                          GraphTraverseType traverseType, bool fCompress)
 {
     RenameThread("Export-blockchain");
     try {
@@ -3185,45 +3363,21 @@ void ExportBootstrapBlockchainWithOrphans(const string& filename, std::atomic<bo
             throw std::runtime_error("Operation was stopped.");
         }
 
-        std::ofstream outFile(filename.c_str(), ios::binary);
-        if (!outFile.good()) {
-            throw std::runtime_error("Failed to open file for writing. Make sure you have sufficient "
-                                     "permissions and diskspace.");
+        std::vector<CBlockIndexSmartPtr> blocksIndices;
+        blocksIndices.reserve(blocksHashes.size());
+        {
+            LOCK(cs_main);
+            for (const uint256& h : blocksHashes) {
+                BlockIndexMapType::const_iterator it = mapBlockIndex.find(h);
+                if (it == mapBlockIndex.end()) {
+                    throw std::runtime_error("Block " + h.ToString() + " is not in the block index.");
+                }
+                blocksIndices.push_back(boost::atomic_load(&it->second));
+            }
         }
 
-        size_t threadsholdSize = 1 << 24; // 4 MB
-
-        CDataStream          serializedBlocks(SER_DISK, CLIENT_VERSION);
-        size_t               written = 0;
-        const std::uintmax_t total   = boost::num_vertices(graph);
+        ExportBootstrapBlocks(filename, blocksIndices, fCompress, stopped, progress);
 
-        for (const uint256& h : blocksHashes) {
-            progress.store(static_cast<double>(written) / static_cast<double>(total),
-                           std::memory_order_relaxed);
-            if (stopped.load() || fShutdown) {
-                throw std::runtime_error("Operation was stopped.");
-            }
-            CBlock block;
-            block.ReadFromDisk(h, true);
-
-            // every block starts with pchMessageStart
-            unsigned int nSize = block.GetSerializeSize(SER_DISK, CLIENT_VERSION);
-            serializedBlocks << FLATDATA(pchMessageStart) << nSize;
-            serializedBlocks << block;
-            if (serializedBlocks.size() > threadsholdSize) {
-                outFile.write(serializedBlocks.str().c_str(), serializedBlocks.size());
-                serializedBlocks.clear();
-            }
-            written++;
-        }
-        if (serializedBlocks.size() > 0) {
-            outFile.write(serializedBlocks.str().c_str(), serializedBlocks.size());
-            serializedBlocks.clear();
-            if (!outFile.good()) {
-                throw std::runtime_error("An error was raised while writing the file. Make sure you "
-                                         "have sufficient permissions and diskspace.");
-            }
-        }
         progress.store(1, std::memory_order_seq_cst);
         result.set_value();
     } catch (std::exception& ex) {
@@ -3,7 +3,9 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blockencodings.h"
 #include "db.h"
+#include "headerchain.h"
 #include "net.h"
 #include "init.h"
 #include "addrman.h"
@@ -12,6 +14,8 @@
 
 #ifdef WIN32
 #include <string.h>
+#else
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_UPNP
@@ -61,10 +65,11 @@ LockedVar<CAddrMan> addrman;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CSharedMessage> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 ThreadSafeHashMap<CInv, int64_t> mapAlreadyAskedFor;
+boost::atomic<int64_t> nLastNodeId(0);
 
 static deque<string> vOneShots;
 CCriticalSection cs_vOneShots;
@@ -96,6 +101,12 @@ void CNode::PushGetBlocks(CBlockIndex* pindexBegin, uint256 hashEnd)
     PushMessage("getblocks", CBlockLocator(pindexBegin), hashEnd);
 }
 
+void CNode::PushGetHeaders(CBlockIndex* pindexBegin)
+{
+    // the locator can have headers whose blocks aren't stored yet
+    PushMessage("getheaders", CBlockLocator(pindexBegin), uint256(0));
+}
+
 // find 'best' local address for a particular peer
 bool GetLocal(CService& addr, const CNetAddr *paddrPeer)
 {
@@ -545,8 +556,13 @@ void CNode::PushVersion()
     CAddress addrMe = GetLocalAddress(&addr);
     RAND_bytes((unsigned char*)&nLocalHostNonce, sizeof(nLocalHostNonce));
     printf("send version message: version %d, blocks=%d, us=%s, them=%s, peer=%s\n", PROTOCOL_VERSION, nBestHeight.load(), addrMe.ToString().c_str(), addrYou.ToString().c_str(), addr.ToString().c_str());
+    // the peers that don't know about compact blocks stop reading after fRelayTxes
+    const bool     fRelayTxes = true;
+    const uint64_t nCompactBlocksVersion =
+        (nLocalServices & NODE_COMPACT_BLOCKS) ? COMPACT_BLOCKS_VERSION : 0;
     PushMessage("version", PROTOCOL_VERSION, nLocalServices.load(), nTime, addrYou, addrMe,
-                nLocalHostNonce.load(), FormatSubVersion(CLIENT_NAME, CLIENT_VERSION, std::vector<string>()), nBestHeight.load());
+                nLocalHostNonce.load(), FormatSubVersion(CLIENT_NAME, CLIENT_VERSION, std::vector<string>()),
+                nBestHeight.load(), fRelayTxes, nCompactBlocksVersion);
 }
 
 
@@ -616,6 +632,11 @@ void CNode::copyStats(CNodeStats &stats)
     X(fInbound);
     X(nStartingHeight);
     X(nMisbehavior);
+    X(nSendBytes);
+    X(nSendMsgs);
+    X(nSendCalls);
+    X(fCompactBlocks);
+    X(nSyncedHeaders);
 }
 #undef X
 
@@ -703,24 +724,106 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+// at most this many queued messages are handed to a single send call (IOV_MAX is 1024 on the
+// systems we support)
+static const unsigned int MAX_SEND_BUFFERS_PER_CALL = 64;
+
+// at most this many buffers of sent messages are kept by a node for new messages, and only if
+// they're not bigger than MAX_REUSED_SEND_BUFFER_SIZE
+static const unsigned int MAX_REUSED_SEND_BUFFERS     = 4;
+static const size_t       MAX_REUSED_SEND_BUFFER_SIZE = 256 * 1024;
+
+// Sends the given buffers, in order, with a single system call. Returns the number of bytes sent,
+// or -1 on error (see WSAGetLastError())
+static int SendBuffers(SOCKET hSocket, const char* const* vpch, const size_t* vnLen, unsigned int nBuffers)
+{
+#ifdef WIN32
+    WSABUF vBuf[MAX_SEND_BUFFERS_PER_CALL];
+    for (unsigned int i = 0; i < nBuffers; i++) {
+        vBuf[i].buf = const_cast<char*>(vpch[i]);
+        vBuf[i].len = vnLen[i];
+    }
+    DWORD nSent = 0;
+    if (WSASend(hSocket, vBuf, nBuffers, &nSent, 0, NULL, NULL) != 0)
+        return -1;
+    return nSent;
+#else
+    struct iovec vIov[MAX_SEND_BUFFERS_PER_CALL];
+    for (unsigned int i = 0; i < nBuffers; i++) {
+        vIov[i].iov_base = const_cast<char*>(vpch[i]);
+        vIov[i].iov_len  = vnLen[i];
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = vIov;
+    msg.msg_iovlen = nBuffers;
+    return sendmsg(hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
+
+void SetMessageSizeAndChecksum(CDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    memcpy((char*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
+
+    // Set the checksum
+    uint256      hash      = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+}
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CQueuedMessage>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        // queued messages are sent together, as many as possible at once
+        const char*  vpch[MAX_SEND_BUFFERS_PER_CALL];
+        size_t       vnLen[MAX_SEND_BUFFERS_PER_CALL];
+        unsigned int nBuffers = 0;
+        size_t       nOffered = 0;
+        for (std::deque<CQueuedMessage>::iterator itBuf = it;
+             itBuf != pnode->vSendMsg.end() && nBuffers < MAX_SEND_BUFFERS_PER_CALL; ++itBuf) {
+            const CSerializeData& data    = itBuf->Get();
+            const size_t          nOffset = (itBuf == it ? pnode->nSendOffset : 0);
+            assert(data.size() > nOffset);
+            vpch[nBuffers]  = &data[nOffset];
+            vnLen[nBuffers] = data.size() - nOffset;
+            nOffered += vnLen[nBuffers];
+            nBuffers++;
+        }
+
+        int nBytes = SendBuffers(pnode->hSocket, vpch, vnLen, nBuffers);
+        pnode->nSendCalls++;
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
-            pnode->nSendOffset += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            pnode->nSendBytes += nBytes;
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                const size_t nSize      = it->Get().size();
+                const size_t nRemaining = nSize - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= nSize;
+                // shared messages aren't ours to reuse
+                if (!it->pshared && pnode->vSendBuffers.size() < MAX_REUSED_SEND_BUFFERS &&
+                    it->data.capacity() <= MAX_REUSED_SEND_BUFFER_SIZE) {
+                    it->data.clear();
+                    pnode->vSendBuffers.push_back(CSerializeData());
+                    pnode->vSendBuffers.back().swap(it->data);
+                }
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nOffered) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -777,6 +880,7 @@ void ThreadSocketHandler2(void* /*parg*/)
         //
         // Disconnect nodes
         //
+        vector<int64_t> vDisconnectedIds;
         {
             LOCK(cs_vNodes);
             // Disconnect unused nodes
@@ -788,6 +892,7 @@ void ThreadSocketHandler2(void* /*parg*/)
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                    vDisconnectedIds.push_back(pnode->nId);
 
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
@@ -835,6 +940,14 @@ void ThreadSocketHandler2(void* /*parg*/)
                 }
             }
         }
+
+        // the blocks of the headers that only the disconnected peers sent won't come
+        if (!vDisconnectedIds.empty())
+        {
+            LOCK(cs_main);
+            BOOST_FOREACH(int64_t nId, vDisconnectedIds)
+                DropPeerHeaders(nId);
+        }
         std::size_t vNodesSize = 0;
         {
             LOCK(cs_vNodes);
@@ -2022,6 +2135,9 @@ bool StopNode()
     if (vnThreadsRunning[THREAD_ADDEDCONNECTIONS] > 0) printf("ThreadOpenAddedConnections still running\n");
     if (vnThreadsRunning[THREAD_DUMPADDRESS] > 0) printf("ThreadDumpAddresses still running\n");
     if (vnThreadsRunning[THREAD_STAKE_MINER] > 0) printf("ThreadStakeMiner still running\n");
+    if (vnThreadsRunning[THREAD_DBMAINTENANCE] > 0) printf("ThreadLMDBMaintenance still running\n");
+    if (vnThreadsRunning[THREAD_ADDRINDEX] > 0) printf("ThreadIndexBuild(addrindex) still running\n");
+    if (vnThreadsRunning[THREAD_TOKENINDEX] > 0) printf("ThreadIndexBuild(tokenindex) still running\n");
     while (vnThreadsRunning[THREAD_MESSAGEHANDLER] > 0 || vnThreadsRunning[THREAD_RPCHANDLER] > 0)
         MilliSleep(20);
     MilliSleep(50);
@@ -2064,7 +2180,8 @@ void RelayTransaction(const CTransaction& tx, const uint256& hash)
 
 void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataStream& ss)
 {
-    CInv inv(MSG_TX, hash);
+    CInv           inv(MSG_TX, hash);
+    CSharedMessage pmsg = MakeSharedMessage(inv.GetCommand(), ss);
     {
         LOCK(cs_mapRelay);
         // Expire old relay messages
@@ -2075,7 +2192,7 @@ void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataSt
         }
 
         // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        mapRelay.insert(std::make_pair(inv, pmsg));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
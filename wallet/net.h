@@ -9,6 +9,7 @@
 #include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
 #include <deque>
+#include <memory>
 #include <openssl/rand.h>
 
 #ifndef WIN32
@@ -18,6 +19,7 @@
 #include "ThreadSafeHashMap.h"
 #include "addrman.h"
 #include "bloom.h"
+#include "globals.h"
 #include "hash.h"
 #include "mruset.h"
 #include "netbase.h"
@@ -26,6 +28,7 @@
 class CRequestTracker;
 class CNode;
 class CBlockIndex;
+class CPartialBlock;
 extern boost::atomic<int> nBestHeight;
 
 inline unsigned int ReceiveFloodSize() { return 1000 * GetArg("-maxreceivebuffer", 5 * 1000); }
@@ -104,10 +107,30 @@ enum threadId
     THREAD_RPCHANDLER,
     THREAD_STAKE_MINER,
     THREAD_IMPORT,
+    THREAD_DBMAINTENANCE,
+    THREAD_ADDRINDEX,
+    THREAD_TOKENINDEX,
 
     THREAD_MAX
 };
 
+/** A complete network message (header and payload), serialized once and then queued without copying
+ *  for every node it's sent to. See MakeSharedMessage() and CNode::PushSharedMessage(). */
+typedef std::shared_ptr<const CSerializeData> CSharedMessage;
+
+/** A message waiting in the send queue of a node: either serialized for that node only (data), or
+ *  shared with other nodes (pshared) */
+struct CQueuedMessage
+{
+    CSerializeData data;
+    CSharedMessage pshared;
+
+    const CSerializeData& Get() const { return pshared ? *pshared : data; }
+};
+
+/** Fills in the size and the checksum of the message in ss, which starts with its header */
+void SetMessageSizeAndChecksum(CDataStream& ss);
+
 extern bool                                        fDiscover;
 extern bool                                        fUseUPnP;
 extern boost::atomic<uint64_t>                     nLocalServices;
@@ -118,10 +141,11 @@ extern LockedVar<CAddrMan>                         addrman;
 
 extern std::vector<CNode*>                  vNodes;
 extern CCriticalSection                     cs_vNodes;
-extern std::map<CInv, CDataStream>          mapRelay;
+extern std::map<CInv, CSharedMessage>       mapRelay;
 extern std::deque<std::pair<int64_t, CInv>> vRelayExpiration;
 extern CCriticalSection                     cs_mapRelay;
 extern ThreadSafeHashMap<CInv, int64_t>     mapAlreadyAskedFor;
+extern boost::atomic<int64_t>               nLastNodeId;
 
 class CNodeStats
 {
@@ -136,6 +160,11 @@ public:
     bool        fInbound;
     int         nStartingHeight;
     int         nMisbehavior;
+    uint64_t    nSendBytes;
+    uint64_t    nSendMsgs;
+    uint64_t    nSendCalls;
+    bool        fCompactBlocks;
+    int         nSyncedHeaders;
 };
 
 class CNetMessage
@@ -180,13 +209,18 @@ class CNode
 {
 public:
     // socket
-    uint64_t                   nServices;
-    SOCKET                     hSocket;
-    CDataStream                ssSend;
-    size_t                     nSendSize;   // total size of all vSendMsg entries
-    size_t                     nSendOffset; // offset inside the first vSendMsg already sent
-    std::deque<CSerializeData> vSendMsg;
-    CCriticalSection           cs_vSend;
+    uint64_t                    nServices;
+    SOCKET                      hSocket;
+    CDataStream                 ssSend;
+    size_t                      nSendSize;    // total size of all vSendMsg entries
+    size_t                      nSendOffset;  // offset inside the first vSendMsg already sent
+    std::deque<CQueuedMessage>  vSendMsg;
+    std::vector<CSerializeData> vSendBuffers; // emptied buffers of sent messages, for reuse by ssSend
+    CCriticalSection            cs_vSend;
+
+    boost::atomic<uint64_t> nSendBytes;
+    boost::atomic<uint64_t> nSendMsgs;  // messages queued for sending
+    boost::atomic<uint64_t> nSendCalls; // system calls made to send them
 
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection        cs_vRecvMsg;
@@ -196,6 +230,7 @@ public:
     boost::atomic<int64_t> nLastRecv;
     boost::atomic<int64_t> nLastSendEmpty;
     boost::atomic<int64_t> nTimeConnected;
+    int64_t                nId; // of the peer among the ones of this process, which isn't reused
     CAddress               addr;
     std::string            addrName;
     CService               addrLocal;
@@ -216,6 +251,21 @@ public:
     CCriticalSection cs_filter;
     CBloomFilter*    pfilter;
     int              nRefCount;
+    // the peer takes compact blocks instead of the inventory of new blocks, and sends them
+    bool fCompactBlocks;
+    // the compact block of the peer whose missing transactions were asked for with getblocktxn
+    std::shared_ptr<CPartialBlock> pPartialBlock;
+    // the header sync (see ProcessHeaders()): the best header that the peer sent, and the blocks of its
+    // header chain that are still to be asked for, in the order of the chain
+    CBlockIndexSmartPtr             pindexBestKnownHeader;
+    boost::atomic<int>              nSyncedHeaders; // the height of pindexBestKnownHeader
+    std::deque<CBlockIndexSmartPtr> vBlocksToDownload;
+    // more headers are asked for once the header index has room for them (see MAX_HEADER_INDEX_SIZE)
+    bool fHeadersSyncPaused;
+    // since when the stored blocks of the peer's header chain got no further than nHeadersStallHeight;
+    // it's stalling after HEADERS_STALL_TIMEOUT
+    int64_t nHeadersStallTime;
+    int     nHeadersStallHeight;
 
 protected:
     // Denial-of-service detection/prevention
@@ -255,6 +305,7 @@ public:
         nLastRecv                = 0;
         nLastSendEmpty           = GetTime();
         nTimeConnected           = GetTime();
+        nId                      = nLastNodeId++;
         addr                     = addrIn;
         addrName                 = addrNameIn == "" ? addr.ToStringIPPort() : addrNameIn;
         nVersion                 = 0;
@@ -268,6 +319,9 @@ public:
         nRefCount                = 0;
         nSendSize                = 0;
         nSendOffset              = 0;
+        nSendBytes               = 0;
+        nSendMsgs                = 0;
+        nSendCalls               = 0;
         hashContinue             = 0;
         pindexLastGetBlocksBegin = 0;
         hashLastGetBlocksEnd     = 0;
@@ -276,6 +330,11 @@ public:
         nMisbehavior             = 0;
         hashCheckpointKnown      = 0;
         fRelayTxes               = false;
+        fCompactBlocks           = false;
+        nSyncedHeaders           = -1;
+        fHeadersSyncPaused       = false;
+        nHeadersStallTime        = 0;
+        nHeadersStallHeight      = -1;
         setInventoryKnown.max_size(SendBufferSize() / 1000);
         pfilter = NULL;
 
@@ -352,6 +411,13 @@ public:
         }
     }
 
+    /** Adds the inventory to what the peer is known to have; false if it was there already */
+    bool SetInventoryKnown(const CInv& inv)
+    {
+        LOCK(cs_inventory);
+        return setInventoryKnown.insert(inv).second;
+    }
+
     void PushInventory(const CInv& inv)
     {
         {
@@ -416,24 +482,23 @@ public:
         if (ssSend.size() == 0)
             return;
 
-        // Set the size
-        unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-        memcpy((char*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
-
-        // Set the checksum
-        uint256      hash      = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-        unsigned int nChecksum = 0;
-        memcpy(&nChecksum, &hash, sizeof(nChecksum));
-        assert(ssSend.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-        memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+        SetMessageSizeAndChecksum(ssSend);
 
         if (fDebug) {
-            printf("(%d bytes)\n", nSize);
+            printf("(%d bytes)\n", (int)(ssSend.size() - CMessageHeader::HEADER_SIZE));
         }
 
-        std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-        ssSend.GetAndClear(*it);
-        nSendSize += (*it).size();
+        // the buffer of the message is queued as it is, and ssSend takes over the buffer of a message
+        // that was already sent, so that nothing is copied or allocated
+        CSerializeData vchReuse;
+        if (!vSendBuffers.empty()) {
+            vchReuse.swap(vSendBuffers.back());
+            vSendBuffers.pop_back();
+        }
+        std::deque<CQueuedMessage>::iterator it = vSendMsg.insert(vSendMsg.end(), CQueuedMessage());
+        ssSend.GetAndClear(it->data, vchReuse);
+        nSendSize += it->data.size();
+        nSendMsgs++;
 
         // If write queue empty, attempt "optimistic write"
         if (it == vSendMsg.begin())
@@ -442,6 +507,24 @@ public:
         LEAVE_CRITICAL_SECTION(cs_vSend);
     }
 
+    /** Queues a message made with MakeSharedMessage(), which may be queued for other nodes too */
+    void PushSharedMessage(const CSharedMessage& pmsg)
+    {
+        LOCK(cs_vSend);
+        if (fDebug)
+            printf("sending: shared message (%d bytes)\n",
+                   (int)(pmsg->size() - CMessageHeader::HEADER_SIZE));
+
+        std::deque<CQueuedMessage>::iterator it = vSendMsg.insert(vSendMsg.end(), CQueuedMessage());
+        it->pshared = pmsg;
+        nSendSize += pmsg->size();
+        nSendMsgs++;
+
+        // If write queue empty, attempt "optimistic write"
+        if (it == vSendMsg.begin())
+            SocketSendData(this);
+    }
+
     void PushVersion();
 
     void PushMessage(const char* pszCommand)
@@ -579,6 +662,22 @@ public:
         }
     }
 
+    template <typename T1, typename T2, typename T3, typename T4, typename T5, typename T6, typename T7,
+              typename T8, typename T9, typename T10>
+    void PushMessage(const char* pszCommand, const T1& a1, const T2& a2, const T3& a3, const T4& a4,
+                     const T5& a5, const T6& a6, const T7& a7, const T8& a8, const T9& a9,
+                     const T10& a10)
+    {
+        try {
+            BeginMessage(pszCommand);
+            ssSend << a1 << a2 << a3 << a4 << a5 << a6 << a7 << a8 << a9 << a10;
+            EndMessage();
+        } catch (...) {
+            AbortMessage();
+            throw;
+        }
+    }
+
     void PushRequest(const char* pszCommand, void (*fn)(void*, CDataStream&), void* param1)
     {
         uint256 hashReply;
@@ -622,6 +721,7 @@ public:
     }
 
     void PushGetBlocks(CBlockIndex* pindexBegin, uint256 hashEnd);
+    void PushGetHeaders(CBlockIndex* pindexBegin);
     bool IsSubscribed(unsigned int nChannel);
     void Subscribe(unsigned int nChannel, unsigned int nHops = 0);
     void CancelSubscribe(unsigned int nChannel);
@@ -657,6 +757,21 @@ inline void RelayInventory(const CInv& inv)
     }
 }
 
+/** Serializes a complete message once, to be queued for any number of nodes with
+ *  CNode::PushSharedMessage() */
+template <typename T>
+CSharedMessage MakeSharedMessage(const char* pszCommand, const T& payload)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CMessageHeader(pszCommand, 0) << payload;
+    SetMessageSizeAndChecksum(ss);
+
+    std::shared_ptr<CSerializeData> pmsg = std::make_shared<CSerializeData>();
+    CSerializeData                  vchUnused;
+    ss.GetAndClear(*pmsg, vchUnused);
+    return pmsg;
+}
+
 class CTransaction;
 void RelayTransaction(const CTransaction& tx, const uint256& hash);
 void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataStream& ss);
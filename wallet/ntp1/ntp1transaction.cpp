@@ -1004,6 +1004,7 @@ std::vector<std::pair<CTransaction, NTP1Transaction>> NTP1Transaction::StdFetche
     // NTP1 transaction data is either in the test pool OR in the database; no third option here
     auto it = mapQueuedNTP1Inputs.find(tx.GetHash());
     if (it == mapQueuedNTP1Inputs.end()) {
+        CTxDBReadSnapshot snapshot(!txdb.IsInWriteTxn());
         for (auto&& inTx : inputsWithNTP1) {
             if (IsTxNTP1(&inTx.first)) {
                 if (txdb.ContainsNTP1Tx(inTx.first.GetHash())) {
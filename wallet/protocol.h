@@ -69,6 +69,11 @@ class CMessageHeader
 enum
 {
     NODE_NETWORK = (1 << 0),
+    // the node only has the last blocks (-prune); it's set instead of NODE_NETWORK, so peers that
+    // don't know it take the node for a client that doesn't serve blocks
+    NODE_NETWORK_LIMITED = (1 << 10),
+    // the node relays new blocks as compact blocks to the peers that set it too (see blockencodings.h)
+    NODE_COMPACT_BLOCKS = (1 << 11),
 };
 
 /** A CService with information about it as peer */
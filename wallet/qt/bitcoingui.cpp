@@ -901,13 +901,13 @@ void BitcoinGUI::exportBlockchainBootstrap()
             // with orphans
             boost::thread exporterThread(boost::bind(
                 &ExportBootstrapBlockchainWithOrphans, filename.toStdString(), boost::ref(stopped),
-                boost::ref(progress), boost::ref(finished), graphTraverseType));
+                boost::ref(progress), boost::ref(finished), graphTraverseType, false));
             exporterThread.detach();
         } else {
             // without orphans
             boost::thread exporterThread(boost::bind(&ExportBootstrapBlockchain, filename.toStdString(),
                                                      boost::ref(stopped), boost::ref(progress),
-                                                     boost::ref(finished)));
+                                                     boost::ref(finished), false));
             exporterThread.detach();
         }
 
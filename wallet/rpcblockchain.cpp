@@ -3,9 +3,15 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addrindex.h"
+#include "base58.h"
 #include "bitcoinrpc.h"
+#include "blockprune.h"
+#include "headerchain.h"
 #include "main.h"
 #include "merkletx.h"
+#include "tokenindex.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include <atomic>
 
@@ -96,56 +102,77 @@ double GetPoSKernelPS()
     return nStakesTime ? dStakeKernelsTriedAvg / nStakesTime : 0;
 }
 
-Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail,
-                   bool ignoreNTP1 = false)
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail,
+                 bool ignoreNTP1, CRPCStreamWriter& writer)
 {
+    writer.BeginObject();
+    // the header fields are small, so they're assembled as an Object and only the transactions,
+    // which can be arbitrarily many, are streamed in batches; cs_main is only held while the values
+    // are assembled, not while they're written
     Object result;
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
-    CMerkleTx txGen(block.vtx[0]);
-    txGen.SetMerkleBranch(&block);
-    result.push_back(Pair("confirmations", (int)txGen.GetDepthInMainChain()));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    result.push_back(Pair("mint", ValueFromAmount(blockindex->nMint)));
-    result.push_back(Pair("time", (int64_t)block.GetBlockTime()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("blocktrust", leftTrim(blockindex->GetBlockTrust().GetHex(), '0')));
-    result.push_back(Pair("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0')));
-    if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    if (blockindex->pnext)
-        result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
-
-    result.push_back(Pair(
-        "flags", strprintf("%s%s", blockindex->IsProofOfStake() ? "proof-of-stake" : "proof-of-work",
-                           blockindex->GeneratedStakeModifier() ? " stake-modifier" : "")));
-    result.push_back(Pair("proofhash", blockindex->hashProof.GetHex()));
-    result.push_back(Pair("entropybit", (int)blockindex->GetStakeEntropyBit()));
-    result.push_back(Pair("modifier", strprintf("%016" PRIx64, blockindex->nStakeModifier)));
-    result.push_back(Pair("modifierchecksum", strprintf("%08x", blockindex->nStakeModifierChecksum)));
-
-    Array txinfo;
-    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
-        if (fPrintTransactionDetail) {
-            Object entry;
-
-            TxToJSON(tx, 0, entry, ignoreNTP1);
-
-            txinfo.push_back(entry);
-        } else
-            txinfo.push_back(tx.GetHash().GetHex());
+    {
+        LOCK(cs_main);
+        result.push_back(Pair("hash", block.GetHash().GetHex()));
+        CMerkleTx txGen(block.vtx[0]);
+        txGen.SetMerkleBranch(&block);
+        result.push_back(Pair("confirmations", (int)txGen.GetDepthInMainChain()));
+        result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
+        result.push_back(Pair("height", blockindex->nHeight));
+        result.push_back(Pair("version", block.nVersion));
+        result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+        result.push_back(Pair("mint", ValueFromAmount(blockindex->nMint)));
+        result.push_back(Pair("time", (int64_t)block.GetBlockTime()));
+        result.push_back(Pair("nonce", (uint64_t)block.nNonce));
+        result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
+        result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+        result.push_back(Pair("blocktrust", leftTrim(blockindex->GetBlockTrust().GetHex(), '0')));
+        result.push_back(Pair("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0')));
+        if (blockindex->pprev)
+            result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+        if (blockindex->pnext)
+            result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
+
+        result.push_back(Pair(
+            "flags", strprintf("%s%s", blockindex->IsProofOfStake() ? "proof-of-stake" : "proof-of-work",
+                               blockindex->GeneratedStakeModifier() ? " stake-modifier" : "")));
+        result.push_back(Pair("proofhash", blockindex->hashProof.GetHex()));
+        result.push_back(Pair("entropybit", (int)blockindex->GetStakeEntropyBit()));
+        result.push_back(Pair("modifier", strprintf("%016" PRIx64, blockindex->nStakeModifier)));
+        result.push_back(
+            Pair("modifierchecksum", strprintf("%08x", blockindex->nStakeModifierChecksum)));
     }
 
-    result.push_back(Pair("tx", txinfo));
+    for (const Pair& p : result)
+        writer.WritePair(p.name_, p.value_);
+
+    writer.WriteKey("tx");
+    writer.BeginArray();
+    for (unsigned int nStart = 0; nStart < block.vtx.size(); nStart += RPC_STREAM_BATCH_SIZE) {
+        const unsigned int nEnd =
+            std::min<unsigned int>(block.vtx.size(), nStart + RPC_STREAM_BATCH_SIZE);
+        Array batch;
+        {
+            LOCK(cs_main);
+            for (unsigned int i = nStart; i < nEnd; i++) {
+                if (fPrintTransactionDetail) {
+                    Object entry;
+
+                    TxToJSON(block.vtx[i], 0, entry, ignoreNTP1);
+
+                    batch.push_back(entry);
+                } else
+                    batch.push_back(block.vtx[i].GetHash().GetHex());
+            }
+        }
+        for (const Value& entry : batch)
+            writer.WriteValue(entry);
+    }
+    writer.EndArray();
 
     if (block.IsProofOfStake())
-        result.push_back(Pair("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end())));
+        writer.WritePair("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end()));
 
-    return result;
+    writer.EndObject();
 }
 
 Value getbestblockhash(const Array& params, bool fHelp)
@@ -179,6 +206,35 @@ Value getdifficulty(const Array& params, bool fHelp)
     return obj;
 }
 
+Value getblockchaininfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockchaininfo\n"
+            "Returns how far the block chain is synced: the best block that's stored, and the best "
+            "chain of headers, whose blocks are downloaded.");
+
+    LOCK(cs_main);
+
+    const CBlockIndexSmartPtr pindexBestBlock = boost::atomic_load(&pindexBest);
+    const CBlockIndexSmartPtr pindexHeader    = GetBestHeader();
+
+    Object obj;
+    obj.push_back(Pair("chain", fTestNet ? "test" : "main"));
+    obj.push_back(Pair("blocks", pindexBestBlock->nHeight));
+    obj.push_back(Pair("headers", pindexHeader->nHeight));
+    obj.push_back(Pair("bestblockhash", pindexBestBlock->GetBlockHash().GetHex()));
+    obj.push_back(Pair("bestheaderhash", pindexHeader->GetBlockHash().GetHex()));
+    obj.push_back(Pair("pendingheaders", (uint64_t)mapHeaderIndex.size()));
+    obj.push_back(Pair("syncprogress", pindexHeader->nHeight > 0
+                                           ? (double)pindexBestBlock->nHeight / pindexHeader->nHeight
+                                           : 1.0));
+    obj.push_back(Pair("initialblockdownload", IsInitialBlockDownload()));
+    obj.push_back(Pair("mediantime", pindexBestBlock->GetMedianTimePast()));
+    obj.push_back(Pair("pruned", nPruneTarget > 0));
+    return obj;
+}
+
 Value settxfee(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 1 || AmountFromValue(params[0]) < MIN_TX_FEE)
@@ -191,7 +247,7 @@ Value settxfee(const Array& params, bool fHelp)
     return true;
 }
 
-Value getrawmempool(const Array& params, bool fHelp)
+void getrawmempool(const Array& params, bool fHelp, CRPCStreamWriter& writer)
 {
     if (fHelp || params.size() != 0)
         throw runtime_error("getrawmempool\n"
@@ -200,11 +256,10 @@ Value getrawmempool(const Array& params, bool fHelp)
     vector<uint256> vtxid;
     mempool.queryHashes(vtxid);
 
-    Array a;
+    writer.BeginArray();
     BOOST_FOREACH (const uint256& hash, vtxid)
-        a.push_back(hash.ToString());
-
-    return a;
+        writer.WriteValue(hash.ToString());
+    writer.EndArray();
 }
 
 Value getblockhash(const Array& params, bool fHelp)
@@ -243,7 +298,17 @@ Value getblockhash(const Array& params, bool fHelp)
 //     return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
 // }
 
-Value getblock(const Array& params, bool fHelp)
+// tells the blocks that were pruned apart from the ones that couldn't be read
+static void ReadBlockForRPC(CBlock& block, const CBlockIndex* pblockindex)
+{
+    if (block.ReadFromDisk(pblockindex, true))
+        return;
+    if (IsBlockPruned(pblockindex))
+        throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
+    throw JSONRPCError(RPC_DATABASE_ERROR, "Can't read block from disk");
+}
+
+void getblock(const Array& params, bool fHelp, CRPCStreamWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 4)
         throw runtime_error(
@@ -266,28 +331,33 @@ Value getblock(const Array& params, bool fHelp)
     if (params.size() > 2)
         fShowTxns = params[2].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
-    CBlock       block;
-    CBlockIndex* pblockindex = boost::atomic_load(&mapBlockIndex[hash]).get();
-    block.ReadFromDisk(pblockindex, true);
+    CBlock              block;
+    CBlockIndexSmartPtr pblockindex;
+    {
+        LOCK(cs_main);
+        BlockIndexMapType::const_iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = boost::atomic_load(&mi->second);
+        ReadBlockForRPC(block, pblockindex.get());
+    }
 
     if (!fVerbose) {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
         ssBlock << block;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        writer.WriteValue(strHex);
+        return;
     }
 
     bool fIgnoreNTP1 = false;
     if (params.size() > 3)
         fIgnoreNTP1 = params[3].get_bool();
 
-    return blockToJSON(block, pblockindex, fShowTxns, fIgnoreNTP1);
+    blockToJSON(block, pblockindex.get(), fShowTxns, fIgnoreNTP1, writer);
 }
 
-Value getblockbynumber(const Array& params, bool fHelp)
+void getblockbynumber(const Array& params, bool fHelp, CRPCStreamWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 3)
         throw runtime_error("getblockbynumber <number> [txinfo] [ignoreNTP1=false]\n"
@@ -297,25 +367,26 @@ Value getblockbynumber(const Array& params, bool fHelp)
                             "transaction is not in the blockchain.");
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > nBestHeight)
-        throw runtime_error("Block number out of range.");
 
     CBlock              block;
-    CBlockIndexSmartPtr pblockindex = boost::atomic_load(&mapBlockIndex[hashBestChain]);
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
-
-    uint256 hash = *pblockindex->phashBlock;
-
-    pblockindex = boost::atomic_load(&mapBlockIndex[hash]);
-    block.ReadFromDisk(pblockindex.get(), true);
+    CBlockIndexSmartPtr pblockindex;
+    {
+        LOCK(cs_main);
+        if (nHeight < 0 || nHeight > nBestHeight)
+            throw runtime_error("Block number out of range.");
+
+        pblockindex = boost::atomic_load(&mapBlockIndex[hashBestChain]);
+        while (pblockindex->nHeight > nHeight)
+            pblockindex = pblockindex->pprev;
+        ReadBlockForRPC(block, pblockindex.get());
+    }
 
     bool fIgnoreNTP1 = false;
     if (params.size() > 2)
         fIgnoreNTP1 = params[2].get_bool();
 
-    return blockToJSON(block, pblockindex.get(), params.size() > 1 ? params[1].get_bool() : false,
-                       fIgnoreNTP1);
+    blockToJSON(block, pblockindex.get(), params.size() > 1 ? params[1].get_bool() : false, fIgnoreNTP1,
+                writer);
 }
 
 // ppcoin: get information of sync-checkpoint
@@ -349,22 +420,303 @@ Value getcheckpoint(const Array& params, bool fHelp)
     return result;
 }
 
+Value getdbinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error("getdbinfo\n"
+                            "Returns the size of the database map, and how often it was resized and how "
+                            "long the database was held up for it.");
+
+    const CLMDBResizeStats stats = CTxDB::GetResizeStats();
+
+    Object result;
+    result.push_back(Pair("mapsize", (uint64_t)stats.nMapSize));
+    result.push_back(Pair("used", (uint64_t)stats.nUsedSize));
+    result.push_back(Pair("resizes", (uint64_t)stats.nResizes));
+    result.push_back(Pair("proactiveresizes", (uint64_t)stats.nProactiveResizes));
+    result.push_back(Pair("stalltotalms", stats.nStallMicrosTotal / 1000.0));
+    result.push_back(Pair("stallmaxms", stats.nStallMicrosMax / 1000.0));
+    result.push_back(Pair("lastresizetime", stats.nLastResizeTime));
+    return result;
+}
+
+namespace {
+/** The most entries the address and the token index RPCs return at once */
+const int64_t MAX_ADDRINDEX_PAGE = 1000;
+
+uint160 AddrIndexScriptHashFromParam(const Value& value)
+{
+    if (!fAddrIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "The address index is off (-addrindex)");
+    if (!fAddrIndexSynced)
+        throw JSONRPCError(RPC_MISC_ERROR,
+                           strprintf("The address index is being built; it's up to height %d of %d",
+                                     nAddrIndexHeight.load(), nBestHeight.load()));
+    CBitcoinAddress address(value.get_str());
+    if (!address.IsValid())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid neblio address");
+    return GetAddrIndexScriptHash(address.Get());
+}
+
+void AddrIndexPageFromParams(const Array& params, uint64_t& nSkip, uint64_t& nCount)
+{
+    const int64_t nSkipParam  = params.size() > 1 ? params[1].get_int64() : 0;
+    const int64_t nCountParam = params.size() > 2 ? params[2].get_int64() : 100;
+    if (nSkipParam < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "skip can't be negative");
+    if (nCountParam < 1 || nCountParam > MAX_ADDRINDEX_PAGE)
+        throw JSONRPCError(RPC_INVALID_PARAMETER,
+                           strprintf("count has to be between 1 and %" PRId64, MAX_ADDRINDEX_PAGE));
+    nSkip  = nSkipParam;
+    nCount = nCountParam;
+}
+
+Array AddrIndexTokensToJSON(const std::vector<CAddrIndexToken>& vTokens)
+{
+    Array result;
+    for (const CAddrIndexToken& token : vTokens) {
+        Object entry;
+        entry.push_back(Pair("tokenId", token.tokenId));
+        entry.push_back(Pair("amount", ToString(token.nAmount)));
+        result.push_back(entry);
+    }
+    return result;
+}
+} // namespace
+
+Value getaddressutxos(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddressutxos <address> [skip=0] [count=100]\n"
+            "Returns the unspent outputs of an address in the main chain, with the NTP1 tokens they "
+            "hold; at most count of them, after the first skip. Needs -addrindex.");
+
+    const uint160 scriptHash = AddrIndexScriptHashFromParam(params[0]);
+    uint64_t      nSkip, nCount;
+    AddrIndexPageFromParams(params, nSkip, nCount);
+
+    CTxDB                                                     txdb("r");
+    std::vector<std::pair<CAddrIndexUtxoKey, CAddrIndexUtxo>> vEntries;
+    if (!txdb.ReadAddrIndexUtxos(scriptHash, nSkip, nCount, vEntries))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+
+    Array result;
+    for (const std::pair<CAddrIndexUtxoKey, CAddrIndexUtxo>& entry : vEntries) {
+        Object utxo;
+        utxo.push_back(Pair("txid", entry.first.txid.GetHex()));
+        utxo.push_back(Pair("vout", (uint64_t)entry.first.n));
+        utxo.push_back(Pair("amount", ValueFromAmount(entry.second.nValue)));
+        utxo.push_back(Pair("height", (uint64_t)entry.second.nHeight));
+        utxo.push_back(Pair("scriptPubKey", HexStr(entry.second.scriptPubKey.begin(),
+                                                   entry.second.scriptPubKey.end())));
+        utxo.push_back(Pair("tokens", AddrIndexTokensToJSON(entry.second.vTokens)));
+        result.push_back(utxo);
+    }
+    return result;
+}
+
+Value getaddresshistory(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddresshistory <address> [skip=0] [count=100]\n"
+            "Returns the outputs paid to an address in the main chain and the spends of them, oldest "
+            "first; at most count of them, after the first skip. A spend has the input that spent the "
+            "output as n, and a negative amount. Needs -addrindex.");
+
+    const uint160 scriptHash = AddrIndexScriptHashFromParam(params[0]);
+    uint64_t      nSkip, nCount;
+    AddrIndexPageFromParams(params, nSkip, nCount);
+
+    CTxDB                                                  txdb("r");
+    std::vector<std::pair<CAddrIndexKey, CAddrIndexDelta>> vEntries;
+    if (!txdb.ReadAddrIndexHistory(scriptHash, nSkip, nCount, vEntries))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+
+    Array result;
+    for (const std::pair<CAddrIndexKey, CAddrIndexDelta>& entry : vEntries) {
+        Object delta;
+        delta.push_back(Pair("txid", entry.first.txid.GetHex()));
+        delta.push_back(Pair("height", (uint64_t)entry.first.nHeight));
+        delta.push_back(Pair("spend", entry.first.fSpend));
+        delta.push_back(Pair("n", (uint64_t)entry.first.n));
+        delta.push_back(Pair("amount", ValueFromAmount(entry.second.nValue)));
+        delta.push_back(Pair("tokens", AddrIndexTokensToJSON(entry.second.vTokens)));
+        result.push_back(delta);
+    }
+    return result;
+}
+
+Value getaddressbalance(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error("getaddressbalance <address>\n"
+                            "Returns the balance of an address in the main chain, and the NTP1 tokens "
+                            "it holds. Needs -addrindex.");
+
+    const uint160 scriptHash = AddrIndexScriptHashFromParam(params[0]);
+
+    CTxDB                                                     txdb("r");
+    std::vector<std::pair<CAddrIndexUtxoKey, CAddrIndexUtxo>> vEntries;
+    if (!txdb.ReadAddrIndexUtxos(scriptHash, 0, std::numeric_limits<uint64_t>::max(), vEntries))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+
+    int64_t                        nBalance = 0;
+    std::map<std::string, NTP1Int> mapTokens;
+    for (const std::pair<CAddrIndexUtxoKey, CAddrIndexUtxo>& entry : vEntries) {
+        nBalance += entry.second.nValue;
+        for (const CAddrIndexToken& token : entry.second.vTokens)
+            mapTokens[token.tokenId] += token.nAmount;
+    }
+    std::vector<CAddrIndexToken> vTokens;
+    for (const std::pair<const std::string, NTP1Int>& token : mapTokens)
+        vTokens.push_back(CAddrIndexToken(token.first, token.second));
+
+    Object result;
+    result.push_back(Pair("balance", ValueFromAmount(nBalance)));
+    result.push_back(Pair("utxos", (uint64_t)vEntries.size()));
+    result.push_back(Pair("tokens", AddrIndexTokensToJSON(vTokens)));
+    return result;
+}
+
+namespace {
+std::string TokenIdFromParam(const Value& value)
+{
+    if (!fTokenIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "The token index is off (-tokenindex)");
+    if (!fTokenIndexSynced)
+        throw JSONRPCError(RPC_MISC_ERROR,
+                           strprintf("The token index is being built; it's up to height %d of %d",
+                                     nTokenIndexHeight.load(), nBestHeight.load()));
+    return value.get_str();
+}
+
+Value ScriptToAddressJSON(const CScript& scriptPubKey)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(scriptPubKey, dest))
+        return Value::null;
+    return CBitcoinAddress(dest).ToString();
+}
+} // namespace
+
+Value gettokeninfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error("gettokeninfo <tokenId>\n"
+                            "Returns the issuance of an NTP1 token in the main chain, how many of it "
+                            "were minted and burned, and how many addresses hold it. Needs "
+                            "-tokenindex.");
+
+    const std::string tokenId = TokenIdFromParam(params[0]);
+
+    CTxDB           txdb("r");
+    CTokenIndexInfo info;
+    if (!txdb.ReadTokenIndexInfo(tokenId, info))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Token " + tokenId + " isn't in the main chain");
+
+    Object result;
+    result.push_back(Pair("tokenId", tokenId));
+    result.push_back(Pair("symbol", info.strSymbol));
+    result.push_back(Pair("issuetxid", info.issueTxid.GetHex()));
+    result.push_back(Pair("issueheight", (uint64_t)info.nIssueHeight));
+    result.push_back(Pair("minted", ToString(info.nMinted)));
+    result.push_back(Pair("burned", ToString(info.nBurned)));
+    result.push_back(Pair("supply", ToString(NTP1Int(info.nMinted - info.nBurned))));
+    result.push_back(Pair("holders", info.nHolders));
+    result.push_back(Pair("transfers", info.nTransfers));
+    return result;
+}
+
+Value gettokenholders(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "gettokenholders <tokenId> [skip=0] [count=100]\n"
+            "Returns the addresses that hold an NTP1 token in the main chain, with their balances; at "
+            "most count of them, after the first skip. Needs -tokenindex.");
+
+    const std::string tokenId = TokenIdFromParam(params[0]);
+    uint64_t          nSkip, nCount;
+    AddrIndexPageFromParams(params, nSkip, nCount);
+
+    CTxDB                                                           txdb("r");
+    std::vector<std::pair<CTokenIndexHolderKey, CTokenIndexHolder>> vEntries;
+    if (!txdb.ReadTokenIndexHolders(tokenId, nSkip, nCount, vEntries))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the token index");
+
+    Array result;
+    for (const std::pair<CTokenIndexHolderKey, CTokenIndexHolder>& entry : vEntries) {
+        Object holder;
+        holder.push_back(Pair("address", ScriptToAddressJSON(entry.second.scriptPubKey)));
+        holder.push_back(Pair("balance", ToString(entry.second.nBalance)));
+        result.push_back(holder);
+    }
+    return result;
+}
+
+Value gettokentransfers(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "gettokentransfers <tokenId> [skip=0] [count=100]\n"
+            "Returns the transactions of the main chain that moved an NTP1 token, oldest first; at "
+            "most count of them, after the first skip. type is issuance, transfer or burn, when fewer "
+            "tokens came out of the transaction than went in. Needs -tokenindex.");
+
+    const std::string tokenId = TokenIdFromParam(params[0]);
+    uint64_t          nSkip, nCount;
+    AddrIndexPageFromParams(params, nSkip, nCount);
+
+    CTxDB                                                               txdb("r");
+    std::vector<std::pair<CTokenIndexTransferKey, CTokenIndexTransfer>> vEntries;
+    if (!txdb.ReadTokenIndexTransfers(tokenId, nSkip, nCount, vEntries))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the token index");
+
+    Array result;
+    for (const std::pair<CTokenIndexTransferKey, CTokenIndexTransfer>& entry : vEntries) {
+        Array recipients;
+        for (const std::pair<CScript, NTP1Int>& recipient : entry.second.vRecipients) {
+            Object output;
+            output.push_back(Pair("address", ScriptToAddressJSON(recipient.first)));
+            output.push_back(Pair("amount", ToString(recipient.second)));
+            recipients.push_back(output);
+        }
+        Object transfer;
+        transfer.push_back(Pair("txid", entry.first.txid.GetHex()));
+        transfer.push_back(Pair("height", (uint64_t)entry.first.nHeight));
+        transfer.push_back(Pair("type", TokenTransferTypeToString(entry.second.nType)));
+        transfer.push_back(Pair("amountin", ToString(entry.second.nAmountIn)));
+        transfer.push_back(Pair("amountout", ToString(entry.second.nAmountOut)));
+        transfer.push_back(Pair("recipients", recipients));
+        result.push_back(transfer);
+    }
+    return result;
+}
+
 Value exportblockchain(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() < 1 || params.size() > 2) {
+    if (fHelp || params.size() < 1 || params.size() > 3) {
         throw runtime_error(
-            "exportblockchain <path-dir> [breadth or depth]\n"
+            "exportblockchain <path-dir> [linear, breadth or depth] [compress=false]\n"
             "Exports the blockchain bootstrap.dat file to <path-dir>.\n"
-            "<path-dir> must be a directory that exists. Ignoring the last parameter "
-            "will export a linear version of the blockchain. If you need orphan chains, "
-            "you can choose whether traversal is going to be breadth-firsth or depth-first.");
+            "<path-dir> must be a directory that exists. Ignoring the second parameter, or "
+            "choosing linear, will export a linear version of the blockchain. If you need orphan "
+            "chains, you can choose whether traversal is going to be breadth-firsth or depth-first.\n"
+            "If compress is true, the blocks are written in zlib compressed chunks with an index, "
+            "which this client imports like an uncompressed bootstrap.dat file.");
     }
-    if (params.size() == 2 && params[1].get_str() != "breadth" && params[1].get_str() != "depth") {
-        throw runtime_error("The second parameter can only be depth or breadth");
+    if (params.size() >= 2 && params[1].get_str() != "linear" && params[1].get_str() != "breadth" &&
+        params[1].get_str() != "depth") {
+        throw runtime_error("The second parameter can only be linear, depth or breadth");
     }
+    if (nPruneHeight > 0)
+        throw JSONRPCError(RPC_MISC_ERROR, "The blockchain can't be exported once blocks are pruned "
+                                           "(-prune)");
 
     boost::optional<GraphTraverseType> graphTraverseType;
-    if (params.size() == 2) {
+    if (params.size() >= 2) {
         if (params[1].get_str() == "breadth") {
             graphTraverseType = GraphTraverseType::BreadthFirst;
         } else if (params[1].get_str() == "depth") {
@@ -374,6 +726,10 @@ Value exportblockchain(const Array& params, bool fHelp)
         }
     }
 
+    bool fCompress = false;
+    if (params.size() >= 3)
+        fCompress = params[2].get_bool();
+
     boost::filesystem::path bdir(params[0].get_str());
     if (!boost::filesystem::exists(bdir))
         throw runtime_error("Directory " + bdir.string() + " does not exist.");
@@ -389,13 +745,14 @@ Value exportblockchain(const Array& params, bool fHelp)
         // with orphans
         boost::thread exporterThread(
             boost::bind(&ExportBootstrapBlockchainWithOrphans, filename.string(), boost::ref(stopped),
-                        boost::ref(progress), boost::ref(finished), graphTraverseType.value()));
+                        boost::ref(progress), boost::ref(finished), graphTraverseType.value(),
+                        fCompress));
         exporterThread.detach();
     } else {
         // without orphans
         boost::thread exporterThread(boost::bind(&ExportBootstrapBlockchain, filename.string(),
                                                  boost::ref(stopped), boost::ref(progress),
-                                                 boost::ref(finished)));
+                                                 boost::ref(finished), fCompress));
         exporterThread.detach();
     }
 
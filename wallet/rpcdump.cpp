@@ -7,6 +7,7 @@
 
 #include "base58.h"
 #include "bitcoinrpc.h"
+#include "blockprune.h"
 #include "init.h" // for pwalletMain
 #include "main.h"
 #include "ui_interface.h"
@@ -111,6 +112,14 @@ public:
     }
 };
 
+// the keys that are imported are looked for in the blocks, which may have been pruned
+static void EnsureBlocksNotPruned()
+{
+    if (nPruneHeight > 0)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Importing keys needs a rescan of the blocks, which isn't "
+                                             "possible once they're pruned (-prune)");
+}
+
 Value importprivkey(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -128,6 +137,7 @@ Value importprivkey(const Array& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key");
     if (fWalletUnlockStakingOnly)
         throw JSONRPCError(RPC_WALLET_UNLOCK_NEEDED, "Wallet is unlocked for staking only.");
+    EnsureBlocksNotPruned();
 
     CKey    key;
     bool    fCompressed;
@@ -151,11 +161,13 @@ Value importprivkey(const Array& params, bool fHelp)
 
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
-
-        pwalletMain->ScanForWalletTransactions(boost::atomic_load(&pindexGenesisBlock).get(), true);
-        pwalletMain->ReacceptWalletTransactions();
     }
 
+    // the rescan takes the locks for each block it applies, so the node goes on meanwhile
+    CBlockIndexSmartPtr pindexGenesis = boost::atomic_load(&pindexGenesisBlock);
+    pwalletMain->ScanForWalletTransactions(pindexGenesis.get(), true);
+    pwalletMain->ReacceptWalletTransactions();
+
     return Value::null;
 }
 
@@ -166,6 +178,7 @@ Value importwallet(const Array& params, bool fHelp)
                             "Imports keys from a wallet dump file (see dumpwallet).");
 
     EnsureWalletIsUnlocked();
+    EnsureBlocksNotPruned();
 
     ifstream file;
     file.open(params[0].get_str().c_str());
@@ -174,66 +187,72 @@ Value importwallet(const Array& params, bool fHelp)
 
     int64_t nTimeBegin = boost::atomic_load(&pindexBest)->nTime;
 
-    bool fGood = true;
+    bool                fGood = true;
+    CBlockIndexSmartPtr pindex;
 
-    while (file.good()) {
-        std::string line;
-        std::getline(file, line);
-        if (line.empty() || line[0] == '#')
-            continue;
-
-        std::vector<std::string> vstr;
-        boost::split(vstr, line, boost::is_any_of(" "));
-        if (vstr.size() < 2)
-            continue;
-        CBitcoinSecret vchSecret;
-        if (!vchSecret.SetString(vstr[0]))
-            continue;
-
-        bool    fCompressed;
-        CKey    key;
-        CSecret secret = vchSecret.GetSecret(fCompressed);
-        key.SetSecret(secret, fCompressed);
-        CKeyID keyid = key.GetPubKey().GetID();
-
-        if (pwalletMain->HaveKey(keyid)) {
-            printf("Skipping import of %s (key already present)\n",
-                   CBitcoinAddress(keyid).ToString().c_str());
-            continue;
-        }
-        int64_t     nTime = DecodeDumpTime(vstr[1]);
-        std::string strLabel;
-        bool        fLabel = true;
-        for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
-            if (boost::algorithm::starts_with(vstr[nStr], "#"))
-                break;
-            if (vstr[nStr] == "change=1")
-                fLabel = false;
-            if (vstr[nStr] == "reserve=1")
-                fLabel = false;
-            if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
-                strLabel = DecodeDumpString(vstr[nStr].substr(6));
-                fLabel   = true;
+    // the keys are added under the locks, which the rescan then takes for each block it applies, so
+    // the node goes on meanwhile
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        while (file.good()) {
+            std::string line;
+            std::getline(file, line);
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::vector<std::string> vstr;
+            boost::split(vstr, line, boost::is_any_of(" "));
+            if (vstr.size() < 2)
+                continue;
+            CBitcoinSecret vchSecret;
+            if (!vchSecret.SetString(vstr[0]))
+                continue;
+
+            bool    fCompressed;
+            CKey    key;
+            CSecret secret = vchSecret.GetSecret(fCompressed);
+            key.SetSecret(secret, fCompressed);
+            CKeyID keyid = key.GetPubKey().GetID();
+
+            if (pwalletMain->HaveKey(keyid)) {
+                printf("Skipping import of %s (key already present)\n",
+                       CBitcoinAddress(keyid).ToString().c_str());
+                continue;
             }
+            int64_t     nTime = DecodeDumpTime(vstr[1]);
+            std::string strLabel;
+            bool        fLabel = true;
+            for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
+                if (boost::algorithm::starts_with(vstr[nStr], "#"))
+                    break;
+                if (vstr[nStr] == "change=1")
+                    fLabel = false;
+                if (vstr[nStr] == "reserve=1")
+                    fLabel = false;
+                if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
+                    strLabel = DecodeDumpString(vstr[nStr].substr(6));
+                    fLabel   = true;
+                }
+            }
+            printf("Importing %s...\n", CBitcoinAddress(keyid).ToString().c_str());
+            if (!pwalletMain->AddKey(key)) {
+                fGood = false;
+                continue;
+            }
+            pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
+            if (fLabel)
+                pwalletMain->SetAddressBookName(keyid, strLabel);
+            nTimeBegin = std::min(nTimeBegin, nTime);
         }
-        printf("Importing %s...\n", CBitcoinAddress(keyid).ToString().c_str());
-        if (!pwalletMain->AddKey(key)) {
-            fGood = false;
-            continue;
-        }
-        pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
-        if (fLabel)
-            pwalletMain->SetAddressBookName(keyid, strLabel);
-        nTimeBegin = std::min(nTimeBegin, nTime);
-    }
-    file.close();
+        file.close();
 
-    CBlockIndexSmartPtr pindex = pindexBest;
-    while (pindex && pindex->pprev && pindex->nTime > nTimeBegin - 7200)
-        pindex = pindex->pprev;
+        pindex = boost::atomic_load(&pindexBest);
+        while (pindex && pindex->pprev && pindex->nTime > nTimeBegin - 7200)
+            pindex = pindex->pprev;
 
-    if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
-        pwalletMain->nTimeFirstKey = nTimeBegin;
+        if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
+            pwalletMain->nTimeFirstKey = nTimeBegin;
+    }
 
     printf("Rescanning last %i blocks\n",
            boost::atomic_load(&pindexBest)->nHeight - pindex->nHeight + 1);
@@ -427,6 +446,10 @@ std::pair<long, long> ImportBackupWallet(const std::string& Src, std::string& Pa
         throw std::logic_error(
             "Please unlock the wallet before importing; unlocking should NOT be for staking only.");
     }
+    if (nPruneHeight > 0) {
+        throw std::logic_error("Importing a wallet needs a rescan of the blocks, which isn't possible "
+                               "once they're pruned (-prune).");
+    }
 
     std::pair<long, long> succeessfullyAddedOutOfTotal = std::make_pair<long, long>(0, 0);
     CWallet               backupWallet(Src);
@@ -61,6 +61,11 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("inbound", stats.fInbound));
         obj.push_back(Pair("startingheight", stats.nStartingHeight));
         obj.push_back(Pair("banscore", stats.nMisbehavior));
+        obj.push_back(Pair("bytessent", stats.nSendBytes));
+        obj.push_back(Pair("msgssent", stats.nSendMsgs));
+        obj.push_back(Pair("sendcalls", stats.nSendCalls));
+        obj.push_back(Pair("compactblocks", stats.fCompactBlocks));
+        obj.push_back(Pair("syncedheaders", stats.nSyncedHeaders));
 
         ret.push_back(obj);
     }
@@ -7,6 +7,7 @@
 
 #include "base58.h"
 #include "bitcoinrpc.h"
+#include "blockprune.h"
 #include "boost/make_shared.hpp"
 #include "climits"
 #include "init.h"
@@ -197,7 +198,10 @@ Value getrawtransaction(const Array& params, bool fHelp)
     CTransaction tx;
     uint256      hashBlock = 0;
     if (!GetTransaction(hash, tx, hashBlock))
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+                           nPruneHeight > 0 ? "No information available about transaction; the block "
+                                              "it's in may have been pruned (-prune)"
+                                            : "No information available about transaction");
 
     CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
     ssTx << tx;
@@ -216,7 +220,7 @@ Value getrawtransaction(const Array& params, bool fHelp)
     return result;
 }
 
-Value listunspent(const Array& params, bool fHelp)
+void listunspent(const Array& params, bool fHelp, CRPCStreamWriter& writer)
 {
     if (fHelp || params.size() > 3)
         throw runtime_error("listunspent [minconf=1] [maxconf=9999999]  [\"address\",...]\n"
@@ -251,50 +255,73 @@ Value listunspent(const Array& params, bool fHelp)
         }
     }
 
-    Array           results;
-    vector<COutput> vecOutputs;
-    pwalletMain->AvailableCoins(vecOutputs, false);
-    for (const COutput& out : vecOutputs) {
-        if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
-            continue;
-
-        std::vector<std::pair<CTransaction, NTP1Transaction>> ntp1inputs =
-            NTP1Transaction::GetAllNTP1InputsOfTx(static_cast<CTransaction>(*out.tx), false);
-        NTP1Transaction ntp1tx;
-        ntp1tx.readNTP1DataFromTx(static_cast<CTransaction>(*out.tx), ntp1inputs);
-
-        if (setAddress.size()) {
-            CTxDestination address;
-            if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
-                continue;
+    // the outputs are taken under the locks, and their entries are assembled in batches and written once
+    // the locks are released
+    vector<pair<COutPoint, int>> vOutputs; // with their depths
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        vector<COutput> vecOutputs;
+        pwalletMain->AvailableCoins(vecOutputs, false);
+        for (const COutput& out : vecOutputs)
+            if (out.nDepth >= nMinDepth && out.nDepth <= nMaxDepth)
+                vOutputs.push_back(make_pair(COutPoint(out.tx->GetHash(), out.i), out.nDepth));
+    }
 
-            if (!setAddress.count(address))
-                continue;
-        }
+    writer.BeginArray();
+    for (unsigned int nStart = 0; nStart < vOutputs.size(); nStart += RPC_STREAM_BATCH_SIZE) {
+        Array entries;
+        {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            for (unsigned int n = nStart; n < vOutputs.size() && n < nStart + RPC_STREAM_BATCH_SIZE;
+                 n++) {
+                const COutPoint& outpoint = vOutputs[n].first;
+                // a transaction that was erased in the meantime is left out
+                map<uint256, CWalletTx>::const_iterator mi = pwalletMain->mapWallet.find(outpoint.hash);
+                if (mi == pwalletMain->mapWallet.end())
+                    continue;
+                const CWalletTx& wtx = (*mi).second;
+
+                if (setAddress.size()) {
+                    CTxDestination address;
+                    if (!ExtractDestination(wtx.vout[outpoint.n].scriptPubKey, address))
+                        continue;
+
+                    if (!setAddress.count(address))
+                        continue;
+                }
 
-        int64_t        nValue = out.tx->vout[out.i].nValue;
-        const CScript& pk     = out.tx->vout[out.i].scriptPubKey;
-        Object         entry;
-        entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
-        entry.push_back(Pair("vout", out.i));
-        CTxDestination address;
-        if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
-            entry.push_back(Pair("address", CBitcoinAddress(address).ToString()));
-            if (pwalletMain->mapAddressBook.count(address))
-                entry.push_back(Pair("account", pwalletMain->mapAddressBook[address]));
-        }
-        entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
-        entry.push_back(Pair("amount", ValueFromAmount(nValue)));
-        entry.push_back(Pair("confirmations", out.nDepth));
-        json_spirit::Array tokensRoot;
-        for (int i = 0; i < (int)ntp1tx.getTxOut(out.i).tokenCount(); i++) {
-            tokensRoot.push_back(ntp1tx.getTxOut(out.i).getToken(i).exportDatabaseJsonData());
+                std::vector<std::pair<CTransaction, NTP1Transaction>> ntp1inputs =
+                    NTP1Transaction::GetAllNTP1InputsOfTx(static_cast<CTransaction>(wtx), false);
+                NTP1Transaction ntp1tx;
+                ntp1tx.readNTP1DataFromTx(static_cast<CTransaction>(wtx), ntp1inputs);
+
+                int64_t        nValue = wtx.vout[outpoint.n].nValue;
+                const CScript& pk     = wtx.vout[outpoint.n].scriptPubKey;
+                Object         entry;
+                entry.push_back(Pair("txid", outpoint.hash.GetHex()));
+                entry.push_back(Pair("vout", (int)outpoint.n));
+                CTxDestination address;
+                if (ExtractDestination(pk, address)) {
+                    entry.push_back(Pair("address", CBitcoinAddress(address).ToString()));
+                    if (pwalletMain->mapAddressBook.count(address))
+                        entry.push_back(Pair("account", pwalletMain->mapAddressBook[address]));
+                }
+                entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
+                entry.push_back(Pair("amount", ValueFromAmount(nValue)));
+                entry.push_back(Pair("confirmations", vOutputs[n].second));
+                const NTP1TxOut&   ntp1txout = ntp1tx.getTxOut(outpoint.n);
+                json_spirit::Array tokensRoot;
+                for (int i = 0; i < (int)ntp1txout.tokenCount(); i++) {
+                    tokensRoot.push_back(ntp1txout.getToken(i).exportDatabaseJsonData());
+                }
+                entry.push_back(Pair("tokens", Value(tokensRoot)));
+                entries.push_back(entry);
+            }
         }
-        entry.push_back(Pair("tokens", Value(tokensRoot)));
-        results.push_back(entry);
+        for (const Value& entry : entries)
+            writer.WriteValue(entry);
     }
-
-    return results;
+    writer.EndArray();
 }
 
 Value createrawtransaction(const Array& params, bool fHelp)
@@ -688,6 +715,7 @@ Value signrawtransaction(const Array& params, bool fHelp)
     bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
 
     // Sign what we can:
+    CSignatureHashContext sigHashContext(mergedTx);
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
         if (mapPrevOut.count(txin.prevout) == 0) {
@@ -699,14 +727,14 @@ Value signrawtransaction(const Array& params, bool fHelp)
         txin.scriptSig.clear();
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
-            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
+            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType, &sigHashContext);
 
         // ... and merge in other signatures:
         for (const CTransaction& txv : txVariants) {
             txin.scriptSig =
                 CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
         }
-        if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, true, true, 0))
+        if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, true, true, 0, &sigHashContext))
             fComplete = false;
     }
 
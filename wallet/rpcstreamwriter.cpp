@@ -0,0 +1,186 @@
+#include "rpcstreamwriter.h"
+
+#include "json/json_spirit_writer_template.h"
+
+#include <stdexcept>
+
+using namespace json_spirit;
+
+void CRPCValueWriter::Put(const Value& val)
+{
+    if (stack.empty()) {
+        result = val;
+        return;
+    }
+    Value& top = stack.back();
+    if (top.type() == obj_type) {
+        if (!hasPendingKey)
+            throw std::logic_error("CRPCValueWriter: value written in an object without a key");
+        top.get_obj().push_back(Pair(pendingKey, val));
+        hasPendingKey = false;
+    } else {
+        top.get_array().push_back(val);
+    }
+}
+
+void CRPCValueWriter::BeginObject()
+{
+    keys.push_back(pendingKey);
+    hasPendingKey = false;
+    stack.push_back(Object());
+}
+
+void CRPCValueWriter::EndObject()
+{
+    if (stack.empty() || stack.back().type() != obj_type)
+        throw std::logic_error("CRPCValueWriter: EndObject() without a matching BeginObject()");
+    Value val = stack.back();
+    stack.pop_back();
+    pendingKey    = keys.back();
+    hasPendingKey = !stack.empty() && stack.back().type() == obj_type;
+    keys.pop_back();
+    Put(val);
+}
+
+void CRPCValueWriter::BeginArray()
+{
+    keys.push_back(pendingKey);
+    hasPendingKey = false;
+    stack.push_back(Array());
+}
+
+void CRPCValueWriter::EndArray()
+{
+    if (stack.empty() || stack.back().type() != array_type)
+        throw std::logic_error("CRPCValueWriter: EndArray() without a matching BeginArray()");
+    Value val = stack.back();
+    stack.pop_back();
+    pendingKey    = keys.back();
+    hasPendingKey = !stack.empty() && stack.back().type() == obj_type;
+    keys.pop_back();
+    Put(val);
+}
+
+void CRPCValueWriter::WriteKey(const std::string& key)
+{
+    if (stack.empty() || stack.back().type() != obj_type)
+        throw std::logic_error("CRPCValueWriter: key written outside of an object");
+    pendingKey    = key;
+    hasPendingKey = true;
+}
+
+void CRPCValueWriter::WriteValue(const Value& val) { Put(val); }
+
+CRPCTextWriter::CRPCTextWriter(SinkFunction Sink, std::size_t FlushThreshold)
+    : sink(Sink), flushThreshold(FlushThreshold)
+{
+    buffer.reserve(flushThreshold);
+}
+
+void CRPCTextWriter::BeginElement()
+{
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (scopes.empty())
+        return;
+    Scope& scope = scopes.back();
+    if (scope.isObject)
+        throw std::logic_error("CRPCTextWriter: value written in an object without a key");
+    if (!scope.isEmpty)
+        buffer.push_back(',');
+    scope.isEmpty = false;
+}
+
+void CRPCTextWriter::MaybeFlush()
+{
+    if (!outputHeld && buffer.size() >= flushThreshold)
+        Flush();
+}
+
+void CRPCTextWriter::HoldOutput(bool fHold)
+{
+    outputHeld = fHold;
+    MaybeFlush();
+}
+
+void CRPCTextWriter::BeginObject()
+{
+    BeginElement();
+    buffer.push_back('{');
+    scopes.push_back(Scope{true, true});
+}
+
+void CRPCTextWriter::EndObject()
+{
+    if (scopes.empty() || !scopes.back().isObject || afterKey)
+        throw std::logic_error("CRPCTextWriter: EndObject() without a matching BeginObject()");
+    scopes.pop_back();
+    buffer.push_back('}');
+    MaybeFlush();
+}
+
+void CRPCTextWriter::BeginArray()
+{
+    BeginElement();
+    buffer.push_back('[');
+    scopes.push_back(Scope{false, true});
+}
+
+void CRPCTextWriter::EndArray()
+{
+    if (scopes.empty() || scopes.back().isObject)
+        throw std::logic_error("CRPCTextWriter: EndArray() without a matching BeginArray()");
+    scopes.pop_back();
+    buffer.push_back(']');
+    MaybeFlush();
+}
+
+void CRPCTextWriter::WriteKey(const std::string& key)
+{
+    if (scopes.empty() || !scopes.back().isObject || afterKey)
+        throw std::logic_error("CRPCTextWriter: key written outside of an object");
+    Scope& scope = scopes.back();
+    if (!scope.isEmpty)
+        buffer.push_back(',');
+    scope.isEmpty = false;
+    buffer += write_string(Value(key), false);
+    buffer.push_back(':');
+    afterKey = true;
+}
+
+void CRPCTextWriter::WriteValue(const Value& val)
+{
+    BeginElement();
+    buffer += write_string(val, false);
+    MaybeFlush();
+}
+
+void CRPCTextWriter::WriteRaw(const std::string& text)
+{
+    buffer += text;
+    MaybeFlush();
+}
+
+void CRPCTextWriter::CloseScopes(std::size_t nDepth)
+{
+    if (afterKey) {
+        // a key without a value would make the output invalid
+        buffer += "null";
+        afterKey = false;
+    }
+    while (scopes.size() > nDepth) {
+        buffer.push_back(scopes.back().isObject ? '}' : ']');
+        scopes.pop_back();
+    }
+}
+
+void CRPCTextWriter::Flush()
+{
+    if (buffer.empty())
+        return;
+    sink(buffer);
+    bytesFlushed += buffer.size();
+    buffer.clear();
+}
@@ -0,0 +1,125 @@
+#ifndef RPCSTREAMWRITER_H
+#define RPCSTREAMWRITER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "json/json_spirit_value.h"
+
+/**
+ * Incremental JSON emitter for RPC calls whose results can get very large (listtransactions,
+ * listunspent, getblock with transaction details...). Instead of building the whole json_spirit
+ * tree and serializing it at the end, the call pushes values into the writer as it produces them.
+ *
+ * Usage: containers are opened and closed explicitly, and every value inside an object must be
+ * preceded by WriteKey() (or use WritePair()). Small sub-trees can be written in one go with
+ * WriteValue().
+ */
+class CRPCStreamWriter
+{
+public:
+    virtual ~CRPCStreamWriter() {}
+
+    virtual void BeginObject()                             = 0;
+    virtual void EndObject()                               = 0;
+    virtual void BeginArray()                              = 0;
+    virtual void EndArray()                                = 0;
+    virtual void WriteKey(const std::string& key)          = 0;
+    virtual void WriteValue(const json_spirit::Value& val) = 0;
+
+    void WritePair(const std::string& key, const json_spirit::Value& val)
+    {
+        WriteKey(key);
+        WriteValue(val);
+    }
+
+    /** While the output is held, a writer that writes somewhere only keeps what's pushed; it's held
+     * while locks are held that the destination mustn't be waited for with */
+    virtual void HoldOutput(bool /*fHold*/) {}
+};
+
+/**
+ * Writer that assembles the pushed values into a regular json_spirit::Value. This is used whenever
+ * the caller needs the result as a tree (GUI console, batch requests, tests).
+ */
+class CRPCValueWriter : public CRPCStreamWriter
+{
+    json_spirit::Value              result;
+    std::vector<json_spirit::Value> stack;
+    std::vector<std::string>        keys;
+    std::string                     pendingKey;
+    bool                            hasPendingKey = false;
+
+    void Put(const json_spirit::Value& val);
+
+public:
+    void BeginObject() override;
+    void EndObject() override;
+    void BeginArray() override;
+    void EndArray() override;
+    void WriteKey(const std::string& key) override;
+    void WriteValue(const json_spirit::Value& val) override;
+
+    const json_spirit::Value& GetValue() const { return result; }
+};
+
+/**
+ * Writer that serializes the pushed values to JSON text. Text is accumulated in an internal buffer
+ * that is handed to the sink function every time it grows beyond the flush threshold, so that
+ * memory use stays bounded no matter how large the result is.
+ */
+class CRPCTextWriter : public CRPCStreamWriter
+{
+public:
+    typedef std::function<void(const std::string&)> SinkFunction;
+
+    static const std::size_t DEFAULT_FLUSH_THRESHOLD = 1 << 16;
+
+private:
+    struct Scope
+    {
+        bool isObject;
+        bool isEmpty;
+    };
+
+    SinkFunction       sink;
+    std::size_t        flushThreshold;
+    std::string        buffer;
+    std::vector<Scope> scopes;
+    bool               afterKey     = false;
+    bool               outputHeld   = false;
+    uint64_t           bytesFlushed = 0;
+
+    void BeginElement();
+    void MaybeFlush();
+
+public:
+    CRPCTextWriter(SinkFunction Sink, std::size_t FlushThreshold = DEFAULT_FLUSH_THRESHOLD);
+
+    void BeginObject() override;
+    void EndObject() override;
+    void BeginArray() override;
+    void EndArray() override;
+    void WriteKey(const std::string& key) override;
+    void WriteValue(const json_spirit::Value& val) override;
+    void HoldOutput(bool fHold) override;
+
+    /** Appends raw, already serialized JSON text at the current position */
+    void WriteRaw(const std::string& text);
+
+    /**
+     * Closes the innermost open containers until only nDepth of them remain open (used to terminate
+     * the output cleanly on errors)
+     */
+    void CloseScopes(std::size_t nDepth = 0);
+
+    /** Hands whatever is buffered to the sink, even if the output is held */
+    void Flush();
+
+    /** Returns the number of bytes that were already handed to the sink */
+    uint64_t GetBytesFlushed() const { return bytesFlushed; }
+};
+
+#endif // RPCSTREAMWRITER_H
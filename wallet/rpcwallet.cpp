@@ -6,6 +6,7 @@
 #include "NetworkForks.h"
 #include "base58.h"
 #include "bitcoinrpc.h"
+#include "blockprune.h"
 #include "boost/make_shared.hpp"
 #include "globals.h"
 #include "init.h"
@@ -92,6 +93,9 @@ Value getinfo(const Array& params, bool fHelp)
     obj.push_back(Pair("newmint", ValueFromAmount(pwalletMain->GetNewMint())));
     obj.push_back(Pair("stake", ValueFromAmount(pwalletMain->GetStake())));
     obj.push_back(Pair("blocks", (int)nBestHeight));
+    obj.push_back(Pair("pruned", nPruneTarget > 0 || nPruneHeight > 0));
+    if (nPruneHeight > 0)
+        obj.push_back(Pair("pruneheight", nPruneHeight.load()));
     obj.push_back(Pair("timeoffset", (int64_t)GetTimeOffset()));
     obj.push_back(Pair("moneysupply", ValueFromAmount(boost::atomic_load(&pindexBest)->nMoneySupply)));
     obj.push_back(Pair("connections", (int)vNodes.size()));
@@ -813,33 +817,28 @@ Value movecmd(const Array& params, bool fHelp)
     if (params.size() > 4)
         strComment = params[4].get_str();
 
-    CWalletDB walletdb(pwalletMain->strWalletFile);
-    if (!walletdb.TxnBegin())
-        throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
-
     int64_t nNow = GetAdjustedTime();
 
     // Debit
     CAccountingEntry debit;
-    debit.nOrderPos       = pwalletMain->IncOrderPosNext(&walletdb);
     debit.strAccount      = strFrom;
     debit.nCreditDebit    = -nAmount;
     debit.nTime           = nNow;
     debit.strOtherAccount = strTo;
     debit.strComment      = strComment;
-    walletdb.WriteAccountingEntry(debit);
 
     // Credit
     CAccountingEntry credit;
-    credit.nOrderPos       = pwalletMain->IncOrderPosNext(&walletdb);
     credit.strAccount      = strTo;
     credit.nCreditDebit    = nAmount;
     credit.nTime           = nNow;
     credit.strOtherAccount = strFrom;
     credit.strComment      = strComment;
-    walletdb.WriteAccountingEntry(credit);
 
-    if (!walletdb.TxnCommit())
+    // both are written in one database transaction, and shown once it's committed
+    CWalletDB                     walletdb(pwalletMain->strWalletFile);
+    std::vector<CAccountingEntry> vEntries = {debit, credit};
+    if (!pwalletMain->AddAccountingEntries(vEntries, walletdb))
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
 
     return true;
@@ -1271,7 +1270,7 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Ar
     }
 }
 
-Value listtransactions(const Array& params, bool fHelp)
+void listtransactions(const Array& params, bool fHelp, CRPCStreamWriter& writer)
 {
     if (fHelp || params.size() > 3)
         throw runtime_error("listtransactions [account] [count=10] [from=0]\n"
@@ -1293,42 +1292,36 @@ Value listtransactions(const Array& params, bool fHelp)
     if (nFrom < 0)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
 
-    Array ret;
-
-    std::list<CAccountingEntry> acentries;
-    CWallet::TxItems            txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
-
-    // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it) {
-        CWalletTx* const pwtx = (*it).second.first;
-        if (pwtx != 0)
-            ListTransactions(*pwtx, strAccount, 0, true, ret);
-        CAccountingEntry* const pacentry = (*it).second.second;
-        if (pacentry != 0)
-            AcentryToJSON(*pacentry, strAccount, ret);
-
-        if ((int)ret.size() >= (nCount + nFrom))
-            break;
+    // the activity log is maintained by the wallet, for each account as well, so only the returned range
+    // is visited; its entries are assembled under the locks, newest first, and written once they're
+    // released
+    const int64_t      nWanted = (int64_t)nCount + nFrom;
+    std::vector<Value> vEntries;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        const CWallet::TxItems& txOrdered = strAccount == "*"
+                                                ? pwalletMain->wtxOrdered
+                                                : pwalletMain->GetAccountOrderedTxItems(strAccount);
+
+        int64_t nIndex = 0; // of the entry, counted from the newest one
+        for (CWallet::TxItems::const_reverse_iterator rit = txOrdered.rbegin();
+             rit != txOrdered.rend() && nIndex < nWanted; ++rit) {
+            Array entries;
+            if ((*rit).second.first != 0)
+                ListTransactions(*(*rit).second.first, strAccount, 0, true, entries);
+            if ((*rit).second.second != 0)
+                AcentryToJSON(*(*rit).second.second, strAccount, entries);
+            for (unsigned int i = 0; i < entries.size() && nIndex < nWanted; i++, nIndex++)
+                if (nIndex >= nFrom)
+                    vEntries.push_back(entries[i]);
+        }
     }
-    // ret is newest to oldest
-
-    if (nFrom > (int)ret.size())
-        nFrom = ret.size();
-    if ((nFrom + nCount) > (int)ret.size())
-        nCount = ret.size() - nFrom;
-    Array::iterator first = ret.begin();
-    std::advance(first, nFrom);
-    Array::iterator last = ret.begin();
-    std::advance(last, nFrom + nCount);
-
-    if (last != ret.end())
-        ret.erase(last, ret.end());
-    if (first != ret.begin())
-        ret.erase(ret.begin(), first);
-
-    std::reverse(ret.begin(), ret.end()); // Return oldest to newest
 
-    return ret;
+    // returned from oldest to newest
+    writer.BeginArray();
+    for (std::vector<Value>::const_reverse_iterator it = vEntries.rbegin(); it != vEntries.rend(); ++it)
+        writer.WriteValue(*it);
+    writer.EndArray();
 }
 
 Value listaccounts(const Array& params, bool fHelp)
@@ -1385,22 +1378,18 @@ Value listaccounts(const Array& params, bool fHelp)
     return ret;
 }
 
-Value listsinceblock(const Array& params, bool fHelp)
+void listsinceblock(const Array& params, bool fHelp, CRPCStreamWriter& writer)
 {
     if (fHelp)
         throw runtime_error(
             "listsinceblock [blockhash] [target-confirmations]\n"
             "Get all transactions in blocks since block [blockhash], or all transactions if omitted");
 
-    CBlockIndex* pindex          = nullptr;
-    int          target_confirms = 1;
-
-    if (params.size() > 0) {
-        uint256 blockId = 0;
+    uint256 blockId         = 0;
+    int     target_confirms = 1;
 
+    if (params.size() > 0)
         blockId.SetHex(params[0].get_str());
-        pindex = CBlockLocator(blockId).GetBlockIndex().get();
-    }
 
     if (params.size() > 1) {
         target_confirms = params[1].get_int();
@@ -1409,38 +1398,59 @@ Value listsinceblock(const Array& params, bool fHelp)
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter");
     }
 
-    int depth = pindex ? (1 + nBestHeight - pindex->nHeight) : -1;
+    // the transactions are listed in batches, and only written once the locks are released
+    int             depth = -1;
+    vector<uint256> vTxids;
+    uint256         lastblock;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        if (params.size() > 0) {
+            CBlockIndexSmartPtr pindex = CBlockLocator(blockId).GetBlockIndex();
+            depth                      = pindex ? (1 + nBestHeight - pindex->nHeight) : -1;
+        }
+        vTxids.reserve(pwalletMain->mapWallet.size());
+        for (map<uint256, CWalletTx>::const_iterator it = pwalletMain->mapWallet.begin();
+             it != pwalletMain->mapWallet.end(); it++)
+            vTxids.push_back((*it).first);
 
-    Array transactions;
+        if (target_confirms == 1) {
+            lastblock = hashBestChain;
+        } else {
+            int target_height = boost::atomic_load(&pindexBest)->nHeight + 1 - target_confirms;
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin();
-         it != pwalletMain->mapWallet.end(); it++) {
-        CWalletTx tx = (*it).second;
+            CBlockIndex* block;
+            for (block = pindexBest.get(); block && block->nHeight > target_height;
+                 block = boost::atomic_load(&block->pprev).get()) {
+            }
 
-        if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions);
+            lastblock = block ? block->GetBlockHash() : 0;
+        }
     }
 
-    uint256 lastblock;
-
-    if (target_confirms == 1) {
-        lastblock = hashBestChain;
-    } else {
-        int target_height = boost::atomic_load(&pindexBest)->nHeight + 1 - target_confirms;
-
-        CBlockIndex* block;
-        for (block = pindexBest.get(); block && block->nHeight > target_height;
-             block = boost::atomic_load(&block->pprev).get()) {
+    writer.BeginObject();
+    writer.WriteKey("transactions");
+    writer.BeginArray();
+    for (unsigned int nStart = 0; nStart < vTxids.size(); nStart += RPC_STREAM_BATCH_SIZE) {
+        Array transactions;
+        {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            for (unsigned int i = nStart; i < vTxids.size() && i < nStart + RPC_STREAM_BATCH_SIZE; i++) {
+                // a transaction that was erased in the meantime is left out
+                map<uint256, CWalletTx>::const_iterator it = pwalletMain->mapWallet.find(vTxids[i]);
+                if (it == pwalletMain->mapWallet.end())
+                    continue;
+                const CWalletTx& tx = (*it).second;
+                if (depth == -1 || tx.GetDepthInMainChain() < depth)
+                    ListTransactions(tx, "*", 0, true, transactions);
+            }
         }
-
-        lastblock = block ? block->GetBlockHash() : 0;
+        for (const Value& entry : transactions)
+            writer.WriteValue(entry);
     }
+    writer.EndArray();
 
-    Object ret;
-    ret.push_back(Pair("transactions", transactions));
-    ret.push_back(Pair("lastblock", lastblock.GetHex()));
-
-    return ret;
+    writer.WritePair("lastblock", lastblock.GetHex());
+    writer.EndObject();
 }
 
 Value gettransaction(const Array& params, bool fHelp)
@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <boost/foreach.hpp>
+#include <boost/thread/tss.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <boost/tuple/tuple_comparison.hpp>
 
@@ -18,7 +19,8 @@ using namespace boost;
 #include "sync.h"
 #include "util.h"
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+              CSignatureHashContext* pSigHashContext = nullptr);
 
 static const valtype vchFalse(0);
 static const valtype vchZero(0);
@@ -401,7 +403,8 @@ bool CheckSequence(const int64_t& nSequence, const CTransaction &txTo, unsigned
     return true;
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, bool fStrictEncodings, int nHashType)
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, bool fStrictEncodings, int nHashType,
+                CSignatureHashContext* pSigHashContext)
 {
     CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
@@ -1150,7 +1153,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                     bool fSuccess = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
                     if (fSuccess)
-                        fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType);
+                        fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, pSigHashContext);
 
                     popstack(stack);
                     popstack(stack);
@@ -1212,7 +1215,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         // Check signature
                         bool fOk = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
                         if (fOk)
-                            fOk = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType);
+                            fOk = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, pSigHashContext);
 
                         if (fOk) {
                             isig++;
@@ -1277,57 +1280,118 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
         printf("ERROR: SignatureHash() : nIn=%d out of range\n", nIn);
         return 1;
     }
-    CTransaction txTmp(txTo);
+    const bool fHashNone         = (nHashType & 0x1f) == SIGHASH_NONE;
+    const bool fHashSingle       = (nHashType & 0x1f) == SIGHASH_SINGLE;
+    const bool fHashAnyoneCanPay = (nHashType & SIGHASH_ANYONECANPAY) != 0;
+
+    // Only lock-in the txout payee at same index as txin
+    if (fHashSingle && nIn >= txTo.vout.size())
+    {
+        printf("ERROR: SignatureHash() : nOut=%d out of range\n", nIn);
+        return 1;
+    }
 
     // In case concatenating two scripts ends up with two codeseparators,
     // or an extra one at the end, this prevents all those possible incompatibilities.
     scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
 
-    // Blank out other inputs' signatures
-    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-        txTmp.vin[i].scriptSig = CScript();
-    txTmp.vin[nIn].scriptSig = scriptCode;
+    // The transaction is serialized the way it would be after blanking out the parts that the hash
+    // type doesn't sign, but without making a copy of it.
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion << txTo.nTime;
 
-    // Blank out some of the outputs
-    if ((nHashType & 0x1f) == SIGHASH_NONE)
+    // Blank out other inputs completely with SIGHASH_ANYONECANPAY, not recommended for open
+    // transactions. Otherwise, blank out other inputs' signatures.
+    WriteCompactSize(ss, fHashAnyoneCanPay ? 1 : txTo.vin.size());
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
     {
-        // Wildcard payee
-        txTmp.vout.clear();
+        if (fHashAnyoneCanPay && i != nIn)
+            continue;
+        const CTxIn& txin = txTo.vin[i];
+        ss << txin.prevout;
+        if (i == nIn)
+            ss << scriptCode;
+        else
+            ss << CScript();
+        // With SIGHASH_NONE and SIGHASH_SINGLE, let the others update at will
+        ss << ((fHashNone || fHashSingle) && i != nIn ? 0u : txin.nSequence);
+    }
 
-        // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
+    if (fHashNone)
+    {
+        // Wildcard payee
+        WriteCompactSize(ss, 0);
     }
-    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+    else if (fHashSingle)
     {
-        // Only lock-in the txout payee at same index as txin
-        unsigned int nOut = nIn;
-        if (nOut >= txTmp.vout.size())
-        {
-            printf("ERROR: SignatureHash() : nOut=%d out of range\n", nOut);
-            return 1;
-        }
-        txTmp.vout.resize(nOut+1);
-        for (unsigned int i = 0; i < nOut; i++)
-            txTmp.vout[i].SetNull();
-
-        // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
+        WriteCompactSize(ss, nIn + 1);
+        const CTxOut txoutNull;
+        for (unsigned int i = 0; i < nIn; i++)
+            ss << txoutNull;
+        ss << txTo.vout[nIn];
+    }
+    else
+    {
+        ss << txTo.vout;
     }
 
-    // Blank out other inputs completely, not recommended for open transactions
-    if (nHashType & SIGHASH_ANYONECANPAY)
+    ss << txTo.nLockTime << nHashType;
+    return ss.GetHash();
+}
+
+// size of an input serialized with an empty scriptSig: prevout, script length and nSequence
+static const size_t BLANK_TXIN_SIZE = 36 + 1 + 4;
+
+CSignatureHashContext::CSignatureHashContext(const CTransaction& txToIn)
+    : txTo(txToIn), nInputs(txToIn.vin.size()), hwHeader(SER_GETHASH, 0), hwPrefix(SER_GETHASH, 0),
+      nPrefixInputs(0)
+{
+    hwHeader << txTo.nVersion << txTo.nTime;
+    WriteCompactSize(hwHeader, nInputs);
+    hwPrefix = hwHeader;
+
+    CDataStream ssInputs(SER_GETHASH, 0);
+    for (const CTxIn& txin : txTo.vin)
+        ssInputs << txin.prevout << CScript() << txin.nSequence;
+    vchInputs.assign(ssInputs.begin(), ssInputs.end());
+    assert(vchInputs.size() == nInputs * BLANK_TXIN_SIZE);
+
+    CDataStream ssOutputs(SER_GETHASH, 0);
+    ssOutputs << txTo.vout << txTo.nLockTime;
+    vchOutputs.assign(ssOutputs.begin(), ssOutputs.end());
+}
+
+uint256 CSignatureHashContext::GetHash(CScript scriptCode, unsigned int nIn, int nHashType)
+{
+    // the other hash types sign only a part of the transaction, which is cheap to serialize anyway
+    if ((nHashType & 0x1f) == SIGHASH_NONE || (nHashType & 0x1f) == SIGHASH_SINGLE ||
+        (nHashType & SIGHASH_ANYONECANPAY) || nIn >= nInputs)
+        return SignatureHash(scriptCode, txTo, nIn, nHashType);
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    // inputs are usually checked in order, so the hash state of the inputs before this one can be
+    // extended from the one of the previous call
+    if (nIn < nPrefixInputs)
     {
-        txTmp.vin[0] = txTmp.vin[nIn];
-        txTmp.vin.resize(1);
+        hwPrefix      = hwHeader;
+        nPrefixInputs = 0;
+    }
+    if (nIn > nPrefixInputs)
+    {
+        hwPrefix.write(vchInputs.data() + nPrefixInputs * BLANK_TXIN_SIZE,
+                       (nIn - nPrefixInputs) * BLANK_TXIN_SIZE);
+        nPrefixInputs = nIn;
     }
 
-    // Serialize and hash
-    CHashWriter ss(SER_GETHASH, 0);
-    ss << txTmp << nHashType;
+    CHashWriter ss(hwPrefix);
+    const char* pInput = vchInputs.data() + nIn * BLANK_TXIN_SIZE;
+    ss.write(pInput, 36);
+    ss << scriptCode;
+    ss.write(pInput + 37, 4);
+    ss.write(pInput + BLANK_TXIN_SIZE, (nInputs - nIn - 1) * BLANK_TXIN_SIZE);
+    ss.write(vchOutputs.data(), vchOutputs.size());
+    ss << nHashType;
     return ss.GetHash();
 }
 
@@ -1388,8 +1452,13 @@ public:
     }
 };
 
+// the key that CheckSig() verifies with on each thread, so that a new one isn't made for each
+// signature, and the inputs of one public key that are checked one after the other share it
+static boost::thread_specific_ptr<CSignatureVerifier> threadSigVerifier;
+
 bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType)
+              const CTransaction& txTo, unsigned int nIn, int nHashType,
+              CSignatureHashContext* pSigHashContext)
 {
     static CSignatureCache signatureCache;
 
@@ -1402,16 +1471,18 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
         return false;
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash = pSigHashContext ? pSigHashContext->GetHash(scriptCode, nIn, nHashType)
+                                      : SignatureHash(scriptCode, txTo, nIn, nHashType);
 
     if (signatureCache.Get(sighash, vchSig, vchPubKey))
         return true;
 
-    CKey key;
-    if (!key.SetPubKey(vchPubKey))
-        return false;
-
-    if (!key.Verify(sighash, vchSig))
+    CSignatureVerifier* pverifier = threadSigVerifier.get();
+    if (!pverifier) {
+        pverifier = new CSignatureVerifier;
+        threadSigVerifier.reset(pverifier);
+    }
+    if (!pverifier->Verify(CPubKey(vchPubKey), sighash, vchSig))
         return false;
 
     signatureCache.Set(sighash, vchSig, vchPubKey);
@@ -1832,14 +1903,15 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
 }
 
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  bool fValidatePayToScriptHash, bool fStrictEncodings, int nHashType)
+                  bool fValidatePayToScriptHash, bool fStrictEncodings, int nHashType,
+                  CSignatureHashContext* pSigHashContext)
 {
     vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, fStrictEncodings, nHashType))
+    if (!EvalScript(stack, scriptSig, txTo, nIn, fStrictEncodings, nHashType, pSigHashContext))
         return false;
     if (fValidatePayToScriptHash)
         stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, fStrictEncodings, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, fStrictEncodings, nHashType, pSigHashContext))
         return false;
     if (stack.empty())
         return false;
@@ -1860,7 +1932,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, fStrictEncodings, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, fStrictEncodings, nHashType, pSigHashContext))
             return false;
         if (stackCopy.empty())
             return false;
@@ -1871,14 +1943,16 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
 }
 
 
-bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType,
+                   CSignatureHashContext* pSigHashContext)
 {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
 
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
-    uint256 hash = SignatureHash(fromPubKey, txTo, nIn, nHashType);
+    uint256 hash = pSigHashContext ? pSigHashContext->GetHash(fromPubKey, nIn, nHashType)
+                                   : SignatureHash(fromPubKey, txTo, nIn, nHashType);
 
     txnouttype whichType;
     if (!Solver(keystore, fromPubKey, hash, nHashType, txin.scriptSig, whichType))
@@ -1892,7 +1966,8 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
         CScript subscript = txin.scriptSig;
 
         // Recompute txn hash using subscript in place of scriptPubKey:
-        uint256 hash2 = SignatureHash(subscript, txTo, nIn, nHashType);
+        uint256 hash2 = pSigHashContext ? pSigHashContext->GetHash(subscript, nIn, nHashType)
+                                        : SignatureHash(subscript, txTo, nIn, nHashType);
 
         txnouttype subType;
         bool fSolved =
@@ -1903,10 +1978,11 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
     }
 
     // Test solution
-    return VerifyScript(txin.scriptSig, fromPubKey, txTo, nIn, true, true, 0);
+    return VerifyScript(txin.scriptSig, fromPubKey, txTo, nIn, true, true, 0, pSigHashContext);
 }
 
-bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType)
+bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType,
+                   CSignatureHashContext* pSigHashContext)
 {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
@@ -1914,10 +1990,11 @@ bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTrans
     assert(txin.prevout.hash == txFrom.GetHash());
     const CTxOut& txout = txFrom.vout[txin.prevout.n];
 
-    return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType);
+    return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType, pSigHashContext);
 }
 
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, bool fStrictEncodings, int nHashType)
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, bool fStrictEncodings, int nHashType,
+                     CSignatureHashContext* pSigHashContext)
 {
     assert(nIn < txTo.vin.size());
     const CTxIn& txin = txTo.vin[nIn];
@@ -1928,7 +2005,8 @@ bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsig
     if (txin.prevout.hash != txFrom.GetHash())
         return false;
 
-    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, fValidatePayToScriptHash, fStrictEncodings, nHashType);
+    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, fValidatePayToScriptHash, fStrictEncodings, nHashType,
+                        pSigHashContext);
 }
 
 static CScript PushAll(const vector<valtype>& values)
@@ -16,6 +16,7 @@
 
 #include "keystore.h"
 #include "bignum.h"
+#include "hash.h"
 
 typedef std::vector<unsigned char> valtype;
 
@@ -679,7 +680,36 @@ bool IsCanonicalPubKey(const std::vector<unsigned char> &vchPubKey);
 bool IsCanonicalSignature(const std::vector<unsigned char> &vchSig);
 
 CScript GetScriptForDestination(const CTxDestination& dest);
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, bool fStrictEncodings, int nHashType);
+/**
+ * Computes the signature hashes of the inputs of one transaction, with the same result as
+ * SignatureHash(). What every input has in common (the other inputs with their scriptSig blanked
+ * out, the outputs) is serialized once, and the hash state of the inputs before the one being
+ * checked is carried from one input to the next, instead of copying and serializing the whole
+ * transaction for every input.
+ *
+ * Only the scriptSigs of the transaction may change while the object is in use (like they do while
+ * the transaction is being signed), since they aren't part of any signature hash. The object isn't
+ * thread-safe.
+ */
+class CSignatureHashContext
+{
+    const CTransaction& txTo;
+    unsigned int        nInputs;
+    CHashWriter         hwHeader;      // version, time and number of inputs
+    CHashWriter         hwPrefix;      // hwHeader followed by the first nPrefixInputs inputs
+    unsigned int        nPrefixInputs;
+    std::vector<char>   vchInputs;     // all the inputs, serialized with an empty scriptSig
+    std::vector<char>   vchOutputs;    // all the outputs and the lock time
+
+public:
+    explicit CSignatureHashContext(const CTransaction& txToIn);
+
+    uint256 GetHash(CScript scriptCode, unsigned int nIn, int nHashType);
+};
+
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, bool fStrictEncodings, int nHashType,
+                CSignatureHashContext* pSigHashContext = nullptr);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType);
@@ -688,11 +718,15 @@ bool IsMine(const CKeyStore& keystore, const CTxDestination &dest);
 void ExtractAffectedKeys(const CKeyStore &keystore, const CScript& scriptPubKey, std::vector<CKeyID> &vKeys);
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet);
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
-bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
+bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL,
+                   CSignatureHashContext* pSigHashContext = nullptr);
+bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL,
+                   CSignatureHashContext* pSigHashContext = nullptr);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  bool fValidatePayToScriptHash, bool fStrictEncodings, int nHashType);
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, bool fStrictEncodings, int nHashType);
+                  bool fValidatePayToScriptHash, bool fStrictEncodings, int nHashType,
+                  CSignatureHashContext* pSigHashContext = nullptr);
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, bool fStrictEncodings, int nHashType,
+                     CSignatureHashContext* pSigHashContext = nullptr);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
@@ -139,4 +139,48 @@ TEST(accounting_tests, acc_orderupgrade)
     EXPECT_TRUE(results[4].strComment.empty());
     EXPECT_TRUE(results[5].nTime == 1333333334);
     EXPECT_TRUE(6 == vpwtx[1]->nOrderPos);
+
+    // the activity log kept in memory must follow the reordering
+    EXPECT_EQ(wallet->wtxOrdered.size(), wallet->mapWallet.size() + wallet->laccentries.size());
+    for (const CWallet::TxItems::value_type& item : wallet->wtxOrdered) {
+        const CWalletTx*        pwtx     = item.second.first;
+        const CAccountingEntry* pacentry = item.second.second;
+        EXPECT_EQ(item.first, pwtx ? pwtx->nOrderPos : pacentry->nOrderPos);
+    }
+
+    {
+        LOCK(wallet->cs_wallet);
+        ae.nTime           = 1333333340;
+        ae.strOtherAccount = "f";
+        CAccountingEntry aeOther = ae;
+        aeOther.strAccount       = "g";
+        aeOther.strOtherAccount  = "";
+        std::vector<CAccountingEntry> vEntries = {ae, aeOther};
+        ASSERT_TRUE(wallet->AddAccountingEntries(vEntries, walletdb));
+        EXPECT_EQ(vEntries[1].nOrderPos, vEntries[0].nOrderPos + 1);
+        EXPECT_EQ(wallet->nOrderPosNext, vEntries[1].nOrderPos + 1);
+
+        const CWallet::TxPair& last = wallet->wtxOrdered.rbegin()->second;
+        ASSERT_TRUE(last.second != nullptr);
+        EXPECT_EQ(last.second->nTime, 1333333340);
+        EXPECT_EQ(last.second->strAccount, "g");
+
+        // the log of an account has its own entries, and the transactions that can have some
+        const CWallet::TxItems& itemsG = wallet->GetAccountOrderedTxItems("g");
+        ASSERT_EQ(itemsG.size(), 1u);
+        EXPECT_EQ(itemsG.begin()->second.second, last.second);
+        EXPECT_TRUE(wallet->GetAccountOrderedTxItems("h").empty());
+        EXPECT_EQ(wallet->GetAccountOrderedTxItems("").size(), wallet->wtxOrdered.size() - 1);
+
+        // a transaction goes to the log of the account that its address is moved to
+        const CKeyID keyID(uint160(5));
+        wtx.vout.resize(1);
+        wtx.vout[0].scriptPubKey.SetDestination(keyID);
+        wallet->AddToWallet(wtx);
+        EXPECT_TRUE(wallet->GetAccountOrderedTxItems("k").empty());
+        wallet->SetAddressBookName(keyID, "k");
+        const CWallet::TxItems& itemsK = wallet->GetAccountOrderedTxItems("k");
+        ASSERT_EQ(itemsK.size(), 1u);
+        EXPECT_EQ(itemsK.begin()->second.first, &wallet->mapWallet[wtx.GetHash()]);
+    }
 }
@@ -0,0 +1,87 @@
+#include "googletest/googletest/include/gtest/gtest.h"
+
+#include "addrindex.h"
+#include "key.h"
+#include "main.h"
+
+namespace {
+std::string SerializeKey(const CAddrIndexKey& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return ss.str();
+}
+} // namespace
+
+TEST(addrindex_tests, key_order)
+{
+    const uint160 scriptHash(1);
+    const uint256 txidLow(1);
+    const uint256 txidHigh(~uint256(0));
+
+    // the entries of an address sort by their height, then by their transaction
+    const std::string str255 = SerializeKey(CAddrIndexKey(scriptHash, 255, txidHigh, 0, false));
+    const std::string str256 = SerializeKey(CAddrIndexKey(scriptHash, 256, txidLow, 0, false));
+    EXPECT_LT(str255, str256);
+    EXPECT_LT(SerializeKey(CAddrIndexKey(scriptHash, 256, txidLow, 1, false)),
+              SerializeKey(CAddrIndexKey(scriptHash, 256, txidLow, 256, false)));
+    EXPECT_LT(SerializeKey(CAddrIndexKey(scriptHash, 256, txidLow, 1, false)),
+              SerializeKey(CAddrIndexKey(scriptHash, 256, txidLow, 1, true)));
+    EXPECT_LT(SerializeKey(CAddrIndexKey(scriptHash, 100000, txidLow, 0, false)),
+              SerializeKey(CAddrIndexKey(scriptHash, 65536 * 256, txidLow, 0, false)));
+
+    // and they begin with the hash of the address
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << scriptHash;
+    EXPECT_EQ(str256.substr(0, ssPrefix.size()), ssPrefix.str());
+
+    CDataStream   ss(str256.data(), str256.data() + str256.size(), SER_DISK, CLIENT_VERSION);
+    CAddrIndexKey key;
+    ss >> key;
+    EXPECT_EQ(key.scriptHash, scriptHash);
+    EXPECT_EQ(key.nHeight, 256u);
+    EXPECT_EQ(key.txid, txidLow);
+    EXPECT_EQ(key.n, 0u);
+    EXPECT_FALSE(key.fSpend);
+}
+
+TEST(addrindex_tests, delta_tokens)
+{
+    CAddrIndexDelta delta;
+    delta.nValue      = -5 * COIN;
+    delta.nPrevHeight = 1234;
+    delta.vTokens.push_back(CAddrIndexToken("La1234", NTP1Int("123456789012345678901234567890")));
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << delta;
+    CAddrIndexDelta deltaRead;
+    ss >> deltaRead;
+    EXPECT_EQ(deltaRead.nValue, delta.nValue);
+    EXPECT_EQ(deltaRead.nPrevHeight, delta.nPrevHeight);
+    ASSERT_EQ(deltaRead.vTokens.size(), 1u);
+    EXPECT_EQ(deltaRead.vTokens[0].tokenId, "La1234");
+    EXPECT_EQ(deltaRead.vTokens[0].nAmount, delta.vTokens[0].nAmount);
+}
+
+TEST(addrindex_tests, script_hash)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    CScript scriptPubKeyHash;
+    scriptPubKeyHash.SetDestination(key.GetPubKey().GetID());
+    CScript scriptPubKey;
+    scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
+
+    // a pay-to-pubkey output is under the address of its key
+    uint160 hashOfKeyHash, hashOfKey;
+    ASSERT_TRUE(GetAddrIndexScriptHash(scriptPubKeyHash, hashOfKeyHash));
+    ASSERT_TRUE(GetAddrIndexScriptHash(scriptPubKey, hashOfKey));
+    EXPECT_EQ(hashOfKeyHash, hashOfKey);
+    EXPECT_EQ(hashOfKeyHash, GetAddrIndexScriptHash(key.GetPubKey().GetID()));
+
+    CScript scriptOpReturn;
+    scriptOpReturn << OP_RETURN;
+    uint160 hashOfNothing;
+    EXPECT_FALSE(GetAddrIndexScriptHash(scriptOpReturn, hashOfNothing));
+}
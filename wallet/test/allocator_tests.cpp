@@ -109,3 +109,56 @@ TEST(allocator_tests, test_LockedPageManagerBase)
     EXPECT_TRUE(lpm.GetLockedPageCount() == 0);
     EXPECT_TRUE((last_unlock_len & (test_page_size-1)) == 0); // always unlock entire pages
 }
+
+TEST(allocator_tests, test_BufferPool)
+{
+    BufferPool& pool = BufferPool::Instance();
+
+    // small buffers aren't pooled
+    size_t nIdle = pool.GetIdleSize();
+    void*  p     = pool.Allocate(100);
+    pool.Free(p, 100);
+    EXPECT_EQ(pool.GetIdleSize(), nIdle);
+
+    // a freed buffer is handed out again for any size of the same class
+    const size_t nSize = BufferPool::MIN_POOLED_SIZE * 3;
+    p                  = pool.Allocate(nSize);
+    memset(p, 0x5a, nSize);
+    nIdle = pool.GetIdleSize();
+    pool.Free(p, nSize);
+    EXPECT_EQ(pool.GetIdleSize(), nIdle + BufferPool::MIN_POOLED_SIZE * 4);
+    void* p2 = pool.Allocate(BufferPool::MIN_POOLED_SIZE * 4);
+    EXPECT_EQ(p2, p);
+    EXPECT_EQ(pool.GetIdleSize(), nIdle);
+    pool.Free(p2, BufferPool::MIN_POOLED_SIZE * 4);
+
+    // the pool doesn't keep more than its limit
+    std::vector<void*> vBuffers;
+    for (size_t n = 0; n <= BufferPool::MAX_IDLE_SIZE / BufferPool::MIN_POOLED_SIZE; n++)
+        vBuffers.push_back(pool.Allocate(BufferPool::MIN_POOLED_SIZE));
+    for (void* pBuffer : vBuffers)
+        pool.Free(pBuffer, BufferPool::MIN_POOLED_SIZE);
+    EXPECT_TRUE(pool.GetIdleSize() <= BufferPool::MAX_IDLE_SIZE);
+}
+
+TEST(allocator_tests, test_data_streams)
+{
+    // public and secure streams serialize the same way
+    CDataStream       ss(SER_NETWORK, PROTOCOL_VERSION);
+    CSecureDataStream ssSecure(SER_NETWORK, PROTOCOL_VERSION);
+    const std::vector<unsigned char> vch(BufferPool::MIN_POOLED_SIZE * 2, 0x42);
+    ss << vch << std::string("neblio");
+    ssSecure << vch << std::string("neblio");
+    EXPECT_EQ(ss.str(), ssSecure.str());
+
+    CSerializeData data;
+    ss.GetAndClear(data);
+    EXPECT_TRUE(ss.empty());
+    EXPECT_EQ(std::string(data.begin(), data.end()), ssSecure.str());
+
+    std::vector<unsigned char> vchRead;
+    std::string                str;
+    ssSecure >> vchRead >> str;
+    EXPECT_TRUE(vchRead == vch);
+    EXPECT_EQ(str, "neblio");
+}
@@ -0,0 +1,152 @@
+#include "googletest/googletest/include/gtest/gtest.h"
+
+#include <vector>
+
+#include "blockencodings.h"
+#include "txmempool.h"
+
+static CTransaction MakeTx(unsigned int n)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(uint256(n + 1), n);
+    tx.vout.resize(1);
+    tx.vout[0].nValue       = 1000 * (n + 1);
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return tx;
+}
+
+// a proof-of-stake block: the coinbase, the coinstake and nTx other transactions
+static CBlock MakeStakeBlock(unsigned int nTx)
+{
+    CBlock block;
+    block.nBits = 0x1d00ffff;
+    block.nTime = 1500000000;
+
+    CTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.resize(1);
+    coinbase.vout[0].SetEmpty();
+    block.vtx.push_back(coinbase);
+
+    CTransaction coinstake = MakeTx(1000);
+    coinstake.vout.resize(2);
+    coinstake.vout[0].SetEmpty();
+    coinstake.vout[1].nValue       = 5000;
+    coinstake.vout[1].scriptPubKey = CScript() << OP_TRUE;
+    block.vtx.push_back(coinstake);
+
+    for (unsigned int i = 0; i < nTx; i++)
+        block.vtx.push_back(MakeTx(i));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    block.vchBlockSig    = std::vector<unsigned char>(70, 0x30);
+    return block;
+}
+
+TEST(blockencodings_tests, serialization)
+{
+    const CBlock block = MakeStakeBlock(5);
+    EXPECT_TRUE(block.IsProofOfStake());
+
+    const CBlockHeaderAndShortTxIDs cmpctblock(block, 0x1234567890abcdefULL);
+    ASSERT_EQ(cmpctblock.vPrefilledTxs.size(), 2u);
+    EXPECT_EQ(cmpctblock.vPrefilledTxs[0].nIndex, 0u);
+    EXPECT_EQ(cmpctblock.vPrefilledTxs[1].nIndex, 1u);
+    ASSERT_EQ(cmpctblock.vShortTxIDs.size(), 5u);
+    EXPECT_EQ(cmpctblock.BlockTxCount(), block.vtx.size());
+    for (unsigned int i = 0; i < 5; i++) {
+        EXPECT_EQ(cmpctblock.vShortTxIDs[i], cmpctblock.GetShortID(block.vtx[i + 2].GetHash()));
+        EXPECT_EQ(cmpctblock.vShortTxIDs[i] >> 48, 0u);
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << cmpctblock;
+    EXPECT_EQ(ss.size(), ::GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION));
+
+    CBlockHeaderAndShortTxIDs cmpctblock2;
+    ss >> cmpctblock2;
+    EXPECT_EQ(cmpctblock2.header.GetHash(), block.GetHash());
+    EXPECT_EQ(cmpctblock2.header.vchBlockSig, block.vchBlockSig);
+    EXPECT_EQ(cmpctblock2.nNonce, cmpctblock.nNonce);
+    EXPECT_EQ(cmpctblock2.vShortTxIDs, cmpctblock.vShortTxIDs);
+    ASSERT_EQ(cmpctblock2.vPrefilledTxs.size(), 2u);
+    EXPECT_EQ(cmpctblock2.vPrefilledTxs[1].tx.GetHash(), block.vtx[1].GetHash());
+    // the keys of the short IDs are set again when it's read
+    EXPECT_EQ(cmpctblock2.GetShortID(block.vtx[4].GetHash()), cmpctblock.vShortTxIDs[2]);
+
+    // another nonce makes other short IDs
+    const CBlockHeaderAndShortTxIDs cmpctblock3(block, 1);
+    EXPECT_NE(cmpctblock3.vShortTxIDs, cmpctblock.vShortTxIDs);
+}
+
+TEST(blockencodings_tests, reconstruction)
+{
+    const CBlock block = MakeStakeBlock(4);
+
+    CTxMemPool pool;
+    for (unsigned int i : {2, 4}) {
+        CTransaction tx = block.vtx[i];
+        pool.addUnchecked(tx.GetHash(), tx);
+    }
+    CTransaction txUnrelated = MakeTx(500);
+    pool.addUnchecked(txUnrelated.GetHash(), txUnrelated);
+
+    const CBlockHeaderAndShortTxIDs cmpctblock(block, 42);
+    CPartialBlock                   partialBlock;
+    ASSERT_EQ(partialBlock.InitData(cmpctblock, pool), COMPACTBLOCK_OK);
+    EXPECT_EQ(partialBlock.GetBlockHash(), block.GetHash());
+
+    const std::vector<uint32_t> vMissing = partialBlock.GetMissing();
+    ASSERT_EQ(vMissing, std::vector<uint32_t>({3, 5}));
+
+    std::vector<CTransaction> vMissingTxs;
+    for (uint32_t nIndex : vMissing)
+        vMissingTxs.push_back(block.vtx[nIndex]);
+
+    CBlock block2;
+    ASSERT_EQ(partialBlock.FillBlock(block2, vMissingTxs), COMPACTBLOCK_OK);
+    EXPECT_EQ(block2.GetHash(), block.GetHash());
+    EXPECT_EQ(block2.vchBlockSig, block.vchBlockSig);
+    ASSERT_EQ(block2.vtx.size(), block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        EXPECT_EQ(block2.vtx[i].GetHash(), block.vtx[i].GetHash());
+
+    // too few or too many transactions
+    EXPECT_EQ(partialBlock.FillBlock(block2, std::vector<CTransaction>(1, block.vtx[3])),
+              COMPACTBLOCK_INVALID);
+    vMissingTxs.push_back(block.vtx[3]);
+    EXPECT_EQ(partialBlock.FillBlock(block2, vMissingTxs), COMPACTBLOCK_INVALID);
+
+    // the wrong transactions don't match the merkle root
+    vMissingTxs = {block.vtx[3], txUnrelated};
+    EXPECT_EQ(partialBlock.FillBlock(block2, vMissingTxs), COMPACTBLOCK_FAILED);
+}
+
+TEST(blockencodings_tests, invalid)
+{
+    const CBlock block = MakeStakeBlock(3);
+    CTxMemPool   pool;
+    CPartialBlock partialBlock;
+
+    // prefilled transactions out of order
+    CBlockHeaderAndShortTxIDs cmpctblock(block, 7);
+    std::swap(cmpctblock.vPrefilledTxs[0], cmpctblock.vPrefilledTxs[1]);
+    EXPECT_EQ(partialBlock.InitData(cmpctblock, pool), COMPACTBLOCK_INVALID);
+
+    // a prefilled transaction past the end of the block
+    cmpctblock = CBlockHeaderAndShortTxIDs(block, 7);
+    cmpctblock.vPrefilledTxs[1].nIndex = 5;
+    EXPECT_EQ(partialBlock.InitData(cmpctblock, pool), COMPACTBLOCK_INVALID);
+
+    // no transactions
+    cmpctblock = CBlockHeaderAndShortTxIDs(block, 7);
+    cmpctblock.vPrefilledTxs.clear();
+    cmpctblock.vShortTxIDs.clear();
+    EXPECT_EQ(partialBlock.InitData(cmpctblock, pool), COMPACTBLOCK_INVALID);
+
+    // short IDs that collide can't be told apart, and the block is asked for whole
+    cmpctblock = CBlockHeaderAndShortTxIDs(block, 7);
+    cmpctblock.vShortTxIDs[1] = cmpctblock.vShortTxIDs[0];
+    EXPECT_EQ(partialBlock.InitData(cmpctblock, pool), COMPACTBLOCK_FAILED);
+}
@@ -0,0 +1,130 @@
+#include "googletest/googletest/include/gtest/gtest.h"
+
+#include <cstring>
+#include <limits>
+
+#include "blockimport.h"
+#include "bootstrap.h"
+#include "hash.h"
+#include "main.h"
+#include "util.h"
+
+static void AppendBlock(std::string& strFile, const std::string& strBlock)
+{
+    uint32_t nSize = strBlock.size();
+    strFile.append(reinterpret_cast<const char*>(pchMessageStart), sizeof(pchMessageStart));
+    strFile.append(reinterpret_cast<const char*>(&nSize), sizeof(nSize));
+    strFile.append(strBlock);
+}
+
+TEST(blockimport_tests, find_external_blocks)
+{
+    std::string strFile = "garbage";
+    AppendBlock(strFile, std::string(100, 'a'));
+    // a block that contains the message start is still read as a whole
+    AppendBlock(strFile, std::string(20, 'b') +
+                             std::string(reinterpret_cast<const char*>(pchMessageStart),
+                                         sizeof(pchMessageStart)) +
+                             std::string(20, 'b'));
+    // sizes that can't be right are skipped
+    AppendBlock(strFile, "");
+    strFile += std::string(reinterpret_cast<const char*>(pchMessageStart), sizeof(pchMessageStart));
+    strFile += std::string("\xff\xff\xff\x7f", 4);
+    AppendBlock(strFile, std::string(1000, 'c'));
+    // truncated at the end of the file
+    AppendBlock(strFile, std::string(50, 'd'));
+    strFile.resize(strFile.size() - 10);
+
+    std::vector<CExternalBlockPos> vPositions =
+        FindExternalBlocks(strFile.data(), strFile.size(), MAX_BLOCK_SIZE);
+    ASSERT_EQ(vPositions.size(), 3u);
+    EXPECT_EQ(strFile.substr(vPositions[0].nOffset, vPositions[0].nSize), std::string(100, 'a'));
+    EXPECT_EQ(vPositions[1].nSize, 44u);
+    EXPECT_EQ(strFile[vPositions[1].nOffset], 'b');
+    EXPECT_EQ(strFile.substr(vPositions[2].nOffset, vPositions[2].nSize), std::string(1000, 'c'));
+
+    // blocks above the size limit are garbage too
+    vPositions = FindExternalBlocks(strFile.data(), strFile.size(), 500);
+    EXPECT_EQ(vPositions.size(), 2u);
+
+    EXPECT_TRUE(FindExternalBlocks(strFile.data(), 5, MAX_BLOCK_SIZE).empty());
+}
+
+TEST(blockimport_tests, compressed_bootstrap_index)
+{
+    // three chunks of records, laid out like ExportBootstrapBlocks() does
+    std::string strFile(BOOTSTRAP_MAGIC, sizeof(BOOTSTRAP_MAGIC));
+    strFile.append(reinterpret_cast<const char*>(&BOOTSTRAP_VERSION), sizeof(BOOTSTRAP_VERSION));
+    std::vector<CBootstrapChunk> vChunks;
+    std::vector<std::string>     vRecords;
+    for (int i = 0; i < 3; i++) {
+        std::string strRecords;
+        for (int j = 0; j <= i; j++)
+            AppendBlock(strRecords, std::string(1000 * (i + 1), 'a' + i));
+        const std::string strCompressed = ZlibCompress(strRecords);
+        CBootstrapChunk   chunk;
+        chunk.nOffset         = strFile.size();
+        chunk.nCompressedSize = strCompressed.size();
+        chunk.nSize           = strRecords.size();
+        chunk.nFirstBlock     = vChunks.empty() ? 0 : vChunks.back().nFirstBlock + vChunks.back().nBlocks;
+        chunk.nBlocks         = i + 1;
+        chunk.hashLastBlock   = i + 1;
+        vChunks.push_back(chunk);
+        vRecords.push_back(strRecords);
+        strFile += strCompressed;
+    }
+    CDataStream ssIndex(SER_DISK, CLIENT_VERSION);
+    ssIndex << vChunks;
+    uint256  hashIndex    = Hash(ssIndex.begin(), ssIndex.end());
+    uint64_t nIndexOffset = strFile.size();
+    ssIndex << hashIndex << nIndexOffset << FLATDATA(BOOTSTRAP_MAGIC);
+    strFile.append(ssIndex.begin(), ssIndex.end());
+
+    ASSERT_TRUE(IsCompressedBootstrap(strFile.data(), strFile.size()));
+    std::vector<CBootstrapChunk> vRead;
+    ASSERT_TRUE(ReadBootstrapIndex(strFile.data(), strFile.size(), vRead));
+    ASSERT_EQ(vRead.size(), 3u);
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(vRead[i].hashLastBlock, uint256(i + 1));
+        const std::string strRecords = DecompressBootstrapChunk(strFile.data(), vRead[i]);
+        EXPECT_EQ(strRecords, vRecords[i]);
+        EXPECT_EQ(FindExternalBlocks(strRecords.data(), strRecords.size(), MAX_BLOCK_SIZE).size(),
+                  (size_t)vRead[i].nBlocks);
+    }
+
+    // seeking by block number
+    EXPECT_EQ(FindBootstrapChunk(vRead, 0), 0);
+    EXPECT_EQ(FindBootstrapChunk(vRead, 1), 1);
+    EXPECT_EQ(FindBootstrapChunk(vRead, 2), 1);
+    EXPECT_EQ(FindBootstrapChunk(vRead, 5), 2);
+    EXPECT_EQ(FindBootstrapChunk(vRead, 6), -1);
+
+    // a plain block file isn't mistaken for a compressed one
+    EXPECT_FALSE(IsCompressedBootstrap(vRecords[0].data(), vRecords[0].size()));
+
+    // a truncated file or a corrupted index are detected
+    EXPECT_FALSE(ReadBootstrapIndex(strFile.data(), strFile.size() - 1, vRead));
+    std::string strCorrupted = strFile;
+    strCorrupted[nIndexOffset + 2] ^= 1;
+    EXPECT_FALSE(ReadBootstrapIndex(strCorrupted.data(), strCorrupted.size(), vRead));
+    EXPECT_TRUE(vRead.empty());
+
+    // and so is a corrupted chunk
+    strCorrupted = strFile;
+    strCorrupted[vChunks[1].nOffset + 5] ^= 0x55;
+    EXPECT_THROW(DecompressBootstrapChunk(strCorrupted.data(), vChunks[1]), std::exception);
+
+    // an index position that would wrap around past the end of the file
+    strCorrupted                  = strFile;
+    const uint64_t nWrappedOffset = std::numeric_limits<uint64_t>::max() - 8;
+    memcpy(&strCorrupted[strCorrupted.size() - BOOTSTRAP_TRAILER_SIZE], &nWrappedOffset,
+           sizeof(nWrappedOffset));
+    EXPECT_FALSE(ReadBootstrapIndex(strCorrupted.data(), strCorrupted.size(), vRead));
+
+    // a chunk isn't inflated past the size in the index
+    CBootstrapChunk chunkTooSmall = vChunks[2];
+    chunkTooSmall.nSize           = 100;
+    EXPECT_THROW(DecompressBootstrapChunk(strFile.data(), chunkTooSmall), std::runtime_error);
+    EXPECT_THROW(ZlibDecompress(ZlibCompress(std::string(100000, 'x')), 99999), std::runtime_error);
+    EXPECT_EQ(ZlibDecompress(ZlibCompress(std::string(100000, 'x')), 100000), std::string(100000, 'x'));
+}
@@ -0,0 +1,49 @@
+#include "googletest/googletest/include/gtest/gtest.h"
+
+#include "blockindex.h"
+#include "blockprune.h"
+
+TEST(blockprune_tests, select_block_files)
+{
+    std::map<uint32_t, uint64_t> mapSizes   = {{0, 100}, {1, 100}, {2, 100}, {3, 100}, {4, 50}};
+    std::map<uint32_t, int>      mapHeights = {{0, 1000}, {1, 3000}, {2, 2000}, {3, 4000}, {4, 4100}};
+
+    // below the target already
+    EXPECT_TRUE(SelectBlockFilesToPrune(mapSizes, mapHeights, 450, 5000).empty());
+
+    // the oldest files first, until the target is reached
+    EXPECT_EQ(SelectBlockFilesToPrune(mapSizes, mapHeights, 350, 5000), std::vector<uint32_t>({0}));
+    EXPECT_EQ(SelectBlockFilesToPrune(mapSizes, mapHeights, 200, 5000),
+              std::vector<uint32_t>({0, 1, 2}));
+
+    // files with blocks above the last one that can be pruned are skipped
+    EXPECT_EQ(SelectBlockFilesToPrune(mapSizes, mapHeights, 200, 2500), std::vector<uint32_t>({0, 2}));
+
+    // the last file is appended to, so it's never picked, whatever its blocks
+    EXPECT_EQ(SelectBlockFilesToPrune(mapSizes, mapHeights, 0, 10000),
+              std::vector<uint32_t>({0, 1, 2, 3}));
+
+    // a file without any block left in it is garbage
+    mapSizes[5] = 10;
+    mapHeights.erase(3);
+    EXPECT_EQ(SelectBlockFilesToPrune(mapSizes, mapHeights, 200, 2500),
+              std::vector<uint32_t>({0, 2, 3}));
+
+    EXPECT_TRUE(SelectBlockFilesToPrune({}, {}, 0, 10000).empty());
+}
+
+TEST(blockprune_tests, pruned_blocks)
+{
+    // a block below the highest one that was pruned is only pruned if it's marked so, since a block file
+    // may have blocks of all heights
+    CBlockIndex index;
+    index.nHeight = 1000;
+    nPruneHeight  = 3000;
+    EXPECT_FALSE(IsBlockPruned(&index));
+
+    index.nStatus |= CBlockIndex::BLOCK_PRUNED;
+    EXPECT_TRUE(IsBlockPruned(&index));
+    EXPECT_FALSE(index.IsHeaderOnly());
+
+    nPruneHeight = 0;
+}
@@ -0,0 +1,161 @@
+#include "googletest/googletest/include/gtest/gtest.h"
+
+#include <boost/filesystem.hpp>
+
+#include "blockstore.h"
+
+namespace {
+boost::filesystem::path GetTestDir()
+{
+    return boost::filesystem::path(TEST_ROOT_PATH) / "data/test_blockstore";
+}
+
+std::string ReadAll(CBlockStore& store, const CBlockFilePos& pos)
+{
+    std::vector<char> vch;
+    EXPECT_TRUE(store.Read(pos, vch));
+    return std::string(vch.begin(), vch.end());
+}
+} // namespace
+
+TEST(blockstore_tests, append_and_read)
+{
+    boost::filesystem::remove_all(GetTestDir());
+
+    const std::string strA(1000, 'a');
+    const std::string strB = "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb";
+    CBlockFilePos     posA, posB, posEmpty;
+    {
+        CBlockStore store(GetTestDir());
+        ASSERT_TRUE(store.Append(strA.data(), strA.size(), posA));
+        ASSERT_TRUE(store.Append(strB.data(), strB.size(), posB));
+        ASSERT_TRUE(store.Append("", 0, posEmpty));
+        EXPECT_TRUE(store.Flush());
+
+        EXPECT_EQ(posA.nFile, 0u);
+        EXPECT_EQ(posA.nPos, CBlockStore::RECORD_HEADER_SIZE);
+        EXPECT_EQ(posB.nPos, posA.nPos + posA.nSize + CBlockStore::RECORD_HEADER_SIZE);
+        EXPECT_EQ(ReadAll(store, posA), strA);
+        EXPECT_EQ(ReadAll(store, posB), strB);
+        EXPECT_EQ(ReadAll(store, posEmpty), "");
+
+        std::vector<char> vch;
+        EXPECT_TRUE(store.ReadPart(posB, 10, 5, vch));
+        EXPECT_EQ(std::string(vch.begin(), vch.end()), strB.substr(10, 5));
+        // what's past the end of the block isn't read
+        EXPECT_TRUE(store.ReadPart(posB, 50, 100, vch));
+        EXPECT_EQ(vch.size(), strB.size() - 50);
+        EXPECT_FALSE(store.ReadPart(posB, strB.size() + 1, 1, vch));
+
+        // a position that doesn't match the record
+        CBlockFilePos posWrong = posB;
+        posWrong.nSize++;
+        EXPECT_FALSE(store.Read(posWrong, vch));
+    }
+
+    // appending continues after what's there when the store is opened again
+    CBlockStore   store(GetTestDir());
+    CBlockFilePos posC;
+    ASSERT_TRUE(store.Append("ccc", 3, posC));
+    EXPECT_EQ(posC.nFile, 0u);
+    EXPECT_EQ(posC.nPos, posEmpty.nPos + CBlockStore::RECORD_HEADER_SIZE);
+    EXPECT_EQ(ReadAll(store, posA), strA);
+    EXPECT_EQ(ReadAll(store, posC), "ccc");
+
+    boost::filesystem::remove_all(GetTestDir());
+}
+
+TEST(blockstore_tests, rotation)
+{
+    boost::filesystem::remove_all(GetTestDir());
+
+    const std::string          strBlock(400, 'x');
+    std::vector<CBlockFilePos> vPos(5);
+    {
+        CBlockStore store(GetTestDir(), 1000);
+        for (CBlockFilePos& pos : vPos)
+            ASSERT_TRUE(store.Append(strBlock.data(), strBlock.size(), pos));
+        // a block that's bigger than a file still goes into one of its own
+        CBlockFilePos     posBig;
+        const std::string strBig(2000, 'y');
+        ASSERT_TRUE(store.Append(strBig.data(), strBig.size(), posBig));
+        EXPECT_EQ(posBig.nFile, 3u);
+        EXPECT_EQ(ReadAll(store, posBig), strBig);
+    }
+    EXPECT_EQ(vPos[0].nFile, 0u);
+    EXPECT_EQ(vPos[1].nFile, 0u);
+    EXPECT_EQ(vPos[2].nFile, 1u);
+    EXPECT_EQ(vPos[2].nPos, CBlockStore::RECORD_HEADER_SIZE);
+    EXPECT_EQ(vPos[4].nFile, 2u);
+
+    CBlockStore store(GetTestDir(), 1000);
+    for (const CBlockFilePos& pos : vPos)
+        EXPECT_EQ(ReadAll(store, pos), strBlock);
+    CBlockFilePos posNext;
+    ASSERT_TRUE(store.Append(strBlock.data(), strBlock.size(), posNext));
+    EXPECT_EQ(posNext.nFile, 4u);
+
+    boost::filesystem::remove_all(GetTestDir());
+}
+
+TEST(blockstore_tests, corruption)
+{
+    boost::filesystem::remove_all(GetTestDir());
+
+    const std::string strBlock(100, 'z');
+    CBlockFilePos     pos;
+    {
+        CBlockStore store(GetTestDir());
+        ASSERT_TRUE(store.Append(strBlock.data(), strBlock.size(), pos));
+    }
+
+    FILE* file = fopen((GetTestDir() / "blk00000.dat").string().c_str(), "r+b");
+    ASSERT_TRUE(file != nullptr);
+    ASSERT_EQ(fseek(file, pos.nPos + 50, SEEK_SET), 0);
+    ASSERT_EQ(fputc('q', file), 'q');
+    fclose(file);
+
+    CBlockStore       store(GetTestDir());
+    std::vector<char> vch;
+    EXPECT_FALSE(store.Read(pos, vch));
+    // parts are read without the checksum
+    EXPECT_TRUE(store.ReadPart(pos, 0, 10, vch));
+
+    boost::filesystem::remove_all(GetTestDir());
+}
+
+TEST(blockstore_tests, remove_file)
+{
+    boost::filesystem::remove_all(GetTestDir());
+
+    const std::string          strBlock(400, 'r');
+    std::vector<CBlockFilePos> vPos(5);
+    {
+        CBlockStore store(GetTestDir(), 1000);
+        for (CBlockFilePos& pos : vPos)
+            ASSERT_TRUE(store.Append(strBlock.data(), strBlock.size(), pos));
+        EXPECT_EQ(store.GetFileSizes().size(), 3u);
+        EXPECT_EQ(ReadAll(store, vPos[0]), strBlock);
+
+        EXPECT_TRUE(store.RemoveFile(0));
+        // the file that's appended to stays
+        EXPECT_FALSE(store.RemoveFile(2));
+
+        std::map<uint32_t, uint64_t> mapSizes = store.GetFileSizes();
+        ASSERT_EQ(mapSizes.size(), 2u);
+        EXPECT_EQ(mapSizes.begin()->first, 1u);
+        EXPECT_EQ(mapSizes[1], 2 * (strBlock.size() + CBlockStore::RECORD_HEADER_SIZE));
+        std::vector<char> vch;
+        EXPECT_FALSE(store.Read(vPos[0], vch));
+        EXPECT_EQ(ReadAll(store, vPos[2]), strBlock);
+    }
+
+    // appending continues in the last file, even though the first one is gone
+    CBlockStore   store(GetTestDir(), 1000);
+    CBlockFilePos pos;
+    ASSERT_TRUE(store.Append("sss", 3, pos));
+    EXPECT_EQ(pos.nFile, 2u);
+    EXPECT_EQ(pos.nPos, vPos[4].nPos + vPos[4].nSize + CBlockStore::RECORD_HEADER_SIZE);
+
+    boost::filesystem::remove_all(GetTestDir());
+}
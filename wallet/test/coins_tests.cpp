@@ -0,0 +1,163 @@
+#include "googletest/googletest/include/gtest/gtest.h"
+
+#include "coins.h"
+#include "key.h"
+#include "main.h"
+
+namespace {
+CTransaction MakeTx(unsigned int nOutputs, bool fCoinStake)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    CTransaction tx;
+    tx.nTime = 1500000000;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(uint256(1), 0);
+    tx.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        tx.vout[i].nValue = (i + 1) * COIN;
+        tx.vout[i].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    }
+    if (fCoinStake)
+        tx.vout[0].SetEmpty();
+    return tx;
+}
+
+CCoins Reserialize(const CCoins& coins)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << coins;
+    EXPECT_EQ(ss.size(), coins.GetSerializeSize(SER_DISK, CLIENT_VERSION));
+    CCoins result;
+    ss >> result;
+    EXPECT_TRUE(ss.empty());
+    return result;
+}
+} // namespace
+
+TEST(coins_tests, serialization)
+{
+    CTransaction tx = MakeTx(20, false);
+    CCoins       coins(tx, 1234);
+    EXPECT_FALSE(coins.IsCoinStake());
+    EXPECT_EQ(coins.nTime, tx.nTime);
+    EXPECT_TRUE(Reserialize(coins) == coins);
+
+    // spent outputs in the first two, in the bitmask, and at the end
+    coins.Spend(0);
+    coins.Spend(5);
+    coins.Spend(19);
+    CCoins result = Reserialize(coins);
+    EXPECT_TRUE(result == coins);
+    EXPECT_FALSE(result.IsAvailable(0));
+    EXPECT_TRUE(result.IsAvailable(1));
+    EXPECT_FALSE(result.IsAvailable(5));
+    EXPECT_EQ(result.vout.size(), 19u);
+
+    CTransaction txStake = MakeTx(3, true);
+    ASSERT_TRUE(txStake.IsCoinStake());
+    CCoins coinsStake(txStake, 99);
+    CCoins resultStake = Reserialize(coinsStake);
+    EXPECT_TRUE(resultStake == coinsStake);
+    EXPECT_TRUE(resultStake.IsCoinStake());
+    EXPECT_EQ(resultStake.nHeight, 99);
+    EXPECT_EQ(resultStake.nTime, txStake.nTime);
+}
+
+TEST(coins_tests, spend)
+{
+    CCoins coins(MakeTx(3, false), 10);
+    EXPECT_FALSE(coins.Spend(3));
+    EXPECT_TRUE(coins.Spend(1));
+    EXPECT_FALSE(coins.Spend(1));
+    EXPECT_EQ(coins.vout.size(), 3u);
+    EXPECT_TRUE(coins.Spend(2));
+    // the spent outputs at the end are dropped
+    EXPECT_EQ(coins.vout.size(), 1u);
+    EXPECT_FALSE(coins.IsPruned());
+
+    CTxInUndo undo;
+    EXPECT_TRUE(coins.Spend(COutPoint(0, 0), undo));
+    EXPECT_TRUE(coins.IsPruned());
+    // the last output being spent carries the metadata
+    EXPECT_EQ(undo.nHeight, 10u);
+    EXPECT_EQ(undo.txout.nValue, 1 * COIN);
+}
+
+TEST(coins_tests, cache_layers)
+{
+    CCoinsView      viewDummy;
+    CCoinsViewCache viewBase(viewDummy);
+    CCoinsViewCache viewTop(viewBase, true);
+
+    CTransaction tx1 = MakeTx(2, false);
+    CTransaction tx2 = MakeTx(2, false);
+    CTransaction tx3 = MakeTx(1, false);
+    tx3.vin[0].prevout = COutPoint(tx1.GetHash(), 1);
+
+    // tx1 spends an output that doesn't exist
+    EXPECT_FALSE(tx1.UpdateCoins(viewBase, 1));
+    viewBase.SetCoins(tx1.GetHash(), CCoins(tx1, 1));
+    viewBase.SetCoins(tx2.GetHash(), CCoins(tx2, 1));
+
+    EXPECT_TRUE(tx3.HaveInputs(viewTop));
+    EXPECT_TRUE(tx3.UpdateCoins(viewTop, 2));
+    EXPECT_FALSE(tx3.HaveInputs(viewTop));
+    // nothing reaches the base before the flush
+    EXPECT_TRUE(viewBase.GetCoins(tx1.GetHash()).IsAvailable(1));
+    EXPECT_FALSE(viewBase.HaveCoins(tx3.GetHash()));
+
+    CBlockIndex index;
+    viewTop.SetBestBlock(&index);
+    EXPECT_TRUE(viewTop.Flush());
+    EXPECT_EQ(viewTop.GetCacheSize(), 0u);
+    EXPECT_EQ(viewBase.GetBestBlock(), &index);
+    EXPECT_FALSE(viewBase.GetCoins(tx1.GetHash()).IsAvailable(1));
+    EXPECT_TRUE(viewBase.GetCoins(tx1.GetHash()).IsAvailable(0));
+    EXPECT_TRUE(viewBase.HaveCoins(tx3.GetHash()));
+    EXPECT_EQ(viewBase.GetCoins(tx3.GetHash()).nHeight, 2);
+    EXPECT_EQ(viewBase.GetCacheSize(), 3u);
+
+    // the dummy view at the bottom can't take the changes
+    EXPECT_FALSE(viewBase.Flush());
+    EXPECT_EQ(viewBase.GetCacheSize(), 3u);
+}
+
+TEST(coins_tests, undo)
+{
+    CCoinsView      viewDummy;
+    CCoinsViewCache view(viewDummy);
+
+    CTransaction txStake = MakeTx(2, true);
+    view.SetCoins(txStake.GetHash(), CCoins(txStake, 7));
+    const CCoins coinsBefore = view.GetCoins(txStake.GetHash());
+
+    CTransaction tx = MakeTx(1, false);
+    tx.vin.resize(2);
+    tx.vin[0].prevout = COutPoint(txStake.GetHash(), 1);
+    tx.vin[1].prevout = COutPoint(txStake.GetHash(), 0);
+
+    CTxUndo txundo;
+    EXPECT_TRUE(tx.UpdateCoins(view, txundo, 20));
+    ASSERT_EQ(txundo.vprevout.size(), 2u);
+    EXPECT_TRUE(view.GetCoins(txStake.GetHash()).IsPruned());
+    // the last output being spent carries the metadata
+    EXPECT_EQ(txundo.vprevout[0].nHeight, 0u);
+    EXPECT_EQ(txundo.vprevout[1].nHeight, 7u);
+    EXPECT_TRUE(txundo.vprevout[1].fCoinStake);
+    EXPECT_EQ(txundo.vprevout[1].nTime, txStake.nTime);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << txundo;
+    CTxUndo txundoRead;
+    ss >> txundoRead;
+    EXPECT_TRUE(ss.empty());
+
+    EXPECT_TRUE(tx.UndoCoins(view, txundoRead));
+    EXPECT_TRUE(view.GetCoins(txStake.GetHash()) == coinsBefore);
+    EXPECT_TRUE(view.GetCoins(tx.GetHash()).IsPruned());
+
+    // the outputs are unspent already
+    EXPECT_FALSE(tx.UndoCoins(view, txundoRead));
+}
@@ -4,6 +4,7 @@
 #include "hash.h"
 #include "ntp1/ntp1tools.h"
 #include <boost/algorithm/string.hpp>
+#include <boost/thread.hpp>
 #include <fstream>
 #include <unordered_map>
 #include <unordered_set>
@@ -28,6 +29,12 @@ std::string RandomString(const int len)
 #define CUSTOM_LMDB_DB_SIZE (1 << 14)
 #include "../txdb-lmdb.h"
 
+#include "../addrindex.h"
+#include "../coins.h"
+#include "../tokenindex.h"
+#include "main.h"
+#include "ntp1/ntp1transaction.h"
+
 TEST(lmdb_tests, basic)
 {
     std::cout << "LMDB DB size: " << DB_DEFAULT_MAPSIZE << std::endl;
@@ -281,6 +288,591 @@ TEST(lmdb_tests, basic_multiple_many_inputs)
     db.Close();
 }
 
+// reads the key on another thread, which only sees what was committed
+static bool ExistsOnOtherThread(const std::string& key)
+{
+    bool fExists = false;
+    boost::thread([&]() { fExists = CTxDB("r").test1_ExistsStrKeyVal(key); }).join();
+    return fExists;
+}
+
+TEST(lmdb_tests, batched_commits)
+{
+    CTxDB::DB_DIR = "test-txdb"; // avoid writing to the main database
+
+    CTxDB::__deleteDb(); // clean up
+
+    CTxDB::QuickSyncHigherControl_Enabled = false;
+    CTxDB db;
+
+    const uint64_t nMaxBytesBefore  = CTxDBBatchScope::nMaxBytes;
+    const int      nSyncLevelBefore = CTxDBBatchScope::nSyncLevel;
+    CTxDBBatchScope::nMaxBytes      = 10000;
+    CTxDBBatchScope::nSyncLevel     = 0; // synced when the scope ends
+
+    {
+        CTxDBBatchScope batch;
+        EXPECT_TRUE(CTxDBBatchScope::IsActive());
+
+        // a block that's connected
+        {
+            CTxDB txdb;
+            txdb.TxnBegin();
+            EXPECT_TRUE(txdb.test1_WriteStrKeyVal("block1", "a"));
+            EXPECT_TRUE(txdb.test1_WriteStrKeyVal("best", "block1"));
+            txdb.TxnCommit();
+        }
+        // and one that fails, which is rolled back alone
+        {
+            CTxDB txdb;
+            txdb.TxnBegin();
+            EXPECT_TRUE(txdb.test1_WriteStrKeyVal("block2", "b"));
+            EXPECT_TRUE(txdb.test1_WriteStrKeyVal("best", "block2"));
+            txdb.TxnAbort();
+        }
+        // writes without a transaction of their own go to the batch too
+        EXPECT_TRUE(db.test1_WriteStrKeyVal("other", "c"));
+
+        // this thread sees the batch, with every CTxDB
+        std::string out;
+        EXPECT_TRUE(CTxDB("r").test1_ReadStrKeyVal("best", out));
+        EXPECT_EQ(out, "block1");
+        EXPECT_FALSE(CTxDB("r").test1_ExistsStrKeyVal("block2"));
+        EXPECT_TRUE(db.test1_ExistsStrKeyVal("other"));
+
+        // other threads don't, until it's committed
+        EXPECT_FALSE(batch.IsDue());
+        EXPECT_FALSE(ExistsOnOtherThread("block1"));
+
+        // a scope inside another one adds to the same batch
+        {
+            CTxDBBatchScope inner;
+            CTxDB           txdb;
+            txdb.TxnBegin();
+            EXPECT_TRUE(txdb.test1_WriteStrKeyVal("block3", "d"));
+            txdb.TxnCommit();
+        }
+        EXPECT_FALSE(ExistsOnOtherThread("block3"));
+
+        // once the batch is big enough, it's committed with the transaction that makes it so
+        {
+            CTxDB txdb;
+            txdb.TxnBegin();
+            EXPECT_TRUE(txdb.test1_WriteStrKeyVal("block4", std::string(20000, 'e')));
+            EXPECT_TRUE(txdb.test1_WriteStrKeyVal("best", "block4"));
+            txdb.TxnCommit();
+        }
+        EXPECT_TRUE(ExistsOnOtherThread("block1"));
+        EXPECT_TRUE(ExistsOnOtherThread("block4"));
+        EXPECT_FALSE(ExistsOnOtherThread("block2"));
+
+        EXPECT_TRUE(db.test1_WriteStrKeyVal("block5", "f"));
+        EXPECT_FALSE(ExistsOnOtherThread("block5"));
+    }
+
+    // the rest is committed when the scope ends
+    EXPECT_FALSE(CTxDBBatchScope::IsActive());
+    EXPECT_TRUE(ExistsOnOtherThread("block5"));
+    std::string out;
+    EXPECT_TRUE(db.test1_ReadStrKeyVal("best", out));
+    EXPECT_EQ(out, "block4");
+
+    // without batching, there's no batch and every block is committed on its own
+    CTxDBBatchScope::nMaxBytes = 0;
+    {
+        CTxDBBatchScope batch;
+        EXPECT_FALSE(CTxDBBatchScope::IsActive());
+        EXPECT_TRUE(batch.IsDue());
+        EXPECT_TRUE(db.test1_WriteStrKeyVal("block6", "g"));
+        EXPECT_TRUE(ExistsOnOtherThread("block6"));
+    }
+
+    CTxDBBatchScope::nMaxBytes  = nMaxBytesBefore;
+    CTxDBBatchScope::nSyncLevel = nSyncLevelBefore;
+    db.Close();
+}
+
+TEST(lmdb_tests, map_growth)
+{
+    const uint64_t GB = UINT64_C(1) << 30;
+    EXPECT_EQ(CTxDB::GetNextMapSize(1 << 14, 0, 4096), (1 << 14) + DB_MIN_MAP_GROWTH);
+    EXPECT_EQ(CTxDB::GetNextMapSize(8 * GB, 0, 4096), 12 * GB);
+    EXPECT_EQ(CTxDB::GetNextMapSize(128 * GB, 0, 4096), 128 * GB + DB_MAX_MAP_GROWTH);
+    // what a batch asks for is given when it's more
+    EXPECT_EQ(CTxDB::GetNextMapSize(GB, 5 * GB, 4096), 6 * GB);
+    EXPECT_EQ(CTxDB::GetNextMapSize(1000, 0, 4096) % 4096, 0u);
+
+    CTxDB::DB_DIR = "test-txdb"; // avoid writing to the main database
+
+    CTxDB::__deleteDb(); // clean up
+
+    CTxDB::QuickSyncHigherControl_Enabled = false;
+    CTxDB db;
+
+    for (int i = 0; i < 100; i++)
+        EXPECT_TRUE(db.test1_WriteStrKeyVal("key" + std::to_string(i), RandomString(1000)));
+
+    const CLMDBResizeStats stats = CTxDB::GetResizeStats();
+    EXPECT_GE(stats.nUsedSize, 100u * 1000u);
+    EXPECT_LE(stats.nUsedSize, stats.nMapSize);
+    EXPECT_LE(stats.nStallMicrosMax, stats.nStallMicrosTotal);
+    // far from full, so the writes don't look at the map
+    EXPECT_FALSE(CTxDB::need_resize_for_write(1000));
+
+    db.Close();
+}
+
+TEST(lmdb_tests, read_snapshot)
+{
+    CTxDB::DB_DIR = "test-txdb"; // avoid writing to the main database
+
+    CTxDB::__deleteDb(); // clean up
+
+    CTxDB::QuickSyncHigherControl_Enabled = false;
+    CTxDB db;
+
+    std::string out;
+    EXPECT_TRUE(db.test1_WriteStrKeyVal("snap", "a"));
+    EXPECT_FALSE(CTxDBReadSnapshot::IsActive());
+    {
+        CTxDBReadSnapshot snapshot;
+        EXPECT_TRUE(snapshot.IsValid());
+        EXPECT_TRUE(CTxDBReadSnapshot::IsActive());
+
+        // what's written after the snapshot is taken isn't seen through it
+        EXPECT_TRUE(db.test1_WriteStrKeyVal("snap", "b"));
+        EXPECT_TRUE(db.test1_ReadStrKeyVal("snap", out));
+        EXPECT_EQ(out, "a");
+        {
+            CTxDBReadSnapshot inner;
+            EXPECT_EQ(inner.GetTxn(), snapshot.GetTxn());
+            EXPECT_TRUE(db.test1_ReadStrKeyVal("snap", out));
+            EXPECT_EQ(out, "a");
+        }
+        EXPECT_TRUE(CTxDBReadSnapshot::IsActive());
+        EXPECT_FALSE(db.test1_ExistsStrKeyVal("other"));
+    }
+    EXPECT_FALSE(CTxDBReadSnapshot::IsActive());
+
+    // without a snapshot, every read sees the last write
+    EXPECT_TRUE(db.test1_ReadStrKeyVal("snap", out));
+    EXPECT_EQ(out, "b");
+    EXPECT_TRUE(db.test1_WriteStrKeyVal("snap", "c"));
+    EXPECT_TRUE(db.test1_ReadStrKeyVal("snap", out));
+    EXPECT_EQ(out, "c");
+
+    // and the reads of other threads have transactions of their own
+    boost::thread reader([&]() {
+        CTxDB             txdb;
+        CTxDBReadSnapshot snapshot;
+        std::string       value;
+        EXPECT_TRUE(txdb.test1_ReadStrKeyVal("snap", value));
+        EXPECT_EQ(value, "c");
+    });
+    reader.join();
+
+    db.Close();
+}
+
+TEST(lmdb_tests, coins_view)
+{
+    CTxDB::DB_DIR = "test-txdb"; // avoid writing to the main database
+
+    CTxDB::__deleteDb(); // clean up
+
+    CTxDB::QuickSyncHigherControl_Enabled = false;
+    CTxDB db;
+
+    CTransaction tx;
+    tx.vout.resize(3);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        tx.vout[i].nValue       = (i + 1) * COIN;
+        tx.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    const uint256 hash = tx.GetHash();
+
+    CCoinsViewDB    viewDB;
+    CCoinsViewCache view(viewDB);
+    EXPECT_FALSE(view.HaveCoins(hash));
+    EXPECT_TRUE(view.SetCoins(hash, CCoins(tx, 5)));
+
+    // nothing is written before the cache is flushed
+    EXPECT_FALSE(db.HaveCoins(hash));
+    EXPECT_TRUE(view.Flush());
+    CCoins coins;
+    EXPECT_TRUE(db.ReadCoins(hash, coins));
+    EXPECT_TRUE(coins == CCoins(tx, 5));
+    // there's no best block to write yet
+    uint256 hashBestBlock;
+    EXPECT_FALSE(db.ReadCoinsBestBlock(hashBestBlock));
+
+    // spent outputs are written too
+    EXPECT_TRUE(view.GetCoins(hash).Spend(1));
+    EXPECT_TRUE(view.Flush());
+    EXPECT_TRUE(db.ReadCoins(hash, coins));
+    EXPECT_TRUE(coins.IsAvailable(0));
+    EXPECT_FALSE(coins.IsAvailable(1));
+    EXPECT_TRUE(coins.IsAvailable(2));
+
+    // and the transaction is erased once all its outputs are spent
+    EXPECT_TRUE(view.GetCoins(hash).Spend(0));
+    EXPECT_TRUE(view.GetCoins(hash).Spend(2));
+    EXPECT_TRUE(view.Flush());
+    EXPECT_FALSE(db.HaveCoins(hash));
+    EXPECT_FALSE(view.HaveCoins(hash));
+
+    db.Close();
+}
+
+TEST(lmdb_tests, pruned_txs)
+{
+    CTxDB::DB_DIR = "test-txdb"; // avoid writing to the main database
+
+    CTxDB::__deleteDb(); // clean up
+
+    CTxDB::QuickSyncHigherControl_Enabled = false;
+    CTxDB db;
+
+    CTransaction tx;
+    tx.vout.resize(1);
+    tx.vout[0].nValue       = COIN;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    const CDiskTxPos pos(uint256(5), 81);
+
+    // a kept transaction is read through its position, even though its block is gone
+    CTransaction txRead;
+    EXPECT_FALSE(db.ReadPrunedTx(pos, txRead));
+    EXPECT_TRUE(db.WritePrunedTx(pos, tx));
+    EXPECT_TRUE(db.ReadPrunedTx(pos, txRead));
+    EXPECT_EQ(txRead.GetHash(), tx.GetHash());
+    EXPECT_TRUE(db.ReadTx(pos, txRead));
+    EXPECT_EQ(txRead.GetHash(), tx.GetHash());
+
+    // until it's dropped; dropping what isn't there is fine
+    EXPECT_TRUE(db.ErasePrunedTx(pos));
+    EXPECT_FALSE(db.ReadPrunedTx(pos, txRead));
+    EXPECT_FALSE(db.ReadTx(pos, txRead));
+    EXPECT_TRUE(db.ErasePrunedTx(pos));
+
+    db.Close();
+}
+
+TEST(lmdb_tests, addr_index)
+{
+    CTxDB::DB_DIR = "test-txdb"; // avoid writing to the main database
+
+    CTxDB::__deleteDb(); // clean up
+
+    CTxDB::QuickSyncHigherControl_Enabled = false;
+    CTxDB db;
+
+    int nHeight = 0;
+    EXPECT_TRUE(db.ReadAddrIndexHeight(nHeight));
+    EXPECT_EQ(nHeight, -1);
+
+    // the entries of the address in between the ones of its neighbours
+    const uint160 scriptHash(2);
+    for (uint32_t nEntryHeight : {300u, 1u, 256u}) {
+        CAddrIndexDelta delta;
+        delta.nValue = nEntryHeight;
+        EXPECT_TRUE(db.WriteAddrIndexDelta(CAddrIndexKey(scriptHash, nEntryHeight, 7, 0, false), delta));
+        CAddrIndexUtxo utxo;
+        utxo.nHeight = nEntryHeight;
+        EXPECT_TRUE(db.WriteAddrIndexUtxo(CAddrIndexUtxoKey(scriptHash, nEntryHeight, 0), utxo));
+    }
+    for (uint160 scriptHashOther : {uint160(1), uint160(3)}) {
+        EXPECT_TRUE(db.WriteAddrIndexDelta(CAddrIndexKey(scriptHashOther, 2, 7, 0, false),
+                                           CAddrIndexDelta()));
+        EXPECT_TRUE(db.WriteAddrIndexUtxo(CAddrIndexUtxoKey(scriptHashOther, 2, 0), CAddrIndexUtxo()));
+    }
+    EXPECT_TRUE(db.WriteAddrIndexHeight(300));
+
+    std::vector<std::pair<CAddrIndexKey, CAddrIndexDelta>> vHistory;
+    EXPECT_TRUE(db.ReadAddrIndexHistory(scriptHash, 0, 100, vHistory));
+    ASSERT_EQ(vHistory.size(), 3u);
+    EXPECT_EQ(vHistory[0].first.nHeight, 1u);
+    EXPECT_EQ(vHistory[1].first.nHeight, 256u);
+    EXPECT_EQ(vHistory[2].first.nHeight, 300u);
+    EXPECT_EQ(vHistory[2].second.nValue, 300);
+
+    // pages
+    EXPECT_TRUE(db.ReadAddrIndexHistory(scriptHash, 1, 1, vHistory));
+    ASSERT_EQ(vHistory.size(), 1u);
+    EXPECT_EQ(vHistory[0].first.nHeight, 256u);
+    EXPECT_TRUE(db.ReadAddrIndexHistory(scriptHash, 3, 100, vHistory));
+    EXPECT_TRUE(vHistory.empty());
+    EXPECT_TRUE(db.ReadAddrIndexHistory(uint160(4), 0, 100, vHistory));
+    EXPECT_TRUE(vHistory.empty());
+
+    std::vector<std::pair<CAddrIndexUtxoKey, CAddrIndexUtxo>> vUtxos;
+    EXPECT_TRUE(db.ReadAddrIndexUtxos(scriptHash, 0, 100, vUtxos));
+    EXPECT_EQ(vUtxos.size(), 3u);
+    EXPECT_TRUE(db.EraseAddrIndexUtxo(CAddrIndexUtxoKey(scriptHash, 256, 0)));
+    // erasing what isn't there is fine
+    EXPECT_TRUE(db.EraseAddrIndexUtxo(CAddrIndexUtxoKey(scriptHash, 256, 0)));
+    EXPECT_TRUE(db.ReadAddrIndexUtxos(scriptHash, 0, 100, vUtxos));
+    EXPECT_EQ(vUtxos.size(), 2u);
+
+    EXPECT_TRUE(db.EraseAddrIndex());
+    EXPECT_TRUE(db.ReadAddrIndexHeight(nHeight));
+    EXPECT_EQ(nHeight, -1);
+    EXPECT_TRUE(db.ReadAddrIndexHistory(scriptHash, 0, 100, vHistory));
+    EXPECT_TRUE(vHistory.empty());
+    EXPECT_TRUE(db.ReadAddrIndexUtxos(uint160(1), 0, 100, vUtxos));
+    EXPECT_TRUE(vUtxos.empty());
+
+    db.Close();
+}
+
+TEST(lmdb_tests, token_index)
+{
+    CTxDB::DB_DIR = "test-txdb"; // avoid writing to the main database
+
+    CTxDB::__deleteDb(); // clean up
+
+    CTxDB::QuickSyncHigherControl_Enabled = false;
+    CTxDB db;
+
+    int nHeight = 0;
+    EXPECT_TRUE(db.ReadTokenIndexHeight(nHeight));
+    EXPECT_EQ(nHeight, -1);
+
+    CTokenIndexInfo info;
+    info.strSymbol = "NIBBL";
+    info.nMinted   = NTP1Int("1000000000000000000000");
+    info.nHolders  = 2;
+    EXPECT_TRUE(db.WriteTokenIndexInfo("La12", info));
+    CTokenIndexInfo infoRead;
+    EXPECT_FALSE(db.ReadTokenIndexInfo("La1", infoRead));
+    EXPECT_TRUE(db.ReadTokenIndexInfo("La12", infoRead));
+    EXPECT_EQ(infoRead.strSymbol, "NIBBL");
+    EXPECT_EQ(infoRead.nMinted, info.nMinted);
+    EXPECT_EQ(infoRead.nHolders, 2u);
+
+    // a token whose id begins with the id of another isn't among its entries
+    for (const std::string tokenId : {"La1", "La12", "La123"}) {
+        for (uint32_t nTransferHeight : {300u, 1u, 256u})
+            EXPECT_TRUE(db.WriteTokenIndexTransfer(CTokenIndexTransferKey(tokenId, nTransferHeight, 7),
+                                                   CTokenIndexTransfer()));
+        CTokenIndexHolder holder;
+        holder.nBalance = tokenId.size();
+        EXPECT_TRUE(db.WriteTokenIndexHolder(CTokenIndexHolderKey(tokenId, 1), holder));
+        EXPECT_TRUE(db.WriteTokenIndexHolder(CTokenIndexHolderKey(tokenId, 2), holder));
+    }
+    EXPECT_TRUE(db.WriteTokenIndexHeight(300));
+
+    std::vector<std::pair<CTokenIndexTransferKey, CTokenIndexTransfer>> vTransfers;
+    EXPECT_TRUE(db.ReadTokenIndexTransfers("La12", 0, 100, vTransfers));
+    ASSERT_EQ(vTransfers.size(), 3u);
+    EXPECT_EQ(vTransfers[0].first.nHeight, 1u);
+    EXPECT_EQ(vTransfers[1].first.nHeight, 256u);
+    EXPECT_EQ(vTransfers[2].first.nHeight, 300u);
+    EXPECT_EQ(vTransfers[2].first.tokenId, "La12");
+    EXPECT_TRUE(db.ReadTokenIndexTransfers("La12", 2, 100, vTransfers));
+    ASSERT_EQ(vTransfers.size(), 1u);
+    EXPECT_EQ(vTransfers[0].first.nHeight, 300u);
+
+    std::vector<std::pair<CTokenIndexHolderKey, CTokenIndexHolder>> vHolders;
+    EXPECT_TRUE(db.ReadTokenIndexHolders("La12", 0, 100, vHolders));
+    ASSERT_EQ(vHolders.size(), 2u);
+    EXPECT_EQ(vHolders[0].second.nBalance, 4);
+    EXPECT_TRUE(db.EraseTokenIndexHolder(CTokenIndexHolderKey("La12", 1)));
+    // erasing what isn't there is fine
+    EXPECT_TRUE(db.EraseTokenIndexHolder(CTokenIndexHolderKey("La12", 1)));
+    EXPECT_TRUE(db.ReadTokenIndexHolders("La12", 0, 100, vHolders));
+    ASSERT_EQ(vHolders.size(), 1u);
+    EXPECT_EQ(vHolders[0].first.scriptHash, uint160(2));
+
+    EXPECT_TRUE(db.EraseTokenIndex());
+    EXPECT_TRUE(db.ReadTokenIndexHeight(nHeight));
+    EXPECT_EQ(nHeight, -1);
+    EXPECT_FALSE(db.ReadTokenIndexInfo("La12", infoRead));
+    EXPECT_TRUE(db.ReadTokenIndexTransfers("La1", 0, 100, vTransfers));
+    EXPECT_TRUE(vTransfers.empty());
+    EXPECT_TRUE(db.ReadTokenIndexHolders("La123", 0, 100, vHolders));
+    EXPECT_TRUE(vHolders.empty());
+
+    db.Close();
+}
+
+// an output of an NTP1 transaction that pays an amount of a token to the script
+static NTP1TxOut MakeTokenTxOut(const CScript& scriptPubKey, const std::string& tokenId,
+                                const NTP1Int& nAmount)
+{
+    std::vector<NTP1TokenTxData> vTokens;
+    if (nAmount > 0) {
+        NTP1TokenTxData token;
+        token.setTokenId(tokenId);
+        token.setTokenSymbol("TKN");
+        token.setAmount(nAmount);
+        vTokens.push_back(token);
+    }
+    NTP1TxOut ntp1txout;
+    ntp1txout.__manualSet(10000, HexStr(scriptPubKey.begin(), scriptPubKey.end()),
+                          scriptPubKey.ToString(), vTokens, "");
+    return ntp1txout;
+}
+
+// a transaction that spends the outputs and pays the amounts of the token to the scripts; its NTP1
+// transaction is written, as it would be when its block is connected
+static CTransaction WriteTokenTx(CTxDB& db, const std::vector<COutPoint>& vPrevouts,
+                                 const std::vector<std::pair<CScript, NTP1Int>>& vPayments,
+                                 const std::string&                              tokenId)
+{
+    CTransaction tx;
+    for (const COutPoint& prevout : vPrevouts)
+        tx.vin.push_back(CTxIn(prevout));
+    std::vector<NTP1TxOut> vNTP1Outs;
+    for (const std::pair<CScript, NTP1Int>& payment : vPayments) {
+        tx.vout.push_back(CTxOut(10000, payment.first));
+        vNTP1Outs.push_back(MakeTokenTxOut(payment.first, tokenId, payment.second));
+    }
+    const CScript scriptOpReturn = CScript() << OP_RETURN << ParseHex("4e5401150020120169895252");
+    tx.vout.push_back(CTxOut(10000, scriptOpReturn));
+    vNTP1Outs.push_back(MakeTokenTxOut(scriptOpReturn, tokenId, 0));
+
+    NTP1Transaction ntp1tx;
+    ntp1tx.__manualSet(1, tx.GetHash(), std::vector<unsigned char>(), std::vector<NTP1TxIn>(), vNTP1Outs,
+                       0, 0, NTP1TxType_TRANSFER);
+    EXPECT_TRUE(db.WriteNTP1Tx(tx.GetHash(), ntp1tx));
+    return tx;
+}
+
+static CBlock MakeTokenBlock(const CTransaction& tx)
+{
+    CBlock block;
+    block.vtx.push_back(tx);
+    return block;
+}
+
+TEST(lmdb_tests, token_index_blocks)
+{
+    CTxDB::DB_DIR = "test-txdb"; // avoid writing to the main database
+
+    CTxDB::__deleteDb(); // clean up
+
+    CTxDB::QuickSyncHigherControl_Enabled = false;
+    CTxDB db;
+    LOCK(cs_main);
+
+    const std::string tokenId = "La1";
+    CScript           scriptA, scriptB;
+    scriptA.SetDestination(CKeyID(uint160(1)));
+    scriptB.SetDestination(CKeyID(uint160(2)));
+    uint160 scriptHashA, scriptHashB;
+    ASSERT_TRUE(GetAddrIndexScriptHash(scriptA, scriptHashA));
+    ASSERT_TRUE(GetAddrIndexScriptHash(scriptB, scriptHashB));
+
+    // the token is issued to A, which sends some of it to B, and B sends less than it got back to A
+    const CTransaction txIssue =
+        WriteTokenTx(db, {COutPoint(uint256(1), 0)}, {std::make_pair(scriptA, NTP1Int(1000))}, tokenId);
+    const CTransaction txSend = WriteTokenTx(
+        db, {COutPoint(txIssue.GetHash(), 0)},
+        {std::make_pair(scriptB, NTP1Int(600)), std::make_pair(scriptA, NTP1Int(400))}, tokenId);
+    const CTransaction txBurn = WriteTokenTx(db, {COutPoint(txSend.GetHash(), 0)},
+                                             {std::make_pair(scriptA, NTP1Int(500))}, tokenId);
+    const std::vector<CBlock> vBlocks = {MakeTokenBlock(txIssue), MakeTokenBlock(txSend),
+                                         MakeTokenBlock(txBurn)};
+
+    CTokenIndexInfo info;
+    int             nHeight = 0;
+    std::vector<std::pair<CTokenIndexHolderKey, CTokenIndexHolder>>     vHolders;
+    std::vector<std::pair<CTokenIndexTransferKey, CTokenIndexTransfer>> vTransfers;
+
+    // a block the index isn't up to yet is left to the background build
+    EXPECT_TRUE(ConnectBlockTokenIndex(db, vBlocks[1], 1));
+    EXPECT_TRUE(db.ReadTokenIndexHeight(nHeight));
+    EXPECT_EQ(nHeight, -1);
+    EXPECT_FALSE(db.ReadTokenIndexInfo(tokenId, info));
+
+    EXPECT_TRUE(ConnectBlockTokenIndex(db, vBlocks[0], 0));
+    ASSERT_TRUE(db.ReadTokenIndexInfo(tokenId, info));
+    EXPECT_EQ(info.issueTxid, txIssue.GetHash());
+    EXPECT_EQ(info.nIssueHeight, 0u);
+    EXPECT_EQ(info.strSymbol, "TKN");
+    EXPECT_EQ(info.nMinted, 1000);
+    EXPECT_EQ(info.nBurned, 0);
+    EXPECT_EQ(info.nHolders, 1u);
+    EXPECT_EQ(info.nTransfers, 1u);
+
+    EXPECT_TRUE(ConnectBlockTokenIndex(db, vBlocks[1], 1));
+    ASSERT_TRUE(db.ReadTokenIndexInfo(tokenId, info));
+    EXPECT_EQ(info.nMinted, 1000);
+    EXPECT_EQ(info.nBurned, 0);
+    EXPECT_EQ(info.nHolders, 2u);
+    EXPECT_EQ(info.nTransfers, 2u);
+
+    EXPECT_TRUE(ConnectBlockTokenIndex(db, vBlocks[2], 2));
+    EXPECT_TRUE(db.ReadTokenIndexHeight(nHeight));
+    EXPECT_EQ(nHeight, 2);
+    ASSERT_TRUE(db.ReadTokenIndexInfo(tokenId, info));
+    EXPECT_EQ(info.nMinted, 1000);
+    EXPECT_EQ(info.nBurned, 100);
+    EXPECT_EQ(info.nHolders, 1u);
+    EXPECT_EQ(info.nTransfers, 3u);
+
+    EXPECT_TRUE(db.ReadTokenIndexTransfers(tokenId, 0, 100, vTransfers));
+    ASSERT_EQ(vTransfers.size(), 3u);
+    EXPECT_EQ(vTransfers[0].second.nType, TOKEN_TRANSFER_ISSUANCE);
+    EXPECT_EQ(vTransfers[0].second.nAmountIn, 0);
+    EXPECT_EQ(vTransfers[0].second.nAmountOut, 1000);
+    EXPECT_EQ(vTransfers[1].second.nType, TOKEN_TRANSFER_TRANSFER);
+    EXPECT_EQ(vTransfers[1].second.vRecipients.size(), 2u);
+    EXPECT_EQ(vTransfers[2].first.txid, txBurn.GetHash());
+    EXPECT_EQ(vTransfers[2].second.nType, TOKEN_TRANSFER_BURN);
+    EXPECT_EQ(vTransfers[2].second.nAmountIn, 600);
+    EXPECT_EQ(vTransfers[2].second.nAmountOut, 500);
+
+    // B spent all it had, so it's not a holder anymore
+    EXPECT_TRUE(db.ReadTokenIndexHolders(tokenId, 0, 100, vHolders));
+    ASSERT_EQ(vHolders.size(), 1u);
+    EXPECT_EQ(vHolders[0].first.scriptHash, scriptHashA);
+    EXPECT_EQ(vHolders[0].second.nBalance, 900);
+    EXPECT_TRUE(vHolders[0].second.scriptPubKey == scriptA);
+
+    // only the block at the top can be disconnected
+    EXPECT_FALSE(DisconnectBlockTokenIndex(db, vBlocks[1], 1));
+
+    // disconnecting the blocks takes back what they did, down to the token
+    EXPECT_TRUE(DisconnectBlockTokenIndex(db, vBlocks[2], 2));
+    EXPECT_TRUE(db.ReadTokenIndexHeight(nHeight));
+    EXPECT_EQ(nHeight, 1);
+    ASSERT_TRUE(db.ReadTokenIndexInfo(tokenId, info));
+    EXPECT_EQ(info.nBurned, 0);
+    EXPECT_EQ(info.nHolders, 2u);
+    EXPECT_EQ(info.nTransfers, 2u);
+    EXPECT_TRUE(db.ReadTokenIndexHolders(tokenId, 0, 100, vHolders));
+    ASSERT_EQ(vHolders.size(), 2u);
+    for (const std::pair<CTokenIndexHolderKey, CTokenIndexHolder>& holder : vHolders)
+        EXPECT_EQ(holder.second.nBalance, holder.first.scriptHash == scriptHashA ? 400 : 600);
+    EXPECT_TRUE(db.ReadTokenIndexTransfers(tokenId, 0, 100, vTransfers));
+    EXPECT_EQ(vTransfers.size(), 2u);
+
+    EXPECT_TRUE(DisconnectBlockTokenIndex(db, vBlocks[1], 1));
+    EXPECT_TRUE(DisconnectBlockTokenIndex(db, vBlocks[0], 0));
+    EXPECT_TRUE(db.ReadTokenIndexHeight(nHeight));
+    EXPECT_EQ(nHeight, -1);
+    EXPECT_FALSE(db.ReadTokenIndexInfo(tokenId, info));
+    EXPECT_TRUE(db.ReadTokenIndexHolders(tokenId, 0, 100, vHolders));
+    EXPECT_TRUE(vHolders.empty());
+    EXPECT_TRUE(db.ReadTokenIndexTransfers(tokenId, 0, 100, vTransfers));
+    EXPECT_TRUE(vTransfers.empty());
+
+    // a block that spends an output its NTP1 transaction doesn't have doesn't match the index, which
+    // is marked to be built again rather than failing the block
+    EXPECT_TRUE(ConnectBlockTokenIndex(db, vBlocks[0], 0));
+    const CTransaction txBad = WriteTokenTx(db, {COutPoint(txIssue.GetHash(), 5)},
+                                            {std::make_pair(scriptB, NTP1Int(1))}, tokenId);
+    tokenIndexBuild.fSynced = true;
+    EXPECT_TRUE(ConnectBlockTokenIndex(db, MakeTokenBlock(txBad), 1));
+    EXPECT_TRUE(db.ReadTokenIndexHeight(nHeight));
+    EXPECT_EQ(nHeight, INDEX_HEIGHT_REBUILD);
+    EXPECT_FALSE(tokenIndexBuild.fSynced);
+    EXPECT_EQ(tokenIndexBuild.nHeight, -1);
+
+    db.Close();
+}
+
 TEST(quicksync_tests, download_index_file)
 {
     std::string        s = cURLTools::GetFileFromHTTPS(QuickSyncDataLink, 30, false);
@@ -43,3 +43,28 @@ TEST(hash_tests, murmurhash3)
 
 #undef T
 }
+
+TEST(hash_tests, siphash)
+{
+    // the test vectors of the SipHash-2-4 reference implementation, with the key 000102..0f
+    CSipHasher hasher(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    EXPECT_EQ(hasher.Finalize(), 0x726fdb47dd0e0e31ULL);
+    static const unsigned char t0[1] = {0};
+    hasher.Write(t0, 1);
+    EXPECT_EQ(hasher.Finalize(), 0x74f839c593dc67fdULL);
+    static const unsigned char t1[7] = {1, 2, 3, 4, 5, 6, 7};
+    hasher.Write(t1, 7);
+    EXPECT_EQ(hasher.Finalize(), 0x93f5f5799a932462ULL);
+    hasher.Write(0x0F0E0D0C0B0A0908ULL);
+    EXPECT_EQ(hasher.Finalize(), 0x3f2acc7f57c29bdbULL);
+
+    // a write that ends in the middle of a word
+    CSipHasher hasher2(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    static const unsigned char t2[15] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14};
+    hasher2.Write(t2, 15);
+    EXPECT_EQ(hasher2.Finalize(), 0xa129ca6149be45e5ULL);
+
+    EXPECT_EQ(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL,
+                             uint256("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100")),
+              0x7127512f72f27cceULL);
+}
@@ -0,0 +1,201 @@
+#include "googletest/googletest/include/gtest/gtest.h"
+
+#include <boost/make_shared.hpp>
+
+#include "block.h"
+#include "blockindex.h"
+#include "headerchain.h"
+#include "main.h"
+#include "util.h"
+
+// a stored block, with no blocks before it, that the headers follow
+static CBlockIndexSmartPtr AddStoredBlock(const uint256& hash, int nHeight, unsigned int nTime)
+{
+    CBlockIndexSmartPtr pindex = boost::make_shared<CBlockIndex>();
+    pindex->nHeight            = nHeight;
+    pindex->nTime              = nTime;
+    pindex->nBits              = 0x1e0fffff;
+    pindex->nChainTrust        = pindex->GetBlockTrust();
+    pindex->SetProofOfStake();
+    BlockIndexMapType::iterator mi = mapBlockIndex.insert(std::make_pair(hash, pindex)).first;
+    pindex->phashBlock             = &mi->first;
+    return pindex;
+}
+
+static CBlock MakeHeader(const CBlockIndexSmartPtr& pindexPrev, unsigned int nTime)
+{
+    CBlock header;
+    header.nVersion       = CBlock::CURRENT_VERSION;
+    header.hashPrevBlock  = pindexPrev->GetBlockHash();
+    header.hashMerkleRoot = uint256(nTime);
+    header.nTime          = nTime;
+    header.nBits          = GetNextTargetRequired(pindexPrev.get(), true);
+    return header;
+}
+
+TEST(headerchain_tests, accept_headers)
+{
+    LOCK(cs_main);
+
+    const unsigned int  nTime   = GetAdjustedTime() - 1000;
+    CBlockIndexSmartPtr pindexA = AddStoredBlock(uint256(1), 6000, nTime);
+    pindexBest                  = pindexA;
+    nBestHeight                 = 6000;
+
+    // a header that doesn't follow a known one
+    CBlock              header = MakeHeader(pindexA, nTime + 30);
+    CBlockIndexSmartPtr pindex;
+    header.hashPrevBlock = uint256(2);
+    EXPECT_FALSE(AcceptBlockHeader(header, pindex, 1));
+    EXPECT_EQ(header.nDoS, 0);
+
+    // a chain of headers after the stored block
+    std::vector<CBlockIndexSmartPtr> vIndexes;
+    CBlockIndexSmartPtr              pindexPrev = pindexA;
+    for (int i = 1; i <= 3; i++) {
+        header = MakeHeader(pindexPrev, nTime + 30 * i);
+        ASSERT_TRUE(AcceptBlockHeader(header, pindex, 1));
+        EXPECT_TRUE(pindex->IsHeaderOnly());
+        EXPECT_TRUE(pindex->IsProofOfStake());
+        EXPECT_EQ(pindex->nHeight, 6000 + i);
+        EXPECT_EQ(pindex->GetBlockHash(), header.GetHash());
+        EXPECT_EQ(pindex->pprev, pindexPrev);
+        EXPECT_EQ(pindex->nChainTrust, pindexPrev->nChainTrust + pindex->GetBlockTrust());
+        vIndexes.push_back(pindex);
+        pindexPrev = pindex;
+    }
+    EXPECT_FALSE(pindexA->IsHeaderOnly());
+    EXPECT_EQ(mapHeaderIndex.size(), 3u);
+    EXPECT_EQ(GetBestHeader(), vIndexes[2]);
+    EXPECT_EQ(LookupHeaderIndex(vIndexes[1]->GetBlockHash()), vIndexes[1]);
+    EXPECT_EQ(LookupHeaderIndex(uint256(1)), pindexA);
+
+    // a header that's known already
+    CBlockIndexSmartPtr pindexAgain;
+    EXPECT_TRUE(AcceptBlockHeader(vIndexes[0]->GetBlockHeader(), pindexAgain, 1));
+    EXPECT_EQ(pindexAgain, vIndexes[0]);
+    EXPECT_EQ(mapHeaderIndex.size(), 3u);
+
+    // a header with the wrong target
+    header       = MakeHeader(vIndexes[2], nTime + 120);
+    header.nBits = 0x1d00ffff;
+    EXPECT_FALSE(AcceptBlockHeader(header, pindex, 1));
+    EXPECT_EQ(header.nDoS, 100);
+
+    // the block of the first header is stored; the second header follows the stored block from then on
+    CBlockIndexSmartPtr pindexStored = AddStoredBlock(vIndexes[0]->GetBlockHash(), 6001, nTime + 30);
+    pindexStored->pprev              = pindexA;
+    HeaderIndexBlockStored(pindexStored);
+    EXPECT_EQ(mapHeaderIndex.size(), 2u);
+    EXPECT_EQ(LookupHeaderIndex(vIndexes[0]->GetBlockHash()), pindexStored);
+    EXPECT_EQ(vIndexes[1]->pprev, pindexStored);
+    EXPECT_EQ(GetBestHeader(), vIndexes[2]);
+
+    // a branch is kept while its end has more trust than the best block, even if its first header
+    // doesn't
+    CBlockIndexSmartPtr pindexB = AddStoredBlock(uint256(3), 6002, nTime + 60);
+    pindexB->nChainTrust        = vIndexes[1]->nChainTrust;
+    pindexBest                  = pindexB;
+    nBestHeight                 = 6002;
+    EXPECT_EQ(PruneHeaderIndex(), 0u);
+    EXPECT_EQ(mapHeaderIndex.size(), 2u);
+
+    // the best block got past the headers, which are on a fork then
+    pindexB->nChainTrust = vIndexes[2]->nChainTrust;
+    EXPECT_EQ(PruneHeaderIndex(), 2u);
+    EXPECT_TRUE(mapHeaderIndex.empty());
+    EXPECT_EQ(GetBestHeader(), pindexB);
+
+    mapBlockIndex.clear();
+    pindexBest.reset();
+    nBestHeight = 0;
+}
+
+TEST(headerchain_tests, peer_headers)
+{
+    LOCK(cs_main);
+
+    const unsigned int  nTime   = GetAdjustedTime() - 1000;
+    CBlockIndexSmartPtr pindexA = AddStoredBlock(uint256(1), 6000, nTime);
+    pindexBest                  = pindexA;
+    nBestHeight                 = 6000;
+
+    // peer 1 sends a chain of three headers, and peer 2 the first of them and a fork after it
+    std::vector<CBlock>              vHeaders;
+    std::vector<CBlockIndexSmartPtr> vIndexes;
+    CBlockIndexSmartPtr              pindex = pindexA;
+    for (int i = 1; i <= 3; i++) {
+        vHeaders.push_back(MakeHeader(pindex, nTime + 30 * i));
+        ASSERT_TRUE(AcceptBlockHeader(vHeaders.back(), pindex, 1));
+        vIndexes.push_back(pindex);
+    }
+    CBlockIndexSmartPtr pindexFork;
+    ASSERT_TRUE(AcceptBlockHeader(vHeaders[0], pindex, 2));
+    EXPECT_EQ(pindex, vIndexes[0]);
+    ASSERT_TRUE(AcceptBlockHeader(MakeHeader(vIndexes[0], nTime + 45), pindexFork, 2));
+    EXPECT_EQ(mapHeaderIndex.size(), 4u);
+    EXPECT_EQ(GetLastStoredHeight(vIndexes[2]), 6000);
+
+    // once peer 1 is gone, only the headers that peer 2 sent are left
+    EXPECT_EQ(DropPeerHeaders(1), 2u);
+    EXPECT_EQ(mapHeaderIndex.size(), 2u);
+    EXPECT_EQ(GetBestHeader(), pindexFork);
+
+    // the branch with the least trust makes room, but not the one that the new header follows
+    for (int i = 1; i <= 2; i++)
+        ASSERT_TRUE(AcceptBlockHeader(vHeaders[i], vIndexes[i], 1));
+    CBlockIndexSmartPtr pindexNew = boost::make_shared<CBlockIndex>();
+    pindexNew->pprev              = vIndexes[2];
+    pindexNew->nChainTrust        = vIndexes[2]->nChainTrust + vIndexes[2]->GetBlockTrust();
+    EXPECT_EQ(EvictHeaderBranches(2, pindexNew), 1u);
+    EXPECT_EQ(mapHeaderIndex.size(), 3u);
+    EXPECT_FALSE(mapHeaderIndex.count(pindexFork->GetBlockHash()));
+    EXPECT_EQ(GetBestHeader(), vIndexes[2]);
+    // nothing has less trust than a header that doesn't get past the others
+    pindexNew->pprev       = pindexA;
+    pindexNew->nChainTrust = pindexA->nChainTrust;
+    EXPECT_EQ(EvictHeaderBranches(0, pindexNew), 0u);
+
+    // the first header is only peer 2's now, and the ones after it go with it
+    EXPECT_EQ(DropPeerHeaders(2), 3u);
+    EXPECT_TRUE(mapHeaderIndex.empty());
+    EXPECT_EQ(GetBestHeader(), pindexA);
+
+    // a header that forks off inside a branch keeps the headers it follows, when the rest of the
+    // branch is evicted
+    for (int i = 0; i <= 2; i++)
+        ASSERT_TRUE(AcceptBlockHeader(vHeaders[i], vIndexes[i], 1));
+    pindexNew->pprev       = vIndexes[0];
+    pindexNew->nChainTrust = vIndexes[2]->nChainTrust + vIndexes[2]->GetBlockTrust();
+    EXPECT_EQ(EvictHeaderBranches(1, pindexNew), 2u);
+    EXPECT_EQ(mapHeaderIndex.size(), 1u);
+    EXPECT_TRUE(mapHeaderIndex.count(vIndexes[0]->GetBlockHash()));
+    EXPECT_EQ(GetBestHeader(), vIndexes[0]);
+    EXPECT_EQ(DropPeerHeaders(1), 1u);
+    EXPECT_TRUE(mapHeaderIndex.empty());
+
+    mapBlockIndex.clear();
+    pindexBest.reset();
+    nBestHeight = 0;
+}
+
+TEST(headerchain_tests, checkpoints)
+{
+    LOCK(cs_main);
+
+    // a header that doesn't match a checkpoint is on a fork that can't become the main chain
+    const unsigned int  nTime   = GetAdjustedTime() - 1000;
+    CBlockIndexSmartPtr pindexA = AddStoredBlock(uint256(1), 24999, nTime);
+    pindexBest                  = pindexA;
+    nBestHeight                 = 24999;
+
+    CBlock              header = MakeHeader(pindexA, nTime + 30);
+    CBlockIndexSmartPtr pindex;
+    EXPECT_FALSE(AcceptBlockHeader(header, pindex, 1));
+    EXPECT_EQ(header.nDoS, 100);
+    EXPECT_TRUE(mapHeaderIndex.empty());
+
+    mapBlockIndex.clear();
+    pindexBest.reset();
+    nBestHeight = 0;
+}
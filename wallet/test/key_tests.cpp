@@ -8,6 +8,9 @@
 #include "uint256.h"
 #include "util.h"
 
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+
 using namespace std;
 
 static const string strSecret1C    ("TtnutkcnaPcu3zmjWcrJazf42fp1YAKRpm8grKRRuYjtiykmGuM7");
@@ -106,3 +109,131 @@ TEST(key_tests, key_test1)
         EXPECT_TRUE(rkey2C.GetPubKey() == key2C.GetPubKey());
     }
 }
+
+// Signature check done the way CKey::Verify() used to: a key built from the curve parameters, and
+// the normalized DER signature given to ECDSA_verify()
+static bool ReferenceVerify(const CPubKey& pubkey, const uint256& hash,
+                            const vector<unsigned char>& vchSig)
+{
+    EC_KEY*               pkey   = EC_KEY_new_by_curve_name(NID_secp256k1);
+    vector<unsigned char> vchRaw = pubkey.Raw();
+    const unsigned char*  pbegin = &vchRaw[0];
+    bool                  ret    = false;
+    if (o2i_ECPublicKey(&pkey, &pbegin, vchRaw.size()) && !vchSig.empty()) {
+        ECDSA_SIG*           sig    = ECDSA_SIG_new();
+        const unsigned char* sigptr = &vchSig[0];
+        if (d2i_ECDSA_SIG(&sig, &sigptr, vchSig.size()) != NULL) {
+            unsigned char* der    = NULL;
+            int            derlen = i2d_ECDSA_SIG(sig, &der);
+            if (derlen > 0)
+                ret = ECDSA_verify(0, (const unsigned char*)&hash, sizeof(hash), der, derlen, pkey) == 1;
+            OPENSSL_free(der);
+        }
+        ECDSA_SIG_free(sig);
+    }
+    EC_KEY_free(pkey);
+    return ret;
+}
+
+TEST(key_tests, verify_matches_reference)
+{
+    for (int n = 0; n < 64; n++) {
+        CKey key;
+        key.MakeNewKey(n % 2 == 0);
+        const CPubKey pubkey = key.GetPubKey();
+
+        const uint256         hash = GetRandHash();
+        vector<unsigned char> vchSig;
+        ASSERT_TRUE(key.Sign(hash, vchSig));
+
+        CKey verifier;
+        ASSERT_TRUE(verifier.SetPubKey(pubkey));
+        EXPECT_TRUE(verifier.Verify(hash, vchSig));
+        EXPECT_TRUE(ReferenceVerify(pubkey, hash, vchSig));
+
+        // another message
+        const uint256 hashOther = GetRandHash();
+        EXPECT_EQ(verifier.Verify(hashOther, vchSig), ReferenceVerify(pubkey, hashOther, vchSig));
+
+        // damaged signatures, including broken encodings
+        for (int m = 0; m < 16; m++) {
+            vector<unsigned char> vchBad = vchSig;
+            vchBad[GetRand(vchBad.size())] ^= (unsigned char)(1 + GetRand(255));
+            EXPECT_EQ(verifier.Verify(hash, vchBad), ReferenceVerify(pubkey, hash, vchBad));
+        }
+        vector<unsigned char> vchShort(vchSig.begin(), vchSig.end() - 1);
+        EXPECT_EQ(verifier.Verify(hash, vchShort), ReferenceVerify(pubkey, hash, vchShort));
+
+        // keys restored from their serialization still use the same curve encoding
+        CKey restored;
+        ASSERT_TRUE(restored.SetPrivKey(key.GetPrivKey()));
+        EXPECT_TRUE(restored.GetPrivKey() == key.GetPrivKey());
+        EXPECT_TRUE(restored.Verify(hash, vchSig));
+    }
+}
+
+TEST(key_tests, signature_verifier_fuzz)
+{
+    // a few keys, so that the verifier gets runs of one public key as well as changes between them
+    vector<CKey>    vKeys(4);
+    vector<CPubKey> vPubKeys;
+    for (unsigned int i = 0; i < vKeys.size(); i++) {
+        vKeys[i].MakeNewKey(i % 2 == 0);
+        vPubKeys.push_back(vKeys[i].GetPubKey());
+    }
+
+    CSignatureVerifier verifier;
+    for (int n = 0; n < 512; n++) {
+        const unsigned int    nKey   = GetRand(vKeys.size());
+        CPubKey               pubkey = vPubKeys[nKey];
+        uint256               hash   = GetRandHash();
+        vector<unsigned char> vchSig;
+        ASSERT_TRUE(vKeys[nKey].Sign(hash, vchSig));
+
+        switch (GetRand(8)) {
+        case 0: // another message
+            hash = GetRandHash();
+            break;
+        case 1: // a damaged signature
+            vchSig[GetRand(vchSig.size())] ^= (unsigned char)(1 + GetRand(255));
+            break;
+        case 2: // a cut signature, down to nothing
+            vchSig.resize(GetRand(vchSig.size()));
+            break;
+        case 3: // random bytes
+            vchSig.resize(GetRand(80));
+            for (unsigned char& ch : vchSig)
+                ch = (unsigned char)GetRand(256);
+            break;
+        case 4: { // a damaged public key
+            vector<unsigned char> vchPubKey = pubkey.Raw();
+            vchPubKey[1 + GetRand(vchPubKey.size() - 1)] ^= (unsigned char)(1 + GetRand(255));
+            pubkey = CPubKey(vchPubKey);
+            break;
+        }
+        case 5: // another key's
+            pubkey = vPubKeys[(nKey + 1) % vPubKeys.size()];
+            break;
+        default:
+            break;
+        }
+
+        CKey       key;
+        const bool fExpected = key.SetPubKey(pubkey) && key.Verify(hash, vchSig);
+        const bool fResult   = verifier.Verify(pubkey, hash, vchSig);
+        EXPECT_EQ(fResult, fExpected) << "check " << n;
+        EXPECT_EQ(fResult, ReferenceVerify(pubkey, hash, vchSig)) << "check " << n;
+    }
+
+    // an invalid public key fails only the signature that goes with it
+    vector<uint256>               vHashes(3);
+    vector<vector<unsigned char>> vSigs(3);
+    for (int n = 0; n < 3; n++) {
+        vHashes[n] = GetRandHash();
+        ASSERT_TRUE(vKeys[0].Sign(vHashes[n], vSigs[n]));
+    }
+    EXPECT_TRUE(verifier.Verify(vPubKeys[0], vHashes[0], vSigs[0]));
+    EXPECT_FALSE(verifier.Verify(CPubKey(vector<unsigned char>(33, 0)), vHashes[1], vSigs[1]));
+    EXPECT_TRUE(verifier.Verify(vPubKeys[0], vHashes[2], vSigs[2]));
+    EXPECT_FALSE(verifier.Verify(CPubKey(), vHashes[0], vSigs[0]));
+}
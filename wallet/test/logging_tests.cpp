@@ -0,0 +1,128 @@
+#include "googletest/googletest/include/gtest/gtest.h"
+
+#include <boost/filesystem/fstream.hpp>
+
+#include "util.h"
+
+static void LogTo(CDebugLogWriter& writer, const char* pszFormat, ...)
+{
+    va_list arg_ptr;
+    va_start(arg_ptr, pszFormat);
+    writer.VPrint(pszFormat, arg_ptr);
+    va_end(arg_ptr);
+}
+
+static std::vector<std::string> ReadLogLines(const boost::filesystem::path& path)
+{
+    std::vector<std::string>    vLines;
+    boost::filesystem::ifstream file(path);
+    std::string                 strLine;
+    while (std::getline(file, strLine))
+        vLines.push_back(strLine);
+    return vLines;
+}
+
+TEST(logging_tests, categories)
+{
+    EXPECT_TRUE(SetLogCategories({"net", "db"}));
+    EXPECT_TRUE(LogAcceptCategory(LOG_NET));
+    EXPECT_TRUE(LogAcceptCategory(LOG_DB));
+    EXPECT_FALSE(LogAcceptCategory(LOG_WALLET));
+
+    // -debug alone enables everything
+    EXPECT_TRUE(SetLogCategories({""}));
+    EXPECT_TRUE(LogAcceptCategory(LOG_WALLET));
+
+    EXPECT_FALSE(SetLogCategories({"wallet", "nosuchcategory"}));
+    EXPECT_TRUE(LogAcceptCategory(LOG_WALLET));
+    EXPECT_FALSE(LogAcceptCategory(LOG_NET));
+
+    // the arguments aren't evaluated if the category is disabled
+    int nEvaluated = 0;
+    LogPrint(LOG_NET, "%d\n", ++nEvaluated);
+    EXPECT_EQ(nEvaluated, 0);
+
+    EXPECT_TRUE(SetLogCategories({}));
+    EXPECT_FALSE(LogAcceptCategory(LOG_WALLET));
+}
+
+TEST(logging_tests, background_writer)
+{
+    const boost::filesystem::path path = boost::filesystem::path(TEST_ROOT_PATH) / "data/test_debug.log";
+    boost::filesystem::remove(path);
+    const bool fLogTimestampsBefore = fLogTimestamps;
+    fLogTimestamps                  = false;
+
+    static const int THREAD_COUNT  = 4;
+    static const int MESSAGE_COUNT = 2000;
+    {
+        CDebugLogWriter writer(path);
+        LogTo(writer, "before start\n");
+        writer.Start();
+
+        boost::thread_group threads;
+        for (int n = 0; n < THREAD_COUNT; n++) {
+            threads.create_thread([&writer, n]() {
+                for (int i = 0; i < MESSAGE_COUNT; i++)
+                    LogTo(writer, "thread %d message %d\n", n, i);
+            });
+        }
+        threads.join_all();
+        LogTo(writer, "after threads\n");
+
+        writer.Stop();
+        EXPECT_EQ(writer.GetDroppedCount(), 0u);
+        LogTo(writer, "after stop\n");
+    }
+
+    // every thread's messages are there and in order
+    std::vector<std::string> vLines = ReadLogLines(path);
+    ASSERT_EQ(vLines.size(), 3u + THREAD_COUNT * MESSAGE_COUNT);
+    EXPECT_EQ(vLines.front(), "before start");
+    EXPECT_EQ(vLines[vLines.size() - 2], "after threads");
+    EXPECT_EQ(vLines.back(), "after stop");
+    std::vector<int> vNext(THREAD_COUNT, 0);
+    for (unsigned int i = 1; i < vLines.size() - 2; i++) {
+        int n, nMessage;
+        ASSERT_EQ(sscanf(vLines[i].c_str(), "thread %d message %d", &n, &nMessage), 2);
+        ASSERT_TRUE(n >= 0 && n < THREAD_COUNT);
+        EXPECT_EQ(nMessage, vNext[n]++);
+    }
+
+    fLogTimestamps = fLogTimestampsBefore;
+    boost::filesystem::remove(path);
+}
+
+TEST(logging_tests, dropped_messages)
+{
+    const boost::filesystem::path path = boost::filesystem::path(TEST_ROOT_PATH) / "data/test_debug.log";
+    boost::filesystem::remove(path);
+    const bool fLogTimestampsBefore = fLogTimestamps;
+    fLogTimestamps                  = false;
+
+    // a buffer that fills up quickly; whatever doesn't fit is counted
+    static const int MESSAGE_COUNT = 20000;
+    uint64_t         nDropped;
+    {
+        CDebugLogWriter writer(path, 4096);
+        writer.Start();
+        for (int i = 0; i < MESSAGE_COUNT; i++)
+            LogTo(writer, "message %d\n", i);
+        writer.Stop();
+        nDropped = writer.GetDroppedCount();
+    }
+
+    uint64_t nMessages = 0, nDroppedInLog = 0;
+    for (const std::string& strLine : ReadLogLines(path)) {
+        uint64_t n;
+        if (sscanf(strLine.c_str(), "*** %" SCNu64 " debug messages were dropped ***", &n) == 1)
+            nDroppedInLog += n;
+        else
+            nMessages++;
+    }
+    EXPECT_EQ(nDroppedInLog, nDropped);
+    EXPECT_EQ(nMessages + nDropped, (uint64_t)MESSAGE_COUNT);
+
+    fLogTimestamps = fLogTimestampsBefore;
+    boost::filesystem::remove(path);
+}
@@ -0,0 +1,117 @@
+#include "googletest/googletest/include/gtest/gtest.h"
+
+#ifndef WIN32
+
+#include <sys/socket.h>
+
+#include "net.h"
+
+// reads whatever is available on the socket
+static void DrainSocket(int hSocket, std::string& strReceived)
+{
+    char buf[65536];
+    ssize_t nBytes;
+    while ((nBytes = recv(hSocket, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        strReceived.append(buf, nBytes);
+}
+
+TEST(net_tests, send_queued_messages)
+{
+    int vSockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, vSockets), 0);
+    int nSendBufferSize = 4096;
+    setsockopt(vSockets[0], SOL_SOCKET, SO_SNDBUF, &nSendBufferSize, sizeof(nSendBufferSize));
+
+    // inbound, so that the node doesn't send a version message
+    CNode* pnode = new CNode(vSockets[0], CAddress(), "test", true);
+
+    // the socket buffer is small, so most of the messages are queued and sent together later
+    static const unsigned int MESSAGE_COUNT = 200;
+    for (unsigned int i = 0; i < MESSAGE_COUNT; i++)
+        pnode->PushMessage("ping", std::vector<unsigned int>(i % 50, i));
+
+    std::string strReceived;
+    for (int nTries = 0; nTries < 100000; nTries++) {
+        DrainSocket(vSockets[1], strReceived);
+        LOCK(pnode->cs_vSend);
+        if (pnode->vSendMsg.empty())
+            break;
+        SocketSendData(pnode);
+    }
+    DrainSocket(vSockets[1], strReceived);
+
+    {
+        LOCK(pnode->cs_vSend);
+        EXPECT_TRUE(pnode->vSendMsg.empty());
+        EXPECT_EQ(pnode->nSendSize, 0u);
+        EXPECT_EQ(pnode->nSendOffset, 0u);
+        EXPECT_FALSE(pnode->vSendBuffers.empty());
+    }
+    EXPECT_EQ(pnode->nSendMsgs, MESSAGE_COUNT);
+    EXPECT_EQ(pnode->nSendBytes, strReceived.size());
+    EXPECT_LT(pnode->nSendCalls, MESSAGE_COUNT);
+
+    // all the messages arrived complete and in order
+    CDataStream ss(strReceived.data(), strReceived.data() + strReceived.size(), SER_NETWORK,
+                   PROTOCOL_VERSION);
+    for (unsigned int i = 0; i < MESSAGE_COUNT; i++) {
+        CMessageHeader hdr;
+        ss >> hdr;
+        EXPECT_TRUE(hdr.IsValid());
+        EXPECT_EQ(hdr.GetCommand(), "ping");
+        std::vector<unsigned int> v;
+        ss >> v;
+        EXPECT_TRUE(v == std::vector<unsigned int>(i % 50, i));
+    }
+    EXPECT_TRUE(ss.empty());
+
+    delete pnode;
+    close(vSockets[1]);
+}
+
+TEST(net_tests, send_shared_message)
+{
+    const CSharedMessage pmsg = MakeSharedMessage("tx", std::string(1000, 'x'));
+
+    CDataStream ssExpected(SER_NETWORK, PROTOCOL_VERSION);
+    ssExpected << CMessageHeader("tx", 0) << std::string(1000, 'x');
+    SetMessageSizeAndChecksum(ssExpected);
+    EXPECT_EQ(std::string(pmsg->begin(), pmsg->end()), ssExpected.str());
+
+    // the same buffer is queued for every node, between messages of their own
+    std::vector<std::pair<CNode*, int>> vNodesTest;
+    for (int i = 0; i < 3; i++) {
+        int vSockets[2];
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, vSockets), 0);
+        vNodesTest.push_back(std::make_pair(new CNode(vSockets[0], CAddress(), "test", true), vSockets[1]));
+    }
+    for (const std::pair<CNode*, int>& node : vNodesTest) {
+        node.first->PushMessage("ping", (uint64_t)1);
+        node.first->PushSharedMessage(pmsg);
+        node.first->PushMessage("ping", (uint64_t)2);
+    }
+
+    for (const std::pair<CNode*, int>& node : vNodesTest) {
+        std::string strReceived;
+        DrainSocket(node.second, strReceived);
+        CDataStream ss(strReceived.data(), strReceived.data() + strReceived.size(), SER_NETWORK,
+                       PROTOCOL_VERSION);
+        CMessageHeader hdr;
+        uint64_t       nNonce;
+        std::string    str;
+        ss >> hdr >> nNonce;
+        EXPECT_EQ(nNonce, 1u);
+        ss >> hdr >> str;
+        EXPECT_EQ(hdr.GetCommand(), "tx");
+        EXPECT_EQ(str, std::string(1000, 'x'));
+        ss >> hdr >> nNonce;
+        EXPECT_EQ(nNonce, 2u);
+        EXPECT_TRUE(ss.empty());
+
+        delete node.first;
+        close(node.second);
+    }
+    EXPECT_EQ(pmsg.use_count(), 1);
+}
+
+#endif
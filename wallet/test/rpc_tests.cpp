@@ -56,3 +56,92 @@ using namespace json_spirit;
 //    string short2(address1Hex+1, address1Hex+sizeof(address1Hex)); // first byte missing
 //    EXPECT_THROW(addmultisig(createArgs(2, short2.c_str()), false), runtime_error);
 //}
+
+static void WriteSampleJSON(CRPCStreamWriter& writer)
+{
+    writer.BeginObject();
+    writer.WritePair("name", "stream \"test\"");
+    writer.WriteKey("list");
+    writer.BeginArray();
+    for (int i = 0; i < 100; i++) {
+        writer.BeginObject();
+        writer.WritePair("index", i);
+        writer.WritePair("amount", ValueFromAmount(i * 1000));
+        writer.WriteKey("empty");
+        writer.BeginArray();
+        writer.EndArray();
+        writer.EndObject();
+    }
+    writer.EndArray();
+    Object small;
+    small.push_back(Pair("a", 1));
+    small.push_back(Pair("b", Value::null));
+    writer.WritePair("small", small);
+    writer.WriteKey("emptyobj");
+    writer.BeginObject();
+    writer.EndObject();
+    writer.EndObject();
+}
+
+TEST(rpc_tests, rpc_stream_writer)
+{
+    CRPCValueWriter valueWriter;
+    WriteSampleJSON(valueWriter);
+    const std::string expected = write_string(valueWriter.GetValue(), false);
+
+    std::vector<std::string> chunks;
+    CRPCTextWriter           textWriter([&chunks](const std::string& s) { chunks.push_back(s); }, 128);
+    WriteSampleJSON(textWriter);
+    textWriter.Flush();
+
+    // the output was flushed in pieces, and put together it's identical to the tree serialization
+    EXPECT_GT(chunks.size(), 1u);
+    std::string joined;
+    for (const std::string& c : chunks)
+        joined += c;
+    EXPECT_EQ(joined, expected);
+    EXPECT_EQ(textWriter.GetBytesFlushed(), expected.size());
+
+    Value parsed;
+    EXPECT_TRUE(read_string(joined, parsed));
+    EXPECT_EQ(find_value(parsed.get_obj(), "list").get_array().size(), 100u);
+}
+
+TEST(rpc_tests, rpc_stream_writer_hold_output)
+{
+    // nothing reaches the sink while the output is held, and all of it comes once it's not anymore
+    std::vector<std::string> chunks;
+    CRPCTextWriter           textWriter([&chunks](const std::string& s) { chunks.push_back(s); }, 128);
+    textWriter.HoldOutput(true);
+    WriteSampleJSON(textWriter);
+    EXPECT_TRUE(chunks.empty());
+    textWriter.HoldOutput(false);
+    ASSERT_EQ(chunks.size(), 1u);
+
+    CRPCValueWriter valueWriter;
+    WriteSampleJSON(valueWriter);
+    EXPECT_EQ(chunks[0], write_string(valueWriter.GetValue(), false));
+}
+
+TEST(rpc_tests, rpc_stream_writer_close_scopes)
+{
+    std::string    out;
+    CRPCTextWriter writer([&out](const std::string& s) { out += s; });
+    writer.BeginObject();
+    writer.WriteKey("result");
+    writer.BeginArray();
+    writer.WriteValue(1);
+    writer.BeginObject();
+    writer.WriteKey("half");
+    writer.CloseScopes(1);
+    writer.WritePair("error", "failed");
+    writer.EndObject();
+    writer.Flush();
+
+    EXPECT_EQ(out, "{\"result\":[1,{\"half\":null}],\"error\":\"failed\"}");
+
+    CRPCTextWriter badWriter([](const std::string&) {});
+    badWriter.BeginObject();
+    EXPECT_THROW(badWriter.WriteValue(1), std::logic_error);
+    EXPECT_THROW(badWriter.EndArray(), std::logic_error);
+}
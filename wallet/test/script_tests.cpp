@@ -22,7 +22,8 @@ using namespace boost::algorithm;
 
 extern uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
 extern bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                         bool fValidatePayToScriptHash, bool fStrictEncodings, int nHashType);
+                         bool fValidatePayToScriptHash, bool fStrictEncodings, int nHashType,
+                         CSignatureHashContext* pSigHashContext);
 
 CScript
 ParseScript(string s)
@@ -451,3 +452,145 @@ TEST(script_tests, script_CHECKMULTISIG23)
 //    combined = CombineSignatures(scriptPubKey, txTo, 0, partial3b, partial3a);
 //    EXPECT_TRUE(combined == partial3c);
 //}
+
+// The signature hash as it was computed before CSignatureHashContext, by modifying a copy of the
+// transaction
+static uint256 ReferenceSignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn,
+                                      int nHashType)
+{
+    if (nIn >= txTo.vin.size())
+        return 1;
+    CTransaction txTmp(txTo);
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+        txTmp.vin[i].scriptSig = CScript();
+    txTmp.vin[nIn].scriptSig = scriptCode;
+
+    if ((nHashType & 0x1f) == SIGHASH_NONE) {
+        txTmp.vout.clear();
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    } else if ((nHashType & 0x1f) == SIGHASH_SINGLE) {
+        unsigned int nOut = nIn;
+        if (nOut >= txTmp.vout.size())
+            return 1;
+        txTmp.vout.resize(nOut + 1);
+        for (unsigned int i = 0; i < nOut; i++)
+            txTmp.vout[i].SetNull();
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    }
+
+    if (nHashType & SIGHASH_ANYONECANPAY) {
+        txTmp.vin[0] = txTmp.vin[nIn];
+        txTmp.vin.resize(1);
+    }
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTmp << nHashType;
+    return ss.GetHash();
+}
+
+static CScript RandomScript()
+{
+    static const opcodetype ops[] = {OP_CHECKSIG, OP_DUP,  OP_HASH160,        OP_EQUALVERIFY,
+                                     OP_1,        OP_ADD,  OP_CODESEPARATOR,  OP_RETURN};
+    CScript                 script;
+    unsigned int            nOps = insecure_rand() % 10;
+    for (unsigned int i = 0; i < nOps; i++) {
+        if (insecure_rand() % 3 == 0)
+            script << std::vector<unsigned char>(insecure_rand() % 80, (unsigned char)insecure_rand());
+        else
+            script << ops[insecure_rand() % (sizeof(ops) / sizeof(ops[0]))];
+    }
+    return script;
+}
+
+static CTransaction RandomTransaction(unsigned int nInputs, unsigned int nOutputs)
+{
+    CTransaction tx;
+    tx.nVersion  = insecure_rand();
+    tx.nTime     = insecure_rand();
+    tx.nLockTime = (insecure_rand() % 2) ? insecure_rand() : 0;
+    for (unsigned int i = 0; i < nInputs; i++) {
+        CTxIn txin;
+        txin.prevout.hash = GetRandHash();
+        txin.prevout.n    = insecure_rand() % 4;
+        txin.scriptSig    = RandomScript();
+        txin.nSequence    = (insecure_rand() % 2) ? std::numeric_limits<unsigned int>::max() : insecure_rand();
+        tx.vin.push_back(txin);
+    }
+    for (unsigned int i = 0; i < nOutputs; i++)
+        tx.vout.push_back(CTxOut(insecure_rand(), RandomScript()));
+    return tx;
+}
+
+TEST(script_tests, signature_hash_matches_reference)
+{
+    seed_insecure_rand(true);
+    static const int hashTypes[] = {0,
+                                    SIGHASH_ALL,
+                                    SIGHASH_NONE,
+                                    SIGHASH_SINGLE,
+                                    SIGHASH_ALL | SIGHASH_ANYONECANPAY,
+                                    SIGHASH_NONE | SIGHASH_ANYONECANPAY,
+                                    SIGHASH_SINGLE | SIGHASH_ANYONECANPAY,
+                                    4,
+                                    0x41};
+
+    for (int t = 0; t < 50; t++) {
+        // some of the transactions have fewer outputs than inputs, for SIGHASH_SINGLE
+        const CTransaction    tx = RandomTransaction(1 + insecure_rand() % 12, insecure_rand() % 8);
+        CSignatureHashContext context(tx);
+
+        // check the inputs out of order too, which restarts the context's hash state
+        std::vector<unsigned int> vInputs;
+        for (unsigned int i = 0; i <= tx.vin.size(); i++)
+            vInputs.push_back(i);
+        vInputs.push_back(insecure_rand() % tx.vin.size());
+        vInputs.push_back(0);
+
+        for (unsigned int nIn : vInputs) {
+            const CScript scriptCode = RandomScript();
+            for (int nHashType : hashTypes) {
+                const uint256 hashRef = ReferenceSignatureHash(scriptCode, tx, nIn, nHashType);
+                EXPECT_EQ(SignatureHash(scriptCode, tx, nIn, nHashType), hashRef);
+                EXPECT_EQ(context.GetHash(scriptCode, nIn, nHashType), hashRef);
+            }
+            const int nRandomHashType = insecure_rand();
+            EXPECT_EQ(context.GetHash(scriptCode, nIn, nRandomHashType),
+                      ReferenceSignatureHash(scriptCode, tx, nIn, nRandomHashType));
+        }
+    }
+}
+
+TEST(script_tests, signature_hash_context_signing)
+{
+    CBasicKeyStore keystore;
+    CTransaction   txFrom;
+    for (int i = 0; i < 20; i++) {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        keystore.AddKey(key);
+        txFrom.vout.push_back(CTxOut(1000 + i, GetScriptForDestination(key.GetPubKey().GetID())));
+    }
+
+    CTransaction txTo;
+    for (unsigned int i = 0; i < txFrom.vout.size(); i++)
+        txTo.vin.push_back(CTxIn(txFrom.GetHash(), i));
+    txTo.vout.push_back(CTxOut(5000, CScript() << OP_TRUE));
+
+    // the scriptSigs filled in while signing aren't part of the hash, so one context serves all inputs
+    CSignatureHashContext context(txTo);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        EXPECT_TRUE(SignSignature(keystore, txFrom, txTo, i, SIGHASH_ALL, &context));
+
+    for (unsigned int i = 0; i < txTo.vin.size(); i++) {
+        EXPECT_TRUE(VerifySignature(txFrom, txTo, i, true, true, 0));
+        EXPECT_TRUE(VerifySignature(txFrom, txTo, i, true, true, 0, &context));
+    }
+}
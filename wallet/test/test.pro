@@ -35,20 +35,29 @@ SOURCES += \
 
 SOURCES += \
     accounting_tests.cpp  \
+    addrindex_tests.cpp   \
     allocator_tests.cpp   \
     base32_tests.cpp      \
     base58_tests.cpp      \
     base64_tests.cpp      \
     bignum_tests.cpp      \
+    blockencodings_tests.cpp \
+    blockimport_tests.cpp \
+    blockprune_tests.cpp \
+    blockstore_tests.cpp \
     bloom_tests.cpp       \
     canonical_tests.cpp   \
+    coins_tests.cpp       \
     compress_tests.cpp    \
     crypter_tests.cpp     \
     db_tests.cpp          \
     getarg_tests.cpp      \
     hash_tests.cpp        \
+    headerchain_tests.cpp \
     key_tests.cpp         \
+    logging_tests.cpp     \
     mruset_tests.cpp      \
+    net_tests.cpp         \
     netbase_tests.cpp     \
     ntp1_tests.cpp        \
     pmt_tests.cpp         \
@@ -336,6 +336,7 @@ TEST(wallet_tests, coin_selection_tests)
     }
 }
 
+#include "blocklocator.h"
 #include "main.h"
 #include "txdb.h"
 
@@ -462,3 +463,543 @@ TEST(blockindex_tests, create)
     //                            const_cast<CBlock*>(this)->vchBlockSig.clear();
     //                        })
 }
+
+TEST(wallet_tests, load_wallet_records)
+{
+    std::string walletPath = std::string(TEST_ROOT_PATH) + "/data/wallet_load.dat";
+    if (boost::filesystem::exists(walletPath)) {
+        ASSERT_TRUE(boost::filesystem::remove(walletPath));
+    }
+
+    // more transactions than are loaded in one batch
+    static const int KEY_COUNT = 200;
+    static const int TX_COUNT  = 12000;
+
+    std::map<CKeyID, CSecret> mapSecrets;
+    std::set<uint256>         setTxHashes;
+    const uint256             hashCorrupt(12345);
+    {
+        CWalletDB walletdb(walletPath, "cr+");
+        for (int i = 0; i < KEY_COUNT; i++) {
+            CKey key;
+            key.MakeNewKey(i % 2 == 0);
+            ASSERT_TRUE(walletdb.WriteKey(key.GetPubKey(), key.GetPrivKey(), CKeyMetadata(GetTime())));
+            bool fCompressed;
+            mapSecrets[key.GetPubKey().GetID()] = key.GetSecret(fCompressed);
+        }
+        CWalletTx wtx;
+        wtx.vin.resize(1);
+        wtx.vout.resize(1);
+        wtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        for (int i = 0; i < TX_COUNT; i++) {
+            wtx.vin[0].prevout = COutPoint(uint256(i + 1), 0);
+            wtx.vout[0].nValue = i + 1;
+            ASSERT_TRUE(walletdb.WriteTx(wtx.GetHash(), wtx));
+            setTxHashes.insert(wtx.GetHash());
+        }
+        // stored under the wrong hash
+        ASSERT_TRUE(walletdb.WriteTx(hashCorrupt, wtx));
+    }
+
+    for (bool fDefer : {false, true}) {
+        mapArgs.set("-deferwalletchecks", fDefer ? "1" : "0");
+
+        CWallet  wallet(walletPath);
+        DBErrors nLoadWalletRet = CWalletDB(walletPath).LoadWallet(&wallet);
+
+        std::set<uint256> setLoaded;
+        for (const std::pair<const uint256, CWalletTx>& item : wallet.mapWallet)
+            setLoaded.insert(item.first);
+        std::set<CKeyID> setKeyIDs;
+        wallet.GetKeys(setKeyIDs);
+        EXPECT_EQ(setKeyIDs.size(), mapSecrets.size());
+        for (const std::pair<const CKeyID, CSecret>& item : mapSecrets) {
+            CKey key;
+            ASSERT_TRUE(wallet.GetKey(item.first, key));
+            bool fCompressed;
+            EXPECT_TRUE(key.GetSecret(fCompressed) == item.second);
+        }
+
+        if (!fDefer) {
+            // the corrupt transaction is left out
+            EXPECT_EQ(nLoadWalletRet, DB_NONCRITICAL_ERROR);
+            EXPECT_TRUE(setLoaded == setTxHashes);
+        } else {
+            // it's only found by the background checks, which drop it then
+            EXPECT_EQ(nLoadWalletRet, DB_LOAD_OK);
+            EXPECT_EQ(setLoaded.size(), setTxHashes.size() + 1);
+
+            unsigned int nBadTxs, nBadKeys;
+            EXPECT_TRUE(VerifyWalletRecords(&wallet, nBadTxs, nBadKeys));
+            EXPECT_EQ(nBadTxs, 1u);
+            EXPECT_EQ(nBadKeys, 0u);
+            setLoaded.clear();
+            for (const std::pair<const uint256, CWalletTx>& item : wallet.mapWallet)
+                setLoaded.insert(item.first);
+            EXPECT_TRUE(setLoaded == setTxHashes);
+        }
+    }
+    mapArgs.erase("-deferwalletchecks");
+
+    // the corrupt record was erased along with the transaction
+    CWallet  wallet(walletPath);
+    DBErrors nLoadWalletRet = CWalletDB(walletPath).LoadWallet(&wallet);
+    EXPECT_EQ(nLoadWalletRet, DB_LOAD_OK);
+    EXPECT_EQ(wallet.mapWallet.size(), setTxHashes.size());
+    EXPECT_EQ(wallet.mapWallet.count(hashCorrupt), 0u);
+}
+
+TEST(wallet_tests, rescan)
+{
+    CTxDB::DB_DIR = "test-txdb"; // avoid writing to the main database
+    CTxDB::__deleteDb();         // clean up
+    CTxDB::QuickSyncHigherControl_Enabled = false;
+
+    std::string walletPath = std::string(TEST_ROOT_PATH) + "/data/wallet_rescan.dat";
+    if (boost::filesystem::exists(walletPath)) {
+        ASSERT_TRUE(boost::filesystem::remove(walletPath));
+    }
+    CWallet wallet(walletPath);
+    ASSERT_EQ(CWalletDB(walletPath, "cr+").LoadWallet(&wallet), DB_LOAD_OK);
+
+    CKey key;
+    key.MakeNewKey(true);
+    ASSERT_TRUE(wallet.AddKey(key));
+    wallet.nTimeFirstKey = 1; // the blocks are older than the key
+    CScript scriptMine;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+    const CScript scriptOther = CScript() << OP_TRUE;
+
+    // more blocks than are read in one batch, with payments to the wallet in both batches, and a
+    // transaction that only spends from the wallet
+    static const int BLOCK_COUNT = 700;
+
+    const BlockIndexMapType          mapBlockIndexBefore = mapBlockIndex;
+    const CBlockIndexSmartPtr        pindexBestBefore    = boost::atomic_load(&pindexBest);
+    std::vector<CBlockIndexSmartPtr> vChain;
+    std::map<int, uint256>           mapWalletTxs; // by height
+    CTxDB                            txdb;
+    for (int nHeight = 0; nHeight < BLOCK_COUNT; nHeight++) {
+        CBlock block;
+        block.nVersion      = CBlock::CURRENT_VERSION;
+        block.hashPrevBlock = vChain.empty() ? uint256(0) : vChain.back()->GetBlockHash();
+        block.nTime         = 1500000000 + nHeight * 30;
+        block.nBits         = CBigNum(~uint256(0) >> 1).GetCompact();
+
+        CTransaction txCoinBase;
+        txCoinBase.vin.resize(1);
+        txCoinBase.vin[0].prevout.SetNull();
+        txCoinBase.vin[0].scriptSig = CScript() << nHeight;
+        txCoinBase.vout.push_back(CTxOut(COIN, scriptOther));
+        block.vtx.push_back(txCoinBase);
+
+        if (nHeight == 10 || nHeight == 520 || nHeight == 690) {
+            CTransaction tx;
+            tx.vin.push_back(CTxIn(COutPoint(uint256(nHeight + 1), 0)));
+            tx.vout.push_back(CTxOut(nHeight * COIN, scriptMine));
+            block.vtx.push_back(tx);
+            mapWalletTxs[nHeight] = tx.GetHash();
+        } else if (nHeight == 600) {
+            CTransaction tx;
+            tx.vin.push_back(CTxIn(COutPoint(mapWalletTxs[520], 0)));
+            tx.vout.push_back(CTxOut(COIN, scriptOther));
+            block.vtx.push_back(tx);
+            mapWalletTxs[nHeight] = tx.GetHash();
+        }
+        block.hashMerkleRoot = block.BuildMerkleTree();
+
+        const uint256 hash = block.GetHash();
+        ASSERT_TRUE(txdb.WriteBlock(hash, block));
+        CBlockIndexSmartPtr pindex = boost::make_shared<CBlockIndex>();
+        pindex->phashBlock         = &mapBlockIndex.insert(std::make_pair(hash, pindex)).first->first;
+        pindex->blockKeyInDB       = hash;
+        pindex->nHeight            = nHeight;
+        pindex->nTime              = block.nTime;
+        if (!vChain.empty()) {
+            pindex->pprev         = vChain.back();
+            vChain.back()->pnext = pindex;
+        }
+        vChain.push_back(pindex);
+    }
+    boost::atomic_store(&pindexBest, vChain.back());
+
+    EXPECT_EQ(wallet.ScanForWalletTransactions(vChain.front().get()), 4);
+    EXPECT_EQ(wallet.mapWallet.size(), 4u);
+    for (const std::pair<const int, uint256>& item : mapWalletTxs)
+        EXPECT_EQ(wallet.mapWallet.count(item.second), 1u) << "height " << item.first;
+    // the payment that was spent afterwards in the same batch is known to be spent
+    EXPECT_TRUE(wallet.mapWallet[mapWalletTxs[520]].IsSpent(0));
+    EXPECT_FALSE(wallet.mapWallet[mapWalletTxs[690]].IsSpent(0));
+    // the progress is only kept until the rescan is done
+    CBlockLocator locator;
+    EXPECT_FALSE(CWalletDB(walletPath).ReadRescanProgress(locator));
+
+    // an interrupted rescan continues from the block it saved
+    EXPECT_TRUE(CWalletDB(walletPath).WriteRescanProgress(CBlockLocator(vChain[550].get())));
+    ASSERT_TRUE(CWalletDB(walletPath).ReadRescanProgress(locator));
+    CBlockIndexSmartPtr pindexResume = locator.GetBlockIndex();
+    EXPECT_EQ(pindexResume, vChain[550]);
+
+    // a wallet that missed everything before finds what's after that block only; the spend of the
+    // payment it doesn't know isn't its own
+    std::string resumedPath = std::string(TEST_ROOT_PATH) + "/data/wallet_rescan_resumed.dat";
+    if (boost::filesystem::exists(resumedPath)) {
+        ASSERT_TRUE(boost::filesystem::remove(resumedPath));
+    }
+    CWallet walletResumed(resumedPath);
+    ASSERT_EQ(CWalletDB(resumedPath, "cr+").LoadWallet(&walletResumed), DB_LOAD_OK);
+    ASSERT_TRUE(walletResumed.AddKey(key));
+    walletResumed.nTimeFirstKey = 1;
+    EXPECT_EQ(walletResumed.ScanForWalletTransactions(pindexResume.get()), 1);
+    EXPECT_EQ(walletResumed.mapWallet.size(), 1u);
+    EXPECT_EQ(walletResumed.mapWallet.count(mapWalletTxs[690]), 1u);
+
+    for (const CBlockIndexSmartPtr& pindex : vChain)
+        pindex->pnext = nullptr;
+    mapBlockIndex = mapBlockIndexBefore;
+    boost::atomic_store(&pindexBest, pindexBestBefore);
+    txdb.Close();
+}
+
+// appends a block with the transactions to the chain in memory and makes it the best one; the wallet
+// transactions get the block's merkle branches, and a coinbase of no one's goes first unless the
+// first of them is one
+static CBlockIndexSmartPtr AppendTestBlock(std::vector<CBlockIndexSmartPtr>& vChain,
+                                           const std::vector<CWalletTx*>& vpwtx, int nSalt = 0)
+{
+    const int nHeight = vChain.size();
+    CBlock    block;
+    block.nVersion      = CBlock::CURRENT_VERSION;
+    block.hashPrevBlock = vChain.empty() ? uint256(0) : vChain.back()->GetBlockHash();
+    block.nTime         = 1500000000 + nHeight * 30;
+    block.nBits         = CBigNum(~uint256(0) >> 1).GetCompact();
+    if (vpwtx.empty() || !vpwtx[0]->IsCoinBase()) {
+        CTransaction txCoinBase;
+        txCoinBase.vin.resize(1);
+        txCoinBase.vin[0].prevout.SetNull();
+        txCoinBase.vin[0].scriptSig = CScript() << nHeight << nSalt;
+        txCoinBase.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE));
+        block.vtx.push_back(txCoinBase);
+    }
+    for (const CWalletTx* pwtx : vpwtx)
+        block.vtx.push_back(*pwtx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    const uint256 hash = block.GetHash();
+    for (CWalletTx* pwtx : vpwtx) {
+        pwtx->hashBlock = hash;
+        pwtx->nIndex    = std::find(block.vtx.begin(), block.vtx.end(), *pwtx) - block.vtx.begin();
+        pwtx->vMerkleBranch = block.GetMerkleBranch(pwtx->nIndex);
+    }
+
+    CBlockIndexSmartPtr pindex = boost::make_shared<CBlockIndex>();
+    pindex->phashBlock         = &mapBlockIndex.insert(std::make_pair(hash, pindex)).first->first;
+    pindex->nHeight            = nHeight;
+    pindex->nTime              = block.nTime;
+    pindex->hashMerkleRoot     = block.hashMerkleRoot;
+    if (!vChain.empty()) {
+        pindex->pprev         = vChain.back();
+        vChain.back()->pnext = pindex;
+    }
+    vChain.push_back(pindex);
+    boost::atomic_store(&pindexBest, pindex);
+    return pindex;
+}
+
+// takes the best block off the chain in memory, as a reorganization does
+static void DisconnectTestBlock(std::vector<CBlockIndexSmartPtr>& vChain)
+{
+    vChain.pop_back();
+    vChain.back()->pnext = nullptr;
+    boost::atomic_store(&pindexBest, vChain.back());
+}
+
+// the balances the way they were found before they were cached, by going through the whole wallet
+static CWalletBalanceCache::Balances ScanBalances(const CWallet& wallet)
+{
+    LOCK2(cs_main, wallet.cs_wallet);
+    CWalletBalanceCache::Balances balances;
+    for (const std::pair<const uint256, CWalletTx>& item : wallet.mapWallet) {
+        const CWalletTx& wtx = item.second;
+        if (wtx.IsTrusted())
+            balances.nBalance += wtx.GetAvailableCredit();
+        if (!IsFinalTx(wtx) || (!wtx.IsTrusted() && wtx.GetDepthInMainChain() == 0))
+            balances.nUnconfirmed += wtx.GetAvailableCredit();
+        if (wtx.GetBlocksToMaturity() > 0 && wtx.GetDepthInMainChain() > 0) {
+            if (wtx.IsCoinBase()) {
+                balances.nImmature += wallet.GetCredit(wtx);
+                balances.nNewMint += wallet.GetCredit(wtx);
+            }
+            if (wtx.IsCoinStake())
+                balances.nStake += wallet.GetCredit(wtx);
+        }
+    }
+    return balances;
+}
+
+static void ExpectCachedBalances(const CWallet& wallet, const std::string& strStep)
+{
+    const CWalletBalanceCache::Balances expected = ScanBalances(wallet);
+    EXPECT_EQ(wallet.GetBalance(), expected.nBalance) << strStep;
+    EXPECT_EQ(wallet.GetUnconfirmedBalance(), expected.nUnconfirmed) << strStep;
+    EXPECT_EQ(wallet.GetImmatureBalance(), expected.nImmature) << strStep;
+    EXPECT_EQ(wallet.GetStake(), expected.nStake) << strStep;
+    EXPECT_EQ(wallet.GetNewMint(), expected.nNewMint) << strStep;
+}
+
+TEST(wallet_tests, balance_cache)
+{
+    std::string walletPath = std::string(TEST_ROOT_PATH) + "/data/wallet_balance.dat";
+    if (boost::filesystem::exists(walletPath)) {
+        ASSERT_TRUE(boost::filesystem::remove(walletPath));
+    }
+    CWallet wallet(walletPath);
+    ASSERT_EQ(CWalletDB(walletPath, "cr+").LoadWallet(&wallet), DB_LOAD_OK);
+
+    CKey key;
+    key.MakeNewKey(true);
+    ASSERT_TRUE(wallet.AddKey(key));
+    CScript scriptMine;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+    const CScript scriptOther = CScript() << OP_TRUE;
+
+    const BlockIndexMapType          mapBlockIndexBefore = mapBlockIndex;
+    const CBlockIndexSmartPtr        pindexBestBefore    = boost::atomic_load(&pindexBest);
+    std::vector<CBlockIndexSmartPtr> vChain;
+    std::vector<CBlockIndexSmartPtr> vDisconnected;
+    for (int i = 0; i < 5; i++)
+        AppendTestBlock(vChain, {});
+    ExpectCachedBalances(wallet, "empty");
+
+    // a payment that's confirmed right away
+    CTransaction txPayment;
+    txPayment.vin.push_back(CTxIn(COutPoint(uint256(1), 0)));
+    txPayment.vout.push_back(CTxOut(10 * COIN, scriptMine));
+    CWalletTx wtxPayment(&wallet, txPayment);
+    AppendTestBlock(vChain, {&wtxPayment});
+    ASSERT_TRUE(wallet.AddToWallet(wtxPayment));
+    ExpectCachedBalances(wallet, "add");
+    EXPECT_EQ(wallet.GetBalance(), 10 * COIN);
+
+    // one that's only confirmed later
+    CTransaction txLater;
+    txLater.vin.push_back(CTxIn(COutPoint(uint256(2), 0)));
+    txLater.vout.push_back(CTxOut(5 * COIN, scriptMine));
+    CWalletTx wtxLater(&wallet, txLater);
+    ASSERT_TRUE(wallet.AddToWallet(wtxLater));
+    ExpectCachedBalances(wallet, "add unconfirmed");
+    AppendTestBlock(vChain, {&wtxLater});
+    ASSERT_TRUE(wallet.AddToWallet(wtxLater));
+    ExpectCachedBalances(wallet, "confirm");
+    EXPECT_EQ(wallet.GetBalance(), 15 * COIN);
+
+    // a coinbase of the wallet's, which is immature until the chain gets past its maturity
+    CTransaction txCoinBase;
+    txCoinBase.vin.resize(1);
+    txCoinBase.vin[0].prevout.SetNull();
+    txCoinBase.vin[0].scriptSig = CScript() << int(vChain.size());
+    txCoinBase.vout.push_back(CTxOut(7 * COIN, scriptMine));
+    CWalletTx wtxCoinBase(&wallet, txCoinBase);
+    const int nCoinBaseHeight = AppendTestBlock(vChain, {&wtxCoinBase})->nHeight;
+    ASSERT_TRUE(wallet.AddToWallet(wtxCoinBase));
+    ExpectCachedBalances(wallet, "coinbase");
+    EXPECT_EQ(wallet.GetImmatureBalance(), 7 * COIN);
+    for (int i = 0; i < CoinbaseMaturity(); i++) {
+        AppendTestBlock(vChain, {});
+        ExpectCachedBalances(wallet, "maturing " + std::to_string(i));
+    }
+    EXPECT_EQ(wallet.GetImmatureBalance(), 0);
+    EXPECT_EQ(wallet.GetBalance(), 22 * COIN);
+
+    // a spend of the first payment with change
+    CTransaction txSpend;
+    txSpend.vin.push_back(CTxIn(COutPoint(txPayment.GetHash(), 0)));
+    txSpend.vout.push_back(CTxOut(6 * COIN, scriptOther));
+    txSpend.vout.push_back(CTxOut(4 * COIN, scriptMine));
+    CWalletTx wtxSpend(&wallet, txSpend);
+    AppendTestBlock(vChain, {&wtxSpend});
+    ASSERT_TRUE(wallet.AddToWallet(wtxSpend));
+    ExpectCachedBalances(wallet, "spend");
+    EXPECT_TRUE(wallet.mapWallet[txPayment.GetHash()].IsSpent(0));
+    EXPECT_EQ(wallet.GetBalance(), 16 * COIN);
+
+    // the spend's block is replaced by another one, and the spend isn't in the chain anymore
+    vDisconnected.push_back(vChain.back());
+    DisconnectTestBlock(vChain);
+    AppendTestBlock(vChain, {}, 1);
+    ExpectCachedBalances(wallet, "reorg");
+    // and a deeper one takes the coinbase out of the chain as well
+    while (vChain.back()->nHeight >= nCoinBaseHeight) {
+        vDisconnected.push_back(vChain.back());
+        DisconnectTestBlock(vChain);
+    }
+    AppendTestBlock(vChain, {}, 2);
+    ExpectCachedBalances(wallet, "deep reorg");
+
+    for (const CBlockIndexSmartPtr& pindex : vChain)
+        pindex->pnext = nullptr;
+    for (const CBlockIndexSmartPtr& pindex : vDisconnected)
+        pindex->pnext = nullptr;
+    mapBlockIndex = mapBlockIndexBefore;
+    boost::atomic_store(&pindexBest, pindexBestBefore);
+}
+
+typedef std::set<std::tuple<uint256, unsigned int, int>> CoinTupleSet; // hash, output, depth
+
+static CoinTupleSet ToCoinTuples(const std::vector<COutput>& vCoins)
+{
+    CoinTupleSet setCoins;
+    for (const COutput& coin : vCoins)
+        setCoins.insert(std::make_tuple(coin.tx->GetHash(), (unsigned int)coin.i, coin.nDepth));
+    return setCoins;
+}
+
+// the coins the way they were listed before they were indexed, by going through the whole wallet
+static CoinTupleSet ScanAvailableCoins(const CWallet& wallet, bool fOnlyConfirmed)
+{
+    LOCK2(cs_main, wallet.cs_wallet);
+    CoinTupleSet setCoins;
+    for (const std::pair<const uint256, CWalletTx>& item : wallet.mapWallet) {
+        const CWalletTx& wtx = item.second;
+        if (!IsFinalTx(wtx) || (fOnlyConfirmed && !wtx.IsTrusted()))
+            continue;
+        if ((wtx.IsCoinBase() || wtx.IsCoinStake()) && wtx.GetBlocksToMaturity() > 0)
+            continue;
+        const int nDepth = wtx.GetDepthInMainChain();
+        if (nDepth < 0)
+            continue;
+        for (unsigned int i = 0; i < wtx.vout.size(); i++)
+            if (!wtx.IsSpent(i) && wallet.IsMine(wtx.vout[i]) &&
+                wtx.vout[i].nValue >= nMinimumInputValue)
+                setCoins.insert(std::make_tuple(item.first, i, nDepth));
+    }
+    return setCoins;
+}
+
+static CoinTupleSet ScanStakingCoins(const CWallet& wallet, unsigned int nSpendTime)
+{
+    LOCK2(cs_main, wallet.cs_wallet);
+    CoinTupleSet setCoins;
+    for (const std::pair<const uint256, CWalletTx>& item : wallet.mapWallet) {
+        const CWalletTx& wtx = item.second;
+        if (wtx.nTime + StakeMinAge() > nSpendTime || wtx.GetBlocksToMaturity() > 0)
+            continue;
+        const int nDepth = wtx.GetDepthInMainChain();
+        if (nDepth < 1)
+            continue;
+        for (unsigned int i = 0; i < wtx.vout.size(); i++)
+            if (!wtx.IsSpent(i) && wallet.IsMine(wtx.vout[i]) &&
+                wtx.vout[i].nValue >= nMinimumInputValue)
+                setCoins.insert(std::make_tuple(item.first, i, nDepth));
+    }
+    return setCoins;
+}
+
+static void ExpectIndexedCoins(const CWallet& wallet, const std::string& strStep)
+{
+    std::vector<COutput> vCoins;
+    for (bool fOnlyConfirmed : {true, false}) {
+        wallet.AvailableCoins(vCoins, fOnlyConfirmed);
+        EXPECT_TRUE(ToCoinTuples(vCoins) == ScanAvailableCoins(wallet, fOnlyConfirmed))
+            << strStep << (fOnlyConfirmed ? ", confirmed only" : "");
+    }
+    // early enough for none of the coins to be old enough, and late enough for all of them
+    for (unsigned int nSpendTime : {0u, (unsigned int)GetAdjustedTime() + 10 * StakeMinAge()}) {
+        wallet.AvailableCoinsForStaking(vCoins, nSpendTime);
+        EXPECT_TRUE(ToCoinTuples(vCoins) == ScanStakingCoins(wallet, nSpendTime))
+            << strStep << ", staking at " << nSpendTime;
+    }
+}
+
+TEST(wallet_tests, output_index)
+{
+    std::string walletPath = std::string(TEST_ROOT_PATH) + "/data/wallet_outputs.dat";
+    if (boost::filesystem::exists(walletPath)) {
+        ASSERT_TRUE(boost::filesystem::remove(walletPath));
+    }
+    CWallet wallet(walletPath);
+    ASSERT_EQ(CWalletDB(walletPath, "cr+").LoadWallet(&wallet), DB_LOAD_OK);
+
+    CKey key;
+    key.MakeNewKey(true);
+    ASSERT_TRUE(wallet.AddKey(key));
+    CScript scriptMine;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+    const CScript scriptOther = CScript() << OP_TRUE;
+
+    const BlockIndexMapType          mapBlockIndexBefore = mapBlockIndex;
+    const CBlockIndexSmartPtr        pindexBestBefore    = boost::atomic_load(&pindexBest);
+    std::vector<CBlockIndexSmartPtr> vChain;
+    std::vector<CBlockIndexSmartPtr> vDisconnected;
+    for (int i = 0; i < 5; i++)
+        AppendTestBlock(vChain, {});
+    ExpectIndexedCoins(wallet, "empty");
+
+    // a payment with two outputs of the wallet's and one of someone else's
+    CTransaction txPayment;
+    txPayment.vin.push_back(CTxIn(COutPoint(uint256(1), 0)));
+    txPayment.vout.push_back(CTxOut(10 * COIN, scriptMine));
+    txPayment.vout.push_back(CTxOut(3 * COIN, scriptMine));
+    txPayment.vout.push_back(CTxOut(2 * COIN, scriptOther));
+    CWalletTx wtxPayment(&wallet, txPayment);
+    const int nPaymentHeight = AppendTestBlock(vChain, {&wtxPayment})->nHeight;
+    ASSERT_TRUE(wallet.AddToWallet(wtxPayment));
+    ExpectIndexedCoins(wallet, "add");
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins);
+    EXPECT_EQ(vCoins.size(), 2u);
+
+    // one that isn't confirmed
+    CTransaction txUnconfirmed;
+    txUnconfirmed.vin.push_back(CTxIn(COutPoint(uint256(2), 0)));
+    txUnconfirmed.vout.push_back(CTxOut(5 * COIN, scriptMine));
+    ASSERT_TRUE(wallet.AddToWallet(CWalletTx(&wallet, txUnconfirmed)));
+    ExpectIndexedCoins(wallet, "add unconfirmed");
+
+    // a spend of the first output with change
+    CTransaction txSpend;
+    txSpend.vin.push_back(CTxIn(COutPoint(txPayment.GetHash(), 0)));
+    txSpend.vout.push_back(CTxOut(6 * COIN, scriptOther));
+    txSpend.vout.push_back(CTxOut(4 * COIN, scriptMine));
+    CWalletTx wtxSpend(&wallet, txSpend);
+    AppendTestBlock(vChain, {&wtxSpend});
+    ASSERT_TRUE(wallet.AddToWallet(wtxSpend));
+    ExpectIndexedCoins(wallet, "spend");
+    wallet.AvailableCoins(vCoins);
+    EXPECT_EQ(vCoins.size(), 2u);
+
+    // a coinstake of the second output, which is immature
+    CTransaction txCoinStake;
+    txCoinStake.vin.push_back(CTxIn(COutPoint(txPayment.GetHash(), 1)));
+    txCoinStake.vout.push_back(CTxOut(0, CScript()));
+    txCoinStake.vout.push_back(CTxOut(3 * COIN + COIN / 2, scriptMine));
+    ASSERT_TRUE(txCoinStake.IsCoinStake());
+    CWalletTx wtxCoinStake(&wallet, txCoinStake);
+    AppendTestBlock(vChain, {&wtxCoinStake});
+    ASSERT_TRUE(wallet.AddToWallet(wtxCoinStake));
+    ExpectIndexedCoins(wallet, "stake");
+    EXPECT_TRUE(wallet.mapWallet[txPayment.GetHash()].IsSpent(1));
+
+    // the coinstake's block is disconnected, and its input is the wallet's to spend again
+    vDisconnected.push_back(vChain.back());
+    DisconnectTestBlock(vChain);
+    wallet.DisableTransaction(txCoinStake);
+    ExpectIndexedCoins(wallet, "disconnect stake");
+    EXPECT_FALSE(wallet.mapWallet[txPayment.GetHash()].IsSpent(1));
+    wallet.AvailableCoins(vCoins);
+    const int nPaymentDepth = vChain.back()->nHeight - nPaymentHeight + 1;
+    EXPECT_EQ(ToCoinTuples(vCoins).count(std::make_tuple(txPayment.GetHash(), 1u, nPaymentDepth)), 1u);
+
+    // and the spend's block with it
+    vDisconnected.push_back(vChain.back());
+    DisconnectTestBlock(vChain);
+    AppendTestBlock(vChain, {}, 1);
+    ExpectIndexedCoins(wallet, "disconnect spend");
+
+    for (const CBlockIndexSmartPtr& pindex : vChain)
+        pindex->pnext = nullptr;
+    for (const CBlockIndexSmartPtr& pindex : vDisconnected)
+        pindex->pnext = nullptr;
+    mapBlockIndex = mapBlockIndexBefore;
+    boost::atomic_store(&pindexBest, pindexBestBefore);
+}
@@ -0,0 +1,248 @@
+#include "tokenindex.h"
+
+#include <map>
+
+#include "block.h"
+#include "main.h"
+#include "net.h"
+#include "ntp1/ntp1transaction.h"
+#include "txdb.h"
+#include "util.h"
+
+boost::atomic<bool> fTokenIndex(false);
+boost::atomic<bool> fTokenIndexSynced(false);
+boost::atomic<int>  nTokenIndexHeight(-1);
+
+CIndexBuild tokenIndexBuild("token index", "tokenindex", THREAD_TOKENINDEX, &CTxDB::ReadTokenIndexHeight,
+                            &CTxDB::WriteTokenIndexHeight, &CTxDB::EraseTokenIndex,
+                            &ConnectBlockTokenIndex, fTokenIndex, fTokenIndexSynced, nTokenIndexHeight);
+
+namespace {
+/** What a transaction did with a token */
+struct CTxTokenChange
+{
+    CTokenIndexTransfer transfer;
+    std::string         strSymbol;
+    // how the balances of the addresses changed
+    std::map<uint160, std::pair<CScript, NTP1Int>> mapBalances;
+};
+
+typedef std::map<std::string, CTxTokenChange> TxTokenChanges;
+
+/** Adds the tokens of an output to the changes, as going out of the transaction, or into it when the
+ * output is one of its inputs */
+void AddTokens(TxTokenChanges& changes, const NTP1TxOut& ntp1txout, bool fOutput)
+{
+    const std::vector<unsigned char> vch = ParseHex(ntp1txout.getScriptPubKeyHex());
+    const CScript                    scriptPubKey(vch.begin(), vch.end());
+    uint160                          scriptHash;
+    const bool                       fAddress = GetAddrIndexScriptHash(scriptPubKey, scriptHash);
+
+    for (unsigned long i = 0; i < ntp1txout.tokenCount(); i++) {
+        const NTP1TokenTxData& token  = ntp1txout.getToken(i);
+        const NTP1Int          amount = token.getAmount();
+        CTxTokenChange&        change = changes[token.getTokenId()];
+        if (change.strSymbol.empty())
+            change.strSymbol = token.getTokenSymbol();
+        if (fOutput) {
+            change.transfer.nAmountOut += amount;
+            change.transfer.vRecipients.push_back(std::make_pair(scriptPubKey, amount));
+        } else {
+            change.transfer.nAmountIn += amount;
+        }
+        if (!fAddress)
+            continue;
+        std::pair<CScript, NTP1Int>& balance = change.mapBalances[scriptHash];
+        balance.first                        = scriptPubKey;
+        balance.second += fOutput ? amount : NTP1Int(-amount);
+    }
+}
+
+/** The tokens a transaction moved: the tokens of the outputs it spent, as they were written with the
+ * NTP1 transactions that made them, against the tokens of its own outputs. fConsistent is set to false
+ * when they don't match the transaction. */
+bool GetTxTokenChanges(CTxDB& txdb, const CTransaction& tx, TxTokenChanges& changes, bool& fConsistent)
+{
+    changes.clear();
+    if (!tx.IsCoinBase()) {
+        for (const CTxIn& txin : tx.vin) {
+            NTP1Transaction ntp1txPrev;
+            // the output has no tokens unless it's of an NTP1 transaction
+            if (!txdb.ReadNTP1Tx(txin.prevout.hash, ntp1txPrev))
+                continue;
+            if (txin.prevout.n >= ntp1txPrev.getTxOutCount()) {
+                printf("GetTxTokenChanges() : the input %s:%u isn't in its NTP1 transaction\n",
+                       txin.prevout.hash.ToString().c_str(), txin.prevout.n);
+                fConsistent = false;
+                return true;
+            }
+            AddTokens(changes, ntp1txPrev.getTxOut(txin.prevout.n), false);
+        }
+    }
+
+    const uint256   txid = tx.GetHash();
+    NTP1Transaction ntp1tx;
+    if (NTP1Transaction::IsTxNTP1(&tx) && txdb.ReadNTP1Tx(txid, ntp1tx))
+        for (unsigned long i = 0; i < ntp1tx.getTxOutCount(); i++)
+            AddTokens(changes, ntp1tx.getTxOut(i), true);
+
+    // tokens are created by their issuance only, so a transaction that has more of a token than it
+    // spent issued it
+    for (TxTokenChanges::value_type& change : changes) {
+        CTokenIndexTransfer& transfer = change.second.transfer;
+        if (transfer.nAmountOut > transfer.nAmountIn)
+            transfer.nType = TOKEN_TRANSFER_ISSUANCE;
+        else if (transfer.nAmountOut < transfer.nAmountIn)
+            transfer.nType = TOKEN_TRANSFER_BURN;
+        else
+            transfer.nType = TOKEN_TRANSFER_TRANSFER;
+    }
+    return true;
+}
+
+/** Adds the token movements of a transaction to the token index, or takes them out of it. Stops with
+ * fConsistent set to false when the index doesn't match the transaction, e.g. when a balance would go
+ * negative; the database failing is an error. */
+bool IndexTxTokens(CTxDB& txdb, const CTransaction& tx, uint32_t nHeight, bool fConnect,
+                   bool& fConsistent)
+{
+    TxTokenChanges changes;
+    if (!GetTxTokenChanges(txdb, tx, changes, fConsistent))
+        return false;
+    if (!fConsistent)
+        return true;
+
+    const uint256 txid = tx.GetHash();
+    for (const TxTokenChanges::value_type& entry : changes) {
+        const std::string&    tokenId = entry.first;
+        const CTxTokenChange& change  = entry.second;
+
+        CTokenIndexInfo info;
+        if (!txdb.ReadTokenIndexInfo(tokenId, info)) {
+            if (!fConnect) {
+                printf("IndexTxTokens() : token %s isn't in the token index\n", tokenId.c_str());
+                fConsistent = false;
+                return true;
+            }
+            info.issueTxid    = txid;
+            info.nIssueHeight = nHeight;
+            info.strSymbol    = change.strSymbol;
+        }
+
+        const NTP1Int nSupplyChange = change.transfer.nAmountOut - change.transfer.nAmountIn;
+        NTP1Int&      nTotal        = nSupplyChange > 0 ? info.nMinted : info.nBurned;
+        const NTP1Int nAmount       = nSupplyChange > 0 ? nSupplyChange : NTP1Int(-nSupplyChange);
+        nTotal += fConnect ? nAmount : NTP1Int(-nAmount);
+
+        for (const auto& balanceChange : change.mapBalances) {
+            if (balanceChange.second.second == 0)
+                continue;
+            const CTokenIndexHolderKey key(tokenId, balanceChange.first);
+            CTokenIndexHolder          holder;
+            if (!txdb.ReadTokenIndexHolder(key, holder)) {
+                holder.nBalance     = 0;
+                holder.scriptPubKey = balanceChange.second.first;
+            }
+            const bool fHeld = holder.nBalance > 0;
+            holder.nBalance += fConnect ? balanceChange.second.second
+                                        : NTP1Int(-balanceChange.second.second);
+            if (holder.nBalance < 0) {
+                printf("IndexTxTokens() : the balance of %s of token %s went negative in %s\n",
+                       HexStr(balanceChange.second.first.begin(), balanceChange.second.first.end())
+                           .c_str(),
+                       tokenId.c_str(), txid.ToString().c_str());
+                fConsistent = false;
+                return true;
+            }
+            if (holder.nBalance > 0) {
+                info.nHolders += fHeld ? 0 : 1;
+                if (!txdb.WriteTokenIndexHolder(key, holder))
+                    return error("IndexTxTokens() : failed to write a holder of token %s",
+                                 tokenId.c_str());
+            } else {
+                info.nHolders -= fHeld ? 1 : 0;
+                if (!txdb.EraseTokenIndexHolder(key))
+                    return error("IndexTxTokens() : failed to erase a holder of token %s",
+                                 tokenId.c_str());
+            }
+        }
+
+        const CTokenIndexTransferKey transferKey(tokenId, nHeight, txid);
+        if (fConnect) {
+            info.nTransfers++;
+            if (!txdb.WriteTokenIndexTransfer(transferKey, change.transfer))
+                return error("IndexTxTokens() : failed to write transaction %s of token %s",
+                             txid.ToString().c_str(), tokenId.c_str());
+        } else {
+            info.nTransfers--;
+            if (!txdb.EraseTokenIndexTransfer(transferKey))
+                return error("IndexTxTokens() : failed to erase transaction %s of token %s",
+                             txid.ToString().c_str(), tokenId.c_str());
+        }
+
+        // the token goes with the last of its transactions, which is its issuance
+        const bool fOk = info.nTransfers > 0 ? txdb.WriteTokenIndexInfo(tokenId, info)
+                                             : txdb.EraseTokenIndexInfo(tokenId);
+        if (!fOk)
+            return error("IndexTxTokens() : failed to write token %s", tokenId.c_str());
+    }
+    return true;
+}
+
+} // namespace
+
+std::string TokenTransferTypeToString(int nType)
+{
+    switch (nType) {
+    case TOKEN_TRANSFER_ISSUANCE:
+        return "issuance";
+    case TOKEN_TRANSFER_TRANSFER:
+        return "transfer";
+    case TOKEN_TRANSFER_BURN:
+        return "burn";
+    default:
+        return "unknown";
+    }
+}
+
+bool ConnectBlockTokenIndex(CTxDB& txdb, const CBlock& block, int nHeight)
+{
+    int nIndexHeight = -1;
+    if (!txdb.ReadTokenIndexHeight(nIndexHeight))
+        return error("ConnectBlockTokenIndex() : failed to read the height of the token index");
+    // the background build gets to the block later
+    if (nIndexHeight != nHeight - 1)
+        return true;
+
+    bool fConsistent = true;
+    for (unsigned int i = 0; i < block.vtx.size() && fConsistent; i++)
+        if (!IndexTxTokens(txdb, block.vtx[i], nHeight, true, fConsistent))
+            return error("ConnectBlockTokenIndex() : failed to index block %s",
+                         block.GetHash().ToString().c_str());
+    if (!fConsistent)
+        return MarkIndexForRebuild(txdb, tokenIndexBuild, block, nHeight);
+    return txdb.WriteTokenIndexHeight(nHeight);
+}
+
+bool DisconnectBlockTokenIndex(CTxDB& txdb, const CBlock& block, int nHeight)
+{
+    int nIndexHeight = -1;
+    if (!txdb.ReadTokenIndexHeight(nIndexHeight))
+        return error("DisconnectBlockTokenIndex() : failed to read the height of the token index");
+    if (nIndexHeight < nHeight)
+        return true;
+    if (nIndexHeight > nHeight)
+        return error("DisconnectBlockTokenIndex() : block %s isn't at the top of the token index",
+                     block.GetHash().ToString().c_str());
+
+    // the NTP1 transactions stay in the database when their block is disconnected, so the same
+    // movements are found as when the block was connected
+    bool fConsistent = true;
+    for (int i = block.vtx.size() - 1; i >= 0 && fConsistent; i--)
+        if (!IndexTxTokens(txdb, block.vtx[i], nHeight, false, fConsistent))
+            return error("DisconnectBlockTokenIndex() : failed to take block %s out of the index",
+                         block.GetHash().ToString().c_str());
+    if (!fConsistent)
+        return MarkIndexForRebuild(txdb, tokenIndexBuild, block, nHeight);
+    return txdb.WriteTokenIndexHeight(nHeight - 1);
+}
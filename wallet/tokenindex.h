@@ -0,0 +1,139 @@
+#ifndef TOKENINDEX_H
+#define TOKENINDEX_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/atomic.hpp>
+
+#include "addrindex.h"
+#include "indexbuild.h"
+#include "ntp1/ntp1script.h"
+#include "script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+class CBlock;
+class CTxDB;
+
+/** -tokenindex */
+extern boost::atomic<bool> fTokenIndex;
+
+/** Whether the token index has caught up with the main chain, after which it's kept up to date by
+ * ConnectBlock() and DisconnectBlock() */
+extern boost::atomic<bool> fTokenIndexSynced;
+
+/** How far the background build of the token index got: the main chain is indexed up to this height,
+ * or -1 if nothing is */
+extern boost::atomic<int> nTokenIndexHeight;
+
+/** The background build of the token index (see InitIndexBuild()) */
+extern CIndexBuild tokenIndexBuild;
+
+/** What a transaction did with a token */
+enum TokenTransferType
+{
+    TOKEN_TRANSFER_ISSUANCE = 0,
+    TOKEN_TRANSFER_TRANSFER = 1,
+    // fewer tokens came out of the transaction than went in; either burned on purpose (NTP1Script_Burn)
+    // or spent by a transaction that doesn't carry them on
+    TOKEN_TRANSFER_BURN = 2,
+};
+
+/** What's known of a token: its issuance, and how many of it there are and where */
+struct CTokenIndexInfo
+{
+    uint256     issueTxid;
+    uint32_t    nIssueHeight;
+    std::string strSymbol;
+    NTP1Int     nMinted;
+    NTP1Int     nBurned;
+    uint64_t    nHolders;
+    uint64_t    nTransfers;
+
+    CTokenIndexInfo() : nIssueHeight(0), nMinted(0), nBurned(0), nHolders(0), nTransfers(0) {}
+
+    IMPLEMENT_SERIALIZE(READWRITE(issueTxid); READWRITE(nIssueHeight); READWRITE(strSymbol);
+                        READWRITE(nMinted); READWRITE(nBurned); READWRITE(nHolders);
+                        READWRITE(nTransfers);)
+};
+
+/** The key of the balance of a token at an address (see GetAddrIndexScriptHash()) */
+struct CTokenIndexHolderKey
+{
+    std::string tokenId;
+    uint160     scriptHash;
+
+    CTokenIndexHolderKey() {}
+    CTokenIndexHolderKey(const std::string& tokenIdIn, const uint160& scriptHashIn)
+        : tokenId(tokenIdIn), scriptHash(scriptHashIn)
+    {
+    }
+
+    bool operator<(const CTokenIndexHolderKey& other) const
+    {
+        return tokenId < other.tokenId || (tokenId == other.tokenId && scriptHash < other.scriptHash);
+    }
+
+    IMPLEMENT_SERIALIZE(READWRITE(tokenId); READWRITE(scriptHash);)
+};
+
+/** The balance of an address, with the script that pays to it, so that the address can be shown */
+struct CTokenIndexHolder
+{
+    NTP1Int nBalance;
+    CScript scriptPubKey;
+
+    CTokenIndexHolder() : nBalance(0) {}
+
+    IMPLEMENT_SERIALIZE(READWRITE(nBalance); READWRITE(scriptPubKey);)
+};
+
+/** The key of a transaction that moved a token; the transactions of a token are in the order of
+ * their blocks */
+struct CTokenIndexTransferKey
+{
+    std::string tokenId;
+    uint32_t    nHeight;
+    uint256     txid;
+
+    CTokenIndexTransferKey() : nHeight(0) {}
+    CTokenIndexTransferKey(const std::string& tokenIdIn, uint32_t nHeightIn, const uint256& txidIn)
+        : tokenId(tokenIdIn), nHeight(nHeightIn), txid(txidIn)
+    {
+    }
+
+    IMPLEMENT_SERIALIZE(READWRITE(tokenId); READWRITE(BIGENDIAN32(nHeight)); READWRITE(txid);)
+};
+
+struct CTokenIndexTransfer
+{
+    int                                      nType; // TokenTransferType
+    NTP1Int                                  nAmountIn;
+    NTP1Int                                  nAmountOut;
+    std::vector<std::pair<CScript, NTP1Int>> vRecipients;
+
+    CTokenIndexTransfer() : nType(TOKEN_TRANSFER_TRANSFER), nAmountIn(0), nAmountOut(0) {}
+
+    IMPLEMENT_SERIALIZE(READWRITE(nType); READWRITE(nAmountIn); READWRITE(nAmountOut);
+                        READWRITE(vRecipients);)
+};
+
+std::string TokenTransferTypeToString(int nType);
+
+/**
+ * Adds the token movements of a block of the main chain to the token index, and moves its height to
+ * the block's; does nothing unless the index is up to the block before, since the background build
+ * gets to the block otherwise (see ThreadIndexBuild()). The tokens of the block's transactions
+ * and their inputs are read from the NTP1 transactions, which have to be written already. An index
+ * that doesn't match the block is marked to be built again (see MarkIndexForRebuild()) rather
+ * than failing the block.
+ */
+bool ConnectBlockTokenIndex(CTxDB& txdb, const CBlock& block, int nHeight);
+
+/** Takes the block out of the token index, if the index is up to it */
+bool DisconnectBlockTokenIndex(CTxDB& txdb, const CBlock& block, int nHeight);
+
+#endif // TOKENINDEX_H
@@ -4,6 +4,7 @@
 #include "bignum.h"
 #include "block.h"
 #include "checkpoints.h"
+#include "coins.h"
 #include "init.h"
 #include "main.h"
 #include "txindex.h"
@@ -180,7 +181,9 @@ unsigned int CTransaction::GetLegacySigOpCount() const
     return nSigOps;
 }
 
-bool CTransaction::CheckTransaction() const
+bool CTransaction::CheckTransaction() const { return CheckTransaction(MaxBlockSize()); }
+
+bool CTransaction::CheckTransaction(unsigned int nSizeLimit) const
 {
     // Basic checks that don't depend on any context
     if (vin.empty())
@@ -188,7 +191,6 @@ bool CTransaction::CheckTransaction() const
     if (vout.empty())
         return DoS(10, error("CTransaction::CheckTransaction() : vout empty"));
     // Size limits
-    unsigned int nSizeLimit = MaxBlockSize();
     if (::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION) > nSizeLimit)
         return DoS(100, error("CTransaction::CheckTransaction() : size limits failed"));
 
@@ -259,8 +261,11 @@ int64_t CTransaction::GetMinFee(unsigned int nBlockSize, enum GetMinFee_mode mod
 
 bool CTransaction::ReadFromDisk(CDiskTxPos pos, CTxDB& txdb) { return txdb.ReadTx(pos, *this); }
 
-bool CTransaction::DisconnectInputs(CTxDB& txdb)
+bool CTransaction::DisconnectInputs(CTxDB& txdb, CCoinsViewCache& view, const CTxUndo& txundo)
 {
+    if (!UndoCoins(view, txundo))
+        return false;
+
     // Relinquish previous transactions' spent pointers
     if (!IsCoinBase()) {
         for (const CTxIn& txin : vin) {
@@ -292,6 +297,77 @@ bool CTransaction::DisconnectInputs(CTxDB& txdb)
     return true;
 }
 
+bool CTransaction::UndoCoins(CCoinsViewCache& inputs, const CTxUndo& txundo) const
+{
+    // The outputs of this transaction go away (whatever spent them was taken back already)
+    inputs.SetCoins(GetHash(), CCoins());
+
+    if (IsCoinBase())
+        return true;
+
+    if (txundo.vprevout.size() != vin.size())
+        return error("UndoCoins() : transaction and undo data inconsistent");
+
+    // in reverse order, so that the input that spent the last output of a transaction, whose undo
+    // data has the metadata of the transaction, is the first to be restored
+    for (unsigned int i = vin.size(); i-- > 0;) {
+        const COutPoint& prevout = vin[i].prevout;
+        const CTxInUndo& undo    = txundo.vprevout[i];
+
+        if (!inputs.HaveCoins(prevout.hash) || inputs.GetCoins(prevout.hash).IsPruned()) {
+            // the whole transaction was spent, so its metadata has to be restored as well
+            if (undo.nHeight == 0)
+                return error("UndoCoins() : undo data of %s:%u is missing its transaction",
+                             prevout.hash.ToString().c_str(), prevout.n);
+            CCoins coins;
+            coins.fCoinBase  = undo.fCoinBase;
+            coins.nHeight    = undo.nHeight;
+            coins.nVersion   = undo.nVersion;
+            coins.fCoinStake = undo.fCoinStake;
+            coins.nTime      = undo.nTime;
+            inputs.SetCoins(prevout.hash, coins);
+        }
+        CCoins& coins = inputs.GetCoins(prevout.hash);
+        if (coins.IsAvailable(prevout.n))
+            return error("UndoCoins() : undo data overwrites the unspent output %s:%u",
+                         prevout.hash.ToString().c_str(), prevout.n);
+        if (coins.vout.size() <= prevout.n)
+            coins.vout.resize(prevout.n + 1);
+        coins.vout[prevout.n] = undo.txout;
+    }
+    return true;
+}
+
+bool CTransaction::ReadUndoFromDisk(CTxDB& txdb, CTxUndo& txundo) const
+{
+    txundo.vprevout.clear();
+    if (IsCoinBase())
+        return true;
+
+    for (const CTxIn& txin : vin) {
+        const COutPoint& prevout = txin.prevout;
+
+        CTransaction txPrev;
+        CTxIndex     txindex;
+        if (!txdb.ReadDiskTx(prevout.hash, txPrev, txindex))
+            return error("ReadUndoFromDisk() : ReadDiskTx prev tx %s failed",
+                         prevout.hash.ToString().c_str());
+        if (prevout.n >= txPrev.vout.size())
+            return error("ReadUndoFromDisk() : prevout.n out of range");
+        BlockIndexMapType::const_iterator mi = mapBlockIndex.find(txindex.pos.nBlockPos);
+        if (mi == mapBlockIndex.end())
+            return error("ReadUndoFromDisk() : the block of prev tx %s is not in the index",
+                         prevout.hash.ToString().c_str());
+
+        // the metadata is always there, since it's not known which of the inputs spent the last
+        // output of the transaction
+        txundo.vprevout.push_back(CTxInUndo(txPrev.vout[prevout.n], txPrev.IsCoinBase(),
+                                            mi->second->nHeight, txPrev.nVersion,
+                                            txPrev.IsCoinStake(), txPrev.nTime));
+    }
+    return true;
+}
+
 bool CTransaction::FetchInputs(CTxDB& txdb, const std::map<uint256, CTxIndex>& mapTestPool, bool fBlock,
                                bool fMiner, MapPrevTx& inputsRet, bool& fInvalid)
 {
@@ -304,6 +380,9 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const std::map<uint256, CTxIndex>& m
     if (IsCoinBase())
         return true; // Coinbase transactions have no inputs to fetch.
 
+    // the inputs are looked up in one read transaction, unless txdb is in a write transaction
+    CTxDBReadSnapshot snapshot(!txdb.IsInWriteTxn());
+
     for (unsigned int i = 0; i < vin.size(); i++) {
         COutPoint prevout = vin[i].prevout;
         if (inputsRet.count(prevout.hash))
@@ -375,6 +454,13 @@ const CTxOut& CTransaction::GetOutputFor(const CTxIn& input, const MapPrevTx& in
     return txPrev.vout[input.prevout.n];
 }
 
+const CTxOut& CTransaction::GetOutputFor(const CTxIn& input, CCoinsViewCache& inputs) const
+{
+    const CCoins& coins = inputs.GetCoins(input.prevout.hash);
+    assert(coins.IsAvailable(input.prevout.n));
+    return coins.vout[input.prevout.n];
+}
+
 int64_t CTransaction::GetValueIn(const MapPrevTx& inputs) const
 {
     if (IsCoinBase())
@@ -387,6 +473,18 @@ int64_t CTransaction::GetValueIn(const MapPrevTx& inputs) const
     return nResult;
 }
 
+int64_t CTransaction::GetValueIn(CCoinsViewCache& inputs) const
+{
+    if (IsCoinBase())
+        return 0;
+
+    int64_t nResult = 0;
+    for (unsigned int i = 0; i < vin.size(); i++) {
+        nResult += GetOutputFor(vin[i], inputs).nValue;
+    }
+    return nResult;
+}
+
 unsigned int CTransaction::GetP2SHSigOpCount(const MapPrevTx& inputs) const
 {
     if (IsCoinBase())
@@ -401,6 +499,20 @@ unsigned int CTransaction::GetP2SHSigOpCount(const MapPrevTx& inputs) const
     return nSigOps;
 }
 
+unsigned int CTransaction::GetP2SHSigOpCount(CCoinsViewCache& inputs) const
+{
+    if (IsCoinBase())
+        return 0;
+
+    unsigned int nSigOps = 0;
+    for (unsigned int i = 0; i < vin.size(); i++) {
+        const CTxOut& prevout = GetOutputFor(vin[i], inputs);
+        if (prevout.scriptPubKey.IsPayToScriptHash())
+            nSigOps += prevout.scriptPubKey.GetSigOpCount(vin[i].scriptSig);
+    }
+    return nSigOps;
+}
+
 bool CTransaction::ConnectInputs(CTxDB& /*txdb*/, MapPrevTx inputs,
                                  std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
                                  const ConstCBlockIndexSmartPtr& pindexBlock, bool fBlock, bool fMiner)
@@ -455,6 +567,7 @@ bool CTransaction::ConnectInputs(CTxDB& /*txdb*/, MapPrevTx inputs,
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
+        CSignatureHashContext sigHashContext(*this);
         for (unsigned int i = 0; i < vin.size(); i++) {
             COutPoint prevout = vin[i].prevout;
             assert(inputs.count(prevout.hash) > 0);
@@ -476,10 +589,12 @@ bool CTransaction::ConnectInputs(CTxDB& /*txdb*/, MapPrevTx inputs,
             if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate()))) {
                 // Verify signature
                 bool fStrictPayToScriptHash = true;
-                if (!VerifySignature(txPrev, *this, i, fStrictPayToScriptHash, false, 0)) {
+                if (!VerifySignature(txPrev, *this, i, fStrictPayToScriptHash, false, 0,
+                                     &sigHashContext)) {
                     // only during transition phase for P2SH: do not invoke anti-DoS code for
                     // potentially old clients relaying bad P2SH transactions
-                    if (fStrictPayToScriptHash && VerifySignature(txPrev, *this, i, false, false, 0))
+                    if (fStrictPayToScriptHash &&
+                        VerifySignature(txPrev, *this, i, false, false, 0, &sigHashContext))
                         return error("ConnectInputs() : %s P2SH VerifySignature failed",
                                      GetHash().ToString().c_str());
 
@@ -524,6 +639,168 @@ bool CTransaction::ConnectInputs(CTxDB& /*txdb*/, MapPrevTx inputs,
     return true;
 }
 
+bool CTransaction::HaveInputs(CCoinsViewCache& inputs) const
+{
+    if (IsCoinBase())
+        return true;
+
+    // first check whether information about the prevout hash is available
+    for (const CTxIn& txin : vin) {
+        if (!inputs.HaveCoins(txin.prevout.hash))
+            return false;
+    }
+    // then check whether the actual outputs are available
+    for (const CTxIn& txin : vin) {
+        if (!inputs.GetCoins(txin.prevout.hash).IsAvailable(txin.prevout.n))
+            return false;
+    }
+    return true;
+}
+
+bool CTransaction::ConnectInputs(CCoinsViewCache& inputs, const ConstCBlockIndexSmartPtr& pindexBlock,
+                                 bool fBlock, bool fMiner) const
+{
+    if (IsCoinBase())
+        return true;
+
+    // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
+    // for an attacker to attempt to split the network.
+    if (!HaveInputs(inputs))
+        return fMiner ? false
+                      : error("ConnectInputs() : %s inputs unavailable", GetHash().ToString().c_str());
+
+    int64_t nValueIn = 0;
+    int64_t nFees    = 0;
+    for (unsigned int i = 0; i < vin.size(); i++) {
+        const COutPoint& prevout = vin[i].prevout;
+        const CCoins&    coins   = inputs.GetCoins(prevout.hash);
+
+        // If prev is coinbase or coinstake, check that it's matured
+        if (coins.IsCoinBase() || coins.IsCoinStake()) {
+            const int nDepth = pindexBlock->nHeight - coins.nHeight;
+            if (nDepth < CoinbaseMaturity())
+                return error("ConnectInputs() : tried to spend %s at depth %d",
+                             coins.IsCoinBase() ? "coinbase" : "coinstake", nDepth);
+        }
+
+        // ppcoin: check transaction timestamp
+        if (coins.nTime > nTime)
+            return DoS(100,
+                       error("ConnectInputs() : transaction timestamp earlier than input transaction"));
+
+        // Check for negative or overflow input values
+        nValueIn += coins.vout[prevout.n].nValue;
+        if (!MoneyRange(coins.vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            return DoS(100, error("ConnectInputs() : txin values out of range"));
+    }
+    // The first loop above does all the inexpensive checks.
+    // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
+    // Helps prevent CPU exhaustion attacks.
+
+    // Skip ECDSA signature verification when connecting blocks (fBlock=true)
+    // before the last blockchain checkpoint. This is safe because block merkle hashes are
+    // still computed and checked, and any change will be caught at the next checkpoint.
+    if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate()))) {
+        CSignatureHashContext sigHashContext(*this);
+        for (unsigned int i = 0; i < vin.size(); i++) {
+            const CScript& scriptPubKey = GetOutputFor(vin[i], inputs).scriptPubKey;
+
+            // Verify signature
+            bool fStrictPayToScriptHash = true;
+            if (!VerifyScript(vin[i].scriptSig, scriptPubKey, *this, i, fStrictPayToScriptHash, false, 0,
+                              &sigHashContext)) {
+                // only during transition phase for P2SH: do not invoke anti-DoS code for
+                // potentially old clients relaying bad P2SH transactions
+                if (fStrictPayToScriptHash &&
+                    VerifyScript(vin[i].scriptSig, scriptPubKey, *this, i, false, false, 0,
+                                 &sigHashContext))
+                    return error("ConnectInputs() : %s P2SH VerifySignature failed",
+                                 GetHash().ToString().c_str());
+
+                return DoS(100, error("ConnectInputs() : %s VerifySignature failed",
+                                      GetHash().ToString().c_str()));
+            }
+        }
+    }
+
+    if (!IsCoinStake()) {
+        if (nValueIn < GetValueOut())
+            return DoS(100, error("ConnectInputs() : %s value in < value out",
+                                  GetHash().ToString().c_str()));
+
+        // Tally transaction fees
+        int64_t nTxFee = nValueIn - GetValueOut();
+        if (nTxFee < 0)
+            return DoS(100, error("ConnectInputs() : %s nTxFee < 0", GetHash().ToString().c_str()));
+
+        // enforce transaction fees for every block
+        if (nTxFee < GetMinFee())
+            return fBlock ? DoS(100, error("ConnectInputs() : %s not paying required fee=%s, paid=%s",
+                                           GetHash().ToString().c_str(),
+                                           FormatMoney(GetMinFee()).c_str(),
+                                           FormatMoney(nTxFee).c_str()))
+                          : false;
+
+        nFees += nTxFee;
+        if (!MoneyRange(nFees))
+            return DoS(100, error("ConnectInputs() : nFees out of range"));
+    }
+
+    return true;
+}
+
+bool CTransaction::UpdateCoins(CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight) const
+{
+    // mark inputs spent
+    if (!IsCoinBase()) {
+        for (const CTxIn& txin : vin) {
+            if (!inputs.HaveCoins(txin.prevout.hash))
+                return error("UpdateCoins() : prev tx %s not found",
+                             txin.prevout.hash.ToString().c_str());
+            txundo.vprevout.push_back(CTxInUndo());
+            if (!inputs.GetCoins(txin.prevout.hash).Spend(txin.prevout, txundo.vprevout.back()))
+                return error("UpdateCoins() : cannot spend input %s:%u",
+                             txin.prevout.hash.ToString().c_str(), txin.prevout.n);
+        }
+    }
+
+    // add outputs
+    return inputs.SetCoins(GetHash(), CCoins(*this, nHeight));
+}
+
+bool CTransaction::UpdateCoins(CCoinsViewCache& inputs, int nHeight) const
+{
+    CTxUndo txundo;
+    return UpdateCoins(inputs, txundo, nHeight);
+}
+
+bool CTransaction::MarkSpentInTxIndex(CTxDB& txdb, std::map<uint256, CTxIndex>& mapTestPool,
+                                      const CDiskTxPos& posThisTx) const
+{
+    if (IsCoinBase())
+        return true;
+
+    for (const CTxIn& txin : vin) {
+        const COutPoint& prevout = txin.prevout;
+
+        std::map<uint256, CTxIndex>::iterator it = mapTestPool.find(prevout.hash);
+        if (it == mapTestPool.end()) {
+            CTxIndex txindex;
+            if (!txdb.ReadTxIndex(prevout.hash, txindex))
+                return error("MarkSpentInTxIndex() : %s prev tx %s index entry not found",
+                             GetHash().ToString().c_str(), prevout.hash.ToString().c_str());
+            it = mapTestPool.insert(std::make_pair(prevout.hash, txindex)).first;
+        }
+        if (prevout.n >= it->second.vSpent.size())
+            return DoS(100, error("MarkSpentInTxIndex() : %s prevout.n out of range %d %" PRIszu
+                                  " prev tx %s",
+                                  GetHash().ToString().c_str(), prevout.n, it->second.vSpent.size(),
+                                  prevout.hash.ToString().c_str()));
+        it->second.vSpent[prevout.n] = posThisTx;
+    }
+    return true;
+}
+
 // ppcoin: total coin age spent in transaction, in the unit of coin-days.
 // Only those coins meeting minimum age requirement counts. As those
 // transactions not in main chain are not currently indexed so we
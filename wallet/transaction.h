@@ -13,6 +13,8 @@
 #include <vector>
 
 class CTransaction;
+class CCoinsViewCache;
+class CTxUndo;
 
 enum GetMinFee_mode
 {
@@ -89,6 +91,7 @@ public:
         @see CTransaction::FetchInputs
         */
     unsigned int GetP2SHSigOpCount(const MapPrevTx& mapInputs) const;
+    unsigned int GetP2SHSigOpCount(CCoinsViewCache& inputs) const;
 
     /** Amount of bitcoins spent by this transaction.
         @return sum of all outputs (note: does not include fees)
@@ -104,6 +107,7 @@ public:
             @see CTransaction::FetchInputs
         */
     int64_t GetValueIn(const MapPrevTx& mapInputs) const;
+    int64_t GetValueIn(CCoinsViewCache& inputs) const;
 
     int64_t GetMinFee(unsigned int nBlockSize = 1, enum GetMinFee_mode mode = GMF_BLOCK,
                       unsigned int nBytes = 0) const;
@@ -126,7 +130,13 @@ public:
 
     bool ReadFromDisk(CTxDB& txdb, COutPoint prevout, CTxIndex& txindexRet);
     bool ReadFromDisk(CTxDB& txdb, COutPoint prevout);
-    bool DisconnectInputs(CTxDB& txdb);
+
+    /** Takes this transaction back in the view (see UndoCoins()) and in the transaction index */
+    bool DisconnectInputs(CTxDB& txdb, CCoinsViewCache& view, const CTxUndo& txundo);
+
+    /** Puts the undo data of this transaction together from the transactions it spends, for blocks
+        that were connected before undo data was written */
+    bool ReadUndoFromDisk(CTxDB& txdb, CTxUndo& txundo) const;
 
     /** Fetch from memory and/or disk. inputsRet keys are transaction hashes.
 
@@ -155,7 +165,32 @@ public:
     bool ConnectInputs(CTxDB& txdb, MapPrevTx inputs, std::map<uint256, CTxIndex>& mapTestPool,
                        const CDiskTxPos& posThisTx, const ConstCBlockIndexSmartPtr& pindexBlock,
                        bool fBlock, bool fMiner);
+
+    /** Whether all the outputs this transaction spends are unspent in the view */
+    bool HaveInputs(CCoinsViewCache& inputs) const;
+
+    /** The checks of ConnectInputs() above, with the outputs being spent taken from a coins view
+        instead of the transaction index (see HaveInputs()). Nothing is changed; see UpdateCoins()
+        and MarkSpentInTxIndex().
+        */
+    bool ConnectInputs(CCoinsViewCache& inputs, const ConstCBlockIndexSmartPtr& pindexBlock, bool fBlock,
+                       bool fMiner) const;
+
+    /** Spends the outputs of the inputs in the view, and adds the outputs of this transaction.
+        What was spent is appended to txundo, for DisconnectInputs(). */
+    bool UpdateCoins(CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight) const;
+    bool UpdateCoins(CCoinsViewCache& inputs, int nHeight) const;
+
+    /** The reverse of UpdateCoins(): removes the outputs of this transaction from the view, and
+        restores the outputs it spent from txundo */
+    bool UndoCoins(CCoinsViewCache& inputs, const CTxUndo& txundo) const;
+
+    /** Marks the outputs of the inputs spent by posThisTx in the transaction index */
+    bool MarkSpentInTxIndex(CTxDB& txdb, std::map<uint256, CTxIndex>& mapTestPool,
+                            const CDiskTxPos& posThisTx) const;
     bool CheckTransaction() const;
+    /** CheckTransaction() with the size limit given (see CBlock::CheckBlock()) */
+    bool CheckTransaction(unsigned int nSizeLimit) const;
     bool GetCoinAge(CTxDB& txdb, uint64_t& nCoinAge) const; // ppcoin: get transaction coin age
 
     [[nodiscard]] static CTransaction FetchTxFromDisk(const uint256& txid);
@@ -172,6 +207,7 @@ public:
 
 protected:
     const CTxOut& GetOutputFor(const CTxIn& input, const MapPrevTx& inputs) const;
+    const CTxOut& GetOutputFor(const CTxIn& input, CCoinsViewCache& inputs) const;
 };
 
 #endif // TRANSACTION_H
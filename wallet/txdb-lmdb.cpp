@@ -4,18 +4,26 @@
 // file license.txt or http://www.opensource.org/licenses/mit-license.php.
 
 #include <map>
+#include <set>
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/scope_exit.hpp>
 #include <boost/thread/future.hpp>
+#include <boost/thread/tss.hpp>
 #include <boost/version.hpp>
 #include <random>
 
+#include "addrindex.h"
+#include "blockprune.h"
 #include "checkpoints.h"
 #include "kernel.h"
 #include "main.h"
+#include "net.h"
+#include "init.h"
+#include "tokenindex.h"
 #include "txdb.h"
+#include "ui_interface.h"
 #include "util.h"
 
 #include "SerializationTester.h"
@@ -29,6 +37,17 @@ DbSmartPtrType glob_db_tx(nullptr, [](MDB_dbi*) {});
 DbSmartPtrType glob_db_ntp1Tx(nullptr, [](MDB_dbi*) {});
 DbSmartPtrType glob_db_ntp1tokenNames(nullptr, [](MDB_dbi*) {});
 DbSmartPtrType glob_db_addrsVsPubKeys(nullptr, [](MDB_dbi*) {});
+DbSmartPtrType glob_db_coins(nullptr, [](MDB_dbi*) {});
+DbSmartPtrType glob_db_blockUndo(nullptr, [](MDB_dbi*) {});
+DbSmartPtrType glob_db_blockPos(nullptr, [](MDB_dbi*) {});
+DbSmartPtrType glob_db_prunedTx(nullptr, [](MDB_dbi*) {});
+DbSmartPtrType glob_db_addrIndex(nullptr, [](MDB_dbi*) {});
+DbSmartPtrType glob_db_addrUtxos(nullptr, [](MDB_dbi*) {});
+DbSmartPtrType glob_db_tokenInfo(nullptr, [](MDB_dbi*) {});
+DbSmartPtrType glob_db_tokenHolders(nullptr, [](MDB_dbi*) {});
+DbSmartPtrType glob_db_tokenTransfers(nullptr, [](MDB_dbi*) {});
+
+std::unique_ptr<CBlockStore> glob_blockStore;
 
 using namespace std;
 using namespace boost;
@@ -37,7 +56,318 @@ boost::filesystem::path CTxDB::DB_DIR                         = "txlmdb";
 bool                    CTxDB::QuickSyncHigherControl_Enabled = true;
 
 std::atomic<uint64_t> mdb_txn_safe::num_active_txns{0};
-std::atomic_flag      mdb_txn_safe::creation_gate = ATOMIC_FLAG_INIT;
+std::atomic<bool>     mdb_txn_safe::creation_gate{false};
+
+std::atomic<uint64_t> CTxDBBatchScope::nMaxBytes{32 * ONE_MB};
+std::atomic<int>      CTxDBBatchScope::nSyncLevel{2};
+
+namespace {
+struct CTxDBThreadBatch
+{
+    std::unique_ptr<mdb_txn_safe> txn;     // begun when it's first used
+    std::vector<MDB_txn*>         vNested; // the transactions of the CTxDBs, innermost last
+    uint64_t                      nBytes     = 0;
+    int64_t                       nBeginTime = 0;
+
+    ~CTxDBThreadBatch();
+};
+
+boost::thread_specific_ptr<CTxDBThreadBatch> threadBatch;
+
+std::atomic<int>          nBatchScopes{0};
+std::atomic<int>          nOpenBatchTxns{0};   // the batches whose transaction is begun, of all threads
+std::atomic<unsigned int> nBatchSyncFlags{0}; // set on the environment while there are batches
+std::atomic<int64_t>      nLastBatchSync{0};
+
+// a batch that failed to commit is aborted with it
+CTxDBThreadBatch::~CTxDBThreadBatch()
+{
+    if (txn)
+        nOpenBatchTxns--;
+}
+
+bool IsBatchDue(const CTxDBThreadBatch& batch)
+{
+    return batch.txn && (batch.nBytes >= CTxDBBatchScope::nMaxBytes ||
+                         GetTimeMillis() - batch.nBeginTime >= CTxDBBatchScope::MAX_AGE_MS);
+}
+
+// the blocks have to be on disk before the positions of their records are committed
+void FlushBlockStore()
+{
+    if (glob_blockStore && !glob_blockStore->Flush())
+        throw std::runtime_error("Failed to sync the block files to disk");
+}
+
+// how much of a block is read for a transaction at first; the rest is read if it's not enough
+const uint32_t FIRST_READ_SIZE = 64 * 1024;
+
+/** Deserializes value at nOffset into the block at pos in the block files, reading nFirstLen bytes
+ * at first and the rest of the block if that's not enough */
+template <typename T>
+bool ReadFromBlockFile(const CBlockFilePos& pos, uint32_t nOffset, uint32_t nFirstLen, T& value,
+                       int serializationTypeModifiers)
+{
+    std::vector<char> vch;
+    for (uint32_t nLen = nFirstLen;; nLen = pos.nSize) {
+        if (!glob_blockStore->ReadPart(pos, nOffset, nLen, vch))
+            return false;
+        try {
+            CDataStream ss(vch, SER_DISK | serializationTypeModifiers, CLIENT_VERSION);
+            ss >> value;
+            return true;
+        } catch (std::exception& ex) {
+            if (nOffset + vch.size() >= pos.nSize)
+                return error("ReadFromBlockFile() : failed to deserialize at %u into the block at %u "
+                             "in file %u: %s",
+                             nOffset, pos.nPos, pos.nFile, ex.what());
+        }
+    }
+}
+
+void CommitThreadBatch(CTxDBThreadBatch& batch)
+{
+    assert(batch.vNested.empty());
+    if (!batch.txn)
+        return;
+    FlushBlockStore();
+    std::unique_ptr<mdb_txn_safe> txn = std::move(batch.txn);
+    nOpenBatchTxns--;
+    const uint64_t                nBytes = batch.nBytes;
+    batch.nBytes                         = 0;
+    txn->commit("Failed to commit a batch of blocks to the db");
+    LogPrint(LOG_DB, "Committed a batch of %" PRIu64 " bytes, begun %" PRId64 "ms ago\n", nBytes,
+             GetTimeMillis() - batch.nBeginTime);
+
+    if (nBatchSyncFlags && GetTimeMillis() - nLastBatchSync >= CTxDBBatchScope::SYNC_INTERVAL_MS) {
+        mdb_env_sync(dbEnv.get(), 1);
+        nLastBatchSync = GetTimeMillis();
+    }
+}
+
+/** Commits the batch, and shuts the node down if that fails. The blocks of the batch are in the
+ * block index in memory already, which the database is behind of then; nothing can be written on
+ * top of that. Returns false if the commit failed. */
+bool CommitThreadBatchOrShutdown(CTxDBThreadBatch& batch)
+{
+    try {
+        CommitThreadBatch(batch);
+        return true;
+    } catch (std::exception& e) {
+        fShutdown = true;
+        const std::string strMessage =
+            _("Error: Failed to write a batch of blocks to the database. The node has to shut down.");
+        strMiscWarning = strMessage;
+        printf("*** %s (%s)\n", strMessage.c_str(), e.what());
+        uiInterface.ThreadSafeMessageBox(strMessage, "neblio",
+                                         CClientUIInterface::OK | CClientUIInterface::ICON_ERROR |
+                                             CClientUIInterface::MODAL);
+        StartShutdown();
+        return false;
+    }
+}
+
+// the nested transaction is over, whether it was committed or not
+void EndNestedTxn(MDB_txn* txn)
+{
+    CTxDBThreadBatch* batch = threadBatch.get();
+    if (batch && !batch->vNested.empty() && batch->vNested.back() == txn)
+        batch->vNested.pop_back();
+}
+} // namespace
+
+CTxDBBatchScope::CTxDBBatchScope() : fOuter(false)
+{
+    // a scope inside another one just adds to its batch
+    if (nMaxBytes == 0 || !dbEnv || threadBatch.get())
+        return;
+    threadBatch.reset(new CTxDBThreadBatch);
+    fOuter = true;
+
+    if (nBatchScopes++ == 0 && nSyncLevel < 2) {
+        nBatchSyncFlags = (nSyncLevel == 0 ? MDB_NOSYNC : MDB_NOMETASYNC);
+        nLastBatchSync  = GetTimeMillis();
+        mdb_env_set_flags(dbEnv.get(), nBatchSyncFlags, 1);
+    }
+}
+
+CTxDBBatchScope::~CTxDBBatchScope()
+{
+    if (!fOuter)
+        return;
+    CommitThreadBatchOrShutdown(*threadBatch);
+    threadBatch.reset();
+
+    if (--nBatchScopes == 0 && nBatchSyncFlags) {
+        mdb_env_set_flags(dbEnv.get(), nBatchSyncFlags, 0);
+        nBatchSyncFlags = 0;
+        mdb_env_sync(dbEnv.get(), 1);
+    }
+}
+
+bool CTxDBBatchScope::IsDue() const
+{
+    // without a batch, every block is committed on its own
+    return !threadBatch.get() || IsBatchDue(*threadBatch);
+}
+
+bool CTxDBBatchScope::IsActive() { return threadBatch.get() != nullptr; }
+
+void CTxDBBatchScope::CountWrite(size_t nBytes)
+{
+    CTxDBThreadBatch* batch = threadBatch.get();
+    if (batch)
+        batch->nBytes += nBytes;
+}
+
+namespace {
+/** The read transaction of a thread (see CTxDBReadSnapshot) */
+struct CTxDBThreadReader
+{
+    MDB_txn* txn    = nullptr; // reset while nDepth is 0
+    int      nDepth = 0;       // the snapshots and reads that use it
+};
+
+boost::mutex                 csThreadReaders;
+std::set<CTxDBThreadReader*> setThreadReaders; // to end them before the environment is closed
+
+void DeleteThreadReader(CTxDBThreadReader* reader)
+{
+    boost::lock_guard<boost::mutex> lock(csThreadReaders);
+    setThreadReaders.erase(reader);
+    if (reader->txn) {
+        if (reader->nDepth > 0)
+            mdb_txn_safe::leave_txn();
+        mdb_txn_abort(reader->txn);
+    }
+    delete reader;
+}
+
+boost::thread_specific_ptr<CTxDBThreadReader> threadReader(DeleteThreadReader);
+
+CTxDBThreadReader* GetThreadReader()
+{
+    CTxDBThreadReader* reader = threadReader.get();
+    if (!reader) {
+        reader = new CTxDBThreadReader;
+        threadReader.reset(reader);
+        boost::lock_guard<boost::mutex> lock(csThreadReaders);
+        setThreadReaders.insert(reader);
+    }
+    return reader;
+}
+
+bool RenewThreadReader(CTxDBThreadReader& reader)
+{
+    mdb_txn_safe::enter_txn();
+    int rc = reader.txn ? mdb_txn_renew(reader.txn)
+                        : mdb_txn_begin(dbEnv.get(), nullptr, MDB_RDONLY, &reader.txn);
+    if (rc == MDB_MAP_RESIZED) {
+        // another process grew the map; it's taken over without this transaction counting
+        mdb_txn_safe::leave_txn();
+        if (reader.txn) {
+            mdb_txn_abort(reader.txn);
+            reader.txn = nullptr;
+        }
+        lmdb_resized(dbEnv.get());
+        mdb_txn_safe::enter_txn();
+        rc = mdb_txn_begin(dbEnv.get(), nullptr, MDB_RDONLY, &reader.txn);
+    }
+    if (rc) {
+        mdb_txn_safe::leave_txn();
+        if (reader.txn) {
+            mdb_txn_abort(reader.txn);
+            reader.txn = nullptr;
+        }
+        return error("Failed to begin transaction at read with error code %i; and error: %s", rc,
+                     mdb_strerror(rc));
+    }
+    return true;
+}
+} // namespace
+
+CTxDBReadSnapshot::CTxDBReadSnapshot(bool fBegin) : txn(nullptr)
+{
+    // the reads of a thread with a batch go to the batch
+    if (!fBegin || CTxDBBatchScope::IsActive())
+        return;
+    CTxDBThreadReader* reader = GetThreadReader();
+    if (reader->nDepth == 0 && !RenewThreadReader(*reader))
+        return;
+    // it may have been ended by EndAll() under a snapshot
+    if (!reader->txn)
+        return;
+    reader->nDepth++;
+    txn = reader->txn;
+}
+
+CTxDBReadSnapshot::~CTxDBReadSnapshot()
+{
+    if (!txn)
+        return;
+    CTxDBThreadReader* reader = threadReader.get();
+    if (--reader->nDepth == 0 && reader->txn) {
+        mdb_txn_reset(reader->txn);
+        mdb_txn_safe::leave_txn();
+    }
+}
+
+bool CTxDBReadSnapshot::IsActive()
+{
+    CTxDBThreadReader* reader = threadReader.get();
+    return reader && reader->nDepth > 0;
+}
+
+void CTxDBReadSnapshot::EndAll()
+{
+    boost::lock_guard<boost::mutex> lock(csThreadReaders);
+    for (CTxDBThreadReader* reader : setThreadReaders) {
+        if (!reader->txn)
+            continue;
+        if (reader->nDepth > 0)
+            mdb_txn_safe::leave_txn();
+        mdb_txn_abort(reader->txn);
+        reader->txn = nullptr;
+    }
+}
+
+namespace {
+// what can be written before need_resize() has to look at the map again, conservatively
+std::atomic<uint64_t> nResizeWriteCredit{0};
+std::atomic<uint64_t> nDbPageSize{4096};
+
+std::atomic<uint64_t> nDbResizes{0};
+std::atomic<uint64_t> nDbProactiveResizes{0};
+std::atomic<int64_t>  nDbStallMicrosTotal{0};
+std::atomic<int64_t>  nDbStallMicrosMax{0};
+std::atomic<int64_t>  nDbLastResizeTime{0};
+
+int64_t GetMicrosSince(const boost::chrono::steady_clock::time_point& start)
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+               boost::chrono::steady_clock::now() - start)
+        .count();
+}
+
+void RecordResize(int64_t nStallMicros, bool fProactive)
+{
+    nDbResizes++;
+    if (fProactive)
+        nDbProactiveResizes++;
+    nDbStallMicrosTotal += nStallMicros;
+    int64_t nMax = nDbStallMicrosMax;
+    while (nStallMicros > nMax && !nDbStallMicrosMax.compare_exchange_weak(nMax, nStallMicros)) {
+    }
+    nDbLastResizeTime = GetTime();
+    // the map changed, so the next write looks at it again
+    nResizeWriteCredit = 0;
+}
+
+uint64_t GetUsedSize(const MDB_envinfo& mei, const MDB_stat& mst)
+{
+    return mst.ms_psize * mei.me_last_pgno;
+}
+} // namespace
 
 // threshold_size is used for batch transactions
 bool CTxDB::need_resize(uint64_t threshold_size)
@@ -53,12 +383,13 @@ bool CTxDB::need_resize(uint64_t threshold_size)
     MDB_stat mst;
 
     mdb_env_stat(dbEnv.get(), &mst);
+    nDbPageSize = mst.ms_psize;
 
     // size_used doesn't include data yet to be committed, which can be
     // significant size during batch transactions. For that, we estimate the size
     // needed at the beginning of the batch transaction and pass in the
     // additional size needed.
-    uint64_t size_used = mst.ms_psize * mei.me_last_pgno;
+    uint64_t size_used = GetUsedSize(mei, mst);
 
 #ifdef DEEP_LMDB_LOGGING
     printf("DB map size:     %zu\n", mei.me_mapsize);
@@ -80,7 +411,9 @@ bool CTxDB::need_resize(uint64_t threshold_size)
             return false;
     }
 
-    if ((double)size_used / mei.me_mapsize > resize_percent) {
+    const uint64_t size_limit = (double)mei.me_mapsize * resize_percent;
+    nResizeWriteCredit        = size_used < size_limit ? size_limit - size_used : 0;
+    if (size_used >= size_limit) {
         printf("Mapsize threshold met (percent-based)\n");
         return true;
     }
@@ -90,8 +423,77 @@ bool CTxDB::need_resize(uint64_t threshold_size)
 #endif
 }
 
+bool CTxDB::need_resize_for_write(uint64_t nBytes)
+{
+    // looking at the map for every write is a waste when it's far from full, so each write takes from
+    // the room there was left below the threshold at the last look, and only once that's used up is it
+    // looked at again
+    const uint64_t nCost   = nBytes + DB_PAGES_PER_WRITE * nDbPageSize;
+    uint64_t       nCredit = nResizeWriteCredit;
+    while (nCredit >= nCost) {
+        if (nResizeWriteCredit.compare_exchange_weak(nCredit, nCredit - nCost))
+            return false;
+    }
+    return need_resize();
+}
+
+void CTxDB::check_resize_on_next_write() { nResizeWriteCredit = 0; }
+
+bool CTxDB::need_proactive_resize()
+{
+#if defined(ENABLE_AUTO_RESIZE)
+    if (!dbEnv)
+        return false;
+    MDB_envinfo mei;
+    mdb_env_info(dbEnv.get(), &mei);
+    MDB_stat mst;
+    mdb_env_stat(dbEnv.get(), &mst);
+    const uint64_t size_used = GetUsedSize(mei, mst);
+    // a batch needs room for twice its size when it's begun (see GetBatchTxn()), with some to spare
+    const uint64_t nBatchReserve = 4 * CTxDBBatchScope::nMaxBytes;
+    return size_used > (double)mei.me_mapsize * DB_PROACTIVE_RESIZE_PERCENT ||
+           mei.me_mapsize - std::min<uint64_t>(size_used, mei.me_mapsize) < nBatchReserve;
+#else
+    return false;
+#endif
+}
+
+uint64_t CTxDB::GetNextMapSize(uint64_t nMapSize, uint64_t nIncrease, uint64_t nPageSize)
+{
+    // growing by a part of the size, rather than by a fixed amount, keeps the number of resizes
+    // logarithmic in the size of the database
+    uint64_t nGrowth = std::min(std::max(nMapSize / 2, DB_MIN_MAP_GROWTH), DB_MAX_MAP_GROWTH);
+    nGrowth          = std::max(nGrowth, nIncrease);
+
+    uint64_t nNewSize = nMapSize + nGrowth;
+    if (nPageSize > 0 && nNewSize % nPageSize != 0)
+        nNewSize += nPageSize - nNewSize % nPageSize;
+    return nNewSize;
+}
+
+CLMDBResizeStats CTxDB::GetResizeStats()
+{
+    CLMDBResizeStats stats;
+    if (dbEnv) {
+        MDB_envinfo mei;
+        mdb_env_info(dbEnv.get(), &mei);
+        MDB_stat mst;
+        mdb_env_stat(dbEnv.get(), &mst);
+        stats.nMapSize  = mei.me_mapsize;
+        stats.nUsedSize = GetUsedSize(mei, mst);
+    }
+    stats.nResizes          = nDbResizes;
+    stats.nProactiveResizes = nDbProactiveResizes;
+    stats.nStallMicrosTotal = nDbStallMicrosTotal;
+    stats.nStallMicrosMax   = nDbStallMicrosMax;
+    stats.nLastResizeTime   = nDbLastResizeTime;
+    return stats;
+}
+
 void lmdb_resized(MDB_env* env)
 {
+    const boost::chrono::steady_clock::time_point stallStart = boost::chrono::steady_clock::now();
+
     mdb_txn_safe::prevent_new_txns();
     BOOST_SCOPE_EXIT(void) { mdb_txn_safe::allow_new_txns(); }
     BOOST_SCOPE_EXIT_END
@@ -111,6 +513,7 @@ void lmdb_resized(MDB_env* env)
 
     mdb_env_info(env, &mei);
     uint64_t new_mapsize = mei.me_mapsize;
+    RecordResize(GetMicrosSince(stallStart), false);
 
     std::stringstream ss;
     ss << "LMDB Mapsize increased."
@@ -122,7 +525,19 @@ void lmdb_resized(MDB_env* env)
 void CTxDB::do_resize(uint64_t increase_size)
 {
     printf("CTxDB::%s\n", __func__);
-    const uint64_t add_size = 1LL << 30;
+
+    MDB_envinfo mei;
+
+    mdb_env_info(dbEnv.get(), &mei);
+
+    MDB_stat mst;
+
+    mdb_env_stat(dbEnv.get(), &mst);
+
+    // grow geometrically, or by increase_size if that's more; it's given at the start of a batch txn
+    // as an estimate of what the batch needs
+    const uint64_t new_mapsize = GetNextMapSize(mei.me_mapsize, increase_size, mst.ms_psize);
+    const uint64_t add_size    = new_mapsize - mei.me_mapsize;
 
     // check disk capacity
     try {
@@ -139,26 +554,24 @@ void CTxDB::do_resize(uint64_t increase_size)
         throw std::runtime_error("Unable to query free disk space.");
     }
 
-    MDB_envinfo mei;
-
-    mdb_env_info(dbEnv.get(), &mei);
-
-    MDB_stat mst;
-
-    mdb_env_stat(dbEnv.get(), &mst);
-
-    // add 1Gb per resize, instead of doing a percentage increase
-    uint64_t new_mapsize = (double)mei.me_mapsize + add_size;
-
-    // If given, use increase_size instead of above way of resizing.
-    // This is currently used for increasing by an estimated size at start of new
-    // batch txn.
-    if (increase_size > 0)
-        new_mapsize = mei.me_mapsize + increase_size;
+    // the resize would wait for the snapshot forever; the write that needs the room fails instead
+    if (CTxDBReadSnapshot::IsActive()) {
+        printf("The LMDB map can't be resized while a read snapshot is open on the same thread\n");
+        return;
+    }
 
-    new_mapsize += (new_mapsize % mst.ms_psize);
+    const boost::chrono::steady_clock::time_point stallStart = boost::chrono::steady_clock::now();
 
-    mdb_txn_safe::prevent_new_txns();
+    // A batch of another thread only ends once that thread commits it, which may take up to
+    // CTxDBBatchScope::MAX_AGE_MS; the gate is only taken while no batch is open, so that the other
+    // transactions aren't held up for that long. This thread never has a batch of its own open here.
+    while (true) {
+        mdb_txn_safe::prevent_new_txns();
+        if (nOpenBatchTxns == 0)
+            break;
+        mdb_txn_safe::allow_new_txns();
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+    }
     BOOST_SCOPE_EXIT(void) { mdb_txn_safe::allow_new_txns(); }
     BOOST_SCOPE_EXIT_END
 
@@ -169,15 +582,94 @@ void CTxDB::do_resize(uint64_t increase_size)
 
     mdb_txn_safe::wait_no_active_txns();
 
+    // another thread may have resized the map while this one was waiting
+    MDB_envinfo meiNow;
+    mdb_env_info(dbEnv.get(), &meiNow);
+    if (meiNow.me_mapsize != mei.me_mapsize && meiNow.me_mapsize - mei.me_mapsize >= increase_size) {
+        nResizeWriteCredit = 0;
+        return;
+    }
+
     int result = mdb_env_set_mapsize(dbEnv.get(), new_mapsize);
     if (result)
         throw std::runtime_error("Failed to set new mapsize: " + std::to_string(result));
+    RecordResize(GetMicrosSince(stallStart), false);
 
     std::stringstream ss;
     ss << "LMDB Mapsize increased."
        << "  Old: " << mei.me_mapsize / (1024 * 1024) << "MiB"
-       << ", New: " << new_mapsize / (1024 * 1024) << "MiB";
-    printf("%s", ss.str().c_str());
+       << ", New: " << new_mapsize / (1024 * 1024) << "MiB"
+       << ", transactions held up for " << GetMicrosSince(stallStart) / 1000 << "ms";
+    printf("%s\n", ss.str().c_str());
+}
+
+bool CTxDB::try_resize()
+{
+    if (!dbEnv)
+        return false;
+
+    // the gate is only taken if it's free, and given back right away if a transaction is open, so
+    // nothing waits for anything
+    if (mdb_txn_safe::creation_gate.exchange(true))
+        return false;
+    BOOST_SCOPE_EXIT(void) { mdb_txn_safe::allow_new_txns(); }
+    BOOST_SCOPE_EXIT_END
+    if (mdb_txn_safe::num_active_txns > 0)
+        return false;
+
+    const boost::chrono::steady_clock::time_point stallStart = boost::chrono::steady_clock::now();
+
+    MDB_envinfo mei;
+    mdb_env_info(dbEnv.get(), &mei);
+    MDB_stat mst;
+    mdb_env_stat(dbEnv.get(), &mst);
+    const uint64_t new_mapsize = GetNextMapSize(mei.me_mapsize, 0, mst.ms_psize);
+
+    // without the room on disk, it's left to do_resize() to report it
+    try {
+        boost::filesystem::space_info si = boost::filesystem::space(GetDataDir() / DB_DIR);
+        if (si.available < new_mapsize - mei.me_mapsize)
+            return false;
+    } catch (...) {
+        return false;
+    }
+
+    if (int result = mdb_env_set_mapsize(dbEnv.get(), new_mapsize))
+        return error("CTxDB::try_resize() : failed to set the map size: %s", mdb_strerror(result));
+    RecordResize(GetMicrosSince(stallStart), true);
+
+    printf("LMDB map resized ahead of time. Old: %" PRIu64 "MiB, New: %" PRIu64 "MiB\n",
+           (uint64_t)mei.me_mapsize / (1024 * 1024), new_mapsize / (1024 * 1024));
+    return true;
+}
+
+void ThreadLMDBMaintenance(void* /*parg*/)
+{
+    RenameThread("neblio-dbmaint");
+    vnThreadsRunning[THREAD_DBMAINTENANCE]++;
+
+    int64_t nLastFailure = 0;
+    while (!fShutdown) {
+        if (CTxDB::need_proactive_resize()) {
+            // a moment without transactions comes between the batches of the initial download and
+            // the messages of peers; if there's none for a minute, the writes resize it themselves
+            // once it's past DB_RESIZE_PERCENT
+            bool fResized = false;
+            for (int i = 0; i < 1200 && !fShutdown && !fResized; i++) {
+                fResized = CTxDB::try_resize();
+                if (!fResized)
+                    MilliSleep(50);
+            }
+            if (!fResized && GetTime() - nLastFailure > 3600) {
+                printf("ThreadLMDBMaintenance() : the database map couldn't be resized ahead of time\n");
+                nLastFailure = GetTime();
+            }
+        }
+        for (int i = 0; i < 100 && !fShutdown; i++)
+            MilliSleep(100);
+    }
+
+    vnThreadsRunning[THREAD_DBMAINTENANCE]--;
 }
 
 bool IsQuickSyncOSCompatible(const std::string& osValue)
@@ -533,6 +1025,15 @@ void CTxDB::init_blockindex(bool fRemoveOld)
     glob_db_ntp1Tx         = DbSmartPtrType(new MDB_dbi, dbDeleter);
     glob_db_ntp1tokenNames = DbSmartPtrType(new MDB_dbi, dbDeleter);
     glob_db_addrsVsPubKeys = DbSmartPtrType(new MDB_dbi, dbDeleter);
+    glob_db_coins          = DbSmartPtrType(new MDB_dbi, dbDeleter);
+    glob_db_blockUndo      = DbSmartPtrType(new MDB_dbi, dbDeleter);
+    glob_db_blockPos       = DbSmartPtrType(new MDB_dbi, dbDeleter);
+    glob_db_prunedTx       = DbSmartPtrType(new MDB_dbi, dbDeleter);
+    glob_db_addrIndex      = DbSmartPtrType(new MDB_dbi, dbDeleter);
+    glob_db_addrUtxos      = DbSmartPtrType(new MDB_dbi, dbDeleter);
+    glob_db_tokenInfo      = DbSmartPtrType(new MDB_dbi, dbDeleter);
+    glob_db_tokenHolders   = DbSmartPtrType(new MDB_dbi, dbDeleter);
+    glob_db_tokenTransfers = DbSmartPtrType(new MDB_dbi, dbDeleter);
 
     // MDB_CREATE: Create the named database if it doesn't exist.
     CTxDB::lmdb_db_open(txn, LMDB_MAINDB.c_str(), MDB_CREATE, *glob_db_main,
@@ -549,6 +1050,24 @@ void CTxDB::init_blockindex(bool fRemoveOld)
                         *glob_db_ntp1tokenNames, "Failed to open db handle for glob_db_ntp1Tx");
     CTxDB::lmdb_db_open(txn, LMDB_ADDRSVSPUBKEYSDB.c_str(), MDB_CREATE, *glob_db_addrsVsPubKeys,
                         "Failed to open db handle for glob_db_ntp1Tx");
+    CTxDB::lmdb_db_open(txn, LMDB_COINSDB.c_str(), MDB_CREATE, *glob_db_coins,
+                        "Failed to open db handle for glob_db_coins");
+    CTxDB::lmdb_db_open(txn, LMDB_BLOCKUNDODB.c_str(), MDB_CREATE, *glob_db_blockUndo,
+                        "Failed to open db handle for glob_db_blockUndo");
+    CTxDB::lmdb_db_open(txn, LMDB_BLOCKPOSDB.c_str(), MDB_CREATE, *glob_db_blockPos,
+                        "Failed to open db handle for glob_db_blockPos");
+    CTxDB::lmdb_db_open(txn, LMDB_PRUNEDTXDB.c_str(), MDB_CREATE, *glob_db_prunedTx,
+                        "Failed to open db handle for glob_db_prunedTx");
+    CTxDB::lmdb_db_open(txn, LMDB_ADDRINDEXDB.c_str(), MDB_CREATE, *glob_db_addrIndex,
+                        "Failed to open db handle for glob_db_addrIndex");
+    CTxDB::lmdb_db_open(txn, LMDB_ADDRUTXOSDB.c_str(), MDB_CREATE, *glob_db_addrUtxos,
+                        "Failed to open db handle for glob_db_addrUtxos");
+    CTxDB::lmdb_db_open(txn, LMDB_TOKENINFODB.c_str(), MDB_CREATE, *glob_db_tokenInfo,
+                        "Failed to open db handle for glob_db_tokenInfo");
+    CTxDB::lmdb_db_open(txn, LMDB_TOKENHOLDERSDB.c_str(), MDB_CREATE, *glob_db_tokenHolders,
+                        "Failed to open db handle for glob_db_tokenHolders");
+    CTxDB::lmdb_db_open(txn, LMDB_TOKENTRANSFERSDB.c_str(), MDB_CREATE, *glob_db_tokenTransfers,
+                        "Failed to open db handle for glob_db_tokenTransfers");
 
     // commit the transaction
     txn.commit();
@@ -574,6 +1093,33 @@ void CTxDB::init_blockindex(bool fRemoveOld)
     if (!glob_db_addrsVsPubKeys) {
         throw std::runtime_error("LMDB nullptr after opening the db_addrsVsPubKeys database.");
     }
+    if (!glob_db_coins) {
+        throw std::runtime_error("LMDB nullptr after opening the db_coins database.");
+    }
+    if (!glob_db_blockUndo) {
+        throw std::runtime_error("LMDB nullptr after opening the db_blockUndo database.");
+    }
+    if (!glob_db_blockPos) {
+        throw std::runtime_error("LMDB nullptr after opening the db_blockPos database.");
+    }
+    if (!glob_db_prunedTx) {
+        throw std::runtime_error("LMDB nullptr after opening the db_prunedTx database.");
+    }
+    if (!glob_db_addrIndex) {
+        throw std::runtime_error("LMDB nullptr after opening the db_addrIndex database.");
+    }
+    if (!glob_db_addrUtxos) {
+        throw std::runtime_error("LMDB nullptr after opening the db_addrUtxos database.");
+    }
+    if (!glob_db_tokenInfo) {
+        throw std::runtime_error("LMDB nullptr after opening the db_tokenInfo database.");
+    }
+    if (!glob_db_tokenHolders) {
+        throw std::runtime_error("LMDB nullptr after opening the db_tokenHolders database.");
+    }
+    if (!glob_db_tokenTransfers) {
+        throw std::runtime_error("LMDB nullptr after opening the db_tokenTransfers database.");
+    }
 
     printf("Done opening the database\n");
     uiInterface.InitMessage("Done opening the database");
@@ -627,6 +1173,8 @@ CTxDB::CTxDB(const char* pszMode)
         fReadOnly = fTmp;
     }
 
+    OpenBlockStore();
+
     printf("Opened LMDB successfully\n");
 }
 
@@ -648,18 +1196,57 @@ void CTxDB::__deleteDb()
     }
 }
 
+MDB_txn* CTxDB::GetBatchTxn()
+{
+    if (activeBatch)
+        return activeBatch->rawPtr();
+    CTxDBThreadBatch* batch = threadBatch.get();
+    if (!batch)
+        return nullptr;
+    if (!batch->vNested.empty())
+        return batch->vNested.back();
+    if (!batch->txn) {
+        // the map can't be resized while the batch is open, so there has to be room for all of it
+        const uint64_t nReserve = 2 * CTxDBBatchScope::nMaxBytes;
+        if (CTxDB::need_resize() || CTxDB::need_resize(nReserve)) {
+            printf("LMDB memory map needs to be resized, doing that now.\n");
+            CTxDB::do_resize(nReserve);
+        }
+        std::unique_ptr<mdb_txn_safe> txn(new mdb_txn_safe);
+        if (auto res = lmdb_txn_begin(dbEnv.get(), nullptr, 0, *txn)) {
+            printf("Failed to begin a batch transaction with error code %i; with error: %s\n", res,
+                   mdb_strerror(res));
+            return nullptr;
+        }
+        batch->txn        = std::move(txn);
+        batch->nBeginTime = GetTimeMillis();
+        nOpenBatchTxns++;
+    }
+    return batch->txn->rawPtr();
+}
+
 bool CTxDB::TxnBegin(size_t required_size)
 {
     assert(activeBatch == nullptr);
-    if (CTxDB::need_resize(required_size)) {
+    CTxDBThreadBatch* batch = threadBatch.get();
+    if (batch && batch->txn && batch->vNested.empty() &&
+        CTxDB::need_resize(required_size + 2 * batch->nBytes)) {
+        // the map can only be resized between batches
+        if (!CommitThreadBatchOrShutdown(*batch))
+            return false;
+    }
+    if ((!batch || !batch->txn) && CTxDB::need_resize(required_size)) {
         printf("LMDB memory map needs to be resized, doing that now.\n");
         CTxDB::do_resize(required_size);
     }
-    activeBatch = std::unique_ptr<mdb_txn_safe>(new mdb_txn_safe);
-    if (auto res = lmdb_txn_begin(dbEnv.get(), nullptr, 0, *activeBatch)) {
+    MDB_txn* parent = batch ? GetBatchTxn() : nullptr;
+    activeBatch     = std::unique_ptr<mdb_txn_safe>(new mdb_txn_safe);
+    if (auto res = lmdb_txn_begin(dbEnv.get(), parent, 0, *activeBatch)) {
         printf("Failed to begin transaction at read with error code %i; with error: %s\n", res,
                mdb_strerror(res));
         activeBatch.reset();
+    } else if (parent) {
+        batch->vNested.push_back(activeBatch->rawPtr());
     }
     return true;
 }
@@ -668,9 +1255,18 @@ bool CTxDB::TxnCommit()
 {
     assert(activeBatch);
     if (activeBatch) {
+        CTxDBThreadBatch* batchOuter = threadBatch.get();
+        if (!batchOuter || batchOuter->vNested.empty() ||
+            batchOuter->vNested.back() != activeBatch->rawPtr())
+            FlushBlockStore();
+        EndNestedTxn(activeBatch->rawPtr());
         activeBatch->commit();
         activeBatch.reset();
     }
+    // the batch can be committed when no transaction is nested in it anymore
+    CTxDBThreadBatch* batch = threadBatch.get();
+    if (batch && batch->vNested.empty() && IsBatchDue(*batch))
+        return CommitThreadBatchOrShutdown(*batch);
     return true;
 }
 
@@ -678,6 +1274,7 @@ bool CTxDB::TxnAbort()
 {
     assert(activeBatch);
     if (activeBatch) {
+        EndNestedTxn(activeBatch->rawPtr());
         activeBatch->abort();
         activeBatch.reset();
     }
@@ -725,7 +1322,13 @@ bool CTxDB::UpdateTxIndex(uint256 hash, const CTxIndex& txindex) { return Write(
 bool CTxDB::ReadTx(const CDiskTxPos& txPos, CTransaction& tx)
 {
     tx.SetNull();
-    return Read(txPos.nBlockPos, tx, db_blocks, 0, txPos.nTxPos);
+    CBlockFilePos pos;
+    if (glob_blockStore && Read(txPos.nBlockPos, pos, db_blockPos))
+        return ReadFromBlockFile(pos, txPos.nTxPos, FIRST_READ_SIZE, tx, 0);
+    if (Read(txPos.nBlockPos, tx, db_blocks, 0, txPos.nTxPos))
+        return true;
+    // the transactions of pruned blocks that are still needed are kept on their own
+    return Read(txPos, tx, db_prunedTx);
 }
 
 bool CTxDB::ReadNTP1Tx(uint256 hash, NTP1Transaction& ntp1tx)
@@ -793,13 +1396,385 @@ bool CTxDB::ReadBlock(uint256 hash, CBlock& blk, bool fReadTransactions)
 {
     blk.SetNull();
     int modifiers = (fReadTransactions ? 0 : SER_BLOCKHEADERONLY);
-    return Read(hash, blk, db_blocks, modifiers);
+
+    // the blocks that weren't moved to the block files yet are still in db_blocks
+    CBlockFilePos pos;
+    if (!glob_blockStore || !Read(hash, pos, db_blockPos)) {
+        if (Read(hash, blk, db_blocks, modifiers))
+            return true;
+        // the header of a pruned block is still in the block index
+        BlockIndexMapType::const_iterator mi = mapBlockIndex.find(hash);
+        if (fReadTransactions || mi == mapBlockIndex.end())
+            return false;
+        blk = mi->second->GetBlockHeader();
+        return true;
+    }
+
+    if (!fReadTransactions) {
+        static const uint32_t nHeaderSize =
+            ::GetSerializeSize(CBlock(), SER_DISK | SER_BLOCKHEADERONLY, CLIENT_VERSION);
+        return ReadFromBlockFile(pos, 0, nHeaderSize, blk, SER_BLOCKHEADERONLY);
+    }
+    std::vector<char> vch;
+    if (!glob_blockStore->Read(pos, vch))
+        return error("CTxDB::ReadBlock() : failed to read block %s from the block files",
+                     hash.ToString().c_str());
+    try {
+        CDataStream ss(vch, SER_DISK, CLIENT_VERSION);
+        ss >> blk;
+    } catch (std::exception& ex) {
+        return error("CTxDB::ReadBlock() : failed to deserialize block %s: %s",
+                     hash.ToString().c_str(), ex.what());
+    }
+    return true;
 }
 
 bool CTxDB::WriteBlock(uint256 hash, const CBlock& blk)
 {
     assert(blk.GetHash() != 0);
-    return Write(hash, blk, db_blocks);
+    if (!glob_blockStore)
+        return Write(hash, blk, db_blocks);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.reserve(::GetSerializeSize(blk, SER_DISK, CLIENT_VERSION));
+    ss << blk;
+    CBlockFilePos pos;
+    if (!glob_blockStore->Append(&ss[0], ss.size(), pos))
+        return error("CTxDB::WriteBlock() : failed to append block %s to the block files",
+                     hash.ToString().c_str());
+    // outside of a transaction, the position is committed right away
+    if (!activeBatch && !CTxDBBatchScope::IsActive() && !glob_blockStore->Flush())
+        return false;
+    return Write(hash, pos, db_blockPos);
+}
+
+bool CTxDB::EraseBlock(uint256 hash)
+{
+    // the record in the block files stays until its whole file is removed
+    if (Exists(hash, db_blockPos) && !Erase(hash, db_blockPos))
+        return false;
+    if (Exists(hash, db_blocks) && !Erase(hash, db_blocks))
+        return false;
+    return EraseBlockUndo(hash);
+}
+
+bool CTxDB::WritePrunedTx(const CDiskTxPos& txPos, const CTransaction& tx)
+{
+    return Write(txPos, tx, db_prunedTx);
+}
+
+bool CTxDB::ReadPrunedTx(const CDiskTxPos& txPos, CTransaction& tx)
+{
+    tx.SetNull();
+    return Read(txPos, tx, db_prunedTx);
+}
+
+bool CTxDB::ErasePrunedTx(const CDiskTxPos& txPos)
+{
+    return !Exists(txPos, db_prunedTx) || Erase(txPos, db_prunedTx);
+}
+
+bool CTxDB::ReadPruneHeight(int& nHeight)
+{
+    nHeight = 0;
+    return !Exists(string("pruneHeight"), db_main) || Read(string("pruneHeight"), nHeight, db_main);
+}
+
+bool CTxDB::WritePruneHeight(int nHeight) { return Write(string("pruneHeight"), nHeight, db_main); }
+
+bool CTxDB::GetBlocksDbSize(uint64_t& nSize)
+{
+    MDB_txn*          batchTxn = GetBatchTxn();
+    CTxDBReadSnapshot snapshot(!batchTxn);
+    if (!batchTxn && !snapshot.IsValid())
+        return error("CTxDB::GetBlocksDbSize() : failed to begin transaction");
+    MDB_stat stat;
+    if (int rc = mdb_stat(batchTxn ? batchTxn : snapshot.GetTxn(), *db_blocks, &stat))
+        return error("CTxDB::GetBlocksDbSize() : mdb_stat failed with error code %d; and error: %s",
+                     rc, mdb_strerror(rc));
+    nSize = static_cast<uint64_t>(stat.ms_branch_pages + stat.ms_leaf_pages + stat.ms_overflow_pages) *
+            stat.ms_psize;
+    return true;
+}
+
+bool CTxDB::ReadBlockFilePositions(std::vector<std::pair<uint256, CBlockFilePos>>& vPositions)
+{
+    vPositions.clear();
+
+    MDB_txn*          batchTxn = GetBatchTxn();
+    CTxDBReadSnapshot snapshot(!batchTxn);
+    if (!batchTxn && !snapshot.IsValid())
+        return error("CTxDB::ReadBlockFilePositions() : failed to begin transaction");
+    MDB_cursor* cursorRawPtr = nullptr;
+    if (int rc = mdb_cursor_open(batchTxn ? batchTxn : snapshot.GetTxn(), *db_blockPos, &cursorRawPtr))
+        return error("CTxDB::ReadBlockFilePositions() : Failed to open lmdb cursor with error code %d; "
+                     "and error: %s",
+                     rc, mdb_strerror(rc));
+    std::unique_ptr<MDB_cursor, void (*)(MDB_cursor*)> cursorPtr(cursorRawPtr, [](MDB_cursor* p) {
+        if (p)
+            mdb_cursor_close(p);
+    });
+
+    MDB_val key;
+    MDB_val data;
+    int     itemRes = mdb_cursor_get(cursorPtr.get(), &key, &data, MDB_FIRST);
+    while (itemRes == 0) {
+        try {
+            CDataStream ssKey(static_cast<const char*>(key.mv_data),
+                              static_cast<const char*>(key.mv_data) + key.mv_size, SER_DISK,
+                              CLIENT_VERSION);
+            CDataStream ssValue(static_cast<const char*>(data.mv_data),
+                                static_cast<const char*>(data.mv_data) + data.mv_size, SER_DISK,
+                                CLIENT_VERSION);
+            std::pair<uint256, CBlockFilePos> entry;
+            ssKey >> entry.first;
+            ssValue >> entry.second;
+            vPositions.push_back(entry);
+        } catch (std::exception& ex) {
+            return error("CTxDB::ReadBlockFilePositions() : failed to deserialize a position: %s",
+                         ex.what());
+        }
+        itemRes = mdb_cursor_get(cursorPtr.get(), &key, &data, MDB_NEXT);
+    }
+    cursorPtr.reset();
+    if (itemRes != MDB_NOTFOUND)
+        return error("CTxDB::ReadBlockFilePositions() : failed to read the positions with error code "
+                     "%d; and error: %s",
+                     itemRes, mdb_strerror(itemRes));
+    return true;
+}
+
+bool CTxDB::ReadAddrIndexHeight(int& nHeight)
+{
+    nHeight = -1;
+    return !Exists(string("addrIndexHeight"), db_main) ||
+           Read(string("addrIndexHeight"), nHeight, db_main);
+}
+
+bool CTxDB::WriteAddrIndexHeight(int nHeight)
+{
+    return Write(string("addrIndexHeight"), nHeight, db_main);
+}
+
+bool CTxDB::ReadAddrIndexDelta(const CAddrIndexKey& key, CAddrIndexDelta& delta)
+{
+    return Read(key, delta, db_addrIndex);
+}
+
+bool CTxDB::WriteAddrIndexDelta(const CAddrIndexKey& key, const CAddrIndexDelta& delta)
+{
+    return Write(key, delta, db_addrIndex);
+}
+
+bool CTxDB::EraseAddrIndexDelta(const CAddrIndexKey& key)
+{
+    return !Exists(key, db_addrIndex) || Erase(key, db_addrIndex);
+}
+
+bool CTxDB::ReadAddrIndexUtxo(const CAddrIndexUtxoKey& key, CAddrIndexUtxo& utxo)
+{
+    return Read(key, utxo, db_addrUtxos);
+}
+
+bool CTxDB::WriteAddrIndexUtxo(const CAddrIndexUtxoKey& key, const CAddrIndexUtxo& utxo)
+{
+    return Write(key, utxo, db_addrUtxos);
+}
+
+bool CTxDB::EraseAddrIndexUtxo(const CAddrIndexUtxoKey& key)
+{
+    return !Exists(key, db_addrUtxos) || Erase(key, db_addrUtxos);
+}
+
+namespace {
+/** Reads the entries of a table whose keys begin with the serialized prefix, in the order of the keys */
+template <typename P, typename K, typename V>
+bool ReadEntriesWithPrefix(MDB_txn* txn, MDB_dbi dbi, const P& prefix, uint64_t nSkip, uint64_t nCount,
+                           std::vector<std::pair<K, V>>& vEntries)
+{
+    vEntries.clear();
+
+    MDB_cursor* cursorRawPtr = nullptr;
+    if (int rc = mdb_cursor_open(txn, dbi, &cursorRawPtr))
+        return error("ReadEntriesWithPrefix() : Failed to open lmdb cursor with error code %d; and "
+                     "error: %s",
+                     rc, mdb_strerror(rc));
+    std::unique_ptr<MDB_cursor, void (*)(MDB_cursor*)> cursorPtr(cursorRawPtr, [](MDB_cursor* p) {
+        if (p)
+            mdb_cursor_close(p);
+    });
+
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << prefix;
+    const std::string strPrefix = ssPrefix.str();
+    MDB_val           key       = {strPrefix.size(), (void*)strPrefix.data()};
+    MDB_val           data;
+    int               itemRes = mdb_cursor_get(cursorPtr.get(), &key, &data, MDB_SET_RANGE);
+    while (itemRes == 0 && vEntries.size() < nCount && key.mv_size >= strPrefix.size() &&
+           memcmp(key.mv_data, strPrefix.data(), strPrefix.size()) == 0) {
+        if (nSkip > 0) {
+            nSkip--;
+        } else {
+            try {
+                CDataStream ssKey(static_cast<const char*>(key.mv_data),
+                                  static_cast<const char*>(key.mv_data) + key.mv_size, SER_DISK,
+                                  CLIENT_VERSION);
+                CDataStream ssValue(static_cast<const char*>(data.mv_data),
+                                    static_cast<const char*>(data.mv_data) + data.mv_size, SER_DISK,
+                                    CLIENT_VERSION);
+                std::pair<K, V> entry;
+                ssKey >> entry.first;
+                ssValue >> entry.second;
+                vEntries.push_back(entry);
+            } catch (std::exception& ex) {
+                return error("ReadEntriesWithPrefix() : failed to deserialize an entry: %s", ex.what());
+            }
+        }
+        itemRes = mdb_cursor_get(cursorPtr.get(), &key, &data, MDB_NEXT);
+    }
+    if (itemRes != 0 && itemRes != MDB_NOTFOUND)
+        return error("ReadEntriesWithPrefix() : failed to read the entries with error code %d; and "
+                     "error: %s",
+                     itemRes, mdb_strerror(itemRes));
+    return true;
+}
+} // namespace
+
+bool CTxDB::ReadAddrIndexHistory(const uint160& scriptHash, uint64_t nSkip, uint64_t nCount,
+                                 std::vector<std::pair<CAddrIndexKey, CAddrIndexDelta>>& vEntries)
+{
+    MDB_txn*          batchTxn = GetBatchTxn();
+    CTxDBReadSnapshot snapshot(!batchTxn);
+    if (!batchTxn && !snapshot.IsValid())
+        return error("CTxDB::ReadAddrIndexHistory() : failed to begin transaction");
+    return ReadEntriesWithPrefix(batchTxn ? batchTxn : snapshot.GetTxn(), *db_addrIndex, scriptHash,
+                                 nSkip, nCount, vEntries);
+}
+
+bool CTxDB::ReadAddrIndexUtxos(const uint160& scriptHash, uint64_t nSkip, uint64_t nCount,
+                               std::vector<std::pair<CAddrIndexUtxoKey, CAddrIndexUtxo>>& vEntries)
+{
+    MDB_txn*          batchTxn = GetBatchTxn();
+    CTxDBReadSnapshot snapshot(!batchTxn);
+    if (!batchTxn && !snapshot.IsValid())
+        return error("CTxDB::ReadAddrIndexUtxos() : failed to begin transaction");
+    return ReadEntriesWithPrefix(batchTxn ? batchTxn : snapshot.GetTxn(), *db_addrUtxos, scriptHash,
+                                 nSkip, nCount, vEntries);
+}
+
+bool CTxDB::EraseAddrIndex()
+{
+    if (!TxnBegin())
+        return error("CTxDB::EraseAddrIndex() : TxnBegin failed");
+    for (MDB_dbi* dbi : {db_addrIndex, db_addrUtxos}) {
+        if (int rc = mdb_drop(activeBatch->rawPtr(), *dbi, 0)) {
+            TxnAbort();
+            return error("CTxDB::EraseAddrIndex() : failed to empty the address index with error code "
+                         "%d; and error: %s",
+                         rc, mdb_strerror(rc));
+        }
+    }
+    if (Exists(string("addrIndexHeight"), db_main) && !Erase(string("addrIndexHeight"), db_main)) {
+        TxnAbort();
+        return error("CTxDB::EraseAddrIndex() : failed to erase the height of the address index");
+    }
+    return TxnCommit();
+}
+
+bool CTxDB::ReadTokenIndexHeight(int& nHeight)
+{
+    nHeight = -1;
+    return !Exists(string("tokenIndexHeight"), db_main) ||
+           Read(string("tokenIndexHeight"), nHeight, db_main);
+}
+
+bool CTxDB::WriteTokenIndexHeight(int nHeight)
+{
+    return Write(string("tokenIndexHeight"), nHeight, db_main);
+}
+
+bool CTxDB::ReadTokenIndexInfo(const std::string& tokenId, CTokenIndexInfo& info)
+{
+    return Read(tokenId, info, db_tokenInfo);
+}
+
+bool CTxDB::WriteTokenIndexInfo(const std::string& tokenId, const CTokenIndexInfo& info)
+{
+    return Write(tokenId, info, db_tokenInfo);
+}
+
+bool CTxDB::EraseTokenIndexInfo(const std::string& tokenId)
+{
+    return !Exists(tokenId, db_tokenInfo) || Erase(tokenId, db_tokenInfo);
+}
+
+bool CTxDB::ReadTokenIndexHolder(const CTokenIndexHolderKey& key, CTokenIndexHolder& holder)
+{
+    return Read(key, holder, db_tokenHolders);
+}
+
+bool CTxDB::WriteTokenIndexHolder(const CTokenIndexHolderKey& key, const CTokenIndexHolder& holder)
+{
+    return Write(key, holder, db_tokenHolders);
+}
+
+bool CTxDB::EraseTokenIndexHolder(const CTokenIndexHolderKey& key)
+{
+    return !Exists(key, db_tokenHolders) || Erase(key, db_tokenHolders);
+}
+
+bool CTxDB::WriteTokenIndexTransfer(const CTokenIndexTransferKey& key,
+                                    const CTokenIndexTransfer&    transfer)
+{
+    return Write(key, transfer, db_tokenTransfers);
+}
+
+bool CTxDB::EraseTokenIndexTransfer(const CTokenIndexTransferKey& key)
+{
+    return !Exists(key, db_tokenTransfers) || Erase(key, db_tokenTransfers);
+}
+
+bool CTxDB::ReadTokenIndexHolders(
+    const std::string& tokenId, uint64_t nSkip, uint64_t nCount,
+    std::vector<std::pair<CTokenIndexHolderKey, CTokenIndexHolder>>& vEntries)
+{
+    MDB_txn*          batchTxn = GetBatchTxn();
+    CTxDBReadSnapshot snapshot(!batchTxn);
+    if (!batchTxn && !snapshot.IsValid())
+        return error("CTxDB::ReadTokenIndexHolders() : failed to begin transaction");
+    return ReadEntriesWithPrefix(batchTxn ? batchTxn : snapshot.GetTxn(), *db_tokenHolders, tokenId,
+                                 nSkip, nCount, vEntries);
+}
+
+bool CTxDB::ReadTokenIndexTransfers(
+    const std::string& tokenId, uint64_t nSkip, uint64_t nCount,
+    std::vector<std::pair<CTokenIndexTransferKey, CTokenIndexTransfer>>& vEntries)
+{
+    MDB_txn*          batchTxn = GetBatchTxn();
+    CTxDBReadSnapshot snapshot(!batchTxn);
+    if (!batchTxn && !snapshot.IsValid())
+        return error("CTxDB::ReadTokenIndexTransfers() : failed to begin transaction");
+    return ReadEntriesWithPrefix(batchTxn ? batchTxn : snapshot.GetTxn(), *db_tokenTransfers, tokenId,
+                                 nSkip, nCount, vEntries);
+}
+
+bool CTxDB::EraseTokenIndex()
+{
+    if (!TxnBegin())
+        return error("CTxDB::EraseTokenIndex() : TxnBegin failed");
+    for (MDB_dbi* dbi : {db_tokenInfo, db_tokenHolders, db_tokenTransfers}) {
+        if (int rc = mdb_drop(activeBatch->rawPtr(), *dbi, 0)) {
+            TxnAbort();
+            return error("CTxDB::EraseTokenIndex() : failed to empty the token index with error code "
+                         "%d; and error: %s",
+                         rc, mdb_strerror(rc));
+        }
+    }
+    if (Exists(string("tokenIndexHeight"), db_main) && !Erase(string("tokenIndexHeight"), db_main)) {
+        TxnAbort();
+        return error("CTxDB::EraseTokenIndex() : failed to erase the height of the token index");
+    }
+    return TxnCommit();
 }
 
 bool CTxDB::EraseTxIndex(const CTransaction& tx)
@@ -852,6 +1827,39 @@ bool CTxDB::WriteHashBestChain(uint256 hashBestChain)
     return Write(string("hashBestChain"), hashBestChain, db_main);
 }
 
+bool CTxDB::ReadCoins(uint256 txid, CCoins& coins) { return Read(txid, coins, db_coins); }
+
+bool CTxDB::WriteCoins(uint256 txid, const CCoins& coins) { return Write(txid, coins, db_coins); }
+
+bool CTxDB::EraseCoins(uint256 txid) { return Erase(txid, db_coins); }
+
+bool CTxDB::HaveCoins(uint256 txid) { return Exists(txid, db_coins); }
+
+bool CTxDB::ReadBlockUndo(uint256 hash, CBlockUndo& blockundo)
+{
+    return Read(hash, blockundo, db_blockUndo);
+}
+
+bool CTxDB::WriteBlockUndo(uint256 hash, const CBlockUndo& blockundo)
+{
+    return Write(hash, blockundo, db_blockUndo);
+}
+
+bool CTxDB::EraseBlockUndo(uint256 hash)
+{
+    return !Exists(hash, db_blockUndo) || Erase(hash, db_blockUndo);
+}
+
+bool CTxDB::ReadCoinsBestBlock(uint256& hashBestBlock)
+{
+    return Read(string("coinsBestBlock"), hashBestBlock, db_main);
+}
+
+bool CTxDB::WriteCoinsBestBlock(uint256 hashBestBlock)
+{
+    return Write(string("coinsBestBlock"), hashBestBlock, db_main);
+}
+
 bool CTxDB::ReadBestInvalidTrust(CBigNum& bnBestInvalidTrust)
 {
     return Read(string("bnBestInvalidTrust"), bnBestInvalidTrust, db_main);
@@ -915,17 +1923,24 @@ bool CTxDB::LoadBlockIndex()
         return true;
     }
 
+    if (!MigrateBlocksToFlatFiles())
+        return false;
+
+    int nHeightPruned = 0;
+    if (!ReadPruneHeight(nHeightPruned))
+        return error("CTxDB::LoadBlockIndex() : failed to read the prune height");
+    nPruneHeight = nHeightPruned;
+
     // The block index is an in-memory structure that maps hashes to on-disk
     // locations where the contents of the block can be found. Here, we scan it
     // out of the DB and into mapBlockIndex.
 
-    MDB_cursor*  cursorRawPtr = nullptr;
-    mdb_txn_safe localTxn;
-    if (auto res = lmdb_txn_begin(dbEnv.get(), nullptr, MDB_RDONLY, localTxn)) {
-        return error("Failed to begin transaction at read with error code %i; and error: %s\n", res,
-                     mdb_strerror(res));
+    MDB_cursor*                        cursorRawPtr = nullptr;
+    std::unique_ptr<CTxDBReadSnapshot> snapshot(new CTxDBReadSnapshot);
+    if (!snapshot->IsValid()) {
+        return error("CTxDB::LoadBlockIndex() : Failed to begin transaction at read\n");
     }
-    if (auto rc = mdb_cursor_open(localTxn, *db_blockIndex, &cursorRawPtr)) {
+    if (auto rc = mdb_cursor_open(snapshot->GetTxn(), *db_blockIndex, &cursorRawPtr)) {
         return error(
             "CTxDB::LoadBlockIndex() : Failed to open lmdb cursor with error code %d; and error: %s\n",
             rc, mdb_strerror(rc));
@@ -1025,7 +2040,7 @@ bool CTxDB::LoadBlockIndex()
     uiInterface.InitMessage(_("Loading block index...") + " (done reading block index)");
 
     cursorPtr.reset();
-    localTxn.commit();
+    snapshot.reset();
 
     if (fRequestShutdown)
         return true;
@@ -1072,11 +2087,18 @@ bool CTxDB::LoadBlockIndex()
     nBestHeight     = pindexBest->nHeight;
     nBestChainTrust = pindexBest->nChainTrust;
 
+    if (!LoadPrunedBlocks(*this))
+        return error("CTxDB::LoadBlockIndex() : failed to find the pruned blocks");
+
     printf("LoadBlockIndex(): hashBestChain=%s  height=%d  trust=%s  date=%s\n",
            hashBestChain.ToString().substr(0, 20).c_str(), nBestHeight.load(),
            CBigNum(nBestChainTrust).ToString().c_str(),
            DateTimeStrFormat("%x %H:%M:%S", pindexBest->GetBlockTime()).c_str());
 
+    // bring the unspent transaction outputs up to the best chain before anything is connected to it
+    if (!LoadCoins())
+        return error("CTxDB::LoadBlockIndex() : failed to load the coin database");
+
     // NovaCoin: load hashSyncCheckpoint
     if (!ReadSyncCheckpoint(Checkpoints::hashSyncCheckpoint))
         return error("CTxDB::LoadBlockIndex() : hashSyncCheckpoint not loaded");
@@ -1108,7 +2130,9 @@ bool CTxDB::LoadBlockIndex()
         }
         loadedCount++;
 
-        if (fRequestShutdown || pindex->nHeight < nBestHeight - nCheckDepth)
+        // the pruned blocks are left as they were checked when they were connected
+        if (fRequestShutdown || pindex->nHeight < nBestHeight - nCheckDepth ||
+            IsBlockPruned(pindex.get()))
             break;
         CBlock block;
         if (!block.ReadFromDisk(pindex.get()))
@@ -1223,15 +2247,308 @@ bool CTxDB::LoadBlockIndex()
     return true;
 }
 
-mdb_txn_safe::mdb_txn_safe(const bool check) : m_txn(nullptr), m_check(check)
+void CTxDB::OpenBlockStore()
 {
-    if (check) {
-        while (creation_gate.test_and_set()) {
-            boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+    // once the blocks are in the block files, they stay there
+    const bool fFlat = Exists(string("flatBlockFiles"), db_main);
+    if (!fFlat && !GetBoolArg("-flatblockfiles", false))
+        return;
+    if (fFlat && !GetBoolArg("-flatblockfiles", true))
+        printf("The blocks are stored in block files, which -flatblockfiles=0 doesn't change; the "
+               "database has to be rebuilt for that\n");
+
+    glob_blockStore.reset(new CBlockStore(GetDataDir() / DB_DIR / "blocks"));
+    if (!fFlat) {
+        bool fTmp = fReadOnly;
+        fReadOnly = false;
+        Write(string("flatBlockFiles"), true, db_main);
+        fReadOnly = fTmp;
+    }
+    printf("Storing the blocks in the block files in %s\n",
+           glob_blockStore->GetDir().string().c_str());
+}
+
+bool CTxDB::MigrateBlocksToFlatFiles()
+{
+    static const size_t MIGRATION_CHUNK_BYTES = 64 * ONE_MB;
+
+    if (!glob_blockStore)
+        return true;
+
+    // the blocks are moved in chunks, each committed with the positions of its blocks, so an
+    // interrupted migration continues where it stopped; what was appended to the block files for
+    // the chunk that wasn't committed is left unused
+    int64_t  nStart  = GetTimeMillis();
+    uint64_t nBlocks = 0;
+    while (true) {
+        if (fRequestShutdown)
+            return false;
+        if (!TxnBegin(MIGRATION_CHUNK_BYTES))
+            return error("CTxDB::MigrateBlocksToFlatFiles() : TxnBegin failed");
+
+        MDB_cursor* cursorRawPtr = nullptr;
+        if (int rc = mdb_cursor_open(activeBatch->rawPtr(), *db_blocks, &cursorRawPtr)) {
+            TxnAbort();
+            return error("CTxDB::MigrateBlocksToFlatFiles() : Failed to open lmdb cursor with error "
+                         "code %d; and error: %s",
+                         rc, mdb_strerror(rc));
         }
-        num_active_txns++;
-        creation_gate.clear();
+        std::unique_ptr<MDB_cursor, void (*)(MDB_cursor*)> cursorPtr(cursorRawPtr, [](MDB_cursor* p) {
+            if (p)
+                mdb_cursor_close(p);
+        });
+
+        // the blocks that were moved are erased, so every chunk starts from the first block left
+        MDB_val              key;
+        MDB_val              data;
+        std::vector<uint256> vMoved;
+        size_t               nBytes  = 0;
+        int                  itemRes = mdb_cursor_get(cursorPtr.get(), &key, &data, MDB_FIRST);
+        while (itemRes == 0 && nBytes < MIGRATION_CHUNK_BYTES) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            ssKey.write(static_cast<const char*>(key.mv_data), key.mv_size);
+            uint256 hash;
+            ssKey >> hash;
+            CBlockFilePos pos;
+            if (!glob_blockStore->Append(static_cast<const char*>(data.mv_data), data.mv_size, pos) ||
+                !Write(hash, pos, db_blockPos)) {
+                TxnAbort();
+                return error("CTxDB::MigrateBlocksToFlatFiles() : failed to move block %s",
+                             hash.ToString().c_str());
+            }
+            nBytes += data.mv_size;
+            vMoved.push_back(hash);
+            itemRes = mdb_cursor_get(cursorPtr.get(), &key, &data, MDB_NEXT);
+        }
+        cursorPtr.reset();
+        if (itemRes != 0 && itemRes != MDB_NOTFOUND) {
+            TxnAbort();
+            return error("CTxDB::MigrateBlocksToFlatFiles() : failed to read the blocks with error code "
+                         "%d; and error: %s",
+                         itemRes, mdb_strerror(itemRes));
+        }
+        if (vMoved.empty()) {
+            TxnAbort();
+            break;
+        }
+        if (nBlocks == 0) {
+            printf("Moving the blocks from the database to the block files...\n");
+            uiInterface.InitMessage(_("Moving the blocks to the block files..."));
+        }
+
+        for (const uint256& hash : vMoved) {
+            if (!Erase(hash, db_blocks)) {
+                TxnAbort();
+                return error("CTxDB::MigrateBlocksToFlatFiles() : failed to erase block %s",
+                             hash.ToString().c_str());
+            }
+        }
+        if (!TxnCommit())
+            return error("CTxDB::MigrateBlocksToFlatFiles() : TxnCommit failed");
+
+        nBlocks += vMoved.size();
+        uiInterface.InitMessage(_("Moving the blocks to the block files...") +
+                                " (block: " + std::to_string(nBlocks) + ")");
+    }
+
+    if (nBlocks > 0)
+        printf("Moved %" PRIu64 " blocks to the block files in %" PRId64 "ms\n", nBlocks,
+               GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CTxDB::RebuildCoins()
+{
+    static const size_t REBUILD_CHUNK_SIZE = 5000;
+
+    printf("Rebuilding the coin database from the transaction index...\n");
+    uiInterface.InitMessage(_("Rebuilding the coin database..."));
+    int64_t nStart = GetTimeMillis();
+
+    // without the best block the coins are ignored on the next start, so an interrupted rebuild
+    // starts over
+    if (Exists(string("coinsBestBlock"), db_main) && !Erase(string("coinsBestBlock"), db_main))
+        return error("CTxDB::RebuildCoins() : failed to erase the best block of the coin database");
+    if (!TxnBegin())
+        return error("CTxDB::RebuildCoins() : TxnBegin failed");
+    if (int rc = mdb_drop(activeBatch->rawPtr(), *db_coins, 0)) {
+        TxnAbort();
+        return error("CTxDB::RebuildCoins() : failed to empty the coin database with error code %d; "
+                     "and error: %s",
+                     rc, mdb_strerror(rc));
+    }
+    TxnCommit();
+
+    // the transaction index is scanned in chunks, each of them in a transaction of its own
+    uint64_t nTxs   = 0;
+    uint64_t nCoins = 0;
+    uint256  hashLast;
+    bool     fFirst = true;
+    bool     fDone  = false;
+    while (!fDone) {
+        if (fRequestShutdown)
+            return false;
+        if (!TxnBegin(64 * ONE_MB))
+            return error("CTxDB::RebuildCoins() : TxnBegin failed");
+
+        MDB_cursor* cursorRawPtr = nullptr;
+        if (int rc = mdb_cursor_open(activeBatch->rawPtr(), *db_tx, &cursorRawPtr)) {
+            TxnAbort();
+            return error("CTxDB::RebuildCoins() : Failed to open lmdb cursor with error code %d; and "
+                         "error: %s",
+                         rc, mdb_strerror(rc));
+        }
+        std::unique_ptr<MDB_cursor, void (*)(MDB_cursor*)> cursorPtr(cursorRawPtr, [](MDB_cursor* p) {
+            if (p)
+                mdb_cursor_close(p);
+        });
+
+        CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+        ssStartKey << hashLast;
+        std::string&& startKeyBin = ssStartKey.str();
+        MDB_val       key         = {startKeyBin.size(), (void*)startKeyBin.data()};
+        MDB_val       data;
+        int itemRes = mdb_cursor_get(cursorPtr.get(), &key, &data, fFirst ? MDB_FIRST : MDB_SET_RANGE);
+
+        std::vector<std::pair<uint256, CTxIndex>> vEntries;
+        while (itemRes == 0 && vEntries.size() < REBUILD_CHUNK_SIZE) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            ssKey.write(static_cast<const char*>(key.mv_data), key.mv_size);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            ssValue.write(static_cast<const char*>(data.mv_data), data.mv_size);
+            std::pair<uint256, CTxIndex> entry;
+            ssKey >> entry.first;
+            ssValue >> entry.second;
+            // the last entry of the previous chunk is where this one started
+            if (fFirst || entry.first != hashLast)
+                vEntries.push_back(entry);
+            itemRes = mdb_cursor_get(cursorPtr.get(), &key, &data, MDB_NEXT);
+        }
+        cursorPtr.reset();
+        if (itemRes == MDB_NOTFOUND) {
+            fDone = true;
+        } else if (itemRes != 0) {
+            TxnAbort();
+            return error("CTxDB::RebuildCoins() : failed to read the transaction index with error code "
+                         "%d; and error: %s",
+                         itemRes, mdb_strerror(itemRes));
+        }
+
+        for (const std::pair<uint256, CTxIndex>& entry : vEntries) {
+            const CTxIndex& txindex = entry.second;
+            bool            fUnspent = false;
+            for (const CDiskTxPos& pos : txindex.vSpent)
+                fUnspent = fUnspent || pos.IsNull();
+            if (!fUnspent)
+                continue;
+
+            BlockIndexMapType::const_iterator mi = mapBlockIndex.find(txindex.pos.nBlockPos);
+            if (mi == mapBlockIndex.end()) {
+                TxnAbort();
+                return error("CTxDB::RebuildCoins() : the block of transaction %s is not in the index",
+                             entry.first.ToString().c_str());
+            }
+            CTransaction tx;
+            if (!ReadTx(txindex.pos, tx)) {
+                // the transactions of pruned blocks that are left are the ones with spendable outputs
+                if (IsBlockPruned(mi->second.get()))
+                    continue;
+                TxnAbort();
+                return error("CTxDB::RebuildCoins() : failed to read transaction %s",
+                             entry.first.ToString().c_str());
+            }
+
+            CCoins coins(tx, mi->second->nHeight);
+            for (unsigned int i = 0; i < coins.vout.size() && i < txindex.vSpent.size(); i++)
+                if (!txindex.vSpent[i].IsNull())
+                    coins.vout[i].SetNull();
+            coins.Cleanup();
+            if (coins.IsPruned())
+                continue;
+            if (!WriteCoins(entry.first, coins)) {
+                TxnAbort();
+                return error("CTxDB::RebuildCoins() : failed to write the coins of %s",
+                             entry.first.ToString().c_str());
+            }
+            nCoins++;
+        }
+        if (!vEntries.empty())
+            hashLast = vEntries.back().first;
+        fFirst = false;
+        nTxs += vEntries.size();
+        if (!TxnCommit())
+            return error("CTxDB::RebuildCoins() : TxnCommit failed");
+
+        uiInterface.InitMessage(_("Rebuilding the coin database...") +
+                                " (transaction: " + std::to_string(nTxs) + ")");
+    }
+
+    if (!WriteCoinsBestBlock(hashBestChain))
+        return error("CTxDB::RebuildCoins() : failed to write the best block of the coin database");
+    if (pcoinsTip)
+        pcoinsTip->SetBestBlock(boost::atomic_load(&pindexBest).get());
+    printf("Rebuilt the coin database: %" PRIu64 " transactions with unspent outputs out of %" PRIu64
+           " in %" PRId64 "ms\n",
+           nCoins, nTxs, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CTxDB::LoadCoins()
+{
+    CBlockIndexSmartPtr pindexBestPtr = boost::atomic_load(&pindexBest);
+    if (!pcoinsTip || !pindexBestPtr)
+        return true;
+
+    uint256 hashCoinsBest;
+    if (!ReadCoinsBestBlock(hashCoinsBest)) {
+        printf("LoadCoins() : the coin database is missing or incomplete\n");
+        return RebuildCoins();
     }
+    if (hashCoinsBest == pindexBestPtr->GetBlockHash())
+        return true;
+
+    // The coins are written some time after the blocks, so they may lag behind the best chain after
+    // a crash. If they're behind on the best chain, the blocks they miss are applied to them;
+    // otherwise, they're rebuilt.
+    BlockIndexMapType::const_iterator mi = mapBlockIndex.find(hashCoinsBest);
+    if (mi == mapBlockIndex.end() || !mi->second->IsInMainChain()) {
+        printf("LoadCoins() : the coin database is not on the best chain\n");
+        return RebuildCoins();
+    }
+
+    CBlockIndexSmartPtr pindexCoins = mi->second;
+    printf("LoadCoins() : bringing the coin database from height %d to %d\n", pindexCoins->nHeight,
+           pindexBestPtr->nHeight);
+    CCoinsViewDB    viewDB;
+    CCoinsViewCache view(viewDB);
+    for (CBlockIndexSmartPtr pindex = pindexCoins->pnext; pindex; pindex = pindex->pnext) {
+        if (fRequestShutdown)
+            return true;
+        CBlock block;
+        if (!block.ReadFromDisk(pindex.get(), *this))
+            return error("LoadCoins() : block.ReadFromDisk failed");
+        for (const CTransaction& tx : block.vtx) {
+            if (!tx.UpdateCoins(view, pindex->nHeight)) {
+                printf("LoadCoins() : failed to apply block %s to the coin database\n",
+                       pindex->GetBlockHash().ToString().c_str());
+                return RebuildCoins();
+            }
+        }
+        view.SetBestBlock(pindex.get());
+        if (view.GetCacheSize() > nCoinCacheSize || pindex == pindexBestPtr) {
+            if (!view.Flush())
+                return error("LoadCoins() : failed to write the coin database");
+        }
+        if (pindex == pindexBestPtr)
+            break;
+    }
+    return true;
+}
+
+mdb_txn_safe::mdb_txn_safe(const bool check) : m_txn(nullptr), m_check(check)
+{
+    if (check)
+        enter_txn();
 }
 
 mdb_txn_safe::~mdb_txn_safe()
@@ -1256,7 +2573,7 @@ mdb_txn_safe::~mdb_txn_safe()
     }
     mdb_txn_abort(m_txn);
 
-    num_active_txns--;
+    leave_txn();
 }
 
 mdb_txn_safe& mdb_txn_safe::operator=(mdb_txn_safe&& other)
@@ -1280,7 +2597,7 @@ mdb_txn_safe::mdb_txn_safe(mdb_txn_safe&& other)
 
 void mdb_txn_safe::uncheck()
 {
-    num_active_txns--;
+    leave_txn();
     m_check = false;
 }
 
@@ -1325,7 +2642,7 @@ uint64_t mdb_txn_safe::num_active_tx() const { return num_active_txns; }
 
 void mdb_txn_safe::prevent_new_txns()
 {
-    while (creation_gate.test_and_set()) {
+    while (creation_gate.exchange(true)) {
         boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
     }
 }
@@ -1337,7 +2654,33 @@ void mdb_txn_safe::wait_no_active_txns()
     }
 }
 
-void mdb_txn_safe::allow_new_txns() { creation_gate.clear(); }
+void mdb_txn_safe::allow_new_txns() { creation_gate = false; }
+
+void mdb_txn_safe::enter_txn()
+{
+    // A transaction nested in the open batch of this thread doesn't wait for the gate: a resize that
+    // took it waits for the batch to be committed, which this thread can only do if it goes on. It's
+    // counted all the same, though the batch keeps the count above zero anyway.
+    CTxDBThreadBatch* batch = threadBatch.get();
+    if (batch && batch->txn) {
+        num_active_txns++;
+        return;
+    }
+
+    // the count goes up before the gate is looked at, so a resize that takes the gate after that waits
+    // for this transaction, and this one waits for a resize that took it before
+    while (true) {
+        num_active_txns++;
+        if (!creation_gate)
+            return;
+        num_active_txns--;
+        while (creation_gate) {
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+        }
+    }
+}
+
+void mdb_txn_safe::leave_txn() { num_active_txns--; }
 
 CTxDB::~CTxDB()
 {
@@ -18,6 +18,7 @@
 
 #include "liblmdb/lmdb.h"
 
+#include "blockstore.h"
 #include "diskblockindex.h"
 #include "disktxpos.h"
 #include "outpoint.h"
@@ -29,6 +30,17 @@ class CBigNum;
 class CBlock;
 class CTransaction;
 class CBitcoinAddress;
+class CCoins;
+class CBlockUndo;
+struct CAddrIndexKey;
+struct CAddrIndexDelta;
+struct CAddrIndexUtxoKey;
+struct CAddrIndexUtxo;
+struct CTokenIndexInfo;
+struct CTokenIndexHolderKey;
+struct CTokenIndexHolder;
+struct CTokenIndexTransferKey;
+struct CTokenIndexTransfer;
 
 #define ENABLE_AUTO_RESIZE
 
@@ -43,6 +55,18 @@ extern DbSmartPtrType glob_db_tx;
 extern DbSmartPtrType glob_db_ntp1Tx;
 extern DbSmartPtrType glob_db_ntp1tokenNames;
 extern DbSmartPtrType glob_db_addrsVsPubKeys;
+extern DbSmartPtrType glob_db_coins;
+extern DbSmartPtrType glob_db_blockUndo;
+extern DbSmartPtrType glob_db_blockPos;
+extern DbSmartPtrType glob_db_prunedTx;
+extern DbSmartPtrType glob_db_addrIndex;
+extern DbSmartPtrType glob_db_addrUtxos;
+extern DbSmartPtrType glob_db_tokenInfo;
+extern DbSmartPtrType glob_db_tokenHolders;
+extern DbSmartPtrType glob_db_tokenTransfers;
+
+// the block files, if the blocks are stored in them instead of db_blocks (-flatblockfiles)
+extern std::unique_ptr<CBlockStore> glob_blockStore;
 
 const std::string LMDB_MAINDB           = "MainDb";
 const std::string LMDB_BLOCKINDEXDB     = "BlockIndexDb";
@@ -51,9 +75,29 @@ const std::string LMDB_TXDB             = "TxDb";
 const std::string LMDB_NTP1TXDB         = "Ntp1txDb";
 const std::string LMDB_NTP1TOKENNAMESDB = "Ntp1NamesDb";
 const std::string LMDB_ADDRSVSPUBKEYSDB = "AddrsVsPubKeysDb";
+const std::string LMDB_COINSDB          = "CoinsDb";
+const std::string LMDB_BLOCKUNDODB      = "BlockUndoDb";
+const std::string LMDB_BLOCKPOSDB       = "BlockPosDb";
+const std::string LMDB_PRUNEDTXDB       = "PrunedTxDb";
+const std::string LMDB_ADDRINDEXDB      = "AddrIndexDb";
+const std::string LMDB_ADDRUTXOSDB      = "AddrUtxosDb";
+const std::string LMDB_TOKENINFODB      = "TokenInfoDb";
+const std::string LMDB_TOKENHOLDERSDB   = "TokenHoldersDb";
+const std::string LMDB_TOKENTRANSFERSDB = "TokenTransfersDb";
 
 constexpr static float DB_RESIZE_PERCENT = 0.9f;
 
+// past this, the maintenance thread resizes the map at a moment when no transaction is open, so that
+// the writes rarely have to hold up every transaction of the process for it (see ThreadLMDBMaintenance)
+constexpr static float DB_PROACTIVE_RESIZE_PERCENT = 0.75f;
+
+// a resize grows the map by half of its size, within these bounds
+constexpr static uint64_t DB_MIN_MAP_GROWTH = UINT64_C(1) << 30;
+constexpr static uint64_t DB_MAX_MAP_GROWTH = UINT64_C(1) << 35;
+
+// the pages that a write may take beyond its size, e.g. for the copies of the branch it goes to
+constexpr static uint64_t DB_PAGES_PER_WRITE = 8;
+
 const std::string QuickSyncDataLink =
     "https://raw.githubusercontent.com/NeblioTeam/neblio-quicksync/master/download.json";
 
@@ -64,7 +108,13 @@ const std::string QuickSyncDataLink =
 constexpr static uint64_t DB_DEFAULT_MAPSIZE = UINT64_C(1) << 31;
 #else
 #if defined(ENABLE_AUTO_RESIZE)
+#if defined(__linux__) && defined(__LP64__)
+// without MDB_WRITEMAP, the map only takes address space on Linux and the file grows as it's written,
+// so a map that lasts for years is reserved up front instead of being resized along the way
+constexpr static uint64_t DB_DEFAULT_MAPSIZE = UINT64_C(1) << 36;
+#else
 constexpr static uint64_t DB_DEFAULT_MAPSIZE = UINT64_C(1) << 30;
+#endif
 #else
 constexpr static uint64_t DB_DEFAULT_MAPSIZE = UINT64_C(1) << 33;
 #endif
@@ -149,6 +199,21 @@ inline int lmdb_txn_begin(MDB_env* env, MDB_txn* parent, unsigned int flags, MDB
     return res;
 }
 
+/** How often the LMDB map was resized, and how long the transactions of the process were held up */
+struct CLMDBResizeStats
+{
+    uint64_t nMapSize          = 0;
+    uint64_t nUsedSize         = 0;
+    uint64_t nResizes          = 0; // including the ones by other processes
+    uint64_t nProactiveResizes = 0; // by the maintenance thread, which never waits for transactions
+    int64_t  nStallMicrosTotal = 0;
+    int64_t  nStallMicrosMax   = 0;
+    int64_t  nLastResizeTime   = 0;
+};
+
+/** Resizes the LMDB map ahead of time, while the process is quiet (see DB_PROACTIVE_RESIZE_PERCENT) */
+void ThreadLMDBMaintenance(void* parg);
+
 struct mdb_txn_safe
 {
     mdb_txn_safe(const bool check = true);
@@ -182,13 +247,107 @@ struct mdb_txn_safe
     static void wait_no_active_txns();
     static void allow_new_txns();
 
+    // counts a transaction that's about to begin, once no resize holds the gate
+    static void enter_txn();
+    static void leave_txn();
+
     MDB_txn*                     m_txn;
     bool                         m_batch_txn = false;
     bool                         m_check;
     static std::atomic<uint64_t> num_active_txns;
 
-    // could use a mutex here, but this should be sufficient.
-    static std::atomic_flag creation_gate;
+    // could use a mutex here, but this should be sufficient. Only resizes take it; transactions only
+    // look at it, so that they don't all write to it
+    static std::atomic<bool> creation_gate;
+};
+
+/**
+ * Group commit of the database writes of many blocks, for the initial block download and imports.
+ *
+ * While a CTxDBBatchScope exists on a thread, every CTxDB used on that thread reads and writes in one
+ * LMDB write transaction, the batch, and the transactions of the CTxDBs (TxnBegin()/TxnCommit()) are
+ * nested in it, so that a block that fails is still rolled back alone. Whenever the last nested
+ * transaction is committed and the batch has grown past nMaxBytes or is older than MAX_AGE_MS, the
+ * batch is committed and a new one is begun; what's left is committed when the scope ends. Instead
+ * of syncing the database every block, it's then synced every commit, or with nSyncLevel below 2,
+ * only every SYNC_INTERVAL_MS and when the scope ends.
+ *
+ * Every nested transaction was a commit of its own before, so each commit of a batch leaves the
+ * database as it would have been after one of them: a block is written together with its index and
+ * the best chain. After a crash, the chain is loaded up to the best block of the last commit and the
+ * blocks after it are downloaded or imported again. With nSyncLevel 0 (MDB_NOSYNC), that holds as
+ * long as the system itself doesn't crash before the next sync.
+ *
+ * Other threads only see the writes once they're committed, and can't write until then, so the scope
+ * is meant to be kept while cs_main is held.
+ */
+class CTxDBBatchScope
+{
+    bool fOuter;
+
+public:
+    static const int64_t MAX_AGE_MS       = 5000;
+    static const int64_t SYNC_INTERVAL_MS = 60000;
+
+    static std::atomic<uint64_t> nMaxBytes;   // -dbbatchsize; 0 disables batching
+    static std::atomic<int>      nSyncLevel;  // -dbbatchsync: 2 syncs every commit, 1 skips the
+                                              // metadata sync (MDB_NOMETASYNC), 0 only syncs
+                                              // periodically (MDB_NOSYNC)
+
+    CTxDBBatchScope();
+    ~CTxDBBatchScope();
+
+    CTxDBBatchScope(const CTxDBBatchScope&) = delete;
+    CTxDBBatchScope& operator=(const CTxDBBatchScope&) = delete;
+
+    /** Whether the batch of this thread should be committed, which is always the case if batching is
+     * disabled */
+    bool IsDue() const;
+
+    /** Whether there's a batch on this thread */
+    static bool IsActive();
+
+    /** Counts what's written to the batch of this thread, if there's one */
+    static void CountWrite(std::size_t nBytes);
+};
+
+/**
+ * A consistent view of the database for many reads on this thread.
+ *
+ * Every thread has one LMDB read transaction of its own, which is renewed (mdb_txn_renew()) when a
+ * read begins and reset (mdb_txn_reset()) when it ends, rather than begun and aborted every time,
+ * so its reader slot and its memory are kept. While a CTxDBReadSnapshot exists on the thread, the
+ * transaction isn't reset between reads: the reads of every CTxDB on the thread that aren't in a
+ * write transaction (TxnBegin() or a CTxDBBatchScope) share it, and see the database as it was when
+ * the first of the snapshots was taken, however many keys they look up. On a thread with a
+ * CTxDBBatchScope, the reads go to the batch, and a snapshot does nothing. A snapshot for the reads
+ * of a CTxDB in TxnBegin() has to be made with fBegin false (see CTxDB::IsInWriteTxn()), since the
+ * thread can't have a read transaction while it has a write transaction.
+ *
+ * The pages of that view can't be reused, and the map can't be resized, until the last snapshot
+ * is gone, so snapshots are meant for a loop of lookups, not to be kept.
+ */
+class CTxDBReadSnapshot
+{
+    MDB_txn* txn;
+
+public:
+    // nothing is begun with fBegin false, which is for the reads of a write transaction
+    explicit CTxDBReadSnapshot(bool fBegin = true);
+    ~CTxDBReadSnapshot();
+
+    CTxDBReadSnapshot(const CTxDBReadSnapshot&) = delete;
+    CTxDBReadSnapshot& operator=(const CTxDBReadSnapshot&) = delete;
+
+    /** Whether the read transaction could be begun */
+    bool     IsValid() const { return txn != nullptr; }
+    MDB_txn* GetTxn() const { return txn; }
+
+    /** Whether the read transaction of this thread is in use, by a snapshot or a read */
+    static bool IsActive();
+
+    /** Ends the read transactions of all the threads, before the environment is closed */
+    static void EndAll();
 };
 
 // Class that provides access to a LevelDB. Note that this class is frequently
@@ -232,6 +391,15 @@ private:
     MDB_dbi* db_ntp1Tx;
     MDB_dbi* db_ntp1tokenNames;
     MDB_dbi* db_addrsVsPubKeys;
+    MDB_dbi* db_coins;
+    MDB_dbi* db_blockUndo;
+    MDB_dbi* db_blockPos;
+    MDB_dbi* db_prunedTx;
+    MDB_dbi* db_addrIndex;
+    MDB_dbi* db_addrUtxos;
+    MDB_dbi* db_tokenInfo;
+    MDB_dbi* db_tokenHolders;
+    MDB_dbi* db_tokenTransfers;
 
     // A batch stores up writes and deletes for atomic application. When this
     // field is non-NULL, writes/deletes go there instead of directly to disk.
@@ -260,31 +428,23 @@ protected:
         ssKey.reserve(1000);
         ssKey << key;
 
-        mdb_txn_safe localTxn(false);
-        if (!activeBatch) {
-            localTxn = mdb_txn_safe();
-            if (auto res = lmdb_txn_begin(dbEnv.get(), nullptr, MDB_RDONLY, localTxn)) {
-                printf("Failed to begin transaction at read with error code %i; and error code: %s\n",
-                       res, mdb_strerror(res));
-            }
-        }
-        // only one of them should be active
-        assert(localTxn.rawPtr() == nullptr || activeBatch == nullptr);
+        MDB_txn*     batchTxn = GetBatchTxn();
+        // outside of a batch, the read transaction of the thread is used (see CTxDBReadSnapshot)
+        CTxDBReadSnapshot snapshot(!batchTxn);
+        if (!batchTxn && !snapshot.IsValid())
+            return false;
 
         std::string&& keyBin = ssKey.str();
         MDB_val       kS     = {keyBin.size(), (void*)(keyBin.c_str())};
         MDB_val       vS     = {0, nullptr};
-        if (auto ret = mdb_get((!activeBatch ? localTxn : *activeBatch), *dbPtr, &kS, &vS)) {
-            std::string dbgKey = KeyAsString(key, ssKey.str());
-
+        if (auto ret = mdb_get((batchTxn ? batchTxn : snapshot.GetTxn()), *dbPtr, &kS, &vS)) {
+            // misses are common, so they're only reported when asked for
             if (ret == MDB_NOTFOUND) {
-                printf("Failed to read lmdb key %s as it doesn't exist\n", dbgKey.c_str());
+                LogPrint(LOG_DB, "Failed to read lmdb key %s as it doesn't exist\n",
+                         KeyAsString(key, ssKey.str()).c_str());
             } else {
                 printf("Failed to read lmdb key %s with an unknown error of code %i; and error: %s\n",
-                       dbgKey.c_str(), ret, mdb_strerror(ret));
-            }
-            if (localTxn.rawPtr()) {
-                localTxn.abort();
+                       KeyAsString(key, ssKey.str()).c_str(), ret, mdb_strerror(ret));
             }
             return false;
         }
@@ -300,9 +460,6 @@ protected:
             printf("Failed to deserialized data when reading for key %s\n", ssKey.str().c_str());
             return false;
         }
-        if (localTxn.rawPtr()) {
-            localTxn.abort();
-        }
         return true;
     }
 
@@ -319,22 +476,18 @@ protected:
         ssKey.reserve(1000);
         ssKey << key;
 
-        mdb_txn_safe localTxn(false);
-        if (!activeBatch) {
-            localTxn = mdb_txn_safe();
-            if (auto res = lmdb_txn_begin(dbEnv.get(), nullptr, MDB_RDONLY, localTxn)) {
-                printf("Failed to begin transaction at read with error code %i; and error code: %s\n",
-                       res, mdb_strerror(res));
-            }
-        }
-        // only one of them should be active
-        assert(localTxn.rawPtr() == nullptr || activeBatch == nullptr);
+        MDB_txn*     batchTxn = GetBatchTxn();
+        // outside of a batch, the read transaction of the thread is used (see CTxDBReadSnapshot)
+        CTxDBReadSnapshot snapshot(!batchTxn);
+        if (!batchTxn && !snapshot.IsValid())
+            return false;
 
         std::string&& keyBin       = ssKey.str();
         MDB_val       kS           = {keyBin.size(), (void*)(keyBin.c_str())};
         MDB_val       vS           = {0, nullptr};
         MDB_cursor*   cursorRawPtr = nullptr;
-        if (auto rc = mdb_cursor_open((!activeBatch ? localTxn : *activeBatch), *dbPtr, &cursorRawPtr)) {
+        if (auto rc =
+                mdb_cursor_open((batchTxn ? batchTxn : snapshot.GetTxn()), *dbPtr, &cursorRawPtr)) {
             return error("ReadMultiple: Failed to open lmdb cursor with error code %d; and error: %s\n",
                          rc, mdb_strerror(rc));
         }
@@ -359,9 +512,6 @@ protected:
                 printf("txdb-lmdb: Cursor with key %s does not exist; with an error of code %i; and "
                        "error: %s\n",
                        dbgKey.c_str(), itemRes, mdb_strerror(itemRes));
-                if (localTxn.rawPtr()) {
-                    localTxn.abort();
-                }
                 return false;
             }
         }
@@ -392,9 +542,6 @@ protected:
         } while (itemRes == 0);
 
         cursorPtr.reset();
-        if (localTxn.rawPtr()) {
-            localTxn.abort();
-        }
         return true;
     }
 
@@ -414,14 +561,16 @@ protected:
         ssValue.reserve(10000);
         ssValue << value;
 
-        // you can't resize the db when a tx is active
-        if (!activeBatch && CTxDB::need_resize()) {
+        // you can't resize the db when a tx is active; batches are resized for when they're begun
+        if (CTxDB::need_resize_for_write(ssKey.size() + ssValue.size()) && !activeBatch &&
+            !CTxDBBatchScope::IsActive()) {
             printf("LMDB memory map needs to be resized, doing that now.\n");
             CTxDB::do_resize();
         }
 
+        MDB_txn*     batchTxn = GetBatchTxn();
         mdb_txn_safe localTxn(false);
-        if (!activeBatch) {
+        if (!batchTxn) {
             localTxn = mdb_txn_safe();
             if (auto res = lmdb_txn_begin(dbEnv.get(), nullptr, 0, localTxn)) {
                 printf("Failed to begin transaction at read with error code %i; and error: %s\n", res,
@@ -430,17 +579,18 @@ protected:
         }
 
         // only one of them should be active
-        assert(localTxn.rawPtr() == nullptr || activeBatch == nullptr);
+        assert(localTxn.rawPtr() == nullptr || batchTxn == nullptr);
 
         std::string&& keyBin = ssKey.str();
         MDB_val       kS     = {keyBin.size(), (void*)(keyBin.c_str())};
         std::string&& valBin = ssValue.str();
         MDB_val       vS     = {valBin.size(), (void*)(valBin.c_str())};
 
-        if (auto ret = mdb_put((!activeBatch ? localTxn : *activeBatch), *dbPtr, &kS, &vS, 0)) {
+        if (auto ret = mdb_put((batchTxn ? batchTxn : localTxn.rawPtr()), *dbPtr, &kS, &vS, 0)) {
             std::string dbgKey = KeyAsString(key, ssKey.str());
             if (ret == MDB_MAP_FULL) {
                 printf("Failed to write key %s with lmdb, MDB_MAP_FULL\n", dbgKey.c_str());
+                CTxDB::check_resize_on_next_write();
             } else {
                 printf("Failed to write key %s with lmdb; Code %i; Error: %s\n", dbgKey.c_str(), ret,
                        mdb_strerror(ret));
@@ -452,6 +602,8 @@ protected:
         }
         if (localTxn.rawPtr()) {
             localTxn.commitIfValid("Tx while writing");
+        } else {
+            CTxDBBatchScope::CountWrite(kS.mv_size + vS.mv_size);
         }
         return true;
     }
@@ -472,14 +624,16 @@ protected:
         ssValue.reserve(10000);
         ssValue << value;
 
-        // you can't resize the db when a tx is active
-        if (!activeBatch && CTxDB::need_resize()) {
+        // you can't resize the db when a tx is active; batches are resized for when they're begun
+        if (CTxDB::need_resize_for_write(ssKey.size() + ssValue.size()) && !activeBatch &&
+            !CTxDBBatchScope::IsActive()) {
             printf("LMDB memory map needs to be resized, doing that now.\n");
             CTxDB::do_resize();
         }
 
+        MDB_txn*     batchTxn = GetBatchTxn();
         mdb_txn_safe localTxn(false);
-        if (!activeBatch) {
+        if (!batchTxn) {
             localTxn = mdb_txn_safe();
             if (auto res = lmdb_txn_begin(dbEnv.get(), nullptr, 0, localTxn)) {
                 printf("Failed to begin transaction at read with error code %i; and error: %s\n", res,
@@ -488,14 +642,14 @@ protected:
         }
 
         // only one of them should be active
-        assert(localTxn.rawPtr() == nullptr || activeBatch == nullptr);
+        assert(localTxn.rawPtr() == nullptr || batchTxn == nullptr);
 
         std::string&& keyBin       = ssKey.str();
         MDB_val       kS           = {keyBin.size(), (void*)(keyBin.c_str())};
         std::string&& valBin       = ssValue.str();
         MDB_val       vS           = {valBin.size(), (void*)(valBin.c_str())};
         MDB_cursor*   cursorRawPtr = nullptr;
-        if (auto rc = mdb_cursor_open((!activeBatch ? localTxn : *activeBatch), *dbPtr, &cursorRawPtr)) {
+        if (auto rc = mdb_cursor_open((batchTxn ? batchTxn : localTxn.rawPtr()), *dbPtr, &cursorRawPtr)) {
             return error("ReadMultiple: Failed to open lmdb cursor with error code %d; and error: %s\n",
                          rc, mdb_strerror(rc));
         }
@@ -509,6 +663,7 @@ protected:
             std::string dbgKey = KeyAsString(key, ssKey.str());
             if (ret == MDB_MAP_FULL) {
                 printf("Failed to write key %s with lmdb, MDB_MAP_FULL\n", dbgKey.c_str());
+                CTxDB::check_resize_on_next_write();
             } else {
                 printf("Failed to write key %s with lmdb; Code %i; Error: %s\n", dbgKey.c_str(), ret,
                        mdb_strerror(ret));
@@ -520,7 +675,11 @@ protected:
         }
 
         cursorPtr.reset();
-        localTxn.commitIfValid("Tx while writing");
+        if (localTxn.rawPtr()) {
+            localTxn.commitIfValid("Tx while writing");
+        } else {
+            CTxDBBatchScope::CountWrite(kS.mv_size + vS.mv_size);
+        }
         return true;
     }
 
@@ -539,8 +698,9 @@ protected:
         ssKey.reserve(1000);
         ssKey << key;
 
+        MDB_txn*     batchTxn = GetBatchTxn();
         mdb_txn_safe localTxn(false);
-        if (!activeBatch) {
+        if (!batchTxn) {
             localTxn = mdb_txn_safe();
             if (auto res = lmdb_txn_begin(dbEnv.get(), nullptr, 0, localTxn)) {
                 printf("Failed to begin transaction at read with error code %i; and error: %s\n", res,
@@ -549,13 +709,13 @@ protected:
         }
 
         // only one of them should be active
-        assert(localTxn.rawPtr() == nullptr || activeBatch == nullptr);
+        assert(localTxn.rawPtr() == nullptr || batchTxn == nullptr);
 
         std::string&& keyBin = ssKey.str();
         MDB_val       kS     = {keyBin.size(), (void*)(keyBin.c_str())};
         MDB_val       vS{0, nullptr};
 
-        if (auto ret = mdb_del((!activeBatch ? localTxn : *activeBatch), *dbPtr, &kS, &vS)) {
+        if (auto ret = mdb_del((batchTxn ? batchTxn : localTxn.rawPtr()), *dbPtr, &kS, &vS)) {
             std::string dbgKey = KeyAsString(key, ssKey.str());
             printf("Failed to delete entry with key %s with lmdb; Code %i; Error message: %s\n",
                    dbgKey.c_str(), ret, mdb_strerror(ret));
@@ -584,8 +744,9 @@ protected:
         ssKey.reserve(1000);
         ssKey << key;
 
+        MDB_txn*     batchTxn = GetBatchTxn();
         mdb_txn_safe localTxn(false);
-        if (!activeBatch) {
+        if (!batchTxn) {
             localTxn = mdb_txn_safe();
             if (auto res = lmdb_txn_begin(dbEnv.get(), nullptr, 0, localTxn)) {
                 printf("Failed to begin transaction at read with error code %i; and error: %s\n", res,
@@ -594,14 +755,14 @@ protected:
         }
 
         // only one of them should be active
-        assert(localTxn.rawPtr() == nullptr || activeBatch == nullptr);
+        assert(localTxn.rawPtr() == nullptr || batchTxn == nullptr);
 
         std::string&& keyBin = ssKey.str();
         MDB_val       kS     = {keyBin.size(), (void*)(keyBin.c_str())};
         MDB_val       vS{0, nullptr};
 
         MDB_cursor* cursorRawPtr = nullptr;
-        if (auto rc = mdb_cursor_open((!activeBatch ? localTxn : *activeBatch), *dbPtr, &cursorRawPtr)) {
+        if (auto rc = mdb_cursor_open((batchTxn ? batchTxn : localTxn.rawPtr()), *dbPtr, &cursorRawPtr)) {
             return error("EraseDup: Failed to open lmdb cursor with error code %d; and error: %s\n", rc,
                          mdb_strerror(rc));
         }
@@ -647,26 +808,17 @@ protected:
         ssKey << key;
         std::string unused;
 
-        mdb_txn_safe localTxn(false);
-        if (!activeBatch) {
-            localTxn = mdb_txn_safe();
-            if (auto res = lmdb_txn_begin(dbEnv.get(), nullptr, MDB_RDONLY, localTxn)) {
-                printf("Failed to begin transaction at read with error code %i; and error: %s\n", res,
-                       mdb_strerror(res));
-            }
-        }
-
-        // only one of them should be active
-        assert(localTxn.rawPtr() == nullptr || activeBatch == nullptr);
+        MDB_txn*     batchTxn = GetBatchTxn();
+        // outside of a batch, the read transaction of the thread is used (see CTxDBReadSnapshot)
+        CTxDBReadSnapshot snapshot(!batchTxn);
+        if (!batchTxn && !snapshot.IsValid())
+            return false;
 
         std::string&& keyBin = ssKey.str();
         MDB_val       kS     = {keyBin.size(), (void*)(keyBin.c_str())};
         MDB_val       vS{0, nullptr};
 
-        if (auto ret = mdb_get((!activeBatch ? localTxn : *activeBatch), *dbPtr, &kS, &vS)) {
-            if (localTxn.rawPtr()) {
-                localTxn.abort();
-            }
+        if (auto ret = mdb_get((batchTxn ? batchTxn : snapshot.GetTxn()), *dbPtr, &kS, &vS)) {
             std::string dbgKey = KeyAsString(key, ssKey.str());
             if (ret == MDB_NOTFOUND) {
                 return false;
@@ -677,9 +829,6 @@ protected:
             }
             return false;
         } else {
-            if (localTxn.rawPtr()) {
-                localTxn.abort();
-            }
             return true;
         }
     }
@@ -696,10 +845,20 @@ public:
     }
 
     static bool need_resize(uint64_t threshold_size = 0);
+    // need_resize() without looking at the map, as long as the writes since the last look surely fit
+    static bool need_resize_for_write(uint64_t nBytes);
+    static void check_resize_on_next_write();
     void        do_resize(uint64_t increase_size = 0);
+    // resizes the map only if no transaction is open, without waiting for one to end
+    static bool try_resize();
+    static bool need_proactive_resize();
+    static uint64_t GetNextMapSize(uint64_t nMapSize, uint64_t nIncrease, uint64_t nPageSize);
+    static CLMDBResizeStats GetResizeStats();
     bool        TxnBegin(std::size_t required_size = 0);
     bool        TxnCommit();
     bool        TxnAbort();
+    // whether the reads go to a write transaction, with which no snapshot is begun on the thread
+    bool        IsInWriteTxn() const { return activeBatch || CTxDBBatchScope::IsActive(); }
 
     // for tests
     bool test1_WriteStrKeyVal(const std::string& key, const std::string& val);
@@ -733,6 +892,46 @@ public:
     bool ReadDiskTx(COutPoint outpoint, CTransaction& tx);
     bool ReadBlock(uint256 hash, CBlock& blk, bool fReadTransactions = true);
     bool WriteBlock(uint256 hash, const CBlock& blk);
+    bool EraseBlock(uint256 hash);
+    bool WritePrunedTx(const CDiskTxPos& txPos, const CTransaction& tx);
+    bool ReadPrunedTx(const CDiskTxPos& txPos, CTransaction& tx);
+    bool ErasePrunedTx(const CDiskTxPos& txPos);
+    bool ReadPruneHeight(int& nHeight);
+    bool WritePruneHeight(int nHeight);
+    bool GetBlocksDbSize(uint64_t& nSize);
+    bool ReadBlockFilePositions(std::vector<std::pair<uint256, CBlockFilePos>>& vPositions);
+    bool ReadAddrIndexHeight(int& nHeight);
+    bool WriteAddrIndexHeight(int nHeight);
+    bool ReadAddrIndexDelta(const CAddrIndexKey& key, CAddrIndexDelta& delta);
+    bool WriteAddrIndexDelta(const CAddrIndexKey& key, const CAddrIndexDelta& delta);
+    bool EraseAddrIndexDelta(const CAddrIndexKey& key);
+    bool ReadAddrIndexUtxo(const CAddrIndexUtxoKey& key, CAddrIndexUtxo& utxo);
+    bool WriteAddrIndexUtxo(const CAddrIndexUtxoKey& key, const CAddrIndexUtxo& utxo);
+    bool EraseAddrIndexUtxo(const CAddrIndexUtxoKey& key);
+    // the entries of an address in the order of their keys, skipping the first nSkip of them
+    bool ReadAddrIndexHistory(const uint160& scriptHash, uint64_t nSkip, uint64_t nCount,
+                              std::vector<std::pair<CAddrIndexKey, CAddrIndexDelta>>& vEntries);
+    bool ReadAddrIndexUtxos(const uint160& scriptHash, uint64_t nSkip, uint64_t nCount,
+                            std::vector<std::pair<CAddrIndexUtxoKey, CAddrIndexUtxo>>& vEntries);
+    bool EraseAddrIndex();
+    bool ReadTokenIndexHeight(int& nHeight);
+    bool WriteTokenIndexHeight(int nHeight);
+    bool ReadTokenIndexInfo(const std::string& tokenId, CTokenIndexInfo& info);
+    bool WriteTokenIndexInfo(const std::string& tokenId, const CTokenIndexInfo& info);
+    bool EraseTokenIndexInfo(const std::string& tokenId);
+    bool ReadTokenIndexHolder(const CTokenIndexHolderKey& key, CTokenIndexHolder& holder);
+    bool WriteTokenIndexHolder(const CTokenIndexHolderKey& key, const CTokenIndexHolder& holder);
+    bool EraseTokenIndexHolder(const CTokenIndexHolderKey& key);
+    bool WriteTokenIndexTransfer(const CTokenIndexTransferKey& key, const CTokenIndexTransfer& transfer);
+    bool EraseTokenIndexTransfer(const CTokenIndexTransferKey& key);
+    // the entries of a token in the order of their keys, skipping the first nSkip of them
+    bool
+    ReadTokenIndexHolders(const std::string& tokenId, uint64_t nSkip, uint64_t nCount,
+                          std::vector<std::pair<CTokenIndexHolderKey, CTokenIndexHolder>>& vEntries);
+    bool ReadTokenIndexTransfers(
+        const std::string& tokenId, uint64_t nSkip, uint64_t nCount,
+        std::vector<std::pair<CTokenIndexTransferKey, CTokenIndexTransfer>>& vEntries);
+    bool EraseTokenIndex();
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
     bool ReadHashBestChain(uint256& hashBestChain);
     bool WriteHashBestChain(uint256 hashBestChain);
@@ -742,12 +941,29 @@ public:
     bool WriteSyncCheckpoint(uint256 hashCheckpoint);
     bool ReadCheckpointPubKey(std::string& strPubKey);
     bool WriteCheckpointPubKey(const std::string& strPubKey);
+    bool ReadCoins(uint256 txid, CCoins& coins);
+    bool WriteCoins(uint256 txid, const CCoins& coins);
+    bool EraseCoins(uint256 txid);
+    bool HaveCoins(uint256 txid);
+    bool ReadBlockUndo(uint256 hash, CBlockUndo& blockundo);
+    bool WriteBlockUndo(uint256 hash, const CBlockUndo& blockundo);
+    bool EraseBlockUndo(uint256 hash);
+    bool ReadCoinsBestBlock(uint256& hashBestBlock);
+    bool WriteCoinsBestBlock(uint256 hashBestBlock);
+    bool RebuildCoins();
+    bool MigrateBlocksToFlatFiles();
     bool LoadBlockIndex();
 
     void init_blockindex(bool fRemoveOld = false);
 
 private:
     bool LoadBlockIndexGuts();
+    bool LoadCoins();
+    void OpenBlockStore();
+
+    // The transaction to read and write in when there's no transaction of our own: the innermost one
+    // of the batch of this thread (see CTxDBBatchScope), or null
+    MDB_txn* GetBatchTxn();
 
     inline void        loadDbPointers();
     inline void        resetDbPointers();
@@ -763,6 +979,15 @@ void CTxDB::loadDbPointers()
     db_ntp1Tx         = glob_db_ntp1Tx.get();
     db_ntp1tokenNames = glob_db_ntp1tokenNames.get();
     db_addrsVsPubKeys = glob_db_addrsVsPubKeys.get();
+    db_coins          = glob_db_coins.get();
+    db_blockUndo      = glob_db_blockUndo.get();
+    db_blockPos       = glob_db_blockPos.get();
+    db_prunedTx       = glob_db_prunedTx.get();
+    db_addrIndex      = glob_db_addrIndex.get();
+    db_addrUtxos      = glob_db_addrUtxos.get();
+    db_tokenInfo      = glob_db_tokenInfo.get();
+    db_tokenHolders   = glob_db_tokenHolders.get();
+    db_tokenTransfers = glob_db_tokenTransfers.get();
 }
 
 void CTxDB::resetDbPointers()
@@ -774,10 +999,21 @@ void CTxDB::resetDbPointers()
     db_ntp1Tx         = nullptr;
     db_ntp1tokenNames = nullptr;
     db_addrsVsPubKeys = nullptr;
+    db_coins          = nullptr;
+    db_blockUndo      = nullptr;
+    db_blockPos       = nullptr;
+    db_prunedTx       = nullptr;
+    db_addrIndex      = nullptr;
+    db_addrUtxos      = nullptr;
+    db_tokenInfo      = nullptr;
+    db_tokenHolders   = nullptr;
+    db_tokenTransfers = nullptr;
 }
 
 void CTxDB::resetGlobalDbPointers()
 {
+    CTxDBReadSnapshot::EndAll();
+
     glob_db_main.reset();
     glob_db_blockIndex.reset();
     glob_db_blocks.reset();
@@ -785,6 +1021,16 @@ void CTxDB::resetGlobalDbPointers()
     glob_db_ntp1Tx.reset();
     glob_db_ntp1tokenNames.reset();
     glob_db_addrsVsPubKeys.reset();
+    glob_db_coins.reset();
+    glob_db_blockUndo.reset();
+    glob_db_blockPos.reset();
+    glob_db_prunedTx.reset();
+    glob_db_addrIndex.reset();
+    glob_db_addrUtxos.reset();
+    glob_db_tokenInfo.reset();
+    glob_db_tokenHolders.reset();
+    glob_db_tokenTransfers.reset();
+    glob_blockStore.reset();
 
     dbEnv.reset();
 }
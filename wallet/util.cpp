@@ -197,47 +197,18 @@ inline int OutputDebugStringF(const char* pszFormat, ...)
         va_end(arg_ptr);
     } else if (!fPrintToDebugger) {
         // print to debug.log
-        static FILE* fileout = NULL;
+        CDebugLogWriter& writer = CDebugLogWriter::Instance();
 
-        if (!fileout) {
-            boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-            fileout                           = fopen(pathDebug.string().c_str(), "a");
-            if (fileout)
-                setbuf(fileout, NULL); // unbuffered
+        // reopen the log file, if requested
+        if (fReopenDebugLog) {
+            fReopenDebugLog = false;
+            writer.Reopen();
         }
-        if (fileout) {
-            static bool fStartedNewLine = true;
-
-            // This routine may be called by global destructors during shutdown.
-            // Since the order of destruction of static/global objects is undefined,
-            // allocate mutexDebugLog on the heap the first time this routine
-            // is called to avoid crashes during shutdown.
-            static boost::mutex* mutexDebugLog = NULL;
-            if (mutexDebugLog == NULL)
-                mutexDebugLog = new boost::mutex();
-            boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
-
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog                   = false;
-                boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-                if (freopen(pathDebug.string().c_str(), "a", fileout) != NULL)
-                    setbuf(fileout, NULL); // unbuffered
-            }
-
-            // Debug print useful for profiling
-            if (fLogTimestamps && fStartedNewLine)
-                fprintf(fileout, "%s ", DateTimeStrFormat("%x %H:%M:%S", GetTime()).c_str());
-            if (pszFormat[strlen(pszFormat) - 1] == '\n')
-                fStartedNewLine = true;
-            else
-                fStartedNewLine = false;
 
-            va_list arg_ptr;
-            va_start(arg_ptr, pszFormat);
-            ret = vfprintf(fileout, pszFormat, arg_ptr);
-            va_end(arg_ptr);
-        }
+        va_list arg_ptr;
+        va_start(arg_ptr, pszFormat);
+        ret = writer.VPrint(pszFormat, arg_ptr);
+        va_end(arg_ptr);
     }
 
 #ifdef WIN32
@@ -1329,6 +1300,23 @@ std::string ZlibDecompress(const std::string& compressedString)
     return res;
 }
 
+std::string ZlibDecompress(const std::string& compressedString, size_t nMaxSize)
+{
+    boost::iostreams::filtering_istreambuf in;
+    in.push(boost::iostreams::zlib_decompressor());
+    in.push(boost::iostreams::array_source(&*compressedString.begin(), &*compressedString.end()));
+    std::string     res;
+    char            buf[64 * 1024];
+    std::streamsize n;
+    while ((n = in.sgetn(buf, sizeof(buf))) > 0) {
+        if (static_cast<size_t>(n) > nMaxSize - res.size())
+            throw std::runtime_error("The decompressed data is larger than " + std::to_string(nMaxSize) +
+                                     " bytes");
+        res.append(buf, n);
+    }
+    return res;
+}
+
 std::uintmax_t GetFreeDiskSpace(const boost::filesystem::path& path)
 {
     static_assert(sizeof(std::uintmax_t) >= 8,
@@ -35,6 +35,7 @@
 #include <openssl/sha.h>
 
 #include "ThreadSafeHashMap.h"
+#include "logging.h"
 #include "netbase.h" // for AddTimeData
 
 // to obtain PRId64 on some old systems
@@ -203,6 +204,14 @@ bool ATTR_WARN_PRINTF(1, 2) error(const char* format, ...);
  */
 #define printf OutputDebugStringF
 
+/* Logs a message of the given LogCategory, only if that category is enabled. The arguments aren't
+ * evaluated otherwise, so this is cheap enough for hot paths. */
+#define LogPrint(category, ...)                                                                    \
+    do {                                                                                           \
+        if (LogAcceptCategory(category))                                                           \
+            OutputDebugStringF(__VA_ARGS__);                                                       \
+    } while (false)
+
 void                           PrintException(std::exception* pex, const char* pszThread);
 void                           PrintExceptionContinue(std::exception* pex, const char* pszThread);
 void                           ParseString(const std::string& str, char c, std::vector<std::string>& v);
@@ -687,6 +696,8 @@ inline void FromLittleEndianToThisEndianness(T& v)
 
 std::string ZlibCompress(const std::string& data);
 std::string ZlibDecompress(const std::string& compressedString);
+/** Throws once the data would decompress to more than nMaxSize bytes, without inflating the rest */
+std::string ZlibDecompress(const std::string& compressedString, size_t nMaxSize);
 
 template <typename T>
 std::string ConvertToBitString(T num)
@@ -18,6 +18,8 @@
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/make_shared.hpp>
 
+#include <atomic>
+
 using namespace std;
 
 unsigned int nStakeSplitAge         = 1 * 24 * 60 * 60;
@@ -369,27 +371,95 @@ int64_t CWallet::IncOrderPosNext(CWalletDB* pwalletdb)
     return nRet;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount)
+void CWallet::RebuildOrderedTxItems()
 {
     AssertLockHeld(cs_wallet); // mapWallet
-    CWalletDB walletdb(strWalletFile);
 
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
-    TxItems txOrdered;
-
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) -->
-    // acentry would make this much faster for applications that do this a lot.
+    wtxOrdered.clear();
     for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
         CWalletTx* wtx = &((*it).second);
-        txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        wtxOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+    }
+    for (CAccountingEntry& entry : laccentries) {
+        wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+    }
+    fAccountOrderedStale = true;
+}
+
+void CWallet::AddToOrderedTxItems(int64_t nOrderPos, CWalletTx* pwtx, CAccountingEntry* pacentry)
+{
+    AssertLockHeld(cs_wallet); // wtxOrdered
+    wtxOrdered.insert(make_pair(nOrderPos, TxPair(pwtx, pacentry)));
+    AddToAccountOrdered(nOrderPos, pwtx, pacentry);
+}
+
+void CWallet::AddToAccountOrdered(int64_t nOrderPos, CWalletTx* pwtx, CAccountingEntry* pacentry)
+{
+    AssertLockHeld(cs_wallet); // mapAccountOrdered, mapAddressBook
+    if (fAccountOrderedStale)
+        return;
+
+    // the accounts that ListTransactions() and AcentryToJSON() can give entries of: the one that sent a
+    // transaction, and the ones of the addresses that its outputs pay to, whether they're the wallet's
+    // or not, since that can change
+    std::set<std::string> setAccounts;
+    if (pacentry)
+        setAccounts.insert(pacentry->strAccount);
+    if (pwtx) {
+        setAccounts.insert(pwtx->strFromAccount);
+        for (const CTxOut& txout : pwtx->vout) {
+            CTxDestination                                        address;
+            std::map<CTxDestination, std::string>::const_iterator mi = mapAddressBook.end();
+            if (ExtractDestination(txout.scriptPubKey, address))
+                mi = mapAddressBook.find(address);
+            setAccounts.insert(mi != mapAddressBook.end() ? mi->second : "");
+        }
     }
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    for (CAccountingEntry& entry : acentries) {
-        txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+    for (const std::string& strAccount : setAccounts)
+        mapAccountOrdered[strAccount].insert(make_pair(nOrderPos, TxPair(pwtx, pacentry)));
+}
+
+const CWallet::TxItems& CWallet::GetAccountOrderedTxItems(const std::string& strAccount)
+{
+    AssertLockHeld(cs_wallet); // mapAccountOrdered
+    if (fAccountOrderedStale) {
+        mapAccountOrdered.clear();
+        fAccountOrderedStale = false;
+        for (const TxItems::value_type& item : wtxOrdered)
+            AddToAccountOrdered(item.first, item.second.first, item.second.second);
+    }
+
+    static const TxItems                           emptyItems;
+    std::map<std::string, TxItems>::const_iterator mi = mapAccountOrdered.find(strAccount);
+    return mi != mapAccountOrdered.end() ? mi->second : emptyItems;
+}
+
+bool CWallet::AddAccountingEntries(std::vector<CAccountingEntry>& vEntries, CWalletDB& walletdb)
+{
+    AssertLockHeld(cs_wallet); // nOrderPosNext, laccentries, wtxOrdered
+
+    // the entries only get into the activity log once they're in the database, and their positions
+    // are given back if they aren't
+    const int64_t nOrderPosNextBefore = nOrderPosNext;
+    if (!walletdb.TxnBegin())
+        return false;
+    bool fOk = true;
+    for (unsigned int i = 0; i < vEntries.size() && fOk; i++) {
+        vEntries[i].nOrderPos = IncOrderPosNext(&walletdb);
+        fOk                   = walletdb.WriteAccountingEntry(vEntries[i]);
+    }
+    if (!fOk)
+        walletdb.TxnAbort();
+    if (!fOk || !walletdb.TxnCommit()) {
+        nOrderPosNext = nOrderPosNextBefore;
+        return false;
     }
 
-    return txOrdered;
+    for (const CAccountingEntry& acentry : vEntries) {
+        laccentries.push_back(acentry);
+        AddToOrderedTxItems(acentry.nOrderPos, nullptr, &laccentries.back());
+    }
+    return true;
 }
 
 void CWallet::WalletUpdateSpent(const CTransaction& tx, bool fBlock)
@@ -437,6 +507,8 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (PAIRTYPE(const uint256, CWalletTx) & item : mapWallet)
             item.second.MarkDirty();
+        balanceCache.SetAllDirty();
+        outputIndex.SetAllDirty();
     }
 }
 
@@ -454,10 +526,12 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         }
         CWalletTx& wtx = (*ret.first).second;
         wtx.BindWallet(this);
+        MarkDirty(hash);
         bool fInsertedNew = ret.second;
         if (fInsertedNew) {
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos     = IncOrderPosNext();
+            AddToOrderedTxItems(wtx.nOrderPos, &wtx, nullptr);
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (wtxIn.hashBlock != 0) {
@@ -467,10 +541,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
                     {
                         // Tolerate times up to the last timestamp in the wallet not more than 5 minutes
                         // into the future
-                        int64_t                     latestTolerated = latestNow + 300;
-                        std::list<CAccountingEntry> acentries;
-                        TxItems                     txOrdered = OrderedTxItems(acentries);
-                        for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend();
+                        int64_t latestTolerated = latestNow + 300;
+                        for (TxItems::reverse_iterator it = wtxOrdered.rbegin(); it != wtxOrdered.rend();
                              ++it) {
                             CWalletTx* const pwtx = (*it).second.first;
                             if (pwtx == &wtx)
@@ -593,8 +665,28 @@ bool CWallet::EraseFromWallet(uint256 hash)
         return false;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end()) {
+            CWalletTx* pwtx = &(*mi).second;
+            // the position is normally the key, but look everywhere in case it was changed
+            auto finder = [pwtx](const TxItems::value_type& item) { return item.second.first == pwtx; };
+            std::pair<TxItems::iterator, TxItems::iterator> range =
+                wtxOrdered.equal_range(pwtx->nOrderPos);
+            TxItems::iterator it = std::find_if(range.first, range.second, finder);
+            if (it == range.second)
+                it = std::find_if(wtxOrdered.begin(), wtxOrdered.end(), finder);
+            if (it != wtxOrdered.end())
+                wtxOrdered.erase(it);
+            for (std::map<std::string, TxItems>::value_type& account : mapAccountOrdered) {
+                range = account.second.equal_range(pwtx->nOrderPos);
+                it    = std::find_if(range.first, range.second, finder);
+                if (it != range.second)
+                    account.second.erase(it);
+            }
+            mapWallet.erase(mi);
+            MarkDirty(hash);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
     }
     return true;
 }
@@ -877,44 +969,189 @@ void CWalletTx::AddSupportingTransactions(CTxDB& txdb)
 
 bool CWalletTx::WriteToDisk() { return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this); }
 
+namespace {
+/** A block read ahead by the rescan workers */
+struct CRescanBlock
+{
+    CBlockIndexSmartPtr pindex;
+    CBlock              block;
+    bool                fRead = false;
+    // for each transaction: whether one of its outputs may belong to the wallet
+    std::vector<bool> vMayBeMine;
+};
+
+// A quick version of IsMine() that only uses the key ids collected before the rescan. It may be
+// wrong with multisig, but never says no to an output IsMine() would accept.
+bool RescanOutputMayBeMine(const CKeyStore& keystore, const std::set<CKeyID>& setKeyIDs,
+                           const CScript& scriptPubKey)
+{
+    vector<valtype> vSolutions;
+    txnouttype      whichType;
+    if (!Solver(scriptPubKey, whichType, vSolutions))
+        return false;
+
+    switch (whichType) {
+    case TX_PUBKEY:
+        return setKeyIDs.count(CPubKey(vSolutions[0]).GetID()) > 0;
+    case TX_PUBKEYHASH:
+        return setKeyIDs.count(CKeyID(uint160(vSolutions[0]))) > 0;
+    case TX_SCRIPTHASH:
+        return keystore.HaveCScript(CScriptID(uint160(vSolutions[0])));
+    case TX_MULTISIG:
+        for (unsigned int i = 1; i + 1 < vSolutions.size(); i++)
+            if (setKeyIDs.count(CPubKey(vSolutions[i]).GetID()))
+                return true;
+        return false;
+    default:
+        return false;
+    }
+}
+
+const size_t RESCAN_BATCH_SIZE = 500;
+
+// Collects the next blocks to scan, starting at pindex, which is moved past them
+std::vector<CRescanBlock> CollectRescanBatch(CBlockIndexSmartPtr& pindex, int64_t nTimeFirstKey)
+{
+    std::vector<CRescanBlock> vBlocks;
+
+    LOCK(cs_main);
+    while (pindex && vBlocks.size() < RESCAN_BATCH_SIZE) {
+        // no need to read and scan block, if block was created before
+        // our wallet birthday (as adjusted for block time variability)
+        if (!nTimeFirstKey || pindex->nTime >= (nTimeFirstKey - 7200)) {
+            vBlocks.push_back(CRescanBlock());
+            vBlocks.back().pindex = pindex;
+        }
+        pindex = boost::atomic_load(&pindex->pnext);
+    }
+    return vBlocks;
+}
+
+// Reads the given blocks on nThreads threads and marks the transactions that may pay to the wallet
+void RescanReadBlocks(std::vector<CRescanBlock>& vBlocks, const CKeyStore& keystore,
+                      const std::set<CKeyID>& setKeyIDs, unsigned int nThreads)
+{
+    std::atomic<size_t> nNext(0);
+    auto                worker = [&]() {
+        CTxDB  txdb("r");
+        size_t i;
+        while ((i = nNext++) < vBlocks.size()) {
+            CRescanBlock& rb = vBlocks[i];
+            // the block is stored under its hash in our own database, so hashing it again (scrypt)
+            // only to compare it to the index isn't needed here
+            rb.fRead = rb.block.ReadFromDisk(rb.pindex->blockKeyInDB, txdb, true);
+            if (!rb.fRead)
+                continue;
+            rb.vMayBeMine.assign(rb.block.vtx.size(), false);
+            for (unsigned int n = 0; n < rb.block.vtx.size(); n++) {
+                for (const CTxOut& txout : rb.block.vtx[n].vout) {
+                    if (RescanOutputMayBeMine(keystore, setKeyIDs, txout.scriptPubKey)) {
+                        rb.vMayBeMine[n] = true;
+                        break;
+                    }
+                }
+            }
+        }
+    };
+
+    boost::thread_group threads;
+    for (unsigned int i = 1; i < nThreads; i++)
+        threads.create_thread(worker);
+    worker();
+    threads.join_all();
+}
+} // namespace
+
 // Scan the block chain (starting in pindexStart) for transactions
 // from or to us. If fUpdate is true, found transactions that already
 // exist in the wallet will be updated.
+// Blocks are read and matched against the wallet keys on worker threads, one batch ahead of the
+// batch being applied, and the wallet is only locked while the transactions of one block are
+// added. The progress is saved after every batch, so that an interrupted rescan continues where it
+// stopped on the next start.
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
 
-    CBlockIndex* pindex = pindexStart;
+    // keys generated during the rescan are new and can't be in any block that's being scanned, so
+    // the keys known now are enough to find the candidate transactions
+    std::set<CKeyID> setKeyIDs;
+    GetKeys(setKeyIDs);
 
-    uint64_t blockCount = pindexStart->nHeight;
+    const unsigned int nThreads = std::max(1u, boost::thread::hardware_concurrency());
 
+    CBlockIndexSmartPtr pindexNext;
     {
-        LOCK2(cs_main, cs_wallet);
-        while (pindex) {
-            blockCount++;
+        LOCK(cs_main);
+        BlockIndexMapType::iterator mi = mapBlockIndex.find(pindexStart->GetBlockHash());
+        if (mi == mapBlockIndex.end())
+            return 0;
+        pindexNext = boost::atomic_load(&mi->second);
+    }
+
+    std::vector<CRescanBlock> vBatch = CollectRescanBatch(pindexNext, nTimeFirstKey);
+    RescanReadBlocks(vBatch, *this, setKeyIDs, nThreads);
+
+    while (!vBatch.empty()) {
+        // read the next batch while this one is being applied
+        std::vector<CRescanBlock> vNextBatch = CollectRescanBatch(pindexNext, nTimeFirstKey);
+        boost::thread             prefetcher(
+            [&]() { RescanReadBlocks(vNextBatch, *this, setKeyIDs, nThreads); });
+
+        CBlockIndexSmartPtr pindexLastApplied;
+        bool                fReorganized = false;
+        for (CRescanBlock& rb : vBatch) {
+            if (fShutdown)
+                break;
 
-            if (blockCount % 1000 == 0) {
-                uiInterface.InitMessage(_("Rescanning... ") + "(block: " + std::to_string(blockCount) +
-                                        "/" + std::to_string(nBestHeight) + ")");
+            LOCK2(cs_main, cs_wallet);
+            if (!rb.pindex->IsInMainChain()) {
+                // the chain changed under us, continue from where it forked
+                CBlockIndexSmartPtr pindexFork = boost::atomic_load(&rb.pindex->pprev);
+                while (pindexFork && !pindexFork->IsInMainChain())
+                    pindexFork = boost::atomic_load(&pindexFork->pprev);
+                pindexNext   = pindexFork ? boost::atomic_load(&pindexFork->pnext) : nullptr;
+                fReorganized = true;
+                break;
             }
-
-            // no need to read and scan block, if block was created before
-            // our wallet birthday (as adjusted for block time variability)
-            if (nTimeFirstKey && (pindex->nTime < (nTimeFirstKey - 7200))) {
-                pindex = boost::atomic_load(&pindex->pnext).get();
-                continue;
+            if (!rb.fRead) {
+                printf("ScanForWalletTransactions() : failed to read block %s\n",
+                       rb.pindex->GetBlockHash().ToString().c_str());
             }
-
-            CBlock block;
-            block.ReadFromDisk(pindex, true);
-            for (CTransaction& tx : block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+            for (unsigned int n = 0; n < rb.block.vtx.size(); n++) {
+                const CTransaction& tx = rb.block.vtx[n];
+                // transactions not paying to us can still be ours if they spend our outputs
+                bool fCandidate = rb.vMayBeMine[n] || mapWallet.count(tx.GetHash());
+                for (unsigned int i = 0; i < tx.vin.size() && !fCandidate; i++)
+                    fCandidate = mapWallet.count(tx.vin[i].prevout.hash) > 0;
+                if (fCandidate && AddToWalletIfInvolvingMe(tx, &rb.block, fUpdate))
                     ret++;
             }
-            pindex = boost::atomic_load(&pindex->pnext).get();
+            pindexLastApplied = rb.pindex;
+        }
+
+        prefetcher.join();
+
+        if (pindexLastApplied) {
+            CWalletDB(strWalletFile).WriteRescanProgress(CBlockLocator(pindexLastApplied.get()));
+            uiInterface.InitMessage(_("Rescanning... ") +
+                                    "(block: " + std::to_string(pindexLastApplied->nHeight) + "/" +
+                                    std::to_string(nBestHeight) + ")");
+        }
+
+        if (fShutdown)
+            return ret;
+
+        if (fReorganized) {
+            vBatch = CollectRescanBatch(pindexNext, nTimeFirstKey);
+            RescanReadBlocks(vBatch, *this, setKeyIDs, nThreads);
+        } else {
+            vBatch.swap(vNextBatch);
         }
-        uiInterface.InitMessage(_("Rescanning... ") + "(done)");
     }
+
+    CWalletDB(strWalletFile).EraseRescanProgress();
+    uiInterface.InitMessage(_("Rescanning... ") + "(done)");
     return ret;
 }
 
@@ -1046,48 +1283,20 @@ void CWallet::ResendWalletTransactions(bool fForce)
 
 int64_t CWallet::GetBalance() const
 {
-    int64_t nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end();
-             ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return balanceCache.Get(*this).nBalance;
 }
 
 int64_t CWallet::GetUnconfirmedBalance() const
 {
-    int64_t nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end();
-             ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return balanceCache.Get(*this).nUnconfirmed;
 }
 
 int64_t CWallet::GetImmatureBalance() const
 {
-    int64_t nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end();
-             ++it) {
-            const CWalletTx& pcoin = (*it).second;
-            if (pcoin.IsCoinBase() && pcoin.GetBlocksToMaturity() > 0 && pcoin.IsInMainChain())
-                nTotal += GetCredit(pcoin);
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return balanceCache.Get(*this).nImmature;
 }
 
 // populate vCoins with vector of spendable COutputs
@@ -1098,9 +1307,8 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed,
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end();
-             ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const auto& item : outputIndex.Get(*this)) {
+            const CWalletTx* pcoin = item.second.pwtx;
 
             if (!IsFinalTx(*pcoin))
                 continue;
@@ -1118,12 +1326,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed,
             if (nDepth < 0)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) &&
-                    pcoin->vout[i].nValue >= nMinimumInputValue &&
+            for (const CWalletOutputIndex::Output& output : item.second.vOutputs)
+                if (output.nValue >= nMinimumInputValue &&
                     (!coinControl || !coinControl->HasSelected() ||
-                     coinControl->IsSelected((*it).first, i)))
-                    vCoins.push_back(COutput(pcoin, i, nDepth));
+                     coinControl->IsSelected(item.first, output.nOut)))
+                    vCoins.push_back(COutput(pcoin, output.nOut, nDepth));
         }
     }
 }
@@ -1135,9 +1342,8 @@ void CWallet::AvailableCoinsForStaking(vector<COutput>& vCoins, unsigned int nSp
     {
         LOCK2(cs_main, cs_wallet);
         unsigned int nSMA = StakeMinAge();
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end();
-             ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const auto& item : outputIndex.Get(*this)) {
+            const CWalletTx* pcoin = item.second.pwtx;
 
             // Filtering by tx timestamp instead of block timestamp may give false positives but never
             // false negatives
@@ -1151,38 +1357,12 @@ void CWallet::AvailableCoinsForStaking(vector<COutput>& vCoins, unsigned int nSp
             if (nDepth < 1)
                 continue;
 
-            // get NTP1 information of this transaction
-            bool txIsNTP1 = NTP1Transaction::IsTxNTP1(pcoin);
-
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) &&
-                    pcoin->vout[i].nValue >= nMinimumInputValue) {
-                    if (txIsNTP1) {
-                        // if this output is an NTP1 output, skip it
-                        try {
-                            const CTransaction* tx = dynamic_cast<const CTransaction*>(pcoin);
-                            if (tx == nullptr) {
-                                throw std::runtime_error(
-                                    "Unable to case transaction: " + pcoin->GetHash().ToString() +
-                                    " to CTransaction");
-                            }
-                            std::vector<std::pair<CTransaction, NTP1Transaction>> inputs =
-                                NTP1Transaction::GetAllNTP1InputsOfTx(*tx, false);
-                            NTP1Transaction ntp1tx;
-                            ntp1tx.readNTP1DataFromTx(*tx, inputs);
-                            // if this output contains tokens, skip it to avoid burning them
-                            if (ntp1tx.getTxOut(i).tokenCount() > 0) {
-                                continue;
-                            }
-                        } catch (std::exception& ex) {
-                            printf(
-                                "Unable to parse script to check whether an output is stakable; error "
-                                "says: %s",
-                                ex.what());
-                        }
-                    }
-                    vCoins.push_back(COutput(pcoin, i, nDepth));
-                }
+            for (const CWalletOutputIndex::Output& output : item.second.vOutputs) {
+                // if this output contains tokens, skip it to avoid burning them
+                if (output.fCarriesTokens)
+                    continue;
+                if (output.nValue >= nMinimumInputValue)
+                    vCoins.push_back(COutput(pcoin, output.nOut, nDepth));
             }
         }
     }
@@ -1232,26 +1412,14 @@ static void ApproximateBestSubset(vector<pair<int64_t, pair<const CWalletTx*, un
 // ppcoin: total coins staked (non-spendable until maturity)
 int64_t CWallet::GetStake() const
 {
-    int64_t nTotal = 0;
     LOCK2(cs_main, cs_wallet);
-    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-        const CWalletTx* pcoin = &(*it).second;
-        if (pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
-            nTotal += CWallet::GetCredit(*pcoin);
-    }
-    return nTotal;
+    return balanceCache.Get(*this).nStake;
 }
 
 int64_t CWallet::GetNewMint() const
 {
-    int64_t nTotal = 0;
     LOCK2(cs_main, cs_wallet);
-    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-        const CWalletTx* pcoin = &(*it).second;
-        if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
-            nTotal += CWallet::GetCredit(*pcoin);
-    }
-    return nTotal;
+    return balanceCache.Get(*this).nNewMint;
 }
 
 bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime, int nConfMine,
@@ -1888,6 +2056,7 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64_t>>& vecSend, C
                 }
 
                 // Sign
+                CSignatureHashContext sigHashContext(wtxNew);
                 for (const PAIRTYPE(const CWalletTx*, unsigned int) & coin : setCoins) {
                     // find the output from the set in the list of inputs of the new tx
                     auto it =
@@ -1903,7 +2072,7 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64_t>>& vecSend, C
                         return false;
                     }
                     int nIn = std::distance(wtxNew.vin.begin(), it);
-                    if (!SignSignature(*this, *coin.first, wtxNew, nIn)) {
+                    if (!SignSignature(*this, *coin.first, wtxNew, nIn, SIGHASH_ALL, &sigHashContext)) {
                         CreateErrorMsg(errorMsg, "Error while signing transactions inputs.");
                         return false;
                     }
@@ -1975,14 +2144,15 @@ bool CWallet::GetStakeWeight(const CKeyStore& /*keystore*/, uint64_t& nMinWeight
     if (setCoins.empty())
         return false;
 
-    CTxDB txdb("r");
+    // the locks are taken before the snapshot, since a thread that holds cs_main may wait for the read
+    // transactions to end when the database grows
+    LOCK2(cs_main, cs_wallet);
+    CTxDB             txdb("r");
+    CTxDBReadSnapshot snapshot;
     for (PAIRTYPE(const CWalletTx*, unsigned int) pcoin : setCoins) {
         CTxIndex txindex;
-        {
-            LOCK2(cs_main, cs_wallet);
-            if (!txdb.ReadTxIndex(pcoin.first->GetHash(), txindex))
-                continue;
-        }
+        if (!txdb.ReadTxIndex(pcoin.first->GetHash(), txindex))
+            continue;
 
         int64_t nTimeWeight = GetWeight((int64_t)pcoin.first->nTime, (int64_t)GetTime());
         CBigNum bnCoinDayWeight =
@@ -2198,9 +2368,10 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
         txNew.vout[1].nValue = nCredit;
 
     // Sign
-    int nIn = 0;
+    int                   nIn = 0;
+    CSignatureHashContext sigHashContext(txNew);
     for (const CWalletTx* pcoin : vwtxPrev) {
-        if (!SignSignature(*this, *pcoin, txNew, nIn++))
+        if (!SignSignature(*this, *pcoin, txNew, nIn++, SIGHASH_ALL, &sigHashContext))
             return error("CreateCoinStake : failed to sign coinstake");
     }
 
@@ -2433,7 +2604,10 @@ bool CWallet::SetAddressBookName(const CTxDestination& address, const string& st
         LOCK(cs_wallet); // mapAddressBook
         std::map<CTxDestination, std::string>::iterator mi = mapAddressBook.find(address);
         fUpdated                                           = mi != mapAddressBook.end();
-        mapAddressBook[address]                            = strName;
+        // the transactions of the address go to the activity log of its new account
+        if ((fUpdated ? mi->second : "") != strName)
+            fAccountOrderedStale = true;
+        mapAddressBook[address] = strName;
     }
     NotifyAddressBookChanged(this, address, strName, ::IsMine(*this, address),
                              (fUpdated ? CT_UPDATED : CT_NEW));
@@ -2447,6 +2621,9 @@ bool CWallet::DelAddressBookName(const CTxDestination& address)
     {
         LOCK(cs_wallet); // mapAddressBook
 
+        std::map<CTxDestination, std::string>::iterator mi = mapAddressBook.find(address);
+        if (mi != mapAddressBook.end() && !mi->second.empty())
+            fAccountOrderedStale = true;
         mapAddressBook.erase(address);
     }
 
@@ -2814,7 +2991,8 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
     for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         vCoins.push_back(&(*it).second);
 
-    CTxDB txdb("r");
+    CTxDB             txdb("r");
+    CTxDBReadSnapshot snapshot;
     for (CWalletTx* pcoin : vCoins) {
         // Find the corresponding transaction index
         CTxIndex txindex;
@@ -17,7 +17,9 @@
 #include "script.h"
 #include "ui_interface.h"
 #include "util.h"
+#include "walletbalancecache.h"
 #include "walletdb.h"
+#include "walletoutputindex.h"
 
 extern bool fWalletUnlockStakingOnly;
 extern bool fConfChange;
@@ -138,13 +140,19 @@ public:
         nWalletMaxVersion   = FEATURE_BASE;
         fFileBacked         = false;
         nMasterKeyMaxID     = 0;
-        pwalletdbEncryption = nullptr;
-        nOrderPosNext       = 0;
-        nTimeFirstKey       = 0;
+        pwalletdbEncryption  = nullptr;
+        nOrderPosNext        = 0;
+        nTimeFirstKey        = 0;
+        fAccountOrderedStale = true;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
     int64_t                      nOrderPosNext;
+
+    // state derived from mapWallet; transactions changing their state have to be reported with
+    // MarkDirty(hash)
+    mutable CWalletBalanceCache balanceCache;
+    mutable CWalletOutputIndex  outputIndex;
     std::map<uint256, int>       mapRequestCount;
 
     std::map<CTxDestination, std::string> mapAddressBook;
@@ -207,13 +215,52 @@ public:
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef std::multimap<int64_t, TxPair>           TxItems;
 
-    /** Get the wallet's activity log
-        @return multimap of ordered transactions and accounting entries
-        @warning Returned pointers are *only* valid within the scope of passed acentries
+    /** The wallet's activity log: all transactions and accounting entries ordered by nOrderPos.
+        It's kept up to date by AddToWallet(), EraseFromWallet() and AddAccountingEntries(), so
+        readers can walk it from either end without rebuilding it.
+        @warning Only valid while holding cs_wallet
+     */
+    TxItems wtxOrdered;
+
+    /** All accounting entries of the wallet, kept in memory so that wtxOrdered can point to them */
+    std::list<CAccountingEntry> laccentries;
+
+    /** Rebuild wtxOrdered from mapWallet and laccentries (used after loading/reordering) */
+    void RebuildOrderedTxItems();
+
+private:
+    // the activity log of each account (see GetAccountOrderedTxItems()); it's built again from
+    // wtxOrdered once fAccountOrderedStale is set, when an address moved to another account
+    std::map<std::string, TxItems> mapAccountOrdered;
+    bool                           fAccountOrderedStale;
+
+    /** Adds an item to wtxOrdered and to the activity logs of its accounts */
+    void AddToOrderedTxItems(int64_t nOrderPos, CWalletTx* pwtx, CAccountingEntry* pacentry);
+    /** Adds an item to the activity logs of the accounts that it can have entries of */
+    void AddToAccountOrdered(int64_t nOrderPos, CWalletTx* pwtx, CAccountingEntry* pacentry);
+
+public:
+
+    /** Writes accounting entries to the database in one transaction, with the next positions in the
+        activity log (nOrderPos), and adds them to the log once the transaction is committed */
+    bool AddAccountingEntries(std::vector<CAccountingEntry>& vEntries, CWalletDB& walletdb);
+
+    /** The activity log of one account: the items of wtxOrdered that can have entries of the account,
+        which are its accounting entries and the transactions that it sent or that pay to one of its
+        addresses. The entries of the items still have to be checked against the account.
+        @warning Only valid while holding cs_wallet
      */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
+    const TxItems& GetAccountOrderedTxItems(const std::string& strAccount);
+
+    /** Adds an accounting entry that was read from the database (used by LoadWallet) */
+    void LoadAccountingEntry(const CAccountingEntry& acentry) { laccentries.push_back(acentry); }
 
     void    MarkDirty();
+    void    MarkDirty(const uint256& hash) const
+    {
+        balanceCache.SetDirty(hash);
+        outputIndex.SetDirty(hash);
+    }
     bool    AddToWallet(const CWalletTx& wtxIn);
     bool    AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate = false,
                                      bool fFindBlock = false);
@@ -531,6 +578,8 @@ public:
                 fAvailableCreditCached = false;
             }
         }
+        if (fReturn)
+            pwallet->MarkDirty(GetHash());
         if (pwallet->walletNewTxUpdateFunctor) {
             pwallet->walletNewTxUpdateFunctor->setReferenceBlockHeight();
             pwallet->walletNewTxUpdateFunctor->run(this->GetHash(), nBestHeight);
@@ -561,6 +610,7 @@ public:
         if (!vfSpent[nOut]) {
             vfSpent[nOut]          = true;
             fAvailableCreditCached = false;
+            pwallet->MarkDirty(GetHash());
         }
         if (pwallet->walletNewTxUpdateFunctor) {
             pwallet->walletNewTxUpdateFunctor->setReferenceBlockHeight();
@@ -576,6 +626,8 @@ public:
         if (vfSpent[nOut]) {
             vfSpent[nOut]          = false;
             fAvailableCreditCached = false;
+            if (pwallet)
+                pwallet->MarkDirty(GetHash());
         }
     }
 
@@ -155,7 +155,21 @@ HEADERS += qt/bitcoingui.h \
     merkletx.h            \
     blocklocator.h        \
     qt/ntp1/issuenewntp1tokendialog.h \
-    crypto_highlevel.h
+    crypto_highlevel.h \
+    rpcstreamwriter.h \
+    walletbalancecache.h \
+    walletoutputindex.h \
+    logging.h \
+    blockimport.h \
+    bootstrap.h \
+    coins.h \
+    blockstore.h \
+    blockprune.h \
+    addrindex.h \
+    tokenindex.h \
+    blockencodings.h \
+    headerchain.h \
+    indexbuild.h
 
 
 
@@ -307,7 +321,21 @@ SOURCES += qt/bitcoin.cpp \
     merkletx.cpp          \
     blocklocator.cpp      \
     qt/ntp1/issuenewntp1tokendialog.cpp \
-    crypto_highlevel.cpp
+    crypto_highlevel.cpp \
+    rpcstreamwriter.cpp \
+    walletbalancecache.cpp \
+    walletoutputindex.cpp \
+    logging.cpp \
+    blockimport.cpp \
+    bootstrap.cpp \
+    coins.cpp \
+    blockstore.cpp \
+    blockprune.cpp \
+    addrindex.cpp \
+    tokenindex.cpp \
+    blockencodings.cpp \
+    headerchain.cpp \
+    indexbuild.cpp
 
 
 SOURCES +=                   \
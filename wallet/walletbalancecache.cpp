@@ -0,0 +1,135 @@
+#include "walletbalancecache.h"
+
+#include "blockindex.h"
+#include "main.h"
+#include "wallet.h"
+
+bool CWalletBalanceCache::Balances::IsNull() const
+{
+    return nBalance == 0 && nUnconfirmed == 0 && nImmature == 0 && nStake == 0 && nNewMint == 0;
+}
+
+CWalletBalanceCache::Balances&
+CWalletBalanceCache::Balances::operator+=(const CWalletBalanceCache::Balances& other)
+{
+    nBalance += other.nBalance;
+    nUnconfirmed += other.nUnconfirmed;
+    nImmature += other.nImmature;
+    nStake += other.nStake;
+    nNewMint += other.nNewMint;
+    return *this;
+}
+
+CWalletBalanceCache::Balances&
+CWalletBalanceCache::Balances::operator-=(const CWalletBalanceCache::Balances& other)
+{
+    nBalance -= other.nBalance;
+    nUnconfirmed -= other.nUnconfirmed;
+    nImmature -= other.nImmature;
+    nStake -= other.nStake;
+    nNewMint -= other.nNewMint;
+    return *this;
+}
+
+void CWalletBalanceCache::Remove(const uint256& hash)
+{
+    std::map<uint256, Entry>::iterator it = mapEntries.find(hash);
+    if (it == mapEntries.end())
+        return;
+    totals -= it->second.contribution;
+    if (it->second.fVolatile)
+        setVolatile.erase(hash);
+    mapEntries.erase(it);
+}
+
+void CWalletBalanceCache::Evaluate(const CWallet& wallet, const uint256& hash, const CWalletTx& wtx,
+                                   int nBestHeight)
+{
+    // the conditions are the ones the balance functions used when scanning the whole wallet
+    Entry entry;
+
+    const int  nDepth   = wtx.GetDepthInMainChain();
+    const bool fTrusted = wtx.IsTrusted();
+    const bool fFinal   = IsFinalTx(wtx);
+    if (fTrusted)
+        entry.contribution.nBalance = wtx.GetAvailableCredit();
+    if (!fFinal || (!fTrusted && nDepth == 0))
+        entry.contribution.nUnconfirmed = wtx.GetAvailableCredit();
+
+    const int nToMaturity = wtx.GetBlocksToMaturity();
+    if (nToMaturity > 0 && nDepth > 0) {
+        if (wtx.IsCoinBase()) {
+            entry.contribution.nImmature = wallet.GetCredit(wtx);
+            entry.contribution.nNewMint  = entry.contribution.nImmature;
+        }
+        if (wtx.IsCoinStake())
+            entry.contribution.nStake = wallet.GetCredit(wtx);
+        mapMaturing.insert(std::make_pair(nBestHeight + nToMaturity, hash));
+    }
+
+    // generated transactions never go to the mempool, so they can only come back with a reorg
+    entry.fVolatile = !fFinal || (nDepth < 1 && !wtx.IsCoinBase() && !wtx.IsCoinStake());
+
+    if (entry.contribution.IsNull() && !entry.fVolatile)
+        return;
+
+    totals += entry.contribution;
+    if (entry.fVolatile)
+        setVolatile.insert(hash);
+    mapEntries[hash] = entry;
+}
+
+const CWalletBalanceCache::Balances& CWalletBalanceCache::Get(const CWallet& wallet)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(wallet.cs_wallet);
+
+    CBlockIndexSmartPtr pindexTip  = boost::atomic_load(&pindexBest);
+    const int           nHeight    = pindexTip ? pindexTip->nHeight : -1;
+    const uint256       hashNewTip = pindexTip ? pindexTip->GetBlockHash() : uint256(0);
+
+    if (!fAllDirty && CoinbaseMaturity() != nMaturity)
+        fAllDirty = true;
+
+    // blocks that were only appended to the chain are fine: wallet transactions in them are added
+    // through AddToWallet(), and maturity is taken care of by the schedule below. Anything else is a
+    // reorganization, and the depth of any transaction may have changed.
+    if (!fAllDirty && hashNewTip != hashTip) {
+        CBlockIndex* pindex = pindexTip.get();
+        while (pindex && pindex->nHeight > nTipHeight)
+            pindex = boost::atomic_load(&pindex->pprev).get();
+        if (!pindex || pindex->nHeight != nTipHeight || pindex->GetBlockHash() != hashTip)
+            fAllDirty = true;
+    }
+
+    if (fAllDirty) {
+        mapEntries.clear();
+        setVolatile.clear();
+        setDirty.clear();
+        mapMaturing.clear();
+        totals = Balances();
+        for (const std::pair<const uint256, CWalletTx>& item : wallet.mapWallet)
+            Evaluate(wallet, item.first, item.second, nHeight);
+        fAllDirty = false;
+    } else {
+        std::multimap<int, uint256>::iterator itMatured = mapMaturing.upper_bound(nHeight);
+        for (std::multimap<int, uint256>::iterator it = mapMaturing.begin(); it != itMatured; ++it)
+            setDirty.insert(it->second);
+        mapMaturing.erase(mapMaturing.begin(), itMatured);
+
+        setDirty.insert(setVolatile.begin(), setVolatile.end());
+        for (const uint256& hash : setDirty) {
+            Remove(hash);
+            std::map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.find(hash);
+            if (it != wallet.mapWallet.end())
+                Evaluate(wallet, hash, it->second, nHeight);
+        }
+        setDirty.clear();
+    }
+
+    hashTip    = hashNewTip;
+    nTipHeight = nHeight;
+    nMaturity  = CoinbaseMaturity();
+
+    return totals;
+}
@@ -0,0 +1,75 @@
+#ifndef WALLETBALANCECACHE_H
+#define WALLETBALANCECACHE_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+
+#include "uint256.h"
+
+class CWallet;
+class CWalletTx;
+
+/**
+ * Running totals of the wallet balances returned by CWallet::GetBalance() and friends.
+ *
+ * The contribution of every transaction is remembered, so that instead of scanning the whole wallet
+ * on every call, only the transactions whose contribution may have changed are evaluated again:
+ *  - transactions touched by a wallet event (see SetDirty())
+ *  - transactions that aren't in the chain yet, since their state depends on the mempool
+ *  - immature coinbase/coinstake transactions, once the tip reaches the height where they mature
+ * Anything that can't be tracked this way (reorganizations, changes of maturity, key imports)
+ * makes the next call start over from scratch.
+ *
+ * All methods must be called while holding cs_wallet; Get() also requires cs_main.
+ */
+class CWalletBalanceCache
+{
+public:
+    struct Balances
+    {
+        int64_t nBalance     = 0;
+        int64_t nUnconfirmed = 0;
+        int64_t nImmature    = 0;
+        int64_t nStake       = 0;
+        int64_t nNewMint     = 0;
+
+        bool IsNull() const;
+        Balances& operator+=(const Balances& other);
+        Balances& operator-=(const Balances& other);
+    };
+
+private:
+    struct Entry
+    {
+        Balances contribution;
+        bool     fVolatile;
+    };
+
+    // only transactions that contribute something or have to be checked on every call are stored
+    std::map<uint256, Entry>    mapEntries;
+    std::set<uint256>           setVolatile;
+    std::set<uint256>           setDirty;
+    std::multimap<int, uint256> mapMaturing; // height at which to evaluate again --> tx hash
+    Balances                    totals;
+
+    uint256 hashTip;
+    int     nTipHeight = -1;
+    int     nMaturity  = 0;
+    bool    fAllDirty  = true;
+
+    void Remove(const uint256& hash);
+    void Evaluate(const CWallet& wallet, const uint256& hash, const CWalletTx& wtx, int nBestHeight);
+
+public:
+    /** The contribution of the given transaction has to be evaluated again */
+    void SetDirty(const uint256& hash) { setDirty.insert(hash); }
+
+    /** All contributions have to be evaluated again */
+    void SetAllDirty() { fAllDirty = true; }
+
+    /** Brings the totals up to date with the wallet and the chain, and returns them */
+    const Balances& Get(const CWallet& wallet);
+};
+
+#endif // WALLETBALANCECACHE_H
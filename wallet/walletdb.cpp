@@ -4,9 +4,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "walletdb.h"
+#include "blockprune.h"
 #include "wallet.h"
+#include <atomic>
+#include <memory>
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 using namespace boost;
@@ -77,10 +81,10 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
     while (true)
     {
         // Read next record
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CSecureDataStream ssKey(SER_DISK, CLIENT_VERSION);
         if (fFlags == DB_SET_RANGE)
             ssKey << boost::make_tuple(string("acentry"), (fAllAccounts? string("") : strAccount), uint64_t(0));
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        CSecureDataStream ssValue(SER_DISK, CLIENT_VERSION);
         int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
         fFlags = DB_NEXT;
         if (ret == DB_NOTFOUND)
@@ -179,6 +183,11 @@ CWalletDB::ReorderTransactions(CWallet* pwallet)
         }
     }
 
+    // The positions changed, so the in-memory activity log has to follow
+    pwallet->laccentries.clear();
+    ListAccountCreditDebit("*", pwallet->laccentries);
+    pwallet->RebuildOrderedTxItems();
+
     return DB_LOAD_OK;
 }
 
@@ -200,15 +209,121 @@ public:
     }
 };
 
-bool
-ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
-             CWalletScanState &wss, string& strType, string& strErr)
+// Reads a "tx" record, whose type has already been read from ssKey. Checking the transaction and
+// hashing it to compare it with the key are the expensive part of loading a big wallet; they're
+// skipped if fCheck is false.
+static bool ReadWalletTx(CSecureDataStream& ssKey, CSecureDataStream& ssValue, uint256& hash,
+                         CWalletTx& wtx, bool& fUpgraded, string& strErr, bool fCheck)
+{
+    ssKey >> hash;
+    ssValue >> wtx;
+    if (fCheck && !(wtx.CheckTransaction() && wtx.GetHash() == hash))
+        return false;
+
+    // Undo serialize changes in 31600
+    fUpgraded = false;
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount.c_str(), hash.ToString().c_str());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString().c_str());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgraded = true;
+    }
+    return true;
+}
+
+static void LoadWalletTx(CWallet* pwallet, const uint256& hash, CWalletTx& wtxIn, bool fUpgraded,
+                         CWalletScanState& wss)
+{
+    CWalletTx& wtx = pwallet->mapWallet[hash];
+    wtx = std::move(wtxIn);
+    wtx.BindWallet(pwallet);
+    if (fUpgraded)
+        wss.vWalletUpgrade.push_back(hash);
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+}
+
+// Reads a "key" or "wkey" record, whose type has already been read from ssKey. Making sure the
+// private key is valid and matches the public key takes EC multiplications; that's skipped if
+// fCheck is false.
+static bool ReadWalletKey(const string& strType, CSecureDataStream& ssKey,
+                          CSecureDataStream& ssValue, CKey& key, string& strErr, bool fCheck)
+{
+    vector<unsigned char> vchPubKey;
+    ssKey >> vchPubKey;
+    if (strType == "key")
+    {
+        CPrivKey pkey;
+        ssValue >> pkey;
+        key.SetPubKey(vchPubKey);
+        if (!key.SetPrivKey(pkey, !fCheck))
+        {
+            strErr = "Error reading wallet database: CPrivKey corrupt";
+            return false;
+        }
+        if (key.GetPubKey() != vchPubKey)
+        {
+            strErr = "Error reading wallet database: CPrivKey pubkey inconsistency";
+            return false;
+        }
+        if (fCheck && !key.IsValid())
+        {
+            strErr = "Error reading wallet database: invalid CPrivKey";
+            return false;
+        }
+    }
+    else
+    {
+        CWalletKey wkey;
+        ssValue >> wkey;
+        key.SetPubKey(vchPubKey);
+        if (!key.SetPrivKey(wkey.vchPrivKey, !fCheck))
+        {
+            strErr = "Error reading wallet database: CPrivKey corrupt";
+            return false;
+        }
+        if (key.GetPubKey() != vchPubKey)
+        {
+            strErr = "Error reading wallet database: CWalletKey pubkey inconsistency";
+            return false;
+        }
+        if (fCheck && !key.IsValid())
+        {
+            strErr = "Error reading wallet database: invalid CWalletKey";
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool LoadWalletKey(CWallet* pwallet, const CKey& key, string& strErr)
+{
+    if (!pwallet->LoadKey(key))
+    {
+        strErr = "Error reading wallet database: LoadKey failed";
+        return false;
+    }
+    return true;
+}
+
+// Reads a record whose type has already been read from ssKey into the wallet
+static bool
+ReadKeyValueOfType(CWallet* pwallet, const string& strType, CSecureDataStream& ssKey,
+                   CSecureDataStream& ssValue, CWalletScanState &wss, string& strErr)
 {
     try {
-        // Unserialize
-        // Taking advantage of the fact that pair serialization
-        // is just the two items serialized one after the other
-        ssKey >> strType;
         if (strType == "name")
         {
             string strAddress;
@@ -217,48 +332,12 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "tx")
         {
-            uint256 hash;
-            ssKey >> hash;
-            CWalletTx& wtx = pwallet->mapWallet[hash];
-            ssValue >> wtx;
-            if (wtx.CheckTransaction() && (wtx.GetHash() == hash))
-                wtx.BindWallet(pwallet);
-            else
-            {
-                pwallet->mapWallet.erase(hash);
+            uint256   hash;
+            CWalletTx wtx;
+            bool      fUpgraded;
+            if (!ReadWalletTx(ssKey, ssValue, hash, wtx, fUpgraded, strErr, true))
                 return false;
-            }
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount.c_str(), hash.ToString().c_str());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString().c_str());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            //// debug print
-            //printf("LoadWallet  %s\n", wtx.GetHash().ToString().c_str());
-            //printf(" %12" PRId64"  %s  %s  %s\n",
-            //    wtx.vout[0].nValue,
-            //    DateTimeStrFormat("%x %H:%M:%S", wtx.GetBlockTime()).c_str(),
-            //    wtx.hashBlock.ToString().substr(0,20).c_str(),
-            //    wtx.mapValue["message"].c_str());
+            LoadWalletTx(pwallet, hash, wtx, fUpgraded, wss);
         }
         else if (strType == "acentry")
         {
@@ -269,67 +348,23 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             if (nNumber > nAccountingEntryNumber)
                 nAccountingEntryNumber = nNumber;
 
-            if (!wss.fAnyUnordered)
-            {
-                CAccountingEntry acentry;
-                ssValue >> acentry;
-                if (acentry.nOrderPos == -1)
-                    wss.fAnyUnordered = true;
-            }
+            CAccountingEntry acentry;
+            ssValue >> acentry;
+            acentry.strAccount = strAccount;
+            acentry.nEntryNo   = nNumber;
+            if (acentry.nOrderPos == -1)
+                wss.fAnyUnordered = true;
+            pwallet->LoadAccountingEntry(acentry);
         }
         else if (strType == "key" || strType == "wkey")
         {
-            vector<unsigned char> vchPubKey;
-            ssKey >> vchPubKey;
-            CKey key;
             if (strType == "key")
-            {
                 wss.nKeys++;
-                CPrivKey pkey;
-                ssValue >> pkey;
-                key.SetPubKey(vchPubKey);
-                if (!key.SetPrivKey(pkey))
-                {
-                    strErr = "Error reading wallet database: CPrivKey corrupt";
-                    return false;
-                }
-                if (key.GetPubKey() != vchPubKey)
-                {
-                    strErr = "Error reading wallet database: CPrivKey pubkey inconsistency";
-                    return false;
-                }
-                if (!key.IsValid())
-                {
-                    strErr = "Error reading wallet database: invalid CPrivKey";
-                    return false;
-                }
-            }
-            else
-            {
-                CWalletKey wkey;
-                ssValue >> wkey;
-                key.SetPubKey(vchPubKey);
-                if (!key.SetPrivKey(wkey.vchPrivKey))
-                {
-                    strErr = "Error reading wallet database: CPrivKey corrupt";
-                    return false;
-                }
-                if (key.GetPubKey() != vchPubKey)
-                {
-                    strErr = "Error reading wallet database: CWalletKey pubkey inconsistency";
-                    return false;
-                }
-                if (!key.IsValid())
-                {
-                    strErr = "Error reading wallet database: invalid CWalletKey";
-                    return false;
-                }
-            }
-            if (!pwallet->LoadKey(key))
-            {
-                strErr = "Error reading wallet database: LoadKey failed";
+            CKey key;
+            if (!ReadWalletKey(strType, ssKey, ssValue, key, strErr, true))
+                return false;
+            if (!LoadWalletKey(pwallet, key, strErr))
                 return false;
-            }
         }
         else if (strType == "mkey")
         {
@@ -424,12 +459,118 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
     return true;
 }
 
+bool
+ReadKeyValue(CWallet* pwallet, CSecureDataStream& ssKey, CSecureDataStream& ssValue,
+             CWalletScanState &wss, string& strType, string& strErr)
+{
+    try {
+        // Unserialize
+        // Taking advantage of the fact that pair serialization
+        // is just the two items serialized one after the other
+        ssKey >> strType;
+    } catch (...)
+    {
+        return false;
+    }
+    return ReadKeyValueOfType(pwallet, strType, ssKey, ssValue, wss, strErr);
+}
+
 static bool IsKeyType(string strType)
 {
     return (strType== "key" || strType == "wkey" ||
             strType == "mkey" || strType == "ckey");
 }
 
+namespace {
+// the records are read and decoded in batches, so that the next batch is read from the database
+// while the previous one is decoded
+const size_t WALLET_LOAD_BATCH_SIZE = 10000;
+
+/** A wallet record, along with what the workers made of it */
+struct CWalletLoadRecord
+{
+    CSecureDataStream ssKey;
+    CSecureDataStream ssValue;
+    string            strType;
+    string            strErr;
+    bool              fDecoded = false; // decoded by a worker; otherwise it's read while merging
+    bool              fOK      = false;
+
+    // "tx"
+    uint256                    hash;
+    std::unique_ptr<CWalletTx> pwtx;
+    bool                       fUpgraded = false;
+
+    // "key" and "wkey"
+    std::unique_ptr<CKey> pkey;
+
+    CWalletLoadRecord() : ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION) {}
+};
+
+// Decodes the records that are expensive to decode: transactions and unencrypted keys. Everything
+// else is left to the merge, which is done in the order of the database whatever the number of
+// threads.
+void DecodeWalletRecords(std::vector<CWalletLoadRecord>& vRecords, bool fCheck, unsigned int nThreads)
+{
+    std::atomic<size_t> nNext(0);
+    auto                worker = [&]() {
+        size_t i;
+        while ((i = nNext++) < vRecords.size()) {
+            CWalletLoadRecord& rec = vRecords[i];
+            try {
+                rec.ssKey >> rec.strType;
+                if (rec.strType == "tx") {
+                    rec.fDecoded = true;
+                    rec.pwtx.reset(new CWalletTx);
+                    rec.fOK = ReadWalletTx(rec.ssKey, rec.ssValue, rec.hash, *rec.pwtx,
+                                           rec.fUpgraded, rec.strErr, fCheck);
+                } else if (rec.strType == "key" || rec.strType == "wkey") {
+                    rec.fDecoded = true;
+                    rec.pkey.reset(new CKey);
+                    rec.fOK = ReadWalletKey(rec.strType, rec.ssKey, rec.ssValue, *rec.pkey,
+                                            rec.strErr, fCheck);
+                }
+            } catch (...) {
+                rec.fDecoded = true;
+                rec.fOK      = false;
+            }
+            if (rec.fDecoded) {
+                // the raw record isn't needed anymore
+                rec.ssKey   = CSecureDataStream(SER_DISK, CLIENT_VERSION);
+                rec.ssValue = CSecureDataStream(SER_DISK, CLIENT_VERSION);
+            }
+        }
+    };
+
+    boost::thread_group threads;
+    for (unsigned int i = 1; i < nThreads; i++)
+        threads.create_thread(worker);
+    worker();
+    threads.join_all();
+}
+
+bool MergeWalletRecord(CWallet* pwallet, CWalletLoadRecord& rec, CWalletScanState& wss)
+{
+    if (!rec.fDecoded)
+        return ReadKeyValueOfType(pwallet, rec.strType, rec.ssKey, rec.ssValue, wss, rec.strErr);
+
+    if (rec.strType == "key")
+        wss.nKeys++;
+    if (!rec.fOK)
+        return false;
+    if (rec.pwtx)
+        LoadWalletTx(pwallet, rec.hash, *rec.pwtx, rec.fUpgraded, wss);
+    else if (rec.pkey)
+        return LoadWalletKey(pwallet, *rec.pkey, rec.strErr);
+    return true;
+}
+} // namespace
+
+// Records are read in batches; while a batch is decoded on worker threads, the next one is read
+// from the database. The decoded records are then merged into the wallet one by one, in the order
+// of the database, so the result is the same as reading them one after the other.
+// With -deferwalletchecks, transactions and keys aren't checked here, but by
+// ThreadCheckWalletRecords() once the wallet is loaded.
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -437,6 +578,9 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
 
+    const bool         fCheck   = !GetBoolArg("-deferwalletchecks");
+    const unsigned int nThreads = std::max(1u, boost::thread::hardware_concurrency());
+
     try {
         LOCK(pwallet->cs_wallet);
         int nMinVersion = 0;
@@ -455,39 +599,67 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        auto readBatch = [&](std::vector<CWalletLoadRecord>& vRecords) -> int {
+            while (vRecords.size() < WALLET_LOAD_BATCH_SIZE)
+            {
+                CWalletLoadRecord rec;
+                int ret = ReadAtCursor(pcursor, rec.ssKey, rec.ssValue);
+                if (ret != 0)
+                    return ret;
+                vRecords.push_back(std::move(rec));
+            }
+            return 0;
+        };
+
+        std::vector<CWalletLoadRecord> vBatch;
+        int ret = readBatch(vBatch);
         while (true)
         {
-            // Read next record
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
-            if (ret == DB_NOTFOUND)
-                break;
-            else if (ret != 0)
+            if (ret != 0 && ret != DB_NOTFOUND)
             {
                 printf("Error reading next record from wallet database\n");
                 return DB_CORRUPT;
             }
+            if (vBatch.empty())
+                break;
 
-            // Try to be tolerant of single corrupt records:
-            string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            // read the next batch while this one is decoded
+            std::vector<CWalletLoadRecord> vNextBatch;
+            {
+                boost::thread decoder([&]() { DecodeWalletRecords(vBatch, fCheck, nThreads); });
+                if (ret == 0)
+                {
+                    try {
+                        ret = readBatch(vNextBatch);
+                    } catch (...) {
+                        ret = -1;
+                    }
+                }
+                decoder.join();
+            }
+
+            for (CWalletLoadRecord& rec : vBatch)
             {
-                // losing keys is considered a catastrophic error, anything else
-                // we assume the user can live with:
-                if (IsKeyType(strType))
-                    result = DB_CORRUPT;
-                else
+                // Try to be tolerant of single corrupt records:
+                if (!MergeWalletRecord(pwallet, rec, wss))
                 {
-                    // Leave other errors alone, if we try to fix them we might make things worse.
-                    fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
-                    if (strType == "tx")
-                        // Rescan if there is a bad transaction record:
-                        SoftSetBoolArg("-rescan", true);
+                    // losing keys is considered a catastrophic error, anything else
+                    // we assume the user can live with:
+                    if (IsKeyType(rec.strType))
+                        result = DB_CORRUPT;
+                    else
+                    {
+                        // Leave other errors alone, if we try to fix them we might make things worse.
+                        fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
+                        if (rec.strType == "tx")
+                            // Rescan if there is a bad transaction record:
+                            SoftSetBoolArg("-rescan", true);
+                    }
                 }
+                if (!rec.strErr.empty())
+                    printf("%s\n", rec.strErr.c_str());
             }
-            if (!strErr.empty())
-                printf("%s\n", strErr.c_str());
+            vBatch.swap(vNextBatch);
         }
         pcursor->close();
     }
@@ -517,6 +689,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     BOOST_FOREACH(uint256 hash, wss.vWalletUpgrade)
         WriteTx(hash, pwallet->mapWallet[hash]);
 
+    {
+        LOCK(pwallet->cs_wallet);
+        pwallet->RebuildOrderedTxItems();
+    }
+
     // Rewrite encrypted wallets of versions 0.4.0 and 0.5.0rc:
     if (wss.fIsEncrypted && (wss.nFileVersion == 40000 || wss.nFileVersion == 50000))
         return DB_NEED_REWRITE;
@@ -530,6 +707,97 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     return result;
 }
 
+bool VerifyWalletRecords(CWallet* pwallet, unsigned int& nBadTxs, unsigned int& nBadKeys)
+{
+    nBadTxs  = 0;
+    nBadKeys = 0;
+
+    // the wallet is only locked to copy one record at a time, so that it stays usable meanwhile
+    std::vector<uint256> vHashes;
+    {
+        LOCK(pwallet->cs_wallet);
+        vHashes.reserve(pwallet->mapWallet.size());
+        for (const std::pair<const uint256, CWalletTx>& item : pwallet->mapWallet)
+            vHashes.push_back(item.first);
+    }
+    for (const uint256& hash : vHashes)
+    {
+        if (fShutdown)
+            return false;
+        CTransaction tx;
+        {
+            LOCK(pwallet->cs_wallet);
+            std::map<uint256, CWalletTx>::const_iterator it = pwallet->mapWallet.find(hash);
+            if (it == pwallet->mapWallet.end())
+                continue;
+            tx = it->second;
+        }
+        if (!tx.CheckTransaction() || tx.GetHash() != hash)
+        {
+            // it's dropped, as LoadWallet() would have left it out; the rescan finds it again if
+            // it's the wallet's
+            printf("VerifyWalletRecords() : corrupt wallet transaction %s\n", hash.ToString().c_str());
+            pwallet->EraseFromWallet(hash);
+            nBadTxs++;
+        }
+    }
+
+    // GetKey() makes the key from the secret alone, so its public key only matches the one the key
+    // is stored under if the secret is valid and belongs to it. Encrypted keys can't be checked
+    // without the passphrase; they weren't before either.
+    if (pwallet->IsCrypted())
+        return true;
+    std::set<CKeyID> setKeyIDs;
+    pwallet->GetKeys(setKeyIDs);
+    for (const CKeyID& keyID : setKeyIDs)
+    {
+        if (fShutdown)
+            return false;
+        CKey key;
+        if (!pwallet->GetKey(keyID, key) || key.GetPubKey().GetID() != keyID)
+        {
+            printf("VerifyWalletRecords() : corrupt wallet key %s\n",
+                   CBitcoinAddress(keyID).ToString().c_str());
+            nBadKeys++;
+        }
+    }
+    return true;
+}
+
+void ThreadCheckWalletRecords(void* parg)
+{
+    RenameThread("neblio-walletchk");
+
+    std::unique_ptr<std::shared_ptr<CWallet>> ppwallet(static_cast<std::shared_ptr<CWallet>*>(parg));
+
+    int64_t      nStart = GetTimeMillis();
+    unsigned int nBadTxs, nBadKeys;
+    if (!VerifyWalletRecords(ppwallet->get(), nBadTxs, nBadKeys))
+        return;
+    printf("Checked wallet records in %" PRId64 "ms: %u corrupt transactions, %u corrupt keys\n",
+           GetTimeMillis() - nStart, nBadTxs, nBadKeys);
+
+    // the corrupt transactions were dropped, so the blocks are scanned again for the wallet's
+    // transactions, as LoadWallet() would have had them (-rescan)
+    if (nBadTxs > 0)
+    {
+        CBlockIndexSmartPtr pindexGenesis = boost::atomic_load(&pindexGenesisBlock);
+        if (pindexGenesis && !IsBlockPruned(pindexGenesis.get()))
+            ppwallet->get()->ScanForWalletTransactions(pindexGenesis.get(), true);
+        else
+            printf("ThreadCheckWalletRecords() : can't rescan the wallet, the blocks were pruned\n");
+    }
+
+    // the wallet is already in use, so all that's left is telling the user, the same way
+    // LoadWallet() would have
+    if (nBadKeys > 0)
+        strMiscWarning = _("Error loading wallet.dat: Wallet corrupted");
+    else if (nBadTxs > 0)
+        strMiscWarning = _("Warning: error reading wallet.dat! All keys read correctly, but "
+                           "transaction data or address book entries might be missing or "
+                           "incorrect.");
+}
+
 void ThreadFlushWalletDB(void* parg)
 {
     // Make this thread recognisable as the wallet flushing thread
@@ -687,8 +955,8 @@ bool CWalletDB::Recover(CDBEnv& dbenv, std::string filename, bool fOnlyKeys)
     {
         if (fOnlyKeys)
         {
-            CDataStream ssKey(row.first, SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(row.second, SER_DISK, CLIENT_VERSION);
+            CSecureDataStream ssKey(row.first, SER_DISK, CLIENT_VERSION);
+            CSecureDataStream ssValue(row.second, SER_DISK, CLIENT_VERSION);
             string strType, strErr;
             bool fReadOK = ReadKeyValue(&dummyWallet, ssKey, ssValue,
                                         wss, strType, strErr);
@@ -135,6 +135,24 @@ public:
         return Read(std::string("bestblock"), locator);
     }
 
+    // last block applied by a rescan that didn't finish yet
+    bool WriteRescanProgress(const CBlockLocator& locator)
+    {
+        nWalletDBUpdated++;
+        return Write(std::string("rescanprogress"), locator);
+    }
+
+    bool ReadRescanProgress(CBlockLocator& locator)
+    {
+        return Read(std::string("rescanprogress"), locator);
+    }
+
+    bool EraseRescanProgress()
+    {
+        nWalletDBUpdated++;
+        return Erase(std::string("rescanprogress"));
+    }
+
     bool WriteOrderPosNext(int64_t nOrderPosNext)
     {
         nWalletDBUpdated++;
@@ -184,4 +202,14 @@ public:
     static bool Recover(CDBEnv& dbenv, std::string filename);
 };
 
+/** Does the checks of the wallet transactions and keys that LoadWallet() skips with
+ * -deferwalletchecks, and counts the records that fail them. The corrupt transactions are erased
+ * from the wallet. Returns false if interrupted by a shutdown. */
+bool VerifyWalletRecords(CWallet* pwallet, unsigned int& nBadTxs, unsigned int& nBadKeys);
+
+/** Runs VerifyWalletRecords(), rescans the blocks if a transaction was corrupt, and warns the user if
+ * anything is wrong. Takes ownership of the std::shared_ptr<CWallet> it's passed, which keeps the
+ * wallet alive until it's done. */
+void ThreadCheckWalletRecords(void* parg);
+
 #endif // BITCOIN_WALLETDB_H
@@ -0,0 +1,66 @@
+#include "walletoutputindex.h"
+
+#include "main.h"
+#include "ntp1/ntp1transaction.h"
+#include "wallet.h"
+
+void CWalletOutputIndex::Update(const CWallet& wallet, const uint256& hash, const CWalletTx& wtx)
+{
+    Entry entry;
+    entry.pwtx = &wtx;
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (!wtx.IsSpent(i) && wallet.IsMine(wtx.vout[i]))
+            entry.vOutputs.push_back(Output{i, wtx.vout[i].nValue, false});
+    }
+    if (entry.vOutputs.empty()) {
+        mapEntries.erase(hash);
+        return;
+    }
+
+    // find out which outputs carry tokens, so that staking doesn't burn them
+    if (NTP1Transaction::IsTxNTP1(&wtx)) {
+        try {
+            std::vector<std::pair<CTransaction, NTP1Transaction>> inputs =
+                NTP1Transaction::GetAllNTP1InputsOfTx(wtx, false);
+            NTP1Transaction ntp1tx;
+            ntp1tx.readNTP1DataFromTx(wtx, inputs);
+            for (Output& output : entry.vOutputs)
+                output.fCarriesTokens = ntp1tx.getTxOut(output.nOut).tokenCount() > 0;
+        } catch (std::exception& ex) {
+            printf("Unable to parse script to check whether an output is stakable; error says: %s\n",
+                   ex.what());
+            setRetry.insert(hash);
+        }
+    }
+
+    mapEntries[hash] = entry;
+}
+
+const CWalletOutputIndex::EntryMap& CWalletOutputIndex::Get(const CWallet& wallet)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(wallet.cs_wallet);
+
+    if (fAllDirty) {
+        mapEntries.clear();
+        setDirty.clear();
+        setRetry.clear();
+        for (const std::pair<const uint256, CWalletTx>& item : wallet.mapWallet)
+            Update(wallet, item.first, item.second);
+        fAllDirty = false;
+        return mapEntries;
+    }
+
+    setDirty.insert(setRetry.begin(), setRetry.end());
+    setRetry.clear();
+    for (const uint256& hash : setDirty) {
+        std::map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.find(hash);
+        if (it != wallet.mapWallet.end())
+            Update(wallet, hash, it->second);
+        else
+            mapEntries.erase(hash);
+    }
+    setDirty.clear();
+
+    return mapEntries;
+}
@@ -0,0 +1,62 @@
+#ifndef WALLETOUTPUTINDEX_H
+#define WALLETOUTPUTINDEX_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "uint256.h"
+
+class CWallet;
+class CWalletTx;
+
+/**
+ * Index of the wallet transactions that still have unspent outputs belonging to the wallet, which
+ * are the only candidates for coin selection and staking. Most transactions of an old wallet are
+ * fully spent, and this avoids going through them every time coins are listed.
+ *
+ * For every such output, what can't change is recorded: its index, its value and whether it
+ * carries NTP1 tokens (which is expensive to find out, since the inputs have to be parsed).
+ * Whatever depends on the chain (depth, maturity) is still checked by the users of the index, but
+ * only for the candidates.
+ *
+ * Transactions whose spent flags or ownership may have changed have to be reported with SetDirty();
+ * they're looked at again on the next call to Get(). All methods must be called while holding
+ * cs_wallet; Get() also requires cs_main.
+ */
+class CWalletOutputIndex
+{
+public:
+    struct Output
+    {
+        unsigned int nOut;
+        int64_t      nValue;
+        bool         fCarriesTokens;
+    };
+
+    struct Entry
+    {
+        const CWalletTx*    pwtx;
+        std::vector<Output> vOutputs;
+    };
+
+    typedef std::map<uint256, Entry> EntryMap;
+
+private:
+    EntryMap          mapEntries;
+    std::set<uint256> setDirty;
+    std::set<uint256> setRetry; // NTP1 transactions that couldn't be parsed
+    bool              fAllDirty = true;
+
+    void Update(const CWallet& wallet, const uint256& hash, const CWalletTx& wtx);
+
+public:
+    void SetDirty(const uint256& hash) { setDirty.insert(hash); }
+    void SetAllDirty() { fAllDirty = true; }
+
+    /** Brings the index up to date and returns the transactions with unspent outputs */
+    const EntryMap& Get(const CWallet& wallet);
+};
+
+#endif // WALLETOUTPUTINDEX_H